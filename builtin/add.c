@@ -324,6 +324,7 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 	int flags;
 	int add_new_files;
 	int require_pathspec;
+	int repair_cache_tree;
 	char *seen = NULL;
 
 	git_config(add_config, NULL);
@@ -380,6 +381,9 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 	if (read_cache() < 0)
 		die(_("index file corrupt"));
 
+	/* without a cache-tree there is nothing worth repairing */
+	repair_cache_tree = !!active_cache_tree;
+
 	die_in_unpopulated_submodule(&the_index, prefix);
 
 	/*
@@ -464,6 +468,18 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 
 finish:
 	if (active_cache_changed) {
+		/*
+		 * Directories whose new contents match a tree we already
+		 * have (e.g. a change that was reverted) become valid in
+		 * the cache-tree again, which lets "diff-index --cached"
+		 * and "status" skip them; no new tree objects are written.
+		 * Only the directories this command invalidated are
+		 * looked at; older invalid ones are left for write-tree.
+		 */
+		if (repair_cache_tree)
+			update_main_cache_tree(WRITE_TREE_SILENT |
+					       WRITE_TREE_REPAIR |
+					       WRITE_TREE_TOUCHED_ONLY);
 		if (write_locked_index(&the_index, &lock_file, COMMIT_LOCK))
 			die(_("Unable to write new index file"));
 	}
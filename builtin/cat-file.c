@@ -331,19 +331,26 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 	}
 }
 
+/*
+ * The objects to answer about are queued up and looked up together with
+ * sha1_object_info_batch(), in the order they are stored in the packs;
+ * with --buffer we queue up to this many, otherwise just one.
+ */
+#define BATCH_QUEUE_MAX 4096
+
+struct batch_queue {
+	struct oid_array oids;
+	/* the names as given on stdin, with the %(rest) in "util" */
+	struct string_list names;
+};
+
+#define BATCH_QUEUE_INIT { OID_ARRAY_INIT, STRING_LIST_INIT_DUP }
+
 static void batch_object_write(const char *obj_name, struct batch_options *opt,
 			       struct expand_data *data)
 {
 	struct strbuf buf = STRBUF_INIT;
 
-	if (!data->skip_object_info &&
-	    sha1_object_info_extended(data->oid.hash, &data->info, LOOKUP_REPLACE_OBJECT) < 0) {
-		printf("%s missing\n",
-		       obj_name ? obj_name : oid_to_hex(&data->oid));
-		fflush(stdout);
-		return;
-	}
-
 	strbuf_expand(&buf, opt->format, expand_format, data);
 	strbuf_addch(&buf, '\n');
 	batch_write(opt, buf.buf, buf.len);
@@ -355,7 +362,66 @@ static void batch_object_write(const char *obj_name, struct batch_options *opt,
 	}
 }
 
-static void batch_one_object(const char *obj_name, struct batch_options *opt,
+static void batch_flush_queue(struct batch_queue *queue,
+			      struct batch_options *opt,
+			      struct expand_data *data)
+{
+	struct object_info_batch *info = NULL;
+	int i;
+
+	if (!queue->oids.nr)
+		return;
+
+	if (!data->skip_object_info) {
+		ALLOC_ARRAY(info, queue->oids.nr);
+		sha1_object_info_batch(&queue->oids, info, &data->info,
+				       LOOKUP_REPLACE_OBJECT);
+	}
+
+	for (i = 0; i < queue->oids.nr; i++) {
+		const char *obj_name = NULL;
+
+		oidcpy(&data->oid, &queue->oids.oid[i]);
+		if (queue->names.nr) {
+			obj_name = queue->names.items[i].string;
+			data->rest = queue->names.items[i].util;
+		}
+
+		if (info) {
+			if (info[i].status < 0) {
+				printf("%s missing\n",
+				       obj_name ? obj_name : oid_to_hex(&data->oid));
+				fflush(stdout);
+				continue;
+			}
+			data->type = info[i].type;
+			data->size = info[i].size;
+			data->disk_size = info[i].disk_size;
+			oidcpy(&data->delta_base_oid, &info[i].delta_base);
+		}
+		batch_object_write(obj_name, opt, data);
+	}
+
+	free(info);
+	oid_array_clear(&queue->oids);
+	string_list_clear(&queue->names, 1);
+}
+
+static void batch_queue_object(struct batch_queue *queue,
+			       const char *obj_name,
+			       struct batch_options *opt,
+			       struct expand_data *data)
+{
+	oid_array_append(&queue->oids, &data->oid);
+	if (obj_name)
+		string_list_append(&queue->names, obj_name)->util =
+			xstrdup_or_null(data->rest);
+	if (!opt->buffer_output || queue->oids.nr >= BATCH_QUEUE_MAX)
+		batch_flush_queue(queue, opt, data);
+}
+
+static void batch_one_object(const char *obj_name, struct batch_queue *queue,
+			     struct batch_options *opt,
 			     struct expand_data *data)
 {
 	struct object_context ctx;
@@ -363,6 +429,9 @@ static void batch_one_object(const char *obj_name, struct batch_options *opt,
 	enum follow_symlinks_result result;
 
 	result = get_sha1_with_context(obj_name, flags, data->oid.hash, &ctx);
+	/* answer about the objects queued before this one first */
+	if (result != FOUND || ctx.mode == 0)
+		batch_flush_queue(queue, opt, data);
 	if (result != FOUND) {
 		switch (result) {
 		case MISSING_OBJECT:
@@ -397,19 +466,20 @@ static void batch_one_object(const char *obj_name, struct batch_options *opt,
 		return;
 	}
 
-	batch_object_write(obj_name, opt, data);
+	batch_queue_object(queue, obj_name, opt, data);
 }
 
 struct object_cb_data {
 	struct batch_options *opt;
 	struct expand_data *expand;
+	struct batch_queue *queue;
 };
 
 static int batch_object_cb(const struct object_id *oid, void *vdata)
 {
 	struct object_cb_data *data = vdata;
 	oidcpy(&data->expand->oid, oid);
-	batch_object_write(NULL, data->opt, data->expand);
+	batch_queue_object(data->queue, NULL, data->opt, data->expand);
 	return 0;
 }
 
@@ -433,6 +503,7 @@ static int batch_packed_object(const struct object_id *oid,
 static int batch_objects(struct batch_options *opt)
 {
 	struct strbuf buf = STRBUF_INIT;
+	struct batch_queue queue = BATCH_QUEUE_INIT;
 	struct expand_data data;
 	int save_warning;
 	int retval = 0;
@@ -474,7 +545,9 @@ static int batch_objects(struct batch_options *opt)
 
 		cb.opt = opt;
 		cb.expand = &data;
+		cb.queue = &queue;
 		oid_array_for_each_unique(&sa, batch_object_cb, &cb);
+		batch_flush_queue(&queue, opt, &data);
 
 		oid_array_clear(&sa);
 		return 0;
@@ -505,8 +578,9 @@ static int batch_objects(struct batch_options *opt)
 			data.rest = p;
 		}
 
-		batch_one_object(buf.buf, opt, &data);
+		batch_one_object(buf.buf, &queue, opt, &data);
 	}
+	batch_flush_queue(&queue, opt, &data);
 
 	strbuf_release(&buf);
 	warn_on_object_refname_ambiguity = save_warning;
@@ -0,0 +1,104 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "parse-options.h"
+#include "pkt-line.h"
+
+static void packet_to_pc_item(const char *buffer, int len,
+			      struct parallel_checkout_item *pc_item)
+{
+	struct pc_item_fixed_portion fixed_portion;
+	const char *name;
+
+	if (len < sizeof(fixed_portion))
+		die("checkout--worker: packet too short (%d bytes)", len);
+
+	memcpy(&fixed_portion, buffer, sizeof(fixed_portion));
+	if (len != sizeof(fixed_portion) + fixed_portion.name_len)
+		die("checkout--worker: invalid packet for item %"PRIuMAX,
+		    (uintmax_t)fixed_portion.id);
+
+	name = buffer + sizeof(fixed_portion);
+
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->ce = xcalloc(1, cache_entry_size(fixed_portion.name_len));
+	memcpy(pc_item->ce->name, name, fixed_portion.name_len);
+	pc_item->ce->ce_namelen = fixed_portion.name_len;
+	pc_item->ce->ce_mode = fixed_portion.ce_mode;
+	oidcpy(&pc_item->ce->oid, &fixed_portion.oid);
+
+	pc_item->id = fixed_portion.id;
+	pc_item->ca.drv = NULL;
+	pc_item->ca.crlf_action = fixed_portion.crlf_action;
+	pc_item->ca.attr_action = fixed_portion.crlf_action;
+	pc_item->ca.ident = fixed_portion.ident;
+}
+
+static void report_result(struct parallel_checkout_item *pc_item)
+{
+	struct pc_item_result res;
+
+	memset(&res, 0, sizeof(res));
+	res.id = pc_item->id;
+	res.status = pc_item->status;
+	if (pc_item->status == PC_ITEM_WRITTEN)
+		memcpy(&res.st, &pc_item->st, sizeof(res.st));
+
+	packet_write(1, (const char *)&res, sizeof(res));
+}
+
+static void worker_loop(void)
+{
+	struct parallel_checkout_item *items = NULL;
+	size_t i, nr = 0, alloc = 0;
+
+	/*
+	 * Read all the items before writing any of them, as the main
+	 * process only starts to collect the results once it has sent
+	 * the items to all the workers.
+	 */
+	for (;;) {
+		int len = packet_read(0, NULL, NULL, packet_buffer,
+				      sizeof(packet_buffer), 0);
+		if (!len)
+			break;
+		ALLOC_GROW(items, nr + 1, alloc);
+		packet_to_pc_item(packet_buffer, len, &items[nr++]);
+	}
+
+	for (i = 0; i < nr; i++) {
+		write_pc_item(&items[i]);
+		report_result(&items[i]);
+	}
+	packet_flush(1);
+
+	for (i = 0; i < nr; i++)
+		free(items[i].ce);
+	free(items);
+}
+
+static const char * const checkout_worker_usage[] = {
+	N_("git checkout--worker"),
+	NULL
+};
+
+int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
+{
+	struct option checkout_worker_options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(checkout_worker_usage,
+				   checkout_worker_options);
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, checkout_worker_options,
+			     checkout_worker_usage, 0);
+	if (argc > 0)
+		usage_with_options(checkout_worker_usage, checkout_worker_options);
+
+	packet_trace_identity("checkout--worker");
+	worker_loop();
+	return 0;
+}
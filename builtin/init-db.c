@@ -21,6 +21,7 @@
 
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
+static const char *init_ref_storage;
 static const char *init_db_template_dir;
 
 static void copy_templates_1(struct strbuf *path, struct strbuf *template,
@@ -239,8 +240,11 @@ static int create_default_files(const char *template_path,
 
 	/* This forces creation of new config file */
 	xsnprintf(repo_version_string, sizeof(repo_version_string),
-		  "%d", GIT_REPO_VERSION);
+		  "%d", repository_format_ref_storage ? 1 : GIT_REPO_VERSION);
 	git_config_set("core.repositoryformatversion", repo_version_string);
+	if (repository_format_ref_storage)
+		git_config_set("extensions.refstorage",
+			       repository_format_ref_storage);
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -370,6 +374,17 @@ int init_db(const char *git_dir, const char *real_git_dir,
 	 */
 	check_repository_format();
 
+	if (init_ref_storage) {
+		const char *current = repository_format_ref_storage;
+
+		if (!current && !access(git_path("HEAD"), F_OK))
+			current = "files";
+		if (current && strcmp(current, init_ref_storage))
+			die(_("attempt to reinitialize repository with different ref storage format"));
+		if (strcmp(init_ref_storage, "files"))
+			repository_format_ref_storage = init_ref_storage;
+	}
+
 	reinit = create_default_files(template_dir, original_git_dir);
 
 	create_object_directory();
@@ -481,6 +496,8 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 			N_("specify that the git repository is to be shared amongst several users"),
 			PARSE_OPT_OPTARG | PARSE_OPT_NONEG, shared_callback, 0},
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
+		OPT_STRING(0, "ref-storage", &init_ref_storage, N_("format"),
+			   N_("specify the ref storage format to use")),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
 		OPT_END()
@@ -488,6 +505,9 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 
 	argc = parse_options(argc, argv, prefix, init_db_options, init_db_usage, 0);
 
+	if (init_ref_storage && !ref_storage_backend_exists(init_ref_storage))
+		die(_("unknown ref storage format '%s'"), init_ref_storage);
+
 	if (real_git_dir && !is_absolute_path(real_git_dir))
 		real_git_dir = real_pathdup(real_git_dir, 1);
 
@@ -0,0 +1,86 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static char const * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index [--object-dir <dir>] [--bitmap] (write|read)"),
+	NULL
+};
+
+static struct opts_multi_pack_index {
+	const char *object_dir;
+	int bitmap;
+} opts;
+
+static int midx_read(void)
+{
+	struct multi_pack_index *m;
+	uint32_t i;
+
+	m = load_multi_pack_index(opts.object_dir, 1);
+	if (!m)
+		die(_("could not read multi-pack-index in '%s'"), opts.object_dir);
+
+	printf("header: %08x %d %d %d\n",
+	       m->signature,
+	       m->version,
+	       m->num_chunks,
+	       m->num_packs);
+
+	printf("chunks:");
+	if (m->chunk_pack_names)
+		printf(" pack-names");
+	if (m->chunk_oid_fanout)
+		printf(" oid-fanout");
+	if (m->chunk_oid_lookup)
+		printf(" oid-lookup");
+	if (m->chunk_object_offsets)
+		printf(" object-offsets");
+	if (m->chunk_large_offsets)
+		printf(" large-offsets");
+	printf("\n");
+
+	printf("num_objects: %u\n", m->num_objects);
+
+	printf("packs:\n");
+	for (i = 0; i < m->num_packs; i++)
+		printf("%s\n", m->pack_names[i]);
+
+	close_midx(m);
+	return 0;
+}
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	static struct option builtin_multi_pack_index_options[] = {
+		OPT_FILENAME(0, "object-dir", &opts.object_dir,
+		  N_("object directory containing set of packfile and pack-index pairs")),
+		OPT_BOOL(0, "bitmap", &opts.bitmap,
+			 N_("write a reachability bitmap with the multi-pack-index")),
+		OPT_END(),
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_multi_pack_index_options,
+			     builtin_multi_pack_index_usage, 0);
+
+	if (!opts.object_dir)
+		opts.object_dir = get_object_directory();
+
+	if (argc != 1)
+		usage_with_options(builtin_multi_pack_index_usage,
+				   builtin_multi_pack_index_options);
+
+	if (!strcmp(argv[0], "write")) {
+		write_midx_file(opts.object_dir,
+				opts.bitmap ? MIDX_WRITE_BITMAP : 0);
+		return 0;
+	}
+	if (!strcmp(argv[0], "read"))
+		return midx_read();
+
+	die(_("unrecognized verb: %s"), argv[0]);
+}
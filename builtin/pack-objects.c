@@ -24,6 +24,7 @@
 #include "sha1-array.h"
 #include "argv-array.h"
 #include "mru.h"
+#include "delta-islands.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [<options>...] [< <ref-list> | < <object-list>]"),
@@ -69,7 +70,9 @@ static off_t reuse_packfile_offset;
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
 static int write_bitmap_index;
-static uint16_t write_bitmap_options;
+static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
+
+static int use_delta_islands;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = 256 * 1024 * 1024;
@@ -100,6 +103,61 @@ static void index_commit_for_bitmap(struct commit *commit)
 	indexed_commits[indexed_commits_nr++] = commit;
 }
 
+#ifndef NO_PTHREADS
+
+static pthread_mutex_t read_mutex;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+
+static pthread_mutex_t cache_mutex;
+#define cache_lock()		pthread_mutex_lock(&cache_mutex)
+#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
+
+static pthread_mutex_t progress_mutex;
+#define progress_lock()		pthread_mutex_lock(&progress_mutex)
+#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+
+#else
+
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define cache_lock()		(void)0
+#define cache_unlock()		(void)0
+#define progress_lock()		(void)0
+#define progress_unlock()	(void)0
+
+#endif
+
+/*
+ * Objects that worker threads deflate ahead of write_pack_file(), see
+ * write_objects_in_parallel().
+ */
+struct deflated_object {
+	enum {
+		DEFLATE_PENDING = 0,
+		DEFLATE_WORKING,
+		DEFLATE_DONE
+	} state;
+	void *data;		/* deflated data, or NULL if left to the writer */
+	unsigned long datalen;
+	unsigned long size;	/* inflated size */
+	enum object_type type;
+};
+
+/*
+ * Non-zero while worker threads read objects; the writer must then
+ * take the read lock as well.
+ */
+static int deflate_workers_active;
+
+#ifndef NO_PTHREADS
+static int write_objects_in_parallel(struct sha1file *f,
+				     struct object_entry **write_order,
+				     uint32_t nr, off_t *offset);
+#else
+#define write_objects_in_parallel(f, write_order, nr, offset) 0
+#endif
+
 static void *get_delta(struct object_entry *entry)
 {
 	unsigned long size, base_size, delta_size;
@@ -123,31 +181,37 @@ static void *get_delta(struct object_entry *entry)
 	return delta_buf;
 }
 
-static unsigned long do_compress(void **pptr, unsigned long size)
+static unsigned long deflate_buffer(const void *in, unsigned long size,
+				    void **out)
 {
 	git_zstream stream;
-	void *in, *out;
 	unsigned long maxsize;
 
 	git_deflate_init(&stream, pack_compression_level);
 	maxsize = git_deflate_bound(&stream, size);
 
-	in = *pptr;
-	out = xmalloc(maxsize);
-	*pptr = out;
+	*out = xmalloc(maxsize);
 
-	stream.next_in = in;
+	stream.next_in = (void *)in;
 	stream.avail_in = size;
-	stream.next_out = out;
+	stream.next_out = *out;
 	stream.avail_out = maxsize;
 	while (git_deflate(&stream, Z_FINISH) == Z_OK)
 		; /* nothing */
 	git_deflate_end(&stream);
 
-	free(in);
 	return stream.total_out;
 }
 
+static unsigned long do_compress(void **pptr, unsigned long size)
+{
+	void *in = *pptr;
+	unsigned long datalen = deflate_buffer(in, size, pptr);
+
+	free(in);
+	return datalen;
+}
+
 static unsigned long write_large_blob_data(struct git_istream *st, struct sha1file *f,
 					   const unsigned char *sha1)
 {
@@ -236,9 +300,13 @@ static void copy_pack_data(struct sha1file *f,
 	}
 }
 
-/* Return 0 if we will bust the pack-size limit */
+/*
+ * Return 0 if we will bust the pack-size limit. If "pre" is given, it
+ * holds the object data deflated by a worker thread.
+ */
 static unsigned long write_no_reuse_object(struct sha1file *f, struct object_entry *entry,
-					   unsigned long limit, int usable_delta)
+					   unsigned long limit, int usable_delta,
+					   struct deflated_object *pre)
 {
 	unsigned long size, datalen;
 	unsigned char header[MAX_PACK_OBJECT_HEADER],
@@ -248,7 +316,19 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	void *buf;
 	struct git_istream *st = NULL;
 
-	if (!usable_delta) {
+	if (pre) {
+		buf = pre->data;
+		pre->data = NULL;
+		datalen = pre->datalen;
+		size = pre->size;
+		type = pre->type;
+		if (usable_delta)
+			type = (allow_ofs_delta && entry->delta->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+		free(entry->delta_data);
+		entry->delta_data = NULL;
+		entry->z_delta_size = 0;
+	} else if (!usable_delta) {
 		if (entry->type == OBJ_BLOB &&
 		    entry->size > big_file_threshold &&
 		    (st = open_istream(entry->idx.oid.hash, &type, &size, NULL)) != NULL)
@@ -280,7 +360,9 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
-	if (st)	/* large blob case, just assume we don't compress well */
+	if (pre)
+		; /* already deflated */
+	else if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
@@ -376,7 +458,7 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 		error("bad packed object CRC for %s",
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta, NULL);
 	}
 
 	offset += entry->in_pack_header_size;
@@ -387,7 +469,7 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 		error("corrupt packed object for %s",
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta, NULL);
 	}
 
 	if (type == OBJ_OFS_DELTA) {
@@ -426,14 +508,38 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 	return hdrlen + datalen;
 }
 
+/*
+ * Decide whether the in-pack data of "entry" can be copied as-is.
+ */
+static int want_reuse_object_data(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!entry->in_pack)
+		return 0;	/* can't reuse what we don't have */
+	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (entry->type != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (entry->delta)
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
 /* Return 0 if we will bust the pack-size limit */
 static off_t write_object(struct sha1file *f,
 			  struct object_entry *entry,
-			  off_t write_offset)
+			  off_t write_offset,
+			  struct deflated_object *pre)
 {
 	unsigned long limit;
 	off_t len;
-	int usable_delta, to_reuse;
+	int usable_delta, to_reuse, need_lock;
 
 	if (!pack_to_stdout)
 		crc32_begin(f);
@@ -461,27 +567,17 @@ static off_t write_object(struct sha1file *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
+	to_reuse = want_reuse_object_data(entry, usable_delta);
 
+	need_lock = deflate_workers_active && (to_reuse || !pre);
+	if (need_lock)
+		read_lock();
 	if (!to_reuse)
-		len = write_no_reuse_object(f, entry, limit, usable_delta);
+		len = write_no_reuse_object(f, entry, limit, usable_delta, pre);
 	else
 		len = write_reuse_object(f, entry, limit, usable_delta);
+	if (need_lock)
+		read_unlock();
 	if (!len)
 		return 0;
 
@@ -502,7 +598,8 @@ enum write_one_status {
 
 static enum write_one_status write_one(struct sha1file *f,
 				       struct object_entry *e,
-				       off_t *offset)
+				       off_t *offset,
+				       struct deflated_object *pre)
 {
 	off_t size;
 	int recursing;
@@ -525,7 +622,7 @@ static enum write_one_status write_one(struct sha1file *f,
 	/* if we are deltified, write out base object first. */
 	if (e->delta) {
 		e->idx.offset = 1; /* now recurse */
-		switch (write_one(f, e->delta, offset)) {
+		switch (write_one(f, e->delta, offset, NULL)) {
 		case WRITE_ONE_RECURSIVE:
 			/* we cannot depend on this one */
 			e->delta = NULL;
@@ -539,7 +636,7 @@ static enum write_one_status write_one(struct sha1file *f,
 	}
 
 	e->idx.offset = *offset;
-	size = write_object(f, e, *offset);
+	size = write_object(f, e, *offset, pre);
 	if (!size) {
 		e->idx.offset = recursing;
 		return WRITE_ONE_BREAK;
@@ -810,9 +907,13 @@ static void write_pack_file(void)
 		}
 
 		nr_written = 0;
+		if (!i && !pack_size_limit &&
+		    write_objects_in_parallel(f, write_order,
+					      to_pack.nr_objects, &offset))
+			i = to_pack.nr_objects;
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
-			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
+			if (write_one(f, e, &offset, NULL) == WRITE_ONE_BREAK)
 				break;
 			display_progress(progress_state, written);
 		}
@@ -1461,7 +1562,8 @@ static void check_object(struct object_entry *entry)
 			break;
 		}
 
-		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL))) {
+		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL)) &&
+		    in_same_island(&entry->idx.oid, &base_entry->idx.oid)) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1748,6 +1850,11 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
+	if (use_delta_islands) {
+		int island_cmp = island_delta_cmp(&a->idx.oid, &b->idx.oid);
+		if (island_cmp)
+			return island_cmp;
+	}
 	if (a->size > b->size)
 		return -1;
 	if (a->size < b->size)
@@ -1778,31 +1885,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-#ifndef NO_PTHREADS
-
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
-static pthread_mutex_t cache_mutex;
-#define cache_lock()		pthread_mutex_lock(&cache_mutex)
-#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
-
-static pthread_mutex_t progress_mutex;
-#define progress_lock()		pthread_mutex_lock(&progress_mutex)
-#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
-
-#else
-
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
-#define cache_lock()		(void)0
-#define cache_unlock()		(void)0
-#define progress_lock()		(void)0
-#define progress_unlock()	(void)0
-
-#endif
-
 static int try_delta(struct unpacked *trg, struct unpacked *src,
 		     unsigned max_depth, unsigned long *mem_usage)
 {
@@ -1817,6 +1899,14 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (trg_entry->type != src_entry->type)
 		return -1;
 
+	/*
+	 * Don't make a delta that readers of one of the islands "trg"
+	 * is in could not reuse.
+	 */
+	if (use_delta_islands &&
+	    !in_same_island(&trg_entry->idx.oid, &src_entry->idx.oid))
+		return -1;
+
 	/*
 	 * We do not bother to try a delta that we discarded on an
 	 * earlier try, but only when reusing delta data.  Note that
@@ -2330,6 +2420,259 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	free(p);
 }
 
+/*
+ * Parallel deflate for write_pack_file().
+ *
+ * The objects are written in a fixed sequence in which delta bases come
+ * before their deltas, so that write_one() never recurses.  Worker
+ * threads claim positions in that sequence, at most DEFLATE_WINDOW per
+ * thread ahead of the writer, and deflate (after computing the delta,
+ * if needed) whatever write_no_reuse_object() would otherwise deflate
+ * on the main thread.  The writer only appends the results to the pack.
+ */
+#define DEFLATE_WINDOW 64
+
+static struct deflate_pipeline {
+	struct object_entry **seq;
+	uint32_t nr;
+	struct deflated_object *ring;
+	uint32_t window;
+	uint32_t next;		/* next position to be claimed */
+	uint32_t consumed;	/* positions before this one are written */
+	int stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} deflate_pipeline;
+
+/*
+ * Order the objects as write_one() would write them, each base right
+ * before the first of its deltas.  Returns NULL if there is a delta
+ * cycle, which write_one() has to resolve.
+ */
+static struct object_entry **compute_write_sequence(struct object_entry **write_order,
+						    uint32_t nr, uint32_t *nr_seq)
+{
+	unsigned char *state = xcalloc(to_pack.nr_objects, 1);
+	struct object_entry **seq, **chain = NULL;
+	uint32_t i, n = 0, chain_nr, chain_alloc = 0;
+
+	ALLOC_ARRAY(seq, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_entry *e;
+
+		chain_nr = 0;
+		for (e = write_order[i]; e; e = e->delta) {
+			if (e->preferred_base || e->idx.offset ||
+			    state[e - to_pack.objects] == 1)
+				break;
+			if (state[e - to_pack.objects] == 2) {
+				free(state);
+				free(chain);
+				free(seq);
+				return NULL;
+			}
+			state[e - to_pack.objects] = 2;
+			ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+			chain[chain_nr++] = e;
+		}
+		while (chain_nr) {
+			e = chain[--chain_nr];
+			state[e - to_pack.objects] = 1;
+			seq[n++] = e;
+		}
+	}
+
+	free(state);
+	free(chain);
+	*nr_seq = n;
+	return seq;
+}
+
+static void deflate_one(struct object_entry *entry, struct deflated_object *out)
+{
+	int usable_delta = !!entry->delta;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	if (want_reuse_object_data(entry, usable_delta))
+		return;
+
+	if (!usable_delta) {
+		if (entry->type == OBJ_BLOB && entry->size > big_file_threshold)
+			return; /* streamed by the writer */
+		read_lock();
+		buf = read_sha1_file(entry->idx.oid.hash, &type, &size);
+		read_unlock();
+		if (!buf)
+			die(_("unable to read %s"), oid_to_hex(&entry->idx.oid));
+	} else if (entry->delta_data) {
+		if (entry->z_delta_size)
+			return; /* already deflated during the delta search */
+		out->datalen = deflate_buffer(entry->delta_data,
+					      entry->delta_size, &out->data);
+		out->size = entry->delta_size;
+		return;
+	} else {
+		void *base_buf, *delta_buf;
+		unsigned long base_size;
+
+		read_lock();
+		buf = read_sha1_file(entry->idx.oid.hash, &type, &size);
+		base_buf = read_sha1_file(entry->delta->idx.oid.hash, &type,
+					  &base_size);
+		read_unlock();
+		if (!buf)
+			die(_("unable to read %s"), oid_to_hex(&entry->idx.oid));
+		if (!base_buf)
+			die(_("unable to read %s"),
+			    oid_to_hex(&entry->delta->idx.oid));
+		delta_buf = diff_delta(base_buf, base_size, buf, size,
+				       &size, 0);
+		if (!delta_buf || size != entry->delta_size)
+			die("delta size changed");
+		free(buf);
+		free(base_buf);
+		buf = delta_buf;
+		type = OBJ_NONE; /* the writer picks the delta type */
+	}
+
+	out->type = type;
+	out->size = size;
+	out->datalen = do_compress(&buf, size);
+	out->data = buf;
+}
+
+static void *threaded_deflate(void *arg)
+{
+	struct deflate_pipeline *dp = arg;
+
+	pthread_mutex_lock(&dp->mutex);
+	for (;;) {
+		struct deflated_object *slot;
+		uint32_t pos;
+
+		while (!dp->stop && dp->next < dp->nr &&
+		       dp->next >= dp->consumed + dp->window)
+			pthread_cond_wait(&dp->cond, &dp->mutex);
+		if (dp->stop || dp->next >= dp->nr)
+			break;
+
+		pos = dp->next++;
+		slot = &dp->ring[pos % dp->window];
+		slot->state = DEFLATE_WORKING;
+		pthread_mutex_unlock(&dp->mutex);
+
+		deflate_one(dp->seq[pos], slot);
+
+		pthread_mutex_lock(&dp->mutex);
+		slot->state = DEFLATE_DONE;
+		pthread_cond_broadcast(&dp->cond);
+	}
+	pthread_mutex_unlock(&dp->mutex);
+	return NULL;
+}
+
+/*
+ * Wait for the object at "pos" to be deflated. Returns NULL if no
+ * worker got to it yet, in which case the writer handles it itself.
+ */
+static struct deflated_object *take_deflated(struct deflate_pipeline *dp,
+					     uint32_t pos)
+{
+	struct deflated_object *slot = &dp->ring[pos % dp->window];
+
+	pthread_mutex_lock(&dp->mutex);
+	if (pos >= dp->next) {
+		dp->next = pos + 1;
+		slot = NULL;
+	} else {
+		while (slot->state != DEFLATE_DONE)
+			pthread_cond_wait(&dp->cond, &dp->mutex);
+	}
+	pthread_mutex_unlock(&dp->mutex);
+
+	return slot && slot->data ? slot : NULL;
+}
+
+static void release_deflated(struct deflate_pipeline *dp, uint32_t pos)
+{
+	struct deflated_object *slot = &dp->ring[pos % dp->window];
+
+	pthread_mutex_lock(&dp->mutex);
+	free(slot->data);
+	memset(slot, 0, sizeof(*slot));
+	dp->consumed = pos + 1;
+	pthread_cond_broadcast(&dp->cond);
+	pthread_mutex_unlock(&dp->mutex);
+}
+
+/*
+ * Write all of "write_order" to "f" with the help of worker threads.
+ * Returns 0 without writing anything if it cannot be done in parallel.
+ */
+static int write_objects_in_parallel(struct sha1file *f,
+				     struct object_entry **write_order,
+				     uint32_t nr, off_t *offset)
+{
+	struct deflate_pipeline *dp = &deflate_pipeline;
+	pthread_t *threads;
+	uint32_t i;
+	int nr_threads = delta_search_threads, ret;
+
+	if (nr_threads <= 1)
+		return 0;
+
+	memset(dp, 0, sizeof(*dp));
+	dp->seq = compute_write_sequence(write_order, nr, &dp->nr);
+	if (!dp->seq)
+		return 0;
+	if (dp->nr < nr_threads) {
+		free(dp->seq);
+		return 0;
+	}
+
+	dp->window = nr_threads * DEFLATE_WINDOW;
+	dp->ring = xcalloc(dp->window, sizeof(*dp->ring));
+	pthread_mutex_init(&dp->mutex, NULL);
+	pthread_cond_init(&dp->cond, NULL);
+	init_threaded_search();
+	deflate_workers_active = 1;
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL, threaded_deflate, dp);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+
+	for (i = 0; i < dp->nr; i++) {
+		struct deflated_object *pre = take_deflated(dp, i);
+
+		if (write_one(f, dp->seq[i], offset, pre) != WRITE_ONE_WRITTEN)
+			die("BUG: object %s was not written in sequence",
+			    oid_to_hex(&dp->seq[i]->idx.oid));
+		release_deflated(dp, i);
+		display_progress(progress_state, written);
+	}
+
+	pthread_mutex_lock(&dp->mutex);
+	dp->stop = 1;
+	pthread_cond_broadcast(&dp->cond);
+	pthread_mutex_unlock(&dp->mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	deflate_workers_active = 0;
+	cleanup_threaded_search();
+	pthread_cond_destroy(&dp->cond);
+	pthread_mutex_destroy(&dp->mutex);
+	free(dp->ring);
+	free(dp->seq);
+	return 1;
+}
+
 #else
 #define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
 #endif
@@ -2473,6 +2816,12 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -2540,6 +2889,9 @@ static void show_commit(struct commit *commit, void *data)
 
 	if (write_bitmap_index)
 		index_commit_for_bitmap(commit);
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj, const char *name, void *data)
@@ -2547,6 +2899,21 @@ static void show_object(struct object *obj, const char *name, void *data)
 	add_preferred_base_object(name);
 	add_object_entry(obj->oid.hash, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
+
+	if (use_delta_islands && obj->type == OBJ_TREE) {
+		const char *p;
+		unsigned int depth;
+		struct object_entry *ent;
+
+		/* the empty string is a root tree, which is depth 0 */
+		depth = *name ? 1 : 0;
+		for (p = strchr(name, '/'); p; p = strchr(p + 1, '/'))
+			depth++;
+
+		ent = packlist_find(&to_pack, obj->oid.hash, NULL);
+		if (ent && depth > to_pack.tree_depth[ent - to_pack.objects])
+			to_pack.tree_depth[ent - to_pack.objects] = depth;
+	}
 }
 
 static void show_edge(struct commit *commit)
@@ -2810,11 +3177,23 @@ static void get_object_list(int ac, const char **av)
 	if (use_bitmap_index && !get_object_list_from_bitmap(&revs))
 		return;
 
+	if (use_delta_islands) {
+		/* marks propagate from children to parents */
+		revs.topo_order = 1;
+		load_delta_islands();
+		REALLOC_ARRAY(to_pack.tree_depth, to_pack.nr_alloc);
+		memset(to_pack.tree_depth, 0,
+		       st_mult(sizeof(*to_pack.tree_depth), to_pack.nr_objects));
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(&revs, show_edge);
 	traverse_commit_list(&revs, show_commit, show_object, NULL);
 
+	if (use_delta_islands)
+		resolve_tree_islands(progress, &to_pack);
+
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
 		if (add_unseen_recent_objects_to_traversal(&revs,
@@ -2949,6 +3328,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_END(),
 	};
 
@@ -3044,6 +3425,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!use_internal_rev_list || (!pack_to_stdout && write_bitmap_index) || is_repository_shallow())
 		use_bitmap_index = 0;
 
+	/* a bitmap walk does not show us the commits to propagate marks */
+	if (use_delta_islands)
+		use_bitmap_index = 0;
+
 	if (pack_to_stdout || !rev_list_all)
 		write_bitmap_index = 0;
 
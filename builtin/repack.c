@@ -7,10 +7,13 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps;
+static int write_midx;
+static int use_delta_islands;
 static char *packdir, *packtmp;
 
 static const char *const git_repack_usage[] = {
@@ -39,6 +42,12 @@ static int repack_config(const char *var, const char *value, void *cb)
 		write_bitmaps = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.usedeltaislands")) {
+		use_delta_islands = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "core.multipackindex"))
+		write_midx = git_config_bool(var, value);
 	return git_default_config(var, value, cb);
 }
 
@@ -181,6 +190,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("pass --local to git-pack-objects")),
 		OPT_BOOL('b', "write-bitmap-index", &write_bitmaps,
 				N_("write bitmap index")),
+		OPT_BOOL('i', "delta-islands", &use_delta_islands,
+				N_("pass --delta-islands to git-pack-objects")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_BOOL('k', "keep-unreachable", &keep_unreachable,
@@ -215,7 +226,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps;
 
-	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
+	/*
+	 * With a multi-pack-index, the bitmap covers all packs, so that
+	 * incremental packs can be kept.
+	 */
+	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE) && !write_midx)
 		die(_(incremental_bitmap_conflict_error));
 
 	packdir = mkpathdup("%s/pack", get_object_directory());
@@ -245,8 +260,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--no-reuse-delta");
 	if (no_reuse_object)
 		argv_array_pushf(&cmd.args, "--no-reuse-object");
-	if (write_bitmaps)
+	if (write_bitmaps && (pack_everything & ALL_INTO_ONE))
 		argv_array_push(&cmd.args, "--write-bitmap-index");
+	if (use_delta_islands)
+		argv_array_push(&cmd.args, "--delta-islands");
 
 	if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs);
@@ -412,6 +429,9 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (delete_redundant) {
 		int opts = 0;
 		string_list_sort(&names);
+		/* a stale multi-pack-index would name the packs we delete */
+		if (!write_midx)
+			clear_midx_file(get_object_directory());
 		for_each_string_list_item(item, &existing_packs) {
 			char *sha1;
 			size_t len = strlen(item->string);
@@ -426,6 +446,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		prune_packed_objects(opts);
 	}
 
+	if (write_midx)
+		write_midx_file(get_object_directory(),
+				write_bitmaps ? MIDX_WRITE_BITMAP : 0);
+
 	if (!no_update_server_info)
 		update_server_info(0);
 	remove_temporary_files();
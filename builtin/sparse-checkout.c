@@ -0,0 +1,343 @@
+#include "builtin.h"
+#include "cache.h"
+#include "dir.h"
+#include "lockfile.h"
+#include "parse-options.h"
+#include "run-command.h"
+#include "strbuf.h"
+#include "string-list.h"
+
+static const char * const builtin_sparse_checkout_usage[] = {
+	N_("git sparse-checkout init [--cone]"),
+	N_("git sparse-checkout list"),
+	N_("git sparse-checkout set [--stdin] [<patterns>...]"),
+	N_("git sparse-checkout disable"),
+	NULL
+};
+
+static char *get_sparse_checkout_filename(void)
+{
+	return git_pathdup("info/sparse-checkout");
+}
+
+static int update_working_directory(void)
+{
+	struct object_id oid;
+	const char *argv[] = { "read-tree", "-m", "-u", "HEAD", NULL };
+
+	/* Nothing to update on an unborn branch */
+	if (get_oid("HEAD", &oid))
+		return 0;
+	if (run_command_v_opt(argv, RUN_GIT_CMD))
+		return error(_("failed to update the working directory"));
+	return 0;
+}
+
+/*
+ * Replace the sparse-checkout file with "contents" and update the
+ * working directory and the index to it; the old file is put back if
+ * the update fails.
+ */
+static int write_patterns_and_update(const struct strbuf *contents)
+{
+	static struct lock_file lk;
+	char *sparse_filename = get_sparse_checkout_filename();
+	struct strbuf old = STRBUF_INIT;
+	int had_file = strbuf_read_file(&old, sparse_filename, 0) >= 0;
+	int result = 0;
+
+	if (safe_create_leading_directories(sparse_filename))
+		die(_("failed to create directory for sparse-checkout file"));
+	hold_lock_file_for_update(&lk, sparse_filename, LOCK_DIE_ON_ERROR);
+	if (write_in_full(get_lock_file_fd(&lk), contents->buf, contents->len) < 0 ||
+	    commit_lock_file(&lk))
+		die_errno(_("unable to write '%s'"), sparse_filename);
+
+	if (update_working_directory()) {
+		result = 1;
+		if (had_file)
+			write_file_buf(sparse_filename, old.buf, old.len);
+		else
+			unlink_or_warn(sparse_filename);
+	}
+
+	strbuf_release(&old);
+	free(sparse_filename);
+	return result;
+}
+
+static int load_patterns(struct exclude_list *el, int cone)
+{
+	char *sparse_filename = get_sparse_checkout_filename();
+	int ret;
+
+	memset(el, 0, sizeof(*el));
+	el->use_cone_patterns = cone;
+	ret = add_excludes_from_file_to_list(sparse_filename, "", 0, el, NULL);
+	free(sparse_filename);
+	return ret;
+}
+
+static int sparse_checkout_list(int argc, const char **argv)
+{
+	struct exclude_list el;
+	struct string_list dirs = STRING_LIST_INIT_DUP;
+	struct hashmap_iter iter;
+	struct exclude_entry *e;
+	int i;
+
+	if (load_patterns(&el, core_sparse_checkout_cone) < 0)
+		die(_("this worktree is not sparse (sparse-checkout file may not exist)"));
+
+	if (!el.use_cone_patterns) {
+		for (i = 0; i < el.nr; i++) {
+			struct exclude *x = el.excludes[i];
+
+			if (x->flags & EXC_FLAG_NEGATIVE)
+				printf("!");
+			printf("%.*s%s\n", x->patternlen, x->pattern,
+			       (x->flags & EXC_FLAG_MUSTBEDIR) ? "/" : "");
+		}
+		clear_exclude_list(&el);
+		return 0;
+	}
+
+	/* In cone mode, show the directories that are included recursively */
+	if (el.recursive_hashmap.tablesize) {
+		hashmap_iter_init(&el.recursive_hashmap, &iter);
+		while ((e = hashmap_iter_next(&iter)))
+			string_list_append(&dirs, e->pattern);
+	}
+	string_list_sort(&dirs);
+	for (i = 0; i < dirs.nr; i++)
+		printf("%s\n", dirs.items[i].string);
+
+	string_list_clear(&dirs, 0);
+	clear_exclude_list(&el);
+	return 0;
+}
+
+/* Like git_config_set_gently(), but unsetting a missing key is fine */
+static int config_set(const char *key, const char *value)
+{
+	int ret = git_config_set_gently(key, value);
+
+	return !value && ret == CONFIG_NOTHING_SET ? 0 : ret;
+}
+
+static int set_config(int cone)
+{
+	if (config_set("core.sparseCheckout", "true") ||
+	    config_set("core.sparseCheckoutCone", cone ? "true" : NULL))
+		return error(_("failed to set the sparse-checkout configuration"));
+	core_apply_sparse_checkout = 1;
+	core_sparse_checkout_cone = cone;
+	return 0;
+}
+
+static int sparse_checkout_init(int argc, const char **argv, const char *prefix)
+{
+	static const char * const usage[] = {
+		N_("git sparse-checkout init [--cone]"),
+		NULL
+	};
+	struct strbuf contents = STRBUF_INIT;
+	char *sparse_filename;
+	int cone = 0, result;
+	struct option options[] = {
+		OPT_BOOL(0, "cone", &cone,
+			 N_("initialize the sparse-checkout in cone mode")),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, prefix, options, usage, 0);
+	if (argc)
+		usage_with_options(usage, options);
+
+	if (set_config(cone))
+		return 1;
+
+	/* An existing sparse-checkout file is kept as it is */
+	sparse_filename = get_sparse_checkout_filename();
+	if (file_exists(sparse_filename)) {
+		free(sparse_filename);
+		return update_working_directory();
+	}
+	free(sparse_filename);
+
+	/* Start with the files at the top level only */
+	strbuf_addstr(&contents, "/*\n!/*/\n");
+	result = write_patterns_and_update(&contents);
+	strbuf_release(&contents);
+	return result;
+}
+
+/*
+ * Turn "dir" into a directory name without leading or trailing
+ * slashes, as the hashsets of cone patterns hold them.
+ */
+static void normalize_cone_dir(struct strbuf *dir)
+{
+	while (dir->len && dir->buf[dir->len - 1] == '/')
+		strbuf_setlen(dir, dir->len - 1);
+	while (dir->len && dir->buf[0] == '/')
+		strbuf_remove(dir, 0, 1);
+	if (!dir->len || strpbrk(dir->buf, "*?[\\"))
+		die(_("'%s' is not a directory name usable in cone mode"),
+		    dir->buf);
+}
+
+static int under_one_of(const char *dir, const struct string_list *dirs)
+{
+	int i;
+
+	for (i = 0; i < dirs->nr; i++) {
+		const char *rest;
+
+		if (skip_prefix(dir, dirs->items[i].string, &rest) &&
+		    *rest == '/')
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Write the cone patterns for the "recursive" directories: the files
+ * at the top level, then for each leading directory its files, and
+ * finally each of the directories with everything below it.
+ */
+static void write_cone_patterns(struct strbuf *out, struct string_list *recursive)
+{
+	struct string_list parents = STRING_LIST_INIT_DUP;
+	int i;
+
+	string_list_sort(recursive);
+	string_list_remove_duplicates(recursive, 0);
+
+	for (i = 0; i < recursive->nr; i++) {
+		const char *dir = recursive->items[i].string;
+		const char *slash;
+
+		for (slash = strchr(dir, '/'); slash; slash = strchr(slash + 1, '/'))
+			string_list_append_nodup(&parents,
+						 xmemdupz(dir, slash - dir));
+	}
+	string_list_sort(&parents);
+	string_list_remove_duplicates(&parents, 0);
+
+	strbuf_addstr(out, "/*\n!/*/\n");
+	for (i = 0; i < parents.nr; i++) {
+		const char *dir = parents.items[i].string;
+
+		if (string_list_has_string(recursive, dir) ||
+		    under_one_of(dir, recursive))
+			continue;
+		strbuf_addf(out, "/%s/\n!/%s/*/\n", dir, dir);
+	}
+	for (i = 0; i < recursive->nr; i++) {
+		const char *dir = recursive->items[i].string;
+
+		if (!under_one_of(dir, recursive))
+			strbuf_addf(out, "/%s/\n", dir);
+	}
+	string_list_clear(&parents, 0);
+}
+
+static int sparse_checkout_set(int argc, const char **argv, const char *prefix)
+{
+	static const char * const usage[] = {
+		N_("git sparse-checkout set [--stdin] [<patterns>...]"),
+		NULL
+	};
+	struct string_list args = STRING_LIST_INIT_DUP;
+	struct strbuf contents = STRBUF_INIT;
+	struct strbuf line = STRBUF_INIT;
+	int use_stdin = 0, result, i;
+	struct option options[] = {
+		OPT_BOOL(0, "stdin", &use_stdin,
+			 N_("read patterns from standard in")),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, prefix, options, usage, 0);
+
+	if (use_stdin) {
+		while (strbuf_getline(&line, stdin) != EOF) {
+			strbuf_trim(&line);
+			if (line.len)
+				string_list_append(&args, line.buf);
+		}
+	} else {
+		for (i = 0; i < argc; i++)
+			string_list_append(&args, argv[i]);
+	}
+
+	if (core_sparse_checkout_cone) {
+		for (i = 0; i < args.nr; i++) {
+			strbuf_reset(&line);
+			strbuf_addstr(&line, args.items[i].string);
+			normalize_cone_dir(&line);
+			free(args.items[i].string);
+			args.items[i].string = strbuf_detach(&line, NULL);
+		}
+		write_cone_patterns(&contents, &args);
+	} else {
+		for (i = 0; i < args.nr; i++)
+			strbuf_addf(&contents, "%s\n", args.items[i].string);
+	}
+
+	if (!core_apply_sparse_checkout && set_config(0))
+		return 1;
+	result = write_patterns_and_update(&contents);
+
+	strbuf_release(&line);
+	strbuf_release(&contents);
+	string_list_clear(&args, 0);
+	return result;
+}
+
+static int sparse_checkout_disable(int argc, const char **argv)
+{
+	struct strbuf contents = STRBUF_INIT;
+	char *sparse_filename;
+
+	/*
+	 * Check out everything with a pattern that does not mean the same
+	 * in cone mode, so that mode has to be left first.
+	 */
+	if (config_set("core.sparseCheckoutCone", NULL) ||
+	    config_set("core.sparseCheckout", "true"))
+		return error(_("failed to set the sparse-checkout configuration"));
+	strbuf_addstr(&contents, "/*\n");
+	if (write_patterns_and_update(&contents))
+		return 1;
+	strbuf_release(&contents);
+
+	if (config_set("core.sparseCheckout", "false"))
+		return error(_("failed to set the sparse-checkout configuration"));
+	sparse_filename = get_sparse_checkout_filename();
+	unlink_or_warn(sparse_filename);
+	free(sparse_filename);
+	return 0;
+}
+
+int cmd_sparse_checkout(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END(),
+	};
+
+	git_config(git_default_config, NULL);
+
+	if (argc < 2)
+		usage_with_options(builtin_sparse_checkout_usage, options);
+	if (!strcmp(argv[1], "list"))
+		return sparse_checkout_list(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "init"))
+		return sparse_checkout_init(argc - 1, argv + 1, prefix);
+	if (!strcmp(argv[1], "set"))
+		return sparse_checkout_set(argc - 1, argv + 1, prefix);
+	if (!strcmp(argv[1], "disable"))
+		return sparse_checkout_disable(argc - 1, argv + 1);
+	usage_with_options(builtin_sparse_checkout_usage, options);
+}
@@ -42,7 +42,7 @@ static int subtree_name_cmp(const char *one, int onelen,
 	return memcmp(one, two, onelen);
 }
 
-static int subtree_pos(struct cache_tree *it, const char *path, int pathlen)
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen)
 {
 	struct cache_tree_sub **down = it->down;
 	int lo, hi;
@@ -69,7 +69,7 @@ static struct cache_tree_sub *find_subtree(struct cache_tree *it,
 					   int create)
 {
 	struct cache_tree_sub *down;
-	int pos = subtree_pos(it, path, pathlen);
+	int pos = cache_tree_subtree_pos(it, path, pathlen);
 	if (0 <= pos)
 		return it->down[pos];
 	if (!create)
@@ -119,9 +119,10 @@ static int do_invalidate_path(struct cache_tree *it, const char *path)
 	slash = strchrnul(path, '/');
 	namelen = slash - path;
 	it->entry_count = -1;
+	it->touched = 1;
 	if (!*slash) {
 		int pos;
-		pos = subtree_pos(it, path, namelen);
+		pos = cache_tree_subtree_pos(it, path, namelen);
 		if (0 <= pos) {
 			cache_tree_free(&it->down[pos]->cache_tree);
 			free(it->down[pos]);
@@ -234,6 +235,27 @@ int cache_tree_fully_valid(struct cache_tree *it)
 	return 1;
 }
 
+/*
+ * Number of entries at the beginning of cache[] that are inside the
+ * directory "base" (with its trailing slash), found by bisection.
+ */
+static int subtree_span(struct cache_entry **cache, int entries,
+			const char *base, int baselen)
+{
+	int lo = 0, hi = entries;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		const struct cache_entry *ce = cache[mi];
+
+		if (ce_namelen(ce) > baselen && !memcmp(ce->name, base, baselen))
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
 static int update_one(struct cache_tree *it,
 		      struct cache_entry **cache,
 		      int entries,
@@ -246,7 +268,9 @@ static int update_one(struct cache_tree *it,
 	int missing_ok = flags & WRITE_TREE_MISSING_OK;
 	int dryrun = flags & WRITE_TREE_DRY_RUN;
 	int repair = flags & WRITE_TREE_REPAIR;
+	int touched_only = flags & WRITE_TREE_TOUCHED_ONLY;
 	int to_invalidate = 0;
+	int invalid_below = 0;
 	int i;
 
 	assert(!(dryrun && repair));
@@ -256,6 +280,28 @@ static int update_one(struct cache_tree *it,
 	if (0 <= it->entry_count && has_sha1_file(it->oid.hash))
 		return it->entry_count;
 
+	/*
+	 * A tree that was already invalid when the index was read is
+	 * not ours to recompute; step over its entries without looking.
+	 */
+	if (touched_only && !it->touched)
+		return subtree_span(cache, entries, base, baselen);
+
+	/*
+	 * A sparse directory entry stands for the whole tree it names,
+	 * which therefore has no subtrees of its own in the index.
+	 */
+	if (entries && S_ISSPARSEDIR(cache[0]->ce_mode) &&
+	    ce_namelen(cache[0]) == baselen &&
+	    !memcmp(cache[0]->name, base, baselen)) {
+		for (i = 0; i < it->subtree_nr; i++)
+			it->down[i]->used = 0;
+		discard_unused_subtrees(it);
+		oidcpy(&it->oid, &cache[0]->oid);
+		it->entry_count = 1;
+		return 1;
+	}
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -291,8 +337,10 @@ static int update_one(struct cache_tree *it,
 		 */
 		sublen = slash - (path + baselen);
 		sub = find_subtree(it, path + baselen, sublen, 1);
-		if (!sub->cache_tree)
+		if (!sub->cache_tree) {
 			sub->cache_tree = cache_tree();
+			sub->cache_tree->touched = it->touched;
+		}
 		subcnt = update_one(sub->cache_tree,
 				    cache + i, entries - i,
 				    path,
@@ -307,10 +355,21 @@ static int update_one(struct cache_tree *it,
 		sub->count = subcnt; /* to be used in the next loop */
 		*skip_count += subskip;
 		sub->used = 1;
+		if (touched_only && sub->cache_tree->entry_count < 0)
+			invalid_below = 1;
 	}
 
 	discard_unused_subtrees(it);
 
+	/*
+	 * With a subtree still invalid, this level cannot name a tree
+	 * that exists either; leave it invalid rather than hash it.
+	 */
+	if (invalid_below) {
+		it->entry_count = -1;
+		return i;
+	}
+
 	/*
 	 * Then write out the tree object for this level.
 	 */
@@ -403,7 +462,11 @@ static int update_one(struct cache_tree *it,
 	if (repair) {
 		unsigned char sha1[20];
 		hash_sha1_file(buffer.buf, buffer.len, tree_type, sha1);
-		if (has_sha1_file(sha1))
+		/*
+		 * The tree may be unreachable and about to be pruned;
+		 * only trust it once it is fresh again.
+		 */
+		if (freshen_object(sha1))
 			hashcpy(it->oid.hash, sha1);
 		else
 			to_invalidate = 1;
@@ -16,6 +16,7 @@ struct cache_tree_sub {
 
 struct cache_tree {
 	int entry_count; /* negative means "invalid" */
+	int touched; /* invalidated since the index was read */
 	struct object_id oid;
 	int subtree_nr;
 	int subtree_alloc;
@@ -26,6 +27,8 @@ struct cache_tree *cache_tree(void);
 void cache_tree_free(struct cache_tree **);
 void cache_tree_invalidate_path(struct index_state *, const char *);
 struct cache_tree_sub *cache_tree_sub(struct cache_tree *, const char *);
+/* position of the subtree "path" in it->down[], or -1-(insertion point) */
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen);
 
 void cache_tree_write(struct strbuf *, struct cache_tree *root);
 struct cache_tree *cache_tree_read(const char *buffer, unsigned long size);
@@ -41,6 +44,7 @@ int update_main_cache_tree(int);
 #define WRITE_TREE_DRY_RUN 4
 #define WRITE_TREE_SILENT 8
 #define WRITE_TREE_REPAIR 16
+#define WRITE_TREE_TOUCHED_ONLY 32 /* leave untouched invalid trees alone */
 
 /* error return codes */
 #define WRITE_TREE_UNREADABLE_INDEX (-1)
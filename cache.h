@@ -11,6 +11,7 @@
 #include "string-list.h"
 #include "pack-revindex.h"
 #include "hash.h"
+#include "sha1-array.h"
 
 #ifndef platform_SHA_CTX
 /*
@@ -100,6 +101,12 @@ struct object_id {
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * A "sparse directory" entry in a sparse index stands for a whole
+ * tree outside of the sparse-checkout cone (see sparse-index.h).
+ */
+#define S_ISSPARSEDIR(m)	((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -201,6 +208,7 @@ struct cache_entry {
 #define CE_ADDED             (1 << 19)
 
 #define CE_HASHED            (1 << 20)
+#define CE_FSMONITOR_VALID   (1 << 21)
 #define CE_WT_REMOVE         (1 << 22) /* remove in work directory */
 #define CE_CONFLICTED        (1 << 23)
 
@@ -324,9 +332,11 @@ static inline unsigned int canon_mode(unsigned int mode)
 #define CACHE_TREE_CHANGED	(1 << 5)
 #define SPLIT_INDEX_ORDERED	(1 << 6)
 #define UNTRACKED_CHANGED	(1 << 7)
+#define FSMONITOR_CHANGED	(1 << 8)
 
 struct split_index;
 struct untracked_cache;
+struct ewah_bitmap;
 
 struct index_state {
 	struct cache_entry **cache;
@@ -336,12 +346,21 @@ struct index_state {
 	struct cache_tree *cache_tree;
 	struct split_index *split_index;
 	struct cache_time timestamp;
+	/* the index file as last read or written, see verify_index_from() */
+	dev_t file_dev;
+	ino_t file_ino;
+	off_t file_size;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_has_run_once : 1,
+		 sparse_index : 1,
+		 write_sparse : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	unsigned char sha1[20];
 	struct untracked_cache *untracked;
+	char *fsmonitor_last_update;
+	struct ewah_bitmap *fsmonitor_dirty;
 };
 
 extern struct index_state the_index;
@@ -672,6 +691,8 @@ extern void *read_blob_data_from_index(const struct index_state *, const char *,
 #define CE_MATCH_IGNORE_MISSING		0x08
 /* enable stat refresh */
 #define CE_MATCH_REFRESH		0x10
+/* do stat comparison even if CE_FSMONITOR_VALID is true */
+#define CE_MATCH_IGNORE_FSMONITOR	0x20
 extern int ie_match_stat(const struct index_state *, const struct cache_entry *, struct stat *, unsigned int);
 extern int ie_modified(const struct index_state *, const struct cache_entry *, struct stat *, unsigned int);
 
@@ -736,6 +757,7 @@ extern int pack_compression_level;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+extern void set_delta_base_cache_command(const char *cmd);
 extern unsigned long big_file_threshold;
 extern unsigned long pack_size_limit_cfg;
 
@@ -762,7 +784,10 @@ extern char *git_replace_ref_base;
 
 extern int fsync_object_files;
 extern int core_preload_index;
+extern const char *core_fsmonitor;
 extern int core_apply_sparse_checkout;
+extern int core_sparse_checkout_cone;
+extern int command_requires_full_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
@@ -847,10 +872,12 @@ extern int grafts_replace_parents;
 #define GIT_REPO_VERSION 0
 #define GIT_REPO_VERSION_READ 1
 extern int repository_format_precious_objects;
+extern const char *repository_format_ref_storage;
 
 struct repository_format {
 	int version;
 	int precious_objects;
+	char *ref_storage;
 	int is_bare;
 	char *work_tree;
 	struct string_list unknown_extensions;
@@ -1281,8 +1308,10 @@ int read_loose_object(const char *path,
  * function does not respect replace references.
  *
  * If the QUICK flag is set, do not re-check the pack directory
- * when we cannot find the object (this means we may give a false
- * negative answer if another process is simultaneously repacking).
+ * when we cannot find the object, and look for loose objects in the
+ * cached directory listings instead of asking the filesystem (this
+ * means we may give a false negative answer if another process is
+ * simultaneously repacking or writing objects).
  */
 #define HAS_SHA1_QUICK 0x1
 extern int has_sha1_file_with_flags(const unsigned char *sha1, int flags);
@@ -1302,6 +1331,12 @@ extern int has_object_file_with_flags(const struct object_id *oid, int flags);
  */
 extern int has_loose_object_nonlocal(const unsigned char *sha1);
 
+/*
+ * Return true iff we have the object named sha1 and could update its
+ * mtime, so that it is as safe from pruning as a freshly written one.
+ */
+extern int freshen_object(const unsigned char *sha1);
+
 extern int has_pack_index(const unsigned char *sha1);
 
 extern void assert_sha1_type(const unsigned char *sha1, enum object_type expect);
@@ -1586,6 +1621,10 @@ extern struct alternate_object_database {
 	struct strbuf scratch;
 	size_t base_len;
 
+	/* see odb_loose_cache() */
+	unsigned char loose_objects_subdir_seen[256];
+	struct oid_array loose_objects_cache[256];
+
 	char path[FLEX_ARRAY];
 } *alt_odb_list;
 extern void prepare_alt_odb(void);
@@ -1600,6 +1639,26 @@ extern int foreach_alt_odb(alt_odb_fn, void*);
  */
 struct alternate_object_database *alloc_alt_odb(const char *dir);
 
+/*
+ * Our own object directory, in the guise of a "struct
+ * alternate_object_database" that is not on the list of alternates,
+ * so that it can be treated like them (e.g. by odb_loose_cache()).
+ */
+extern struct alternate_object_database *local_object_database(void);
+
+/*
+ * Return the list of loose objects in the fanout directory of "sha1"
+ * (objects/XX) of the object database "alt", reading the directory
+ * on first use.  The list is kept until reprepare_packed_git() and
+ * does not see objects that other processes add or remove in the
+ * meantime, so only use it where a stale answer is acceptable.
+ */
+extern struct oid_array *odb_loose_cache(struct alternate_object_database *alt,
+					 const unsigned char *sha1);
+extern int odb_loose_cache_has(struct alternate_object_database *alt,
+			       const unsigned char *sha1);
+extern void odb_clear_loose_cache(struct alternate_object_database *alt);
+
 /*
  * Add the directory to the on-disk alternates file; the new entry will also
  * take effect in the current process.
@@ -1645,7 +1704,8 @@ extern struct packed_git {
 	unsigned pack_local:1,
 		 pack_keep:1,
 		 freshened:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1;
 	unsigned char sha1[20];
 	struct revindex_entry *revindex;
 	/* something like ".git/objects/pack/xxxxx.pack" */
@@ -1726,6 +1786,7 @@ extern void close_pack_index(struct packed_git *);
 
 extern unsigned char *use_pack(struct packed_git *, struct pack_window **, off_t, unsigned long *);
 extern void close_pack_windows(struct packed_git *);
+extern void close_pack(struct packed_git *);
 extern void close_all_packs(void);
 extern void unuse_pack(struct pack_window **);
 extern void clear_delta_base_cache(void);
@@ -1773,6 +1834,15 @@ extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsig
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
+/*
+ * Return the offset in "p" of the base of the delta whose header ends at
+ * "*curpos", advancing "*curpos" past the base reference to the deflated
+ * delta data. Returns 0 when the base cannot be found in the same pack.
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
+			    off_t *curpos, enum object_type type,
+			    off_t delta_obj_offset);
+
 /*
  * Iterate over the files in the loose-object parts of the object
  * directory "path", triggering the following callbacks:
@@ -1827,6 +1897,7 @@ typedef int each_packed_object_fn(const struct object_id *oid,
 				  void *data);
 extern int for_each_loose_object(each_loose_object_fn, void *, unsigned flags);
 extern int for_each_packed_object(each_packed_object_fn, void *, unsigned flags);
+extern int for_each_object_in_pack(struct packed_git *p, each_packed_object_fn, void *data);
 
 struct object_info {
 	/* Request */
@@ -1869,6 +1940,36 @@ struct object_info {
 extern int sha1_object_info_extended(const unsigned char *, struct object_info *, unsigned flags);
 extern int packed_object_info(struct packed_git *pack, off_t offset, struct object_info *);
 
+/*
+ * The answer about one object of a sha1_object_info_batch() request:
+ * "status" is what sha1_object_info_extended() returned, and "pack"
+ * and "offset" say where a packed object is stored ("pack" is NULL
+ * for objects that are not in a pack).
+ */
+struct object_info_batch {
+	struct object_id oid;
+	int status;
+	enum object_type type;
+	unsigned long size;
+	off_t disk_size;
+	struct object_id delta_base;
+	struct packed_git *pack;
+	off_t offset;
+};
+
+/*
+ * Look up the objects in "oids" and fill in "out[i]" for each
+ * "oids->oid[i]", with the items requested in "want" (which cannot
+ * ask for "typename").  Packed objects are looked at in the order in
+ * which they are stored, after asking the OS to read ahead the parts
+ * of the packs that hold them, which is much faster than a lookup at
+ * a time when the packs are not in the page cache.
+ */
+extern void sha1_object_info_batch(const struct oid_array *oids,
+				   struct object_info_batch *out,
+				   const struct object_info *want,
+				   unsigned flags);
+
 /* Dumb servers support */
 extern int update_server_info(int);
 
@@ -2049,6 +2150,8 @@ extern int git_config_get_maybe_bool(const char *key, int *dest);
 extern int git_config_get_pathname(const char *key, const char **dest);
 extern int git_config_get_untracked_cache(void);
 extern int git_config_get_split_index(void);
+extern int git_config_get_index_threads(int *dest);
+extern int git_config_get_fsmonitor(void);
 extern int git_config_get_max_percent_split_change(void);
 
 /* This dies if the configured or default date is in the future */
@@ -2136,9 +2239,11 @@ int decode_85(char *dst, const char *line, int linelen);
 void encode_85(char *buf, const unsigned char *data, int bytes);
 
 /* alloc.c */
+struct commit;
 extern void *alloc_blob_node(void);
 extern void *alloc_tree_node(void);
 extern void *alloc_commit_node(void);
+extern void init_commit_node(struct commit *c);
 extern void *alloc_tag_node(void);
 extern void *alloc_object_node(void);
 extern void alloc_report(void);
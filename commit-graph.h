@@ -0,0 +1,80 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "git-compat-util.h"
+#include "string-list.h"
+
+struct commit;
+
+extern char *get_commit_graph_filename(const char *obj_dir);
+
+/*
+ * Given a commit struct, try to fill the commit struct info, including:
+ *  1. tree object
+ *  2. date
+ *  3. parents
+ *  4. generation number
+ *
+ * Returns 1 if and only if the commit was found in the commit-graph
+ * (and core.commitGraph is enabled), in which case the commit is
+ * marked as parsed and its object never needs to be inflated.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * It is possible that we loaded commit contents from the commit buffer,
+ * but we also want to ensure the commit-graph content is correctly
+ * checked and filled. Fill the graph_pos and generation members of
+ * the given commit.
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/*
+ * Return 1 if and only if a commit-graph file is in use and it records
+ * generation numbers, so that walks may rely on a commit never reaching
+ * another commit of equal or higher generation.
+ */
+extern int generation_numbers_enabled(void);
+
+struct commit_graph {
+	int graph_fd;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_commits;
+
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_large_edges;
+};
+
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+extern void free_commit_graph(struct commit_graph *g);
+
+/*
+ * Release the commit-graph that is used by parse_commit_in_graph(),
+ * e.g. before it is replaced on disk.
+ */
+extern void close_commit_graph(void);
+
+/*
+ * Write a commit-graph file for "obj_dir" containing the commits found
+ * in the packs named by "pack_indexes", the commits named (possibly
+ * via tags) by the hex object names in "commit_hex", or, if both are
+ * NULL, every commit in every known pack.  The set is closed under
+ * reachability before writing.  With "append", the commits of the
+ * existing commit-graph file are kept as well.
+ */
+extern void write_commit_graph(const char *obj_dir,
+			       struct string_list *pack_indexes,
+			       struct string_list *commit_hex,
+			       int append);
+
+/* Write a commit-graph file covering every commit reachable from a ref. */
+extern void write_commit_graph_reachable(const char *obj_dir, int append);
+
+#endif
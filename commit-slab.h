@@ -39,6 +39,11 @@
  *
  *   Call this function before the slab falls out of scope to avoid
  *   leaking memory.
+ *
+ * A slab that is used from more than one file is declared in a header
+ * with declare_commit_slab() and declare_commit_slab_prototypes(), and
+ * its functions are defined in exactly one .c file with
+ * implement_shared_commit_slab().
  */
 
 /* allocate ~512kB at once, allowing for malloc overhead */
@@ -48,17 +53,29 @@
 
 #define MAYBE_UNUSED __attribute__((__unused__))
 
-#define define_commit_slab(slabname, elemtype) 				\
+#define declare_commit_slab(slabname, elemtype) 			\
 									\
 struct slabname {							\
 	unsigned slab_size;						\
 	unsigned stride;						\
 	unsigned slab_count;						\
 	elemtype **slab;						\
-};									\
+}
+
+#define declare_commit_slab_prototypes(slabname, elemtype)		\
+									\
+void init_ ##slabname## _with_stride(struct slabname *s, unsigned stride); \
+void init_ ##slabname(struct slabname *s);				\
+void clear_ ##slabname(struct slabname *s);				\
+elemtype *slabname## _at_peek(struct slabname *s, const struct commit *c, int add_if_missing); \
+elemtype *slabname## _at(struct slabname *s, const struct commit *c);	\
+elemtype *slabname## _peek(struct slabname *s, const struct commit *c)
+
+#define implement_commit_slab(slabname, elemtype, scope)		\
+									\
 static int stat_ ##slabname## realloc;					\
 									\
-static MAYBE_UNUSED void init_ ##slabname## _with_stride(struct slabname *s, \
+scope void init_ ##slabname## _with_stride(struct slabname *s, \
 						   unsigned stride)	\
 {									\
 	unsigned int elem_size;						\
@@ -71,12 +88,12 @@ static MAYBE_UNUSED void init_ ##slabname## _with_stride(struct slabname *s, \
 	s->slab = NULL;							\
 }									\
 									\
-static MAYBE_UNUSED void init_ ##slabname(struct slabname *s)		\
+scope void init_ ##slabname(struct slabname *s)		\
 {									\
 	init_ ##slabname## _with_stride(s, 1);				\
 }									\
 									\
-static MAYBE_UNUSED void clear_ ##slabname(struct slabname *s)		\
+scope void clear_ ##slabname(struct slabname *s)		\
 {									\
 	int i;								\
 	for (i = 0; i < s->slab_count; i++)				\
@@ -86,7 +103,7 @@ static MAYBE_UNUSED void clear_ ##slabname(struct slabname *s)		\
 	s->slab = NULL;							\
 }									\
 									\
-static MAYBE_UNUSED elemtype *slabname## _at_peek(struct slabname *s,	\
+scope elemtype *slabname## _at_peek(struct slabname *s,	\
 						  const struct commit *c, \
 						  int add_if_missing)   \
 {									\
@@ -114,13 +131,13 @@ static MAYBE_UNUSED elemtype *slabname## _at_peek(struct slabname *s,	\
 	return &s->slab[nth_slab][nth_slot * s->stride];		\
 }									\
 									\
-static MAYBE_UNUSED elemtype *slabname## _at(struct slabname *s,	\
+scope elemtype *slabname## _at(struct slabname *s,	\
 					     const struct commit *c)	\
 {									\
 	return slabname##_at_peek(s, c, 1);				\
 }									\
 									\
-static MAYBE_UNUSED elemtype *slabname## _peek(struct slabname *s,	\
+scope elemtype *slabname## _peek(struct slabname *s,	\
 					     const struct commit *c)	\
 {									\
 	return slabname##_at_peek(s, c, 0);				\
@@ -128,6 +145,16 @@ static MAYBE_UNUSED elemtype *slabname## _peek(struct slabname *s,	\
 									\
 struct slabname
 
+#define implement_static_commit_slab(slabname, elemtype)		\
+	implement_commit_slab(slabname, elemtype, static MAYBE_UNUSED)
+
+#define implement_shared_commit_slab(slabname, elemtype)		\
+	implement_commit_slab(slabname, elemtype, )
+
+#define define_commit_slab(slabname, elemtype)				\
+	declare_commit_slab(slabname, elemtype);			\
+	implement_static_commit_slab(slabname, elemtype)
+
 /*
  * Note that this redundant forward declaration is required
  * to allow a terminating semicolon, which makes instantiations look
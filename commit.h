@@ -7,6 +7,12 @@
 #include "decorate.h"
 #include "gpg-interface.h"
 #include "string-list.h"
+#include "commit-slab.h"
+
+#define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_ZERO 0
 
 struct commit_list {
 	struct commit *item;
@@ -20,6 +26,17 @@ struct commit {
 	timestamp_t date;
 	struct commit_list *parents;
 	struct tree *tree;
+	/*
+	 * Position of the commit in the commit-graph file, or
+	 * COMMIT_NOT_FROM_GRAPH.
+	 */
+	uint32_t graph_pos;
+	/*
+	 * Topological level of the commit: one more than the maximum
+	 * generation of its parents.  GENERATION_NUMBER_INFINITY for
+	 * commits that were not loaded from the commit-graph.
+	 */
+	uint32_t generation;
 };
 
 extern int save_commit_buffer;
@@ -250,6 +267,8 @@ typedef int (*each_commit_graft_fn)(const struct commit_graft *, void *);
 struct commit_graft *read_graft_line(char *buf, int len);
 int register_commit_graft(struct commit_graft *, int);
 struct commit_graft *lookup_commit_graft(const unsigned char *sha1);
+/* Are there any grafts (including shallow boundaries) in effect? */
+int has_commit_grafts(void);
 
 extern struct commit_list *get_merge_bases(struct commit *rev1, struct commit *rev2);
 extern struct commit_list *get_merge_bases_many(struct commit *one, int n, struct commit **twos);
@@ -392,7 +411,15 @@ extern int remove_signature(struct strbuf *buf);
  */
 extern int check_commit_signature(const struct commit *commit, struct signature_check *sigc);
 
+/* record author-date for each commit object */
+declare_commit_slab(author_date_slab, unsigned long);
+declare_commit_slab_prototypes(author_date_slab, unsigned long);
+
+void record_author_date(struct author_date_slab *author_date,
+			struct commit *commit);
+int compare_commits_by_author_date(const void *a_, const void *b_, void *author_date);
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
+int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
 
 LAST_ARG_MUST_BE_NULL
 extern int run_commit_hook(int editor_is_used, const char *index_file, const char *name, ...);
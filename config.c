@@ -1225,6 +1225,11 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.sparsecheckoutcone")) {
+		core_sparse_checkout_cone = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.precomposeunicode")) {
 		precomposed_unicode = git_config_bool(var, value);
 		return 0;
@@ -2022,6 +2027,50 @@ int git_config_get_split_index(void)
 	return -1; /* default value */
 }
 
+int git_config_get_fsmonitor(void)
+{
+	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
+		core_fsmonitor = getenv("GIT_FSMONITOR_TEST");
+
+	if (core_fsmonitor && !*core_fsmonitor)
+		core_fsmonitor = NULL;
+
+	if (core_fsmonitor)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Store the number of threads to use for loading the index into dest:
+ * 0 to decide automatically, 1 to not use threads. Return 1 if
+ * index.threads is not set.
+ */
+int git_config_get_index_threads(int *dest)
+{
+	int is_bool, val;
+
+	val = git_env_ulong("GIT_TEST_INDEX_THREADS", 0);
+	if (val) {
+		*dest = val;
+		return 0;
+	}
+
+	if (!git_config_get_bool_or_int("index.threads", &is_bool, &val)) {
+		if (is_bool)
+			*dest = val ? 0 : 1;
+		else if (val < 0)
+			git_die_config("index.threads",
+				       _("index.threads value '%d' must not be negative"),
+				       val);
+		else
+			*dest = val;
+		return 0;
+	}
+
+	return 1; /* not set */
+}
+
 int git_config_get_max_percent_split_change(void)
 {
 	int val = -1;
@@ -0,0 +1,43 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+struct commit;
+struct object_id;
+struct packing_data;
+struct progress;
+
+/*
+ * Read the "pack.island" configuration and mark the tips of every ref
+ * that matches one of its patterns with the island(s) it belongs to.
+ */
+extern void load_delta_islands(void);
+
+/*
+ * Propagate the island marks of "commit" to its tree and parents.  The
+ * commits must be visited children-first, e.g. by a --topo-order walk.
+ */
+extern void propagate_island_marks(struct commit *commit);
+
+/*
+ * Propagate the island marks of the trees in "to_pack" to their
+ * entries.  The trees are processed in order of the "tree_depth"
+ * recorded for them, so that a tree has received the marks of every
+ * tree that contains it before its own entries are marked.
+ */
+extern void resolve_tree_islands(int progress, struct packing_data *to_pack);
+
+/*
+ * Return 1 if "src" may be used as a delta base for "trg", i.e. if it
+ * is in every island "trg" is in.  Objects that are not in any island
+ * may use any base.
+ */
+extern int in_same_island(const struct object_id *trg, const struct object_id *src);
+
+/*
+ * Compare "a" and "b" for the order in which delta candidates are
+ * considered: an object that is in islands the other one is not in
+ * sorts first, so that it is available as a base for the other.
+ */
+extern int island_delta_cmp(const struct object_id *a, const struct object_id *b);
+
+#endif
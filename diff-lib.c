@@ -490,6 +490,16 @@ static int diff_cache(struct rev_info *revs,
 	if (!tree)
 		return error("bad tree object %s",
 			     tree_name ? tree_name : oid_to_hex(tree_oid));
+
+	/*
+	 * A valid cache-tree whose root is the tree we compare with
+	 * means the index has no staged changes at all.
+	 */
+	if (cached && !DIFF_OPT_TST(&revs->diffopt, FIND_COPIES_HARDER) &&
+	    the_index.cache_tree && the_index.cache_tree->entry_count >= 0 &&
+	    !oidcmp(&the_index.cache_tree->oid, &tree->object.oid))
+		return 0;
+
 	memset(&opts, 0, sizeof(opts));
 	opts.head_idx = 1;
 	opts.index_only = cached;
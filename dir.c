@@ -17,6 +17,7 @@
 #include "utf8.h"
 #include "varint.h"
 #include "ewah/ewok.h"
+#include "fsmonitor.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -566,9 +567,176 @@ void parse_exclude_pattern(const char **pattern,
 	*patternlen = len;
 }
 
+static int exclude_entry_cmp(const struct exclude_entry *e1,
+			     const struct exclude_entry *e2,
+			     const void *unused_keydata)
+{
+	if (e1->patternlen != e2->patternlen)
+		return 1;
+	return ignore_case ?
+		strncasecmp(e1->pattern, e2->pattern, e1->patternlen) :
+		strncmp(e1->pattern, e2->pattern, e1->patternlen);
+}
+
+static unsigned int exclude_entry_hash(const char *path, size_t len)
+{
+	return ignore_case ? memihash(path, len) : memhash(path, len);
+}
+
+static int hashset_contains(struct hashmap *map, const char *path, size_t len)
+{
+	struct exclude_entry key;
+
+	if (!map->tablesize)
+		return 0;
+	hashmap_entry_init(&key, exclude_entry_hash(path, len));
+	key.pattern = (char *)path;
+	key.patternlen = len;
+	return !!hashmap_get(map, &key, NULL);
+}
+
+static void hashset_add(struct hashmap *map, const char *path, size_t len)
+{
+	struct exclude_entry *e;
+
+	if (hashset_contains(map, path, len))
+		return;
+	if (!map->tablesize)
+		hashmap_init(map, (hashmap_cmp_fn)exclude_entry_cmp, 0);
+	e = xmalloc(sizeof(*e));
+	hashmap_entry_init(e, exclude_entry_hash(path, len));
+	e->pattern = xmemdupz(path, len);
+	e->patternlen = len;
+	hashmap_add(map, e);
+}
+
+static void hashset_clear(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct exclude_entry *e;
+
+	if (!map->tablesize)
+		return;
+	hashmap_iter_init(map, &iter);
+	while ((e = hashmap_iter_next(&iter)))
+		free(e->pattern);
+	hashmap_free(map, 1);
+}
+
+static void hashset_remove(struct hashmap *map, const char *path, size_t len)
+{
+	struct exclude_entry key, *e;
+
+	if (!map->tablesize)
+		return;
+	hashmap_entry_init(&key, exclude_entry_hash(path, len));
+	key.pattern = (char *)path;
+	key.patternlen = len;
+	e = hashmap_remove(map, &key, NULL);
+	if (e) {
+		free(e->pattern);
+		free(e);
+	}
+}
+
+static void disable_cone_patterns(struct exclude_list *el, const char *pattern)
+{
+	warning(_("unrecognized pattern: '%s'"), pattern);
+	warning(_("disabling cone pattern matching"));
+	hashset_clear(&el->recursive_hashmap);
+	hashset_clear(&el->parent_hashmap);
+	el->use_cone_patterns = 0;
+}
+
+/*
+ * Record a cone pattern in the hashsets. The only forms allowed are
+ * the ones that "git sparse-checkout set" writes in cone mode: a
+ * single star for the files at the top level, a negative pattern
+ * made of a directory (or nothing, for the top level), a star and a
+ * slash for its subdirectories, and "/<dir>/" for a directory with
+ * everything below it.
+ */
+static void add_exclude_to_hashsets(struct exclude_list *el, struct exclude *x,
+				    const char *given)
+{
+	const char *dir = x->pattern + 1;
+	size_t len = x->patternlen - 1;
+	size_t i;
+
+	if (x->baselen || !len || x->pattern[0] != '/')
+		goto unrecognized;
+
+	if (!(x->flags & (EXC_FLAG_NEGATIVE | EXC_FLAG_MUSTBEDIR))) {
+		if (len == 1 && dir[0] == '*')
+			return;
+		goto unrecognized;
+	}
+
+	if (x->flags & EXC_FLAG_NEGATIVE) {
+		if (!(x->flags & EXC_FLAG_MUSTBEDIR) ||
+		    x->nowildcardlen != x->patternlen - 1 ||
+		    dir[len - 1] != '*')
+			goto unrecognized;
+		if (len == 1)
+			return; /* the subdirectories of the top level */
+		if (dir[len - 2] != '/')
+			goto unrecognized;
+		len -= 2;
+		/* only the files of a directory included before */
+		if (!hashset_contains(&el->recursive_hashmap, dir, len))
+			goto unrecognized;
+		hashset_remove(&el->recursive_hashmap, dir, len);
+		hashset_add(&el->parent_hashmap, dir, len);
+		return;
+	}
+
+	if (x->nowildcardlen != x->patternlen)
+		goto unrecognized;
+	hashset_add(&el->recursive_hashmap, dir, len);
+	for (i = 0; i < len; i++)
+		if (dir[i] == '/')
+			hashset_add(&el->parent_hashmap, dir, i);
+	return;
+
+unrecognized:
+	disable_cone_patterns(el, given);
+}
+
+enum cone_match_result cone_pattern_match(struct exclude_list *el,
+					  const char *pathname,
+					  int pathlen, int dtype)
+{
+	int dirlen, i;
+
+	/* the directory of a file, or the directory itself */
+	if (dtype == DT_DIR) {
+		dirlen = pathlen;
+	} else {
+		for (dirlen = pathlen; dirlen > 0; dirlen--)
+			if (pathname[dirlen - 1] == '/')
+				break;
+		if (!dirlen)
+			return CONE_MATCHED;
+		dirlen--;
+	}
+	if (!dirlen)
+		return CONE_MATCHED;
+
+	if (hashset_contains(&el->recursive_hashmap, pathname, dirlen))
+		return CONE_MATCHED_RECURSIVE;
+	if (hashset_contains(&el->parent_hashmap, pathname, dirlen))
+		return CONE_MATCHED;
+	for (i = dirlen - 1; i > 0; i--)
+		if (pathname[i] == '/' &&
+		    hashset_contains(&el->recursive_hashmap, pathname, i))
+			return CONE_MATCHED_RECURSIVE;
+	return CONE_NOT_MATCHED;
+}
+
 void add_exclude(const char *string, const char *base,
 		 int baselen, struct exclude_list *el, int srcpos)
 {
+	const char *given = string;
 	struct exclude *x;
 	int patternlen;
 	unsigned flags;
@@ -590,6 +758,9 @@ void add_exclude(const char *string, const char *base,
 	ALLOC_GROW(el->excludes, el->nr + 1, el->alloc);
 	el->excludes[el->nr++] = x;
 	x->el = el;
+
+	if (el->use_cone_patterns)
+		add_exclude_to_hashsets(el, x, given);
 }
 
 static void *read_skip_worktree_file_from_index(const struct index_state *istate,
@@ -632,6 +803,8 @@ void clear_exclude_list(struct exclude_list *el)
 		free(el->excludes[i]);
 	free(el->excludes);
 	free(el->filebuf);
+	hashset_clear(&el->recursive_hashmap);
+	hashset_clear(&el->parent_hashmap);
 
 	memset(el, 0, sizeof(*el));
 }
@@ -1017,6 +1190,14 @@ int is_excluded_from_list(const char *pathname,
 			  struct exclude_list *el, struct index_state *istate)
 {
 	struct exclude *exclude;
+
+	if (el->use_cone_patterns) {
+		if (*dtype == DT_UNKNOWN)
+			*dtype = get_dtype(NULL, istate, pathname, pathlen);
+		return cone_pattern_match(el, pathname, pathlen, *dtype) !=
+			CONE_NOT_MATCHED;
+	}
+
 	exclude = last_exclude_matching_from_list(pathname, pathlen, basename,
 						  dtype, el, istate);
 	if (exclude)
@@ -1669,6 +1850,178 @@ static void add_untracked(struct untracked_cache_dir *dir, const char *name)
 	dir->untracked[dir->untracked_nr++] = xstrdup(name);
 }
 
+struct untracked_stat_item {
+	struct untracked_cache_dir *ucd;
+	char *path;
+};
+
+struct untracked_stat_list {
+	struct untracked_stat_item *items;
+	int nr, alloc;
+};
+
+static void collect_untracked_dirs(struct untracked_stat_list *list,
+				   struct untracked_cache_dir *ucd,
+				   struct strbuf *path, int use_fsmonitor)
+{
+	size_t len = path->len;
+	int i;
+
+	/*
+	 * Only directories that were valid are worth checking ahead:
+	 * the others are read anyway, and fsmonitor vouches for those
+	 * it reports valid.
+	 */
+	if (ucd->valid && !use_fsmonitor) {
+		ALLOC_GROW(list->items, list->nr + 1, list->alloc);
+		list->items[list->nr].ucd = ucd;
+		list->items[list->nr].path = xstrdup(path->len ? path->buf : ".");
+		list->nr++;
+	}
+	for (i = 0; i < ucd->dirs_nr; i++) {
+		strbuf_addstr(path, ucd->dirs[i]->name);
+		strbuf_addch(path, '/');
+		collect_untracked_dirs(list, ucd->dirs[i], path, use_fsmonitor);
+		strbuf_setlen(path, len);
+	}
+}
+
+/*
+ * Find the cached directory for "base" (of "len" bytes, ending with a
+ * slash) without creating it, or NULL if it is not cached.
+ */
+static struct untracked_cache_dir *find_untracked_dir(struct untracked_cache_dir *ucd,
+						      const char *base, int len)
+{
+	while (ucd && len) {
+		const char *slash = memchr(base, '/', len);
+		int namelen = slash ? slash - base : len;
+		int i;
+
+		for (i = 0; i < ucd->dirs_nr; i++)
+			if (!strncmp(ucd->dirs[i]->name, base, namelen) &&
+			    !ucd->dirs[i]->name[namelen])
+				break;
+		ucd = i < ucd->dirs_nr ? ucd->dirs[i] : NULL;
+		if (!slash)
+			break;
+		len -= slash + 1 - base;
+		base = slash + 1;
+	}
+	return ucd;
+}
+
+static void clear_untracked_stat_list(struct untracked_stat_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++) {
+		list->items[i].ucd->stat_unchanged = 0;
+		free(list->items[i].path);
+	}
+	free(list->items);
+	memset(list, 0, sizeof(*list));
+}
+
+#ifdef NO_PTHREADS
+static void preload_untracked_cache(struct dir_struct *dir,
+				    struct index_state *istate,
+				    const char *base, int len,
+				    struct untracked_stat_list *list)
+{
+	; /* nothing */
+}
+#else
+
+#include <pthread.h>
+
+/*
+ * Like for preload_index(): at most 20 threads, and at least 500
+ * directories to stat() for each of them.
+ */
+#define MAX_PARALLEL_UNTRACKED (20)
+#define UNTRACKED_THREAD_COST (500)
+
+struct untracked_stat_thread {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct untracked_stat_item *items;
+	int nr;
+};
+
+static void *untracked_stat_thread(void *_data)
+{
+	struct untracked_stat_thread *p = _data;
+	int i;
+
+	for (i = 0; i < p->nr; i++) {
+		struct untracked_cache_dir *ucd = p->items[i].ucd;
+		struct stat st;
+
+		/*
+		 * Each thread has its own directories, and only marks
+		 * those that need no further check; anything else is
+		 * left to valid_cached_dir() in the main thread.
+		 */
+		if (!stat(p->items[i].path, &st) &&
+		    !match_stat_data_racy(p->istate, &ucd->stat_data, &st))
+			ucd->stat_unchanged = 1;
+	}
+	return NULL;
+}
+
+/*
+ * stat() the directories of the untracked cache in parallel before
+ * read_directory_recursive() visits them one after the other.
+ */
+static void preload_untracked_cache(struct dir_struct *dir,
+				    struct index_state *istate,
+				    const char *base, int len,
+				    struct untracked_stat_list *list)
+{
+	struct untracked_stat_thread data[MAX_PARALLEL_UNTRACKED];
+	struct untracked_cache_dir *ucd;
+	struct strbuf path = STRBUF_INIT;
+	int threads, i, work, offset;
+
+	if (!core_preload_index)
+		return;
+
+	/* only what read_directory() will look at, i.e. below "base" */
+	ucd = find_untracked_dir(dir->untracked->root, base, len);
+	if (!ucd)
+		return;
+
+	/* fsmonitor may invalidate directories; let it do so first */
+	refresh_fsmonitor(istate);
+	strbuf_add(&path, base, len);
+	collect_untracked_dirs(list, ucd, &path, dir->untracked->use_fsmonitor);
+	strbuf_release(&path);
+
+	threads = list->nr / UNTRACKED_THREAD_COST;
+	if (threads < 2) {
+		clear_untracked_stat_list(list);
+		return;
+	}
+	if (threads > MAX_PARALLEL_UNTRACKED)
+		threads = MAX_PARALLEL_UNTRACKED;
+	work = DIV_ROUND_UP(list->nr, threads);
+	memset(&data, 0, sizeof(data));
+	for (i = offset = 0; i < threads; i++, offset += work) {
+		struct untracked_stat_thread *p = data + i;
+
+		p->istate = istate;
+		p->items = list->items + offset;
+		p->nr = offset + work > list->nr ? list->nr - offset : work;
+		if (pthread_create(&p->pthread, NULL, untracked_stat_thread, p))
+			die("unable to create threaded stat");
+	}
+	for (i = 0; i < threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join threaded stat");
+}
+#endif
+
 static int valid_cached_dir(struct dir_struct *dir,
 			    struct untracked_cache_dir *untracked,
 			    struct index_state *istate,
@@ -1680,17 +2033,24 @@ static int valid_cached_dir(struct dir_struct *dir,
 	if (!untracked)
 		return 0;
 
-	if (stat(path->len ? path->buf : ".", &st)) {
-		invalidate_directory(dir->untracked, untracked);
-		memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
-		return 0;
-	}
-	if (!untracked->valid ||
-	    match_stat_data_racy(istate, &untracked->stat_data, &st)) {
-		if (untracked->valid)
+	/*
+	 * With fsmonitor, we can trust the untracked cache's valid field.
+	 */
+	refresh_fsmonitor(istate);
+	if (!(dir->untracked->use_fsmonitor && untracked->valid) &&
+	    !(untracked->stat_unchanged && untracked->valid)) {
+		if (stat(path->len ? path->buf : ".", &st)) {
 			invalidate_directory(dir->untracked, untracked);
-		fill_stat_data(&untracked->stat_data, &st);
-		return 0;
+			memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
+			return 0;
+		}
+		if (!untracked->valid ||
+		    match_stat_data_racy(istate, &untracked->stat_data, &st)) {
+			if (untracked->valid)
+				invalidate_directory(dir->untracked, untracked);
+			fill_stat_data(&untracked->stat_data, &st);
+			return 0;
+		}
 	}
 
 	if (untracked->check_only != !!check_only) {
@@ -2084,10 +2444,45 @@ static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *d
 	return root;
 }
 
+/*
+ * Write the untracked cache back once this many directories, or this
+ * share of the cached ones, had to be read again; see
+ * untracked_cache_worth_writing().
+ */
+#define UNTRACKED_WRITE_MIN_DIRS (4)
+#define UNTRACKED_WRITE_RATIO (32)
+
+static unsigned int count_untracked_dirs(struct untracked_cache_dir *ucd)
+{
+	unsigned int i, nr = 1;
+
+	for (i = 0; i < ucd->dirs_nr; i++)
+		nr += count_untracked_dirs(ucd->dirs[i]);
+	return nr;
+}
+
+/*
+ * Whether to write the index to save the directories that were read
+ * into the untracked cache, so that the next command does not have to
+ * read them again. In a large tree, rewriting the index for one or
+ * two of them costs more than it saves; they are still saved whenever
+ * the index is written for another reason.
+ */
+static int untracked_cache_worth_writing(struct untracked_cache *uc)
+{
+	if (!uc->dir_opened)
+		return 0;
+	if (uc->dir_opened >= UNTRACKED_WRITE_MIN_DIRS)
+		return 1;
+	return (uint64_t)uc->dir_opened * UNTRACKED_WRITE_RATIO >=
+		count_untracked_dirs(uc->root);
+}
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
 	struct untracked_cache_dir *untracked;
+	struct untracked_stat_list stat_list = { NULL, 0, 0 };
 
 	if (has_symlink_leading_path(path, len))
 		return dir->nr;
@@ -2099,8 +2494,11 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
+	else
+		preload_untracked_cache(dir, istate, path, len, &stat_list);
 	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
 		read_directory_recursive(dir, istate, path, len, untracked, 0, pathspec);
+	clear_untracked_stat_list(&stat_list);
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
@@ -2139,9 +2537,7 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 				 dir->untracked->dir_invalidated,
 				 dir->untracked->dir_opened);
 		if (dir->untracked == istate->untracked &&
-		    (dir->untracked->dir_opened ||
-		     dir->untracked->gitignore_invalidated ||
-		     dir->untracked->dir_invalidated))
+		    untracked_cache_worth_writing(dir->untracked))
 			istate->cache_changed |= UNTRACKED_CHANGED;
 		if (dir->untracked != istate->untracked) {
 			free(dir->untracked);
@@ -43,6 +43,13 @@ struct exclude {
  * can also be used to represent the list of --exclude values passed
  * via CLI args.
  */
+/* A directory in one of the hashsets of cone patterns */
+struct exclude_entry {
+	struct hashmap_entry ent;
+	char *pattern;
+	size_t patternlen;
+};
+
 struct exclude_list {
 	int nr;
 	int alloc;
@@ -54,6 +61,24 @@ struct exclude_list {
 	const char *src;
 
 	struct exclude **excludes;
+
+	/*
+	 * Set before adding sparse-checkout patterns to also compile
+	 * them into hashsets of directories; this is reset (with a
+	 * warning) if a pattern is not of the cone form:
+	 *
+	 *  - the directories named by "/<dir>/", which are included
+	 *    with everything below them, go to recursive_hashmap;
+	 *
+	 *  - their leading directories, and the directories of which
+	 *    only the files are included (those with a negative pattern
+	 *    for their subdirectories), go to parent_hashmap.
+	 *
+	 * The files at the top level are always included.
+	 */
+	unsigned use_cone_patterns : 1;
+	struct hashmap recursive_hashmap;
+	struct hashmap parent_hashmap;
 };
 
 /*
@@ -118,6 +143,8 @@ struct untracked_cache_dir {
 	/* all data except 'dirs' in this struct are good */
 	unsigned int valid : 1;
 	unsigned int recurse : 1;
+	/* stat() found the directory unchanged in preload_untracked_cache() */
+	unsigned int stat_unchanged : 1;
 	/* null SHA-1 means this directory does not have .gitignore */
 	unsigned char exclude_sha1[20];
 	char name[FLEX_ARRAY];
@@ -134,6 +161,12 @@ struct untracked_cache {
 	 */
 	unsigned dir_flags;
 	struct untracked_cache_dir *root;
+	/*
+	 * Set when the filesystem monitor reported every change since
+	 * the untracked cache was written, so that valid directories
+	 * need not be stat()ed.
+	 */
+	int use_fsmonitor;
 	/* Statistics */
 	int dir_created;
 	int gitignore_invalidated;
@@ -226,6 +259,23 @@ extern int is_excluded_from_list(const char *pathname, int pathlen,
 				 const char *basename, int *dtype,
 				 struct exclude_list *el,
 				 struct index_state *istate);
+
+enum cone_match_result {
+	CONE_NOT_MATCHED = 0,
+	CONE_MATCHED,
+	CONE_MATCHED_RECURSIVE
+};
+
+/*
+ * Match a path against the cone patterns of "el": a file is matched if
+ * it is at the top level or in one of the directories of the hashsets;
+ * a directory is matched if it is in parent_hashmap, and matched
+ * recursively if it or one of its leading directories is in
+ * recursive_hashmap, in which case everything below it is matched too.
+ */
+extern enum cone_match_result cone_pattern_match(struct exclude_list *el,
+						 const char *pathname,
+						 int pathlen, int dtype);
 struct dir_entry *dir_add_ignored(struct dir_struct *dir,
 				  struct index_state *istate,
 				  const char *pathname, int len);
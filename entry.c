@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "streaming.h"
 #include "submodule.h"
+#include "parallel-checkout.h"
 
 static void create_directories(const char *path, int path_len,
 			       const struct checkout *state)
@@ -319,5 +320,10 @@ int checkout_entry(struct cache_entry *ce,
 		return 0;
 
 	create_directories(path.buf, path.len, state);
+
+	/* Regular files may be left to run_parallel_checkout() */
+	if (!state->base_dir_len && !enqueue_checkout(ce))
+		return 0;
+
 	return write_entry(ce, path.buf, state, 0);
 }
@@ -0,0 +1,299 @@
+#include "cache.h"
+#include "dir.h"
+#include "ewah/ewok.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+#include "strbuf.h"
+
+/*
+ * Version 1 of both the index extension and the hook protocol used a
+ * timestamp in nanoseconds instead of an opaque token. Only the
+ * token-based version 2 is implemented here.
+ */
+#define INDEX_EXTENSION_VERSION	(2)
+#define HOOK_INTERFACE_VERSION	(2)
+
+struct trace_key trace_fsmonitor = TRACE_KEY_INIT(FSMONITOR);
+
+static void fsmonitor_ewah_callback(size_t pos, void *is)
+{
+	struct index_state *istate = (struct index_state *)is;
+	struct cache_entry *ce = istate->cache[pos];
+
+	ce->ce_flags &= ~CE_FSMONITOR_VALID;
+}
+
+int read_fsmonitor_extension(struct index_state *istate, const void *data,
+	unsigned long sz)
+{
+	const char *index = data, *end = index + sz, *token_end;
+	uint32_t hdr_version;
+	uint32_t ewah_size;
+	struct ewah_bitmap *fsmonitor_dirty;
+	int ret;
+
+	if (sz < sizeof(uint32_t) + 1 + sizeof(uint32_t))
+		return error("corrupt fsmonitor extension (too short)");
+
+	hdr_version = get_be32(index);
+	index += sizeof(uint32_t);
+	if (hdr_version != INDEX_EXTENSION_VERSION)
+		return error("bad fsmonitor version %d", hdr_version);
+
+	token_end = memchr(index, '\0', end - index);
+	if (!token_end || end - token_end - 1 < sizeof(uint32_t))
+		return error("corrupt fsmonitor extension (too short)");
+
+	ewah_size = get_be32(token_end + 1);
+	if (end - token_end - 1 - sizeof(uint32_t) != ewah_size)
+		return error("corrupt fsmonitor extension (bad ewah size)");
+
+	fsmonitor_dirty = ewah_new();
+	ret = ewah_read_mmap(fsmonitor_dirty, token_end + 1 + sizeof(uint32_t),
+			     ewah_size);
+	if (ret != ewah_size) {
+		ewah_free(fsmonitor_dirty);
+		return error("failed to parse ewah bitmap reading fsmonitor index extension");
+	}
+
+	free(istate->fsmonitor_last_update);
+	istate->fsmonitor_last_update = xmemdupz(index, token_end - index);
+	if (istate->fsmonitor_dirty)
+		ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = fsmonitor_dirty;
+
+	trace_printf_key(&trace_fsmonitor, "read fsmonitor extension successful");
+	return 0;
+}
+
+void fill_fsmonitor_bitmap(struct index_state *istate)
+{
+	unsigned int i, skipped = 0;
+
+	if (istate->fsmonitor_dirty)
+		ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = ewah_new();
+	for (i = 0; i < istate->cache_nr; i++) {
+		if (istate->cache[i]->ce_flags & CE_REMOVE)
+			skipped++;
+		else if (!(istate->cache[i]->ce_flags & CE_FSMONITOR_VALID))
+			ewah_set(istate->fsmonitor_dirty, i - skipped);
+	}
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	uint32_t hdr_version;
+	uint32_t ewah_start;
+	uint32_t ewah_size = 0;
+	int fixup = 0;
+
+	put_be32(&hdr_version, INDEX_EXTENSION_VERSION);
+	strbuf_add(sb, &hdr_version, sizeof(uint32_t));
+
+	strbuf_addstr(sb, istate->fsmonitor_last_update);
+	strbuf_addch(sb, 0); /* Want to keep a NUL */
+
+	fixup = sb->len;
+	strbuf_add(sb, &ewah_size, sizeof(uint32_t)); /* we'll fix this up later */
+
+	ewah_start = sb->len;
+	if (!istate->fsmonitor_dirty)
+		fill_fsmonitor_bitmap(istate);
+	ewah_serialize_strbuf(istate->fsmonitor_dirty, sb);
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+
+	/* fix up size field */
+	put_be32(&ewah_size, sb->len - ewah_start);
+	memcpy(sb->buf + fixup, &ewah_size, sizeof(uint32_t));
+
+	trace_printf_key(&trace_fsmonitor, "write fsmonitor extension successful");
+}
+
+/*
+ * Call the query-fsmonitor hook passing the last update token of the
+ * saved results.
+ */
+static int query_fsmonitor(const char *last_update, struct strbuf *query_result)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+
+	if (!core_fsmonitor || !get_git_work_tree())
+		return -1;
+
+	argv_array_push(&cp.args, core_fsmonitor);
+	argv_array_pushf(&cp.args, "%d", HOOK_INTERFACE_VERSION);
+	argv_array_push(&cp.args, last_update);
+	cp.use_shell = 1;
+	cp.dir = get_git_work_tree();
+
+	return capture_command(&cp, query_result, 1024);
+}
+
+static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
+{
+	int pos = index_name_pos(istate, name, strlen(name));
+
+	/* Unmerged paths have several entries, all after "pos". */
+	if (pos < 0)
+		pos = -pos - 1;
+	while (pos < istate->cache_nr &&
+	       !strcmp(istate->cache[pos]->name, name)) {
+		struct cache_entry *ce = istate->cache[pos++];
+
+		/* Make sure the cleared bit is saved with the new token */
+		if (ce->ce_flags & CE_FSMONITOR_VALID) {
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+			istate->cache_changed |= FSMONITOR_CHANGED;
+		}
+	}
+
+	/*
+	 * Mark the untracked cache dirty even if it wasn't found in the index
+	 * as it could be a new untracked file.
+	 */
+	trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_callback '%s'", name);
+	untracked_cache_invalidate_path(istate, name);
+}
+
+void refresh_fsmonitor(struct index_state *istate)
+{
+	struct strbuf query_result = STRBUF_INIT;
+	int query_success = 0, trust_result;
+	size_t bol = 0; /* beginning of line */
+	char *last_update, *new_token = NULL;
+	const char *buf;
+	unsigned int i;
+
+	if (!core_fsmonitor || istate->fsmonitor_has_run_once)
+		return;
+	istate->fsmonitor_has_run_once = 1;
+
+	trace_printf_key(&trace_fsmonitor, "refresh fsmonitor");
+
+	/*
+	 * Without a token from an earlier run nothing is known about the
+	 * state of the files; ask for a token all the same, and start
+	 * from the current time in the hope that the hook understands it.
+	 */
+	trust_result = !!istate->fsmonitor_last_update;
+	if (trust_result)
+		last_update = xstrdup(istate->fsmonitor_last_update);
+	else
+		last_update = xstrfmt("%"PRIuMAX, (uintmax_t)getnanotime());
+
+	query_success = !query_fsmonitor(last_update, &query_result);
+	trace_printf_key(&trace_fsmonitor, "fsmonitor process '%s' returned %s",
+			 core_fsmonitor, query_success ? "success" : "failure");
+	free(last_update);
+
+	/* The first NUL-terminated item of the output is the new token. */
+	buf = query_result.buf;
+	if (query_success) {
+		const char *end = memchr(buf, '\0', query_result.len);
+
+		if (end && end != buf) {
+			new_token = xmemdupz(buf, end - buf);
+			bol = end - buf + 1;
+		} else {
+			query_success = 0;
+		}
+	}
+
+	/*
+	 * A "/" in place of the list of paths means that all of them
+	 * may have changed.
+	 */
+	if (query_success && trust_result &&
+	    strcmp(buf + bol, "/")) {
+		/* Mark all entries returned by the monitor as dirty */
+		for (i = bol; i < query_result.len; i++) {
+			if (buf[i] != '\0')
+				continue;
+			if (i > bol)
+				fsmonitor_refresh_callback(istate, buf + bol);
+			bol = i + 1;
+		}
+		if (bol < query_result.len)
+			fsmonitor_refresh_callback(istate, buf + bol);
+
+		/* Now mark the untracked cache for fsmonitor usage */
+		if (istate->untracked)
+			istate->untracked->use_fsmonitor = 1;
+	} else {
+		/* Mark all entries invalid */
+		for (i = 0; i < istate->cache_nr; i++)
+			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+
+		/* If we're going to check every file, ensure we save the results */
+		istate->cache_changed |= FSMONITOR_CHANGED;
+
+		if (istate->untracked)
+			istate->untracked->use_fsmonitor = 0;
+	}
+	strbuf_release(&query_result);
+
+	/* Now that we've updated istate, save the new token */
+	free(istate->fsmonitor_last_update);
+	istate->fsmonitor_last_update = new_token;
+}
+
+void add_fsmonitor(struct index_state *istate)
+{
+	unsigned int i;
+
+	if (!istate->fsmonitor_last_update) {
+		trace_printf_key(&trace_fsmonitor, "add fsmonitor");
+		istate->cache_changed |= FSMONITOR_CHANGED;
+
+		/* reset the fsmonitor state */
+		for (i = 0; i < istate->cache_nr; i++)
+			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+
+		/* Update the fsmonitor state */
+		refresh_fsmonitor(istate);
+	}
+}
+
+void remove_fsmonitor(struct index_state *istate)
+{
+	if (istate->fsmonitor_last_update) {
+		trace_printf_key(&trace_fsmonitor, "remove fsmonitor");
+		istate->cache_changed |= FSMONITOR_CHANGED;
+		free(istate->fsmonitor_last_update);
+		istate->fsmonitor_last_update = NULL;
+	}
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	unsigned int i;
+	int fsmonitor_enabled = git_config_get_fsmonitor();
+
+	if (istate->fsmonitor_dirty) {
+		if (fsmonitor_enabled) {
+			/* Mark all entries valid */
+			for (i = 0; i < istate->cache_nr; i++)
+				istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+
+			/* Mark all previously saved entries as dirty */
+			if (istate->fsmonitor_dirty->bit_size > istate->cache_nr)
+				for (i = 0; i < istate->cache_nr; i++)
+					istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+			else
+				ewah_each_bit(istate->fsmonitor_dirty,
+					      fsmonitor_ewah_callback, istate);
+		}
+
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+	}
+
+	if (fsmonitor_enabled) {
+		add_fsmonitor(istate);
+		refresh_fsmonitor(istate);
+	} else {
+		remove_fsmonitor(istate);
+	}
+}
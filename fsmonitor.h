@@ -0,0 +1,63 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+#include "cache.h"
+
+extern struct trace_key trace_fsmonitor;
+
+/*
+ * Read the fsmonitor index extension and (if configured) restore the
+ * CE_FSMONITOR_VALID state.
+ */
+int read_fsmonitor_extension(struct index_state *istate, const void *data,
+			     unsigned long sz);
+
+/*
+ * Fill the fsmonitor_dirty ewah bits with the current state of
+ * CE_FSMONITOR_VALID. This must be done on the full index, before
+ * it is split for writing.
+ */
+void fill_fsmonitor_bitmap(struct index_state *istate);
+
+/*
+ * Write the fsmonitor index extension from the bitmap prepared by
+ * fill_fsmonitor_bitmap().
+ */
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate);
+
+/*
+ * Add/remove the fsmonitor index extension.
+ */
+void add_fsmonitor(struct index_state *istate);
+void remove_fsmonitor(struct index_state *istate);
+
+/*
+ * Add/remove the fsmonitor index extension as necessary based on the
+ * current core.fsmonitor setting.
+ */
+void tweak_fsmonitor(struct index_state *istate);
+
+/*
+ * Run the configured fsmonitor integration hook (once per process)
+ * and clear CE_FSMONITOR_VALID on every entry it reports as changed,
+ * invalidating the untracked cache for those paths as well.
+ */
+void refresh_fsmonitor(struct index_state *istate);
+
+/*
+ * Set the given cache entry's CE_FSMONITOR_VALID bit. This should be
+ * called any time the cache entry has been updated to reflect the
+ * current state of the file on disk.
+ */
+static inline void mark_fsmonitor_valid(struct index_state *istate,
+					struct cache_entry *ce)
+{
+	if (core_fsmonitor && !(ce->ce_flags & CE_FSMONITOR_VALID)) {
+		istate->cache_changed |= FSMONITOR_CHANGED;
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+		trace_printf_key(&trace_fsmonitor, "mark_fsmonitor_valid '%s'",
+				 ce->name);
+	}
+}
+
+#endif
@@ -0,0 +1,931 @@
+#include "cache.h"
+#include "lockfile.h"
+#include "csum-file.h"
+#include "midx.h"
+#include "commit.h"
+#include "tag.h"
+#include "refs.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_VERSION 1
+#define MIDX_HASH_VERSION 1
+#define MIDX_HASH_LEN GIT_SHA1_RAWSZ
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_CHUNK_ALIGNMENT 4
+#define MIDX_MAX_CHUNKS 5
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_CHUNKLOOKUP_WIDTH + \
+		       MIDX_FANOUT_SIZE + MIDX_HASH_LEN)
+
+char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+char *get_midx_bitmap_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index.bitmap", object_dir);
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct multi_pack_index *m = NULL;
+	int fd;
+	struct stat st;
+	size_t midx_size;
+	void *midx_map = NULL;
+	uint32_t hash_version;
+	char *midx_name = get_midx_filename(object_dir);
+	const unsigned char *chunk_lookup, *names, *end;
+	uint32_t i;
+
+	fd = git_open(midx_name);
+	if (fd < 0)
+		goto cleanup_fail;
+	if (fstat(fd, &st)) {
+		error_errno(_("failed to read %s"), midx_name);
+		goto cleanup_fail;
+	}
+
+	midx_size = xsize_t(st.st_size);
+	if (midx_size < MIDX_MIN_SIZE) {
+		error(_("multi-pack-index file %s is too small"), midx_name);
+		goto cleanup_fail;
+	}
+
+	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	FLEX_ALLOC_STR(m, object_dir, object_dir);
+	m->fd = fd;
+	m->data = midx_map;
+	m->data_len = midx_size;
+	m->local = local;
+
+	m->signature = get_be32(m->data);
+	if (m->signature != MIDX_SIGNATURE) {
+		error(_("multi-pack-index signature 0x%08x does not match signature 0x%08x"),
+		      m->signature, MIDX_SIGNATURE);
+		goto cleanup_fail;
+	}
+
+	m->version = m->data[4];
+	if (m->version != MIDX_VERSION) {
+		error(_("multi-pack-index version %d not recognized"),
+		      m->version);
+		goto cleanup_fail;
+	}
+
+	hash_version = m->data[5];
+	if (hash_version != MIDX_HASH_VERSION) {
+		error(_("hash version %u does not match"), hash_version);
+		goto cleanup_fail;
+	}
+	m->hash_len = MIDX_HASH_LEN;
+
+	m->num_chunks = m->data[6];
+	/* data[7] is the number of base multi-pack-index files, unused */
+	m->num_packs = get_be32(m->data + 8);
+
+	end = m->data + m->data_len - m->hash_len;
+	chunk_lookup = m->data + MIDX_HEADER_SIZE;
+	if (chunk_lookup + (m->num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH > end) {
+		error(_("multi-pack-index chunk lookup table exceeds the file"));
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < m->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		const unsigned char *chunk;
+
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset > m->data_len - m->hash_len) {
+			error(_("improper chunk offset %08x%08x"),
+			      (uint32_t)(chunk_offset >> 32),
+			      (uint32_t)chunk_offset);
+			goto cleanup_fail;
+		}
+		chunk = m->data + chunk_offset;
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = chunk;
+			break;
+
+		case MIDX_CHUNKID_OIDFANOUT:
+			m->chunk_oid_fanout = (const uint32_t *)chunk;
+			break;
+
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = chunk;
+			break;
+
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = chunk;
+			break;
+
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = chunk;
+			break;
+
+		default:
+			/*
+			 * Do nothing on unrecognized chunks, allowing
+			 * future extensions to add optional chunks.
+			 */
+			break;
+		}
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets) {
+		error(_("multi-pack-index %s is missing a required chunk"),
+		      midx_name);
+		goto cleanup_fail;
+	}
+	if ((const unsigned char *)m->chunk_oid_fanout + MIDX_FANOUT_SIZE > end) {
+		error(_("multi-pack-index OID fanout is too small"));
+		goto cleanup_fail;
+	}
+
+	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
+	if (m->chunk_oid_lookup + (size_t)m->num_objects * m->hash_len > end ||
+	    m->chunk_object_offsets + (size_t)m->num_objects * MIDX_OFFSET_WIDTH > end) {
+		error(_("multi-pack-index %s is truncated"), midx_name);
+		goto cleanup_fail;
+	}
+
+	ALLOC_ARRAY(m->pack_names, m->num_packs);
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+
+	names = m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		const unsigned char *nul = memchr(names, '\0', end - names);
+
+		if (!nul) {
+			error(_("multi-pack-index pack names are truncated"));
+			goto cleanup_fail;
+		}
+		m->pack_names[i] = (const char *)names;
+		if (i && strcmp(m->pack_names[i - 1], m->pack_names[i]) >= 0) {
+			error(_("multi-pack-index pack names out of order: '%s' before '%s'"),
+			      m->pack_names[i - 1], m->pack_names[i]);
+			goto cleanup_fail;
+		}
+		names = nul + 1;
+	}
+
+	free(midx_name);
+	return m;
+
+cleanup_fail:
+	if (m) {
+		free(m->pack_names);
+		free(m->packs);
+		free(m);
+	}
+	free(midx_name);
+	if (midx_map)
+		munmap(midx_map, midx_size);
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+	munmap((unsigned char *)m->data, m->data_len);
+	close(m->fd);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+int bsearch_midx(const unsigned char *sha1, struct multi_pack_index *m,
+		 uint32_t *result)
+{
+	uint32_t lo, hi;
+	int first = sha1[0];
+
+	lo = first ? ntohl(m->chunk_oid_fanout[first - 1]) : 0;
+	hi = ntohl(m->chunk_oid_fanout[first]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, m->chunk_oid_lookup + m->hash_len * mi);
+		if (!cmp) {
+			*result = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+const unsigned char *nth_midxed_object_sha1(struct multi_pack_index *m,
+					    uint32_t n)
+{
+	if (n >= m->num_objects)
+		return NULL;
+	return m->chunk_oid_lookup + m->hash_len * n;
+}
+
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t n)
+{
+	return get_be32(m->chunk_object_offsets + n * MIDX_OFFSET_WIDTH);
+}
+
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t n)
+{
+	const unsigned char *offset_data;
+	uint32_t offset32;
+
+	offset_data = m->chunk_object_offsets + n * MIDX_OFFSET_WIDTH;
+	offset32 = get_be32(offset_data + 4);
+
+	if (offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		const unsigned char *large;
+
+		offset32 ^= MIDX_LARGE_OFFSET_NEEDED;
+		large = m->chunk_large_offsets +
+			(size_t)offset32 * MIDX_LARGE_OFFSET_WIDTH;
+		if (!m->chunk_large_offsets ||
+		    large + MIDX_LARGE_OFFSET_WIDTH > m->data + m->data_len)
+			die(_("multi-pack-index large offset out of bounds"));
+		return get_be64(large);
+	}
+
+	return offset32;
+}
+
+/* loaded multi-pack-indexes, the local one first */
+static struct multi_pack_index *midx_list;
+
+int multi_pack_index_enabled(void)
+{
+	int value;
+
+	if (git_config_get_bool("core.multipackindex", &value))
+		return 0;
+	return value;
+}
+
+uint32_t resolve_midx_packs(struct multi_pack_index *m)
+{
+	struct strbuf pack_name = STRBUF_INIT;
+	size_t dirlen;
+	uint32_t i, missing = 0;
+
+	strbuf_addf(&pack_name, "%s/pack/", m->object_dir);
+	dirlen = pack_name.len;
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p;
+
+		m->packs[i] = NULL;
+		strbuf_setlen(&pack_name, dirlen);
+		strbuf_addstr(&pack_name, m->pack_names[i]);
+		if (strbuf_strip_suffix(&pack_name, ".idx")) {
+			strbuf_addstr(&pack_name, ".pack");
+			for (p = packed_git; p; p = p->next) {
+				if (!strcmp(p->pack_name, pack_name.buf)) {
+					m->packs[i] = p;
+					break;
+				}
+			}
+		}
+		if (!m->packs[i])
+			missing++;
+	}
+	strbuf_release(&pack_name);
+
+	return missing;
+}
+
+void prepare_multi_pack_index_one(const char *object_dir, int local)
+{
+	struct multi_pack_index *m, **tail;
+	uint32_t i;
+
+	if (!multi_pack_index_enabled())
+		return;
+
+	for (tail = &midx_list; *tail; tail = &(*tail)->next)
+		if (!strcmp((*tail)->object_dir, object_dir))
+			return;
+
+	m = load_multi_pack_index(object_dir, local);
+	if (!m)
+		return;
+
+	resolve_midx_packs(m);
+	for (i = 0; i < m->num_packs; i++)
+		if (m->packs[i])
+			m->packs[i]->multi_pack_index = 1;
+
+	*tail = m;
+}
+
+void close_multi_pack_indexes(void)
+{
+	while (midx_list) {
+		struct multi_pack_index *m = midx_list;
+		uint32_t i;
+
+		for (i = 0; i < m->num_packs; i++)
+			if (m->packs[i])
+				m->packs[i]->multi_pack_index = 0;
+
+		midx_list = m->next;
+		close_midx(m);
+	}
+}
+
+static int fill_midx_entry_one(const unsigned char *sha1, struct pack_entry *e,
+			       struct multi_pack_index *m)
+{
+	uint32_t pos, pack_int_id;
+	struct packed_git *p;
+
+	if (!bsearch_midx(sha1, m, &pos))
+		return 0;
+
+	pack_int_id = nth_midxed_pack_int_id(m, pos);
+	if (pack_int_id >= m->num_packs)
+		return -1;
+	p = m->packs[pack_int_id];
+	if (!p)
+		return -1;
+
+	if (p->num_bad_objects) {
+		uint32_t i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+				return -1;
+	}
+
+	/*
+	 * As in fill_pack_entry(), make sure the packfile is still
+	 * here and can be accessed before handing out the location.
+	 */
+	if (!is_pack_valid(p))
+		return -1;
+
+	e->offset = nth_midxed_offset(m, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e)
+{
+	struct multi_pack_index *m;
+	int ret = 0;
+
+	for (m = midx_list; m; m = m->next) {
+		int found = fill_midx_entry_one(sha1, e, m);
+		if (found > 0)
+			return 1;
+		if (found < 0)
+			ret = -1;
+	}
+	return ret;
+}
+
+struct pack_info {
+	char *name;
+	struct packed_git *p;
+};
+
+struct pack_midx_entry {
+	struct object_id oid;
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	uint64_t offset;
+};
+
+static int pack_info_compare(const void *_a, const void *_b)
+{
+	const struct pack_info *a = _a, *b = _b;
+	return strcmp(a->name, b->name);
+}
+
+static int midx_oid_compare(const void *_a, const void *_b)
+{
+	const struct pack_midx_entry *a = _a, *b = _b;
+	int cmp = oidcmp(&a->oid, &b->oid);
+
+	if (cmp)
+		return cmp;
+
+	/* prefer the copy in the most recently modified pack */
+	if (a->pack_mtime > b->pack_mtime)
+		return -1;
+	else if (a->pack_mtime < b->pack_mtime)
+		return 1;
+
+	return a->pack_int_id - b->pack_int_id;
+}
+
+static void collect_packs(const char *object_dir, struct pack_info **packs,
+			  uint32_t *nr)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	DIR *dir;
+	struct dirent *de;
+	uint32_t alloc = 0;
+
+	strbuf_addf(&path, "%s/pack", object_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		if (errno != ENOENT)
+			error_errno(_("unable to open object pack directory: %s"),
+				    path.buf);
+		strbuf_release(&path);
+		return;
+	}
+
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+
+		if (!ends_with(de->d_name, ".idx"))
+			continue;
+
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+
+		p = add_packed_git(path.buf, path.len, 0);
+		if (!p)
+			continue;
+		if (open_pack_index(p)) {
+			warning(_("failed to open pack-index '%s'"), path.buf);
+			close_pack(p);
+			free(p);
+			continue;
+		}
+
+		ALLOC_GROW(*packs, *nr + 1, alloc);
+		(*packs)[*nr].name = xstrdup(de->d_name);
+		(*packs)[*nr].p = p;
+		(*nr)++;
+	}
+	closedir(dir);
+	strbuf_release(&path);
+
+	QSORT(*packs, *nr, pack_info_compare);
+}
+
+/*
+ * Gather the objects of all packs, sorted by object name and with
+ * duplicates removed, keeping the copy from the newest pack.
+ */
+static struct pack_midx_entry *get_sorted_entries(struct pack_info *packs,
+						  uint32_t nr_packs,
+						  uint32_t *nr_objects)
+{
+	struct pack_midx_entry *entries;
+	size_t total = 0, nr = 0, i;
+	uint32_t j;
+
+	for (i = 0; i < nr_packs; i++)
+		total = st_add(total, packs[i].p->num_objects);
+	ALLOC_ARRAY(entries, total);
+
+	for (i = 0; i < nr_packs; i++) {
+		struct packed_git *p = packs[i].p;
+
+		for (j = 0; j < p->num_objects; j++) {
+			struct pack_midx_entry *e = &entries[nr++];
+
+			nth_packed_object_oid(&e->oid, p, j);
+			e->pack_int_id = i;
+			e->pack_mtime = p->mtime;
+			e->offset = nth_packed_object_offset(p, j);
+		}
+	}
+
+	QSORT(entries, nr, midx_oid_compare);
+
+	*nr_objects = 0;
+	for (i = 0; i < nr; i++) {
+		if (*nr_objects &&
+		    !oidcmp(&entries[i].oid, &entries[*nr_objects - 1].oid))
+			continue;
+		entries[(*nr_objects)++] = entries[i];
+	}
+
+	return entries;
+}
+
+static size_t write_midx_pack_names(struct sha1file *f,
+				    struct pack_info *packs, uint32_t nr)
+{
+	unsigned char padding[MIDX_CHUNK_ALIGNMENT];
+	size_t written = 0;
+	uint32_t i;
+
+	for (i = 0; i < nr; i++) {
+		size_t len = strlen(packs[i].name) + 1;
+		sha1write(f, packs[i].name, len);
+		written += len;
+	}
+
+	i = MIDX_CHUNK_ALIGNMENT - (written % MIDX_CHUNK_ALIGNMENT);
+	if (i < MIDX_CHUNK_ALIGNMENT) {
+		memset(padding, 0, sizeof(padding));
+		sha1write(f, padding, i);
+		written += i;
+	}
+
+	return written;
+}
+
+static void write_midx_oid_fanout(struct sha1file *f,
+				  struct pack_midx_entry *objects, uint32_t nr)
+{
+	struct pack_midx_entry *list = objects, *last = objects + nr;
+	uint32_t count = 0;
+	uint32_t i;
+
+	/*
+	 * Write the first-level table (the list is sorted,
+	 * but we use a 256-entry lookup to be able to avoid
+	 * having to do eight extra binary search iterations).
+	 */
+	for (i = 0; i < 256; i++) {
+		while (list < last && list->oid.hash[0] == i) {
+			count++;
+			list++;
+		}
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_midx_oid_lookup(struct sha1file *f,
+				  struct pack_midx_entry *objects, uint32_t nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		sha1write(f, objects[i].oid.hash, MIDX_HASH_LEN);
+}
+
+static void write_midx_object_offsets(struct sha1file *f,
+				      struct pack_midx_entry *objects,
+				      uint32_t nr)
+{
+	uint32_t i, nr_large_offset = 0;
+
+	for (i = 0; i < nr; i++) {
+		struct pack_midx_entry *obj = &objects[i];
+
+		sha1write_be32(f, obj->pack_int_id);
+
+		if (obj->offset >> 31)
+			sha1write_be32(f, MIDX_LARGE_OFFSET_NEEDED | nr_large_offset++);
+		else
+			sha1write_be32(f, (uint32_t)obj->offset);
+	}
+}
+
+static void write_midx_large_offsets(struct sha1file *f,
+				     struct pack_midx_entry *objects,
+				     uint32_t nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++) {
+		uint64_t offset = objects[i].offset;
+
+		if (!(offset >> 31))
+			continue;
+
+		sha1write_be32(f, offset >> 32);
+		sha1write_be32(f, offset & 0xffffffff);
+	}
+}
+
+struct midx_bitmap_data {
+	struct rev_info revs;
+	struct packing_data *pdata;
+	struct commit **commits;
+	uint32_t commits_nr, commits_alloc;
+	const struct object_id *missing;
+};
+
+static int midx_pseudo_pack_compare(const void *_a, const void *_b)
+{
+	const struct pack_midx_entry *a = *(const struct pack_midx_entry **)_a;
+	const struct pack_midx_entry *b = *(const struct pack_midx_entry **)_b;
+
+	if (a->pack_int_id != b->pack_int_id)
+		return a->pack_int_id < b->pack_int_id ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+static int add_ref_to_bitmap_walk(const char *refname,
+				  const struct object_id *oid,
+				  int flags, void *cb_data)
+{
+	struct midx_bitmap_data *data = cb_data;
+	struct object *object;
+	struct commit *commit;
+
+	/*
+	 * Tips that are not covered (e.g. loose commits pushed since the
+	 * last repack) are left to the walk at read time.
+	 */
+	if (!packlist_find(data->pdata, oid->hash, NULL))
+		return 0;
+
+	object = parse_object(oid);
+	if (!object)
+		return 0;
+
+	commit = lookup_commit_reference_gently(oid, 1);
+	if (commit)
+		commit->object.flags |= NEEDS_BITMAP;
+
+	add_pending_object(&data->revs, object, refname);
+	return 0;
+}
+
+static void bitmap_show_commit(struct commit *commit, void *cb_data)
+{
+	struct midx_bitmap_data *data = cb_data;
+
+	if (!packlist_find(data->pdata, commit->object.oid.hash, NULL)) {
+		if (!data->missing)
+			data->missing = &commit->object.oid;
+		return;
+	}
+
+	ALLOC_GROW(data->commits, data->commits_nr + 1, data->commits_alloc);
+	data->commits[data->commits_nr++] = commit;
+}
+
+static void bitmap_show_object(struct object *object, const char *name,
+			       void *cb_data)
+{
+	struct midx_bitmap_data *data = cb_data;
+	struct object_entry *entry;
+
+	entry = packlist_find(data->pdata, object->oid.hash, NULL);
+	if (!entry) {
+		if (!data->missing)
+			data->missing = &object->oid;
+		return;
+	}
+
+	if (!entry->hash)
+		entry->hash = pack_name_hash(name);
+}
+
+/*
+ * Write a bitmap for the multi-pack-index whose trailing checksum is
+ * "midx_hash".  Bit positions follow the "pseudo-pack" order of the
+ * objects, i.e. the order the covered packs would have if they were
+ * concatenated by pack-int-id, with the duplicates left out.
+ */
+static void write_midx_bitmap(const char *object_dir,
+			      const unsigned char *midx_hash,
+			      struct pack_info *packs,
+			      struct pack_midx_entry *entries,
+			      uint32_t nr_entries)
+{
+	struct packing_data pdata;
+	struct midx_bitmap_data data;
+	struct pack_midx_entry **order;
+	struct pack_idx_entry **index, **pseudo_index;
+	char *bitmap_name;
+	uint16_t options = BITMAP_OPT_OBJECT_ORDER;
+	int hash_cache, lookup_table;
+	uint32_t i;
+
+	if (!nr_entries)
+		return;
+
+	memset(&pdata, 0, sizeof(pdata));
+	for (i = 0; i < nr_entries; i++) {
+		struct pack_midx_entry *e = &entries[i];
+		struct object_info oi = OBJECT_INFO_INIT;
+		struct object_entry *entry;
+		enum object_type type;
+		uint32_t index_pos;
+
+		packlist_find(&pdata, e->oid.hash, &index_pos);
+		entry = packlist_alloc(&pdata, e->oid.hash, index_pos);
+
+		oi.typep = &type;
+		if (packed_object_info(packs[e->pack_int_id].p, e->offset, &oi) < 0)
+			die(_("unable to get type of object %s"),
+			    oid_to_hex(&e->oid));
+		entry->type = type;
+		entry->in_pack = packs[e->pack_int_id].p;
+		entry->in_pack_offset = e->offset;
+	}
+
+	ALLOC_ARRAY(order, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		order[i] = &entries[i];
+	QSORT(order, nr_entries, midx_pseudo_pack_compare);
+
+	/*
+	 * The packlist was filled in object name order, so the entries
+	 * line up with the multi-pack-index positions.
+	 */
+	ALLOC_ARRAY(index, nr_entries);
+	ALLOC_ARRAY(pseudo_index, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		index[i] = &pdata.objects[i].idx;
+		pseudo_index[i] = &pdata.objects[order[i] - entries].idx;
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.pdata = &pdata;
+	init_revisions(&data.revs, NULL);
+	data.revs.tag_objects = 1;
+	data.revs.tree_objects = 1;
+	data.revs.blob_objects = 1;
+	head_ref(add_ref_to_bitmap_walk, &data);
+	for_each_ref(add_ref_to_bitmap_walk, &data);
+
+	if (prepare_revision_walk(&data.revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&data.revs, bitmap_show_commit,
+			     bitmap_show_object, &data);
+	reset_revision_walk();
+
+	if (data.missing) {
+		warning(_("not writing a multi-pack-index bitmap: "
+			  "object %s is reachable but not covered"),
+			oid_to_hex(data.missing));
+		goto cleanup;
+	}
+	if (!data.commits_nr)
+		goto cleanup;
+
+	if (git_config_get_bool("pack.writebitmaphashcache", &hash_cache) ||
+	    hash_cache)
+		options |= BITMAP_OPT_HASH_CACHE;
+	if (!git_config_get_bool("pack.writebitmaplookuptable", &lookup_table) &&
+	    lookup_table)
+		options |= BITMAP_OPT_LOOKUP_TABLE;
+
+	bitmap_name = get_midx_bitmap_filename(object_dir);
+	bitmap_writer_show_progress(0);
+	bitmap_writer_build_type_index(pseudo_index, nr_entries);
+	bitmap_writer_select_commits(data.commits, data.commits_nr, -1);
+	bitmap_writer_build(&pdata);
+	bitmap_writer_set_checksum((unsigned char *)midx_hash);
+	bitmap_writer_finish(index, nr_entries, bitmap_name, options);
+	free(bitmap_name);
+
+cleanup:
+	free(data.commits);
+	free(order);
+	free(index);
+	free(pseudo_index);
+	free(pdata.objects);
+	free(pdata.index);
+}
+
+void write_midx_file(const char *object_dir, unsigned flags)
+{
+	static struct lock_file lk;
+	struct sha1file *f;
+	char *midx_name, *bitmap_name;
+	int fd;
+	struct pack_info *packs = NULL;
+	uint32_t nr_packs = 0, nr_entries, nr_large_offset = 0;
+	struct pack_midx_entry *entries;
+	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
+	unsigned char final_hash[GIT_MAX_RAWSZ];
+	size_t pack_name_len = 0;
+	uint32_t i, num_chunks;
+
+	collect_packs(object_dir, &packs, &nr_packs);
+	entries = get_sorted_entries(packs, nr_packs, &nr_entries);
+
+	for (i = 0; i < nr_packs; i++)
+		pack_name_len += strlen(packs[i].name) + 1;
+	if (pack_name_len % MIDX_CHUNK_ALIGNMENT)
+		pack_name_len += MIDX_CHUNK_ALIGNMENT -
+				 (pack_name_len % MIDX_CHUNK_ALIGNMENT);
+
+	for (i = 0; i < nr_entries; i++)
+		if (entries[i].offset >> 31)
+			nr_large_offset++;
+
+	num_chunks = nr_large_offset ? 5 : 4;
+
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[2] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[3] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_ids[4] = nr_large_offset ? MIDX_CHUNKID_LARGEOFFSETS : 0;
+	chunk_ids[5] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE +
+			   (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + pack_name_len;
+	chunk_offsets[2] = chunk_offsets[1] + MIDX_FANOUT_SIZE;
+	chunk_offsets[3] = chunk_offsets[2] + (uint64_t)nr_entries * MIDX_HASH_LEN;
+	chunk_offsets[4] = chunk_offsets[3] + (uint64_t)nr_entries * MIDX_OFFSET_WIDTH;
+	chunk_offsets[5] = chunk_offsets[4] +
+			   (uint64_t)nr_large_offset * MIDX_LARGE_OFFSET_WIDTH;
+
+	midx_name = get_midx_filename(object_dir);
+	if (safe_create_leading_directories(midx_name))
+		die_errno(_("unable to create leading directories of %s"),
+			  midx_name);
+
+	fd = hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, get_lock_file_path(&lk));
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_u8(f, MIDX_VERSION);
+	sha1write_u8(f, MIDX_HASH_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* number of base multi-pack-index files */
+	sha1write_be32(f, nr_packs);
+
+	for (i = 0; i <= num_chunks; i++) {
+		uint32_t chunk_write[3];
+
+		chunk_write[0] = htonl(chunk_ids[i]);
+		chunk_write[1] = htonl(chunk_offsets[i] >> 32);
+		chunk_write[2] = htonl(chunk_offsets[i] & 0xffffffff);
+		sha1write(f, chunk_write, MIDX_CHUNKLOOKUP_WIDTH);
+	}
+
+	write_midx_pack_names(f, packs, nr_packs);
+	write_midx_oid_fanout(f, entries, nr_entries);
+	write_midx_oid_lookup(f, entries, nr_entries);
+	write_midx_object_offsets(f, entries, nr_entries);
+	if (nr_large_offset)
+		write_midx_large_offsets(f, entries, nr_entries);
+
+	/*
+	 * Keep the descriptor open so that the lockfile machinery can
+	 * close and rename it; append the trailing checksum ourselves.
+	 */
+	sha1close(f, final_hash, 0);
+	write_or_die(fd, final_hash, MIDX_HASH_LEN);
+	close_multi_pack_indexes();
+	if (commit_lock_file(&lk))
+		die_errno(_("unable to write %s"), midx_name);
+
+	bitmap_name = get_midx_bitmap_filename(object_dir);
+	unlink_or_warn(bitmap_name);
+	free(bitmap_name);
+	if (flags & MIDX_WRITE_BITMAP)
+		write_midx_bitmap(object_dir, final_hash, packs,
+				  entries, nr_entries);
+
+	for (i = 0; i < nr_packs; i++) {
+		close_pack(packs[i].p);
+		free(packs[i].p);
+		free(packs[i].name);
+	}
+	free(packs);
+	free(entries);
+	free(midx_name);
+}
+
+void clear_midx_file(const char *object_dir)
+{
+	char *midx_name = get_midx_filename(object_dir);
+	char *bitmap_name = get_midx_bitmap_filename(object_dir);
+
+	close_multi_pack_indexes();
+	unlink_or_warn(bitmap_name);
+	unlink_or_warn(midx_name);
+	free(bitmap_name);
+	free(midx_name);
+}
@@ -0,0 +1,96 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+#include "git-compat-util.h"
+
+struct pack_entry;
+struct packed_git;
+
+struct multi_pack_index {
+	struct multi_pack_index *next;
+
+	int fd;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t signature;
+	unsigned char version;
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	int local;
+
+	const unsigned char *chunk_pack_names;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+
+	const char **pack_names;
+	struct packed_git **packs;
+	char object_dir[FLEX_ARRAY];
+};
+
+extern char *get_midx_filename(const char *object_dir);
+extern char *get_midx_bitmap_filename(const char *object_dir);
+
+extern struct multi_pack_index *load_multi_pack_index(const char *object_dir,
+						      int local);
+extern void close_midx(struct multi_pack_index *m);
+
+extern int bsearch_midx(const unsigned char *sha1, struct multi_pack_index *m,
+			uint32_t *result);
+extern const unsigned char *nth_midxed_object_sha1(struct multi_pack_index *m,
+						   uint32_t n);
+extern uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t n);
+extern off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t n);
+
+/* Return 1 if core.multiPackIndex is enabled. */
+extern int multi_pack_index_enabled(void);
+
+/*
+ * Point the "packs" of "m" at the matching packs in the packed_git
+ * list, which must have been prepared.  Returns the number of packs
+ * that could not be found.
+ */
+extern uint32_t resolve_midx_packs(struct multi_pack_index *m);
+
+/*
+ * Load the multi-pack-index of "object_dir" (if core.multiPackIndex is
+ * enabled) and associate it with the packs from that directory that
+ * are already in the packed_git list, marking them as covered.
+ */
+extern void prepare_multi_pack_index_one(const char *object_dir, int local);
+
+/*
+ * Release all loaded multi-pack-indexes and clear the marks on the
+ * packs they covered, e.g. before the pack directories are rescanned.
+ */
+extern void close_multi_pack_indexes(void);
+
+/*
+ * Look "sha1" up in the loaded multi-pack-indexes.  Returns 1 and fills
+ * "e" if found in a usable pack, 0 if no multi-pack-index knows the
+ * object, and -1 if one does but its pack cannot be used (e.g. it has
+ * been deleted or the object was found to be corrupt there), in which
+ * case the caller has to search every pack.
+ */
+extern int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e);
+
+#define MIDX_WRITE_BITMAP (1 << 0)
+
+/*
+ * Write a multi-pack-index covering every pack in "object_dir"/pack.
+ * With MIDX_WRITE_BITMAP, also write a reachability bitmap for the
+ * objects it covers; see "multi-pack-index bitmaps" in
+ * Documentation/technical/bitmap-format.txt.
+ */
+extern void write_midx_file(const char *object_dir, unsigned flags);
+
+/* Remove the multi-pack-index of "object_dir" and its bitmap, if any. */
+extern void clear_midx_file(const char *object_dir);
+
+#endif
@@ -28,11 +28,12 @@ struct object_array {
 #define TYPE_BITS   3
 /*
  * object flag allocation:
- * revision.h:      0---------10                                26
+ * revision.h:      0---------10                            24--26
  * fetch-pack.c:    0---5
  * walker.c:        0-2
  * upload-pack.c:       4       11----------------19
  * builtin/blame.c:               12-13
+ * commit-graph.c:                       15
  * bisect.c:                               16
  * bundle.c:                               16
  * http-push.c:                            16-----19
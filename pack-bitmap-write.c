@@ -18,6 +18,7 @@ struct bitmapped_commit {
 	int flags;
 	int xor_offset;
 	uint32_t commit_pos;
+	off_t write_offset;
 };
 
 struct bitmap_writer {
@@ -479,6 +480,9 @@ static void write_selected_commits_v1(struct sha1file *f,
 		if (commit_pos < 0)
 			die("BUG: trying to write commit not in index");
 
+		stored->commit_pos = commit_pos;
+		stored->write_offset = f->total + f->offset;
+
 		sha1write_be32(f, commit_pos);
 		sha1write_u8(f, stored->xor_offset);
 		sha1write_u8(f, stored->flags);
@@ -500,6 +504,61 @@ static void write_hash_cache(struct sha1file *f,
 	}
 }
 
+static void write_object_order(struct sha1file *f,
+			       struct pack_idx_entry **index,
+			       uint32_t index_nr)
+{
+	uint32_t i, *order;
+
+	ALLOC_ARRAY(order, index_nr);
+	for (i = 0; i < index_nr; ++i) {
+		struct object_entry *entry = (struct object_entry *)index[i];
+		order[entry->in_pack_pos] = htonl(i);
+	}
+	sha1write(f, order, st_mult(index_nr, sizeof(*order)));
+	free(order);
+}
+
+static int table_cmp(const void *_a, const void *_b)
+{
+	uint32_t a = writer.selected[*(const uint32_t *)_a].commit_pos;
+	uint32_t b = writer.selected[*(const uint32_t *)_b].commit_pos;
+
+	return a < b ? -1 : a > b;
+}
+
+static void write_lookup_table(struct sha1file *f)
+{
+	uint32_t i, *table, *table_inv;
+
+	ALLOC_ARRAY(table, writer.selected_nr);
+	ALLOC_ARRAY(table_inv, writer.selected_nr);
+
+	/* table[row] is the selected commit at that row, sorted by position */
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = i;
+	QSORT(table, writer.selected_nr, table_cmp);
+	for (i = 0; i < writer.selected_nr; i++)
+		table_inv[table[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *selected = &writer.selected[table[i]];
+		uint64_t offset = selected->write_offset;
+		uint32_t xor_row = BITMAP_NO_XOR_ROW;
+
+		if (selected->xor_offset)
+			xor_row = table_inv[table[i] - selected->xor_offset];
+
+		sha1write_be32(f, selected->commit_pos);
+		sha1write_be32(f, offset >> 32);
+		sha1write_be32(f, offset & 0xffffffff);
+		sha1write_be32(f, xor_row);
+	}
+
+	free(table);
+	free(table_inv);
+}
+
 void bitmap_writer_set_checksum(unsigned char *sha1)
 {
 	hashcpy(writer.pack_checksum, sha1);
@@ -534,9 +593,15 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.tags);
 	write_selected_commits_v1(f, index, index_nr);
 
+	if (options & BITMAP_OPT_OBJECT_ORDER)
+		write_object_order(f, index, index_nr);
+
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
 
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f);
+
 	sha1close(f, NULL, CSUM_FSYNC);
 
 	if (adjust_shared_perm(tmp_file.buf))
@@ -9,6 +9,7 @@
 #include "pack-bitmap.h"
 #include "pack-revindex.h"
 #include "pack-objects.h"
+#include "midx.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -28,11 +29,27 @@ struct stored_bitmap {
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
+ *
+ * A bitmap index may also cover all the packs of the local multi-pack-index,
+ * which is preferred over the bitmap of a single pack.
  */
 static struct bitmap_index {
 	/* Packfile to which this bitmap index belongs to */
 	struct packed_git *pack;
 
+	/*
+	 * Multi-pack-index to which this bitmap index belongs to, if
+	 * `pack` is NULL. Its objects are numbered in "pseudo-pack"
+	 * order: `midx_order` maps each bit position to a position in
+	 * the multi-pack-index and `midx_bit_pos` is its inverse.
+	 */
+	struct multi_pack_index *midx;
+	const unsigned char *midx_order;
+	uint32_t *midx_bit_pos;
+
+	/* Number of objects in `pack` or `midx` */
+	uint32_t num_objects;
+
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
 	 * they will be sent as-is without using them for repacking
@@ -66,6 +83,13 @@ static struct bitmap_index {
 	/* Name-hash cache (or NULL if not present). */
 	uint32_t *hashes;
 
+	/*
+	 * Lookup table (or NULL if not present). When present, the commit
+	 * bitmaps are not read up front, but one at a time when they are
+	 * first asked for, and `bitmaps` only holds the ones loaded so far.
+	 */
+	const unsigned char *table_lookup;
+
 	/*
 	 * Extended index.
 	 *
@@ -145,21 +169,49 @@ static int load_bitmap_header(struct bitmap_index *index)
 	if (index->version != 1)
 		return error("Unsupported version for bitmap index file (%d)", index->version);
 
+	index->entry_count = ntohl(header->entry_count);
+
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
+		unsigned char *end = index->map + index->map_size - 20;
+		size_t table_size = st_mult(index->num_objects, sizeof(uint32_t));
 
 		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			size_t lookup_size = st_mult(index->entry_count,
+						     BITMAP_LOOKUP_TABLE_ROW_SIZE);
+
+			if ((size_t)(end - index->map) < sizeof(*header) + lookup_size)
+				return error("Corrupted bitmap index (lookup table out of bounds)");
+			end -= lookup_size;
+			index->table_lookup = end;
+		}
+
 		if (flags & BITMAP_OPT_HASH_CACHE) {
-			unsigned char *end = index->map + index->map_size - 20;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			if ((size_t)(end - index->map) < sizeof(*header) + table_size)
+				return error("Corrupted bitmap index (hash cache out of bounds)");
+			end -= table_size;
+			index->hashes = (uint32_t *)end;
+		}
+
+		if (index->midx) {
+			if (!(flags & BITMAP_OPT_OBJECT_ORDER))
+				return error("Multi-pack-index bitmap lacks the object order");
+			if ((size_t)(end - index->map) < sizeof(*header) + table_size)
+				return error("Corrupted bitmap index (object order out of bounds)");
+			index->midx_order = end - table_size;
 		}
 	}
 
-	index->entry_count = ntohl(header->entry_count);
+	if (index->midx &&
+	    hashcmp(header->checksum, index->midx->data +
+		    index->midx->data_len - index->midx->hash_len))
+		return error("Multi-pack-index bitmap does not match the multi-pack-index");
+
 	index->map_pos += sizeof(*header);
 	return 0;
 }
@@ -208,6 +260,14 @@ static inline uint8_t read_u8(const unsigned char *buffer, size_t *pos)
 
 #define MAX_XOR_OFFSET 160
 
+static const unsigned char *bitmap_commit_sha1(struct bitmap_index *index,
+					       uint32_t commit_idx_pos)
+{
+	if (index->midx)
+		return nth_midxed_object_sha1(index->midx, commit_idx_pos);
+	return nth_packed_object_sha1(index->pack, commit_idx_pos);
+}
+
 static int load_bitmap_entries_v1(struct bitmap_index *index)
 {
 	uint32_t i;
@@ -224,7 +284,10 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		if (commit_idx_pos >= index->num_objects)
+			return error("Corrupted bitmap index (commit position out of bounds)");
+
+		sha1 = bitmap_commit_sha1(index, commit_idx_pos);
 
 		bitmap = read_bitmap_1(index);
 		if (!bitmap)
@@ -247,6 +310,121 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
+/*
+ * Load the bitmap in row "row" of the lookup table, and the bitmaps it
+ * is XOR'ed against, unless they are loaded already.
+ */
+static struct stored_bitmap *load_bitmap_row(struct bitmap_index *index,
+					     uint32_t row, uint32_t depth)
+{
+	const unsigned char *p;
+	const unsigned char *sha1;
+	struct stored_bitmap *xor_bitmap = NULL;
+	struct ewah_bitmap *bitmap;
+	uint32_t commit_idx_pos, xor_row;
+	uint64_t offset;
+	khiter_t hash_pos;
+	int flags;
+
+	if (row >= index->entry_count || depth > index->entry_count) {
+		error("Corrupted bitmap index (bad lookup table row)");
+		return NULL;
+	}
+
+	p = index->table_lookup + (size_t)row * BITMAP_LOOKUP_TABLE_ROW_SIZE;
+	commit_idx_pos = get_be32(p);
+	offset = ((uint64_t)get_be32(p + 4) << 32) | get_be32(p + 8);
+	xor_row = get_be32(p + 12);
+
+	if (commit_idx_pos >= index->num_objects) {
+		error("Corrupted bitmap index (commit position out of bounds)");
+		return NULL;
+	}
+
+	sha1 = bitmap_commit_sha1(index, commit_idx_pos);
+	hash_pos = kh_get_sha1(index->bitmaps, sha1);
+	if (hash_pos < kh_end(index->bitmaps))
+		return kh_value(index->bitmaps, hash_pos);
+
+	if (xor_row != BITMAP_NO_XOR_ROW) {
+		xor_bitmap = load_bitmap_row(index, xor_row, depth + 1);
+		if (!xor_bitmap)
+			return NULL;
+	}
+
+	if (offset > index->map_size - 20 - 6 ||
+	    get_be32(index->map + offset) != commit_idx_pos) {
+		error("Corrupted bitmap index (bad lookup table offset)");
+		return NULL;
+	}
+
+	index->map_pos = offset + 5;
+	flags = read_u8(index->map, &index->map_pos);
+
+	bitmap = read_bitmap_1(index);
+	if (!bitmap)
+		return NULL;
+
+	return store_bitmap(index, bitmap, sha1, xor_bitmap, flags);
+}
+
+/*
+ * Find the position of "sha1" in the pack (or multi-pack-index) index
+ * the bitmap belongs to.
+ */
+static int bitmap_index_position(struct bitmap_index *index,
+				 const unsigned char *sha1, uint32_t *result)
+{
+	struct revindex_entry *entry;
+	off_t offset;
+
+	if (index->midx)
+		return bsearch_midx(sha1, index->midx, result);
+
+	offset = find_pack_entry_one(sha1, index->pack);
+	if (!offset)
+		return 0;
+	entry = find_pack_revindex(index->pack, offset);
+	if (!entry)
+		return 0;
+	*result = entry->nr;
+	return 1;
+}
+
+/*
+ * Return the stored bitmap for the commit "sha1", loading it from the
+ * lookup table if needed, or NULL if the commit has none.
+ */
+static struct stored_bitmap *find_stored_bitmap(const unsigned char *sha1)
+{
+	khiter_t hash_pos;
+	uint32_t commit_idx_pos, lo, hi;
+
+	hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
+	if (hash_pos < kh_end(bitmap_git.bitmaps))
+		return kh_value(bitmap_git.bitmaps, hash_pos);
+
+	if (!bitmap_git.table_lookup ||
+	    !bitmap_index_position(&bitmap_git, sha1, &commit_idx_pos))
+		return NULL;
+
+	lo = 0;
+	hi = bitmap_git.entry_count;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t pos = get_be32(bitmap_git.table_lookup +
+					(size_t)mi * BITMAP_LOOKUP_TABLE_ROW_SIZE);
+
+		if (pos == commit_idx_pos)
+			return load_bitmap_row(&bitmap_git, mi, 0);
+		if (pos > commit_idx_pos)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return NULL;
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	size_t len;
@@ -284,6 +462,7 @@ static int open_pack_bitmap_1(struct packed_git *packfile)
 	}
 
 	bitmap_git.pack = packfile;
+	bitmap_git.num_objects = packfile->num_objects;
 	bitmap_git.map_size = xsize_t(st.st_size);
 	bitmap_git.map = xmmap(NULL, bitmap_git.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	bitmap_git.map_pos = 0;
@@ -293,6 +472,64 @@ static int open_pack_bitmap_1(struct packed_git *packfile)
 		munmap(bitmap_git.map, bitmap_git.map_size);
 		bitmap_git.map = NULL;
 		bitmap_git.map_size = 0;
+		bitmap_git.pack = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int open_midx_bitmap(void)
+{
+	int fd;
+	struct stat st;
+	char *bitmap_name;
+	struct multi_pack_index *m;
+
+	if (!multi_pack_index_enabled())
+		return -1;
+
+	/*
+	 * Keep a private copy of the multi-pack-index, so that it stays
+	 * valid while the packs are re-scanned; the packs themselves are
+	 * never freed.
+	 */
+	m = load_multi_pack_index(get_object_directory(), 1);
+	if (!m)
+		return -1;
+
+	bitmap_name = get_midx_bitmap_filename(m->object_dir);
+	fd = git_open(bitmap_name);
+	free(bitmap_name);
+
+	if (fd < 0 || resolve_midx_packs(m)) {
+		if (fd >= 0)
+			close(fd);
+		close_midx(m);
+		return -1;
+	}
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		close_midx(m);
+		return -1;
+	}
+
+	bitmap_git.midx = m;
+	bitmap_git.num_objects = m->num_objects;
+	bitmap_git.map_size = xsize_t(st.st_size);
+	bitmap_git.map = xmmap(NULL, bitmap_git.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git.map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(&bitmap_git) < 0) {
+		munmap(bitmap_git.map, bitmap_git.map_size);
+		bitmap_git.map = NULL;
+		bitmap_git.map_size = 0;
+		bitmap_git.midx = NULL;
+		bitmap_git.midx_order = NULL;
+		bitmap_git.hashes = NULL;
+		close_midx(m);
 		return -1;
 	}
 
@@ -305,7 +542,22 @@ static int load_pack_bitmap(void)
 
 	bitmap_git.bitmaps = kh_init_sha1();
 	bitmap_git.ext_index.positions = kh_init_sha1_pos();
-	load_pack_revindex(bitmap_git.pack);
+
+	if (bitmap_git.midx) {
+		uint32_t i;
+
+		ALLOC_ARRAY(bitmap_git.midx_bit_pos, bitmap_git.num_objects);
+		for (i = 0; i < bitmap_git.num_objects; i++) {
+			uint32_t n = get_be32(bitmap_git.midx_order + 4 * i);
+
+			if (n >= bitmap_git.num_objects) {
+				error("Corrupted bitmap index (bad object order)");
+				goto failed;
+			}
+			bitmap_git.midx_bit_pos[n] = i;
+		}
+	} else
+		load_pack_revindex(bitmap_git.pack);
 
 	if (!(bitmap_git.commits = read_bitmap_1(&bitmap_git)) ||
 		!(bitmap_git.trees = read_bitmap_1(&bitmap_git)) ||
@@ -313,7 +565,7 @@ static int load_pack_bitmap(void)
 		!(bitmap_git.tags = read_bitmap_1(&bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(&bitmap_git) < 0)
+	if (!bitmap_git.table_lookup && load_bitmap_entries_v1(&bitmap_git) < 0)
 		goto failed;
 
 	bitmap_git.loaded = 1;
@@ -334,6 +586,9 @@ static int open_pack_bitmap(void)
 	assert(!bitmap_git.map && !bitmap_git.loaded);
 
 	prepare_packed_git();
+	if (!open_midx_bitmap())
+		return 0;
+
 	for (p = packed_git; p; p = p->next) {
 		if (open_pack_bitmap_1(p) == 0)
 			ret = 0;
@@ -365,7 +620,7 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git.pack->num_objects;
+		return bitmap_pos + bitmap_git.num_objects;
 	}
 
 	return -1;
@@ -373,7 +628,17 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 
 static inline int bitmap_position_packfile(const unsigned char *sha1)
 {
-	off_t offset = find_pack_entry_one(sha1, bitmap_git.pack);
+	off_t offset;
+
+	if (bitmap_git.midx) {
+		uint32_t pos;
+
+		if (!bsearch_midx(sha1, bitmap_git.midx, &pos))
+			return -1;
+		return bitmap_git.midx_bit_pos[pos];
+	}
+
+	offset = find_pack_entry_one(sha1, bitmap_git.pack);
 	if (!offset)
 		return -1;
 
@@ -411,7 +676,7 @@ static int ext_index_add_object(struct object *object, const char *name)
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git.pack->num_objects;
+	return bitmap_pos + bitmap_git.num_objects;
 }
 
 static void show_object(struct object *object, const char *name, void *data)
@@ -435,7 +700,7 @@ static int add_to_include_set(struct include_data *data,
 			      const unsigned char *sha1,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct stored_bitmap *st;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -443,9 +708,8 @@ static int add_to_include_set(struct include_data *data,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
-	if (hash_pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, hash_pos);
+	st = find_stored_bitmap(sha1);
+	if (st) {
 		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
 		return 0;
 	}
@@ -499,10 +763,9 @@ static struct bitmap *find_objects(struct rev_info *revs,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, object->oid.hash);
+			struct stored_bitmap *st = find_stored_bitmap(object->oid.hash);
 
-			if (pos < kh_end(bitmap_git.bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
+			if (st) {
 				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
 
 				if (base == NULL)
@@ -582,7 +845,7 @@ static void show_extended_objects(struct bitmap *objects,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git.pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_git.num_objects + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -590,6 +853,33 @@ static void show_extended_objects(struct bitmap *objects,
 	}
 }
 
+/*
+ * Find the object at position "pos" of the bitmap, along with its
+ * position in the pack index (or multi-pack-index) and where it is
+ * stored.
+ */
+static const unsigned char *nth_bitmap_object(uint32_t pos, uint32_t *nr,
+					      struct packed_git **pack,
+					      off_t *offset)
+{
+	if (bitmap_git.midx) {
+		struct multi_pack_index *m = bitmap_git.midx;
+		uint32_t n = get_be32(bitmap_git.midx_order + 4 * pos);
+
+		*nr = n;
+		*pack = m->packs[nth_midxed_pack_int_id(m, n)];
+		*offset = nth_midxed_offset(m, n);
+		return nth_midxed_object_sha1(m, n);
+	} else {
+		struct revindex_entry *entry = &bitmap_git.pack->revindex[pos];
+
+		*nr = entry->nr;
+		*pack = bitmap_git.pack;
+		*offset = entry->offset;
+		return nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+	}
+}
+
 static void show_objects_for_type(
 	struct bitmap *objects,
 	struct ewah_bitmap *type_filter,
@@ -602,7 +892,7 @@ static void show_objects_for_type(
 	struct ewah_iterator it;
 	eword_t filter;
 
-	if (bitmap_git.reuse_objects == bitmap_git.pack->num_objects)
+	if (bitmap_git.reuse_objects == bitmap_git.num_objects)
 		return;
 
 	ewah_iterator_init(&it, type_filter);
@@ -612,8 +902,9 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			const unsigned char *sha1;
-			struct revindex_entry *entry;
-			uint32_t hash = 0;
+			struct packed_git *pack;
+			off_t obj_offset;
+			uint32_t nr, hash = 0;
 
 			if ((word >> offset) == 0)
 				break;
@@ -623,13 +914,12 @@ static void show_objects_for_type(
 			if (pos + offset < bitmap_git.reuse_objects)
 				continue;
 
-			entry = &bitmap_git.pack->revindex[pos + offset];
-			sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+			sha1 = nth_bitmap_object(pos + offset, &nr, &pack, &obj_offset);
 
 			if (bitmap_git.hashes)
-				hash = ntohl(bitmap_git.hashes[entry->nr]);
+				hash = ntohl(bitmap_git.hashes[nr]);
 
-			show_reach(sha1, object_type, 0, hash, bitmap_git.pack, entry->offset);
+			show_reach(sha1, object_type, 0, hash, pack, obj_offset);
 		}
 
 		pos += BITS_IN_EWORD;
@@ -643,7 +933,11 @@ static int in_bitmapped_pack(struct object_list *roots)
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git.pack) > 0)
+		if (bitmap_git.midx) {
+			uint32_t pos;
+			if (bsearch_midx(object->oid.hash, bitmap_git.midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git.pack) > 0)
 			return 1;
 	}
 
@@ -758,6 +1052,13 @@ int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 
 	assert(result);
 
+	/*
+	 * The objects of a multi-pack-index bitmap are spread over
+	 * several packs, none of which can be sent verbatim.
+	 */
+	if (bitmap_git.midx)
+		return -1;
+
 	for (i = 0; i < result->word_alloc; ++i) {
 		if (result->words[i] != (eword_t)~0) {
 			reuse_objects += ewah_bit_ctz64(~result->words[i]);
@@ -859,7 +1160,7 @@ static uint32_t count_object_type(struct bitmap *objects,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git.pack->num_objects + i))
+			bitmap_get(objects, bitmap_git.num_objects + i))
 			count++;
 	}
 
@@ -921,7 +1222,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct stored_bitmap *st;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 
@@ -935,10 +1236,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git.version, bitmap_git.entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_sha1(bitmap_git.bitmaps, root->oid.hash);
+	st = find_stored_bitmap(root->oid.hash);
 
-	if (pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
+	if (st) {
 		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
 
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
@@ -1022,16 +1322,24 @@ int rebuild_existing_bitmaps(struct packing_data *mapping,
 	if (prepare_bitmap_git() < 0)
 		return -1;
 
-	num_objects = bitmap_git.pack->num_objects;
+	/* every bitmap is needed, so load the ones not loaded yet */
+	if (bitmap_git.table_lookup) {
+		for (i = 0; i < bitmap_git.entry_count; i++)
+			if (!load_bitmap_row(&bitmap_git, i, 0))
+				return -1;
+	}
+
+	num_objects = bitmap_git.num_objects;
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
+		struct packed_git *pack;
 		struct object_entry *oe;
+		off_t offset;
+		uint32_t nr;
 
-		entry = &bitmap_git.pack->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_bitmap_object(i, &nr, &pack, &offset);
 		oe = packlist_find(mapping, sha1, NULL);
 
 		if (oe)
@@ -20,8 +20,14 @@ static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_OBJECT_ORDER = 8,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
 };
 
+/* Size of a row of the lookup table, and its "no XOR base" marker. */
+#define BITMAP_LOOKUP_TABLE_ROW_SIZE 16
+#define BITMAP_NO_XOR_ROW 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
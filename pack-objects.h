@@ -48,6 +48,13 @@ struct packing_data {
 
 	int32_t *index;
 	uint32_t index_size;
+
+	/*
+	 * Depth of each tree object below the root tree it was reached
+	 * from, indexed like "objects"; only allocated when delta islands
+	 * are in use.
+	 */
+	unsigned int *tree_depth;
 };
 
 struct object_entry *packlist_alloc(struct packing_data *pdata,
@@ -0,0 +1,459 @@
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "pkt-line.h"
+#include "run-command.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+struct pc_worker {
+	struct child_process cp;
+};
+
+struct parallel_checkout {
+	enum pc_status status;
+	struct parallel_checkout_item *items; /* The parallel checkout queue */
+	size_t nr, alloc;
+};
+
+static struct parallel_checkout parallel_checkout;
+
+enum pc_status parallel_checkout_status(void)
+{
+	return parallel_checkout.status;
+}
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	const char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	if (env_workers && *env_workers) {
+		if (strtol_i(env_workers, 10, num_workers))
+			die("invalid value for GIT_TEST_CHECKOUT_WORKERS: '%s'",
+			    env_workers);
+		if (*num_workers < 1)
+			*num_workers = online_cpus();
+
+		*threshold = 0;
+		return;
+	}
+
+	if (git_config_get_int("checkout.workers", num_workers))
+		*num_workers = 1;
+	else if (*num_workers < 1)
+		*num_workers = online_cpus();
+
+	if (git_config_get_int("checkout.thresholdForParallelism", threshold))
+		*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		die("BUG: parallel checkout already initialized");
+
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		die("BUG: cannot finish parallel checkout: not initialized yet");
+
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+int enqueue_checkout(struct cache_entry *ce)
+{
+	struct parallel_checkout_item *pc_item;
+	struct conv_attrs ca;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES ||
+	    !S_ISREG(ce->ce_mode))
+		return -1;
+
+	/*
+	 * Filter drivers run external commands, which are better left
+	 * to the main process (and cannot be described to a worker).
+	 */
+	convert_attrs(&ca, ce->name);
+	if (ca.drv)
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+
+	pc_item = &parallel_checkout.items[parallel_checkout.nr];
+	pc_item->ce = ce;
+	memcpy(&pc_item->ca, &ca, sizeof(pc_item->ca));
+	pc_item->status = PC_ITEM_PENDING;
+	pc_item->id = parallel_checkout.nr;
+	parallel_checkout.nr++;
+
+	return 0;
+}
+
+static int handle_results(struct checkout *state)
+{
+	int ret = 0;
+	size_t i;
+	int have_pending = 0, have_collisions = 0;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+		struct cache_entry *ce = pc_item->ce;
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			if (state->refresh_cache) {
+				assert(state->istate);
+				fill_stat_cache_info(ce, &pc_item->st);
+				ce->ce_flags |= CE_UPDATE_IN_BASE;
+				state->istate->cache_changed |= CE_ENTRY_CHANGED;
+			}
+			break;
+		case PC_ITEM_COLLIDED:
+			have_collisions = 1;
+			break;
+		case PC_ITEM_PENDING:
+			have_pending = 1;
+			/* fall through */
+		case PC_ITEM_FAILED:
+			ret = -1;
+			break;
+		default:
+			die("BUG: unknown checkout item status in parallel checkout");
+		}
+	}
+
+	if (have_pending)
+		error("parallel checkout finished with pending entries");
+
+	/*
+	 * The colliding entries are written sequentially, and in the
+	 * same order as they would have been without parallel checkout.
+	 * checkout_entry() takes care of removing whatever is in the way.
+	 */
+	if (have_collisions) {
+		for (i = 0; i < parallel_checkout.nr; i++) {
+			struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+			if (pc_item->status == PC_ITEM_COLLIDED &&
+			    checkout_entry(pc_item->ce, state, NULL))
+				ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+static int reset_fd(int fd, const char *path)
+{
+	if (lseek(fd, 0, SEEK_SET) != 0)
+		return error_errno("failed to rewind descriptor of '%s'", path);
+	if (ftruncate(fd, 0))
+		return error_errno("failed to truncate file '%s'", path);
+	return 0;
+}
+
+static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
+			       const char *path)
+{
+	struct cache_entry *ce = pc_item->ce;
+	struct stream_filter *filter;
+	struct strbuf buf = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	size_t newsize = 0;
+	ssize_t wrote;
+	char *new;
+
+	filter = get_stream_filter_ca(&pc_item->ca, ce->oid.hash);
+	if (filter) {
+		if (!stream_blob_to_fd(fd, &ce->oid, filter, 1))
+			return 0;
+		/* Try again without streaming */
+		if (reset_fd(fd, path))
+			return -1;
+	}
+
+	new = read_sha1_file(ce->oid.hash, &type, &size);
+	if (!new || type != OBJ_BLOB) {
+		free(new);
+		return error("unable to read sha1 file of %s (%s)",
+			     path, oid_to_hex(&ce->oid));
+	}
+
+	if (convert_to_working_tree_ca(&pc_item->ca, ce->name, new, size, &buf)) {
+		free(new);
+		new = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	wrote = write_in_full(fd, new, size);
+	free(new);
+	if (wrote != size)
+		return error("unable to write file %s", path);
+
+	return 0;
+}
+
+/*
+ * The leading directories were created by checkout_entry() when the
+ * entry was queued, but an entry written in the meantime (say, a
+ * symlink whose name only differs in case on a case-insensitive
+ * filesystem) may have replaced one of them since.
+ */
+static int check_leading_dirs(const char *path, int len)
+{
+	const char *slash = path + len;
+
+	while (slash > path && *slash != '/')
+		slash--;
+	return slash == path || has_dirs_only_path(path, slash - path, 0);
+}
+
+void write_pc_item(struct parallel_checkout_item *pc_item)
+{
+	struct cache_entry *ce = pc_item->ce;
+	const char *path = ce->name;
+	int fd;
+
+	if (!check_leading_dirs(path, ce_namelen(ce))) {
+		pc_item->status = PC_ITEM_COLLIDED;
+		return;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL,
+		  (ce->ce_mode & 0100) ? 0777 : 0666);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == EISDIR) {
+			pc_item->status = PC_ITEM_COLLIDED;
+		} else {
+			error_errno("unable to create file %s", path);
+			pc_item->status = PC_ITEM_FAILED;
+		}
+		return;
+	}
+
+	if (write_pc_item_to_fd(pc_item, fd, path)) {
+		close(fd);
+		unlink(path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+
+	/* use fstat() when we can, as write_entry() does */
+	if (fstat_is_reliable() && fstat(fd, &pc_item->st)) {
+		error_errno("unable to stat just-written file %s", path);
+		close(fd);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+	if (close(fd)) {
+		error_errno("unable to close file %s", path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+	if (!fstat_is_reliable() && lstat(path, &pc_item->st)) {
+		error_errno("unable to stat just-written file %s", path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+
+	pc_item->status = PC_ITEM_WRITTEN;
+}
+
+static void write_items_sequentially(void)
+{
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++)
+		write_pc_item(&parallel_checkout.items[i]);
+}
+
+static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
+{
+	struct pc_item_fixed_portion fixed_portion;
+	size_t name_len = ce_namelen(pc_item->ce);
+	char *data;
+
+	if (sizeof(fixed_portion) + name_len > LARGE_PACKET_DATA_MAX)
+		die("path too long for parallel checkout: '%s'",
+		    pc_item->ce->name);
+
+	memset(&fixed_portion, 0, sizeof(fixed_portion));
+	fixed_portion.id = pc_item->id;
+	oidcpy(&fixed_portion.oid, &pc_item->ce->oid);
+	fixed_portion.ce_mode = pc_item->ce->ce_mode;
+	fixed_portion.crlf_action = pc_item->ca.crlf_action;
+	fixed_portion.ident = pc_item->ca.ident;
+	fixed_portion.name_len = name_len;
+
+	data = xmalloc(sizeof(fixed_portion) + name_len);
+	memcpy(data, &fixed_portion, sizeof(fixed_portion));
+	memcpy(data + sizeof(fixed_portion), pc_item->ce->name, name_len);
+	packet_write(fd, data, sizeof(fixed_portion) + name_len);
+	free(data);
+}
+
+/*
+ * Each worker is given small chunks of consecutive entries in turn, so
+ * that the entries of one directory mostly end up in the same worker
+ * while large and small files are still spread over all of them.
+ */
+#define CHUNKS_PER_WORKER 10
+
+static struct pc_worker *setup_workers(int num_workers)
+{
+	struct pc_worker *workers;
+	size_t i, chunk_size;
+
+	ALLOC_ARRAY(workers, num_workers);
+
+	for (i = 0; i < num_workers; i++) {
+		struct child_process *cp = &workers[i].cp;
+
+		child_process_init(cp);
+		cp->git_cmd = 1;
+		cp->in = -1;
+		cp->out = -1;
+		cp->clean_on_exit = 1;
+		argv_array_push(&cp->args, "checkout--worker");
+
+		if (start_command(cp))
+			die(_("failed to spawn checkout worker"));
+	}
+
+	chunk_size = DIV_ROUND_UP(parallel_checkout.nr,
+				  num_workers * CHUNKS_PER_WORKER);
+
+	/*
+	 * The workers read all of their items before they start writing
+	 * results, so we cannot deadlock with them here.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct pc_worker *worker = &workers[(i / chunk_size) % num_workers];
+
+		send_one_item(worker->cp.in, &parallel_checkout.items[i]);
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		packet_flush(workers[i].cp.in);
+		close(workers[i].cp.in);
+		workers[i].cp.in = -1;
+	}
+
+	return workers;
+}
+
+static void finish_workers(struct pc_worker *workers, int num_workers)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++) {
+		close(workers[i].cp.out);
+		if (finish_command(&workers[i].cp))
+			error(_("checkout worker %d finished with error"), i);
+	}
+
+	free(workers);
+}
+
+static void parse_and_save_result(const char *buffer, int len)
+{
+	struct pc_item_result res;
+	struct parallel_checkout_item *pc_item;
+
+	if (len != sizeof(res))
+		die("BUG: unexpected result size from checkout worker "
+		    "(got %d, expected %d)", len, (int)sizeof(res));
+
+	memcpy(&res, buffer, sizeof(res));
+	if (res.id >= parallel_checkout.nr)
+		die("BUG: checkout worker sent unknown item id %"PRIuMAX,
+		    (uintmax_t)res.id);
+
+	pc_item = &parallel_checkout.items[res.id];
+	pc_item->status = res.status;
+	if (res.status == PC_ITEM_WRITTEN)
+		memcpy(&pc_item->st, &res.st, sizeof(pc_item->st));
+}
+
+static void gather_results(struct pc_worker *workers, int num_workers)
+{
+	int i, active_workers = num_workers;
+	struct pollfd *pfds;
+
+	ALLOC_ARRAY(pfds, num_workers);
+	for (i = 0; i < num_workers; i++) {
+		pfds[i].fd = workers[i].cp.out;
+		pfds[i].events = POLLIN;
+	}
+
+	while (active_workers) {
+		int nr = poll(pfds, num_workers, -1);
+
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("failed to poll checkout workers");
+		}
+
+		for (i = 0; i < num_workers && nr > 0; i++) {
+			struct pollfd *pfd = &pfds[i];
+			int len;
+
+			if (!pfd->revents)
+				continue;
+			nr--;
+
+			if (pfd->revents & POLLIN) {
+				len = packet_read(pfd->fd, NULL, NULL,
+						  packet_buffer,
+						  sizeof(packet_buffer),
+						  PACKET_READ_GENTLE_ON_EOF);
+				if (len > 0) {
+					parse_and_save_result(packet_buffer, len);
+					continue;
+				}
+				/* a flush or EOF: this worker is done */
+			} else if (!(pfd->revents & (POLLHUP | POLLERR))) {
+				continue;
+			}
+
+			pfd->fd = -1;
+			active_workers--;
+		}
+	}
+
+	free(pfds);
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers, int threshold)
+{
+	int ret;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		die("BUG: cannot run parallel checkout: uninitialized or already running");
+
+	parallel_checkout.status = PC_RUNNING;
+
+	if (parallel_checkout.nr < num_workers)
+		num_workers = parallel_checkout.nr;
+
+	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
+		write_items_sequentially();
+	} else {
+		struct pc_worker *workers = setup_workers(num_workers);
+		gather_results(workers, num_workers);
+		finish_workers(workers, num_workers);
+	}
+
+	ret = handle_results(state);
+
+	finish_parallel_checkout();
+	return ret;
+}
@@ -0,0 +1,106 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+#include "cache.h"
+#include "convert.h"
+
+/****************************************************************
+ * Users of parallel checkout
+ ****************************************************************/
+
+enum pc_status {
+	PC_UNINITIALIZED = 0,
+	PC_ACCEPTING_ENTRIES,
+	PC_RUNNING
+};
+
+enum pc_status parallel_checkout_status(void);
+
+/*
+ * Read the checkout.workers and checkout.thresholdForParallelism
+ * settings (or GIT_TEST_CHECKOUT_WORKERS).
+ */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * Start accepting entries: from now on checkout_entry() queues the
+ * regular files it would write, instead of writing them itself, until
+ * run_parallel_checkout() is called.
+ */
+void init_parallel_checkout(void);
+
+/*
+ * Queue a regular file for the parallel checkout. Returns 0 when the
+ * entry was queued, or -1 when parallel checkout is not accepting
+ * entries or the entry is not eligible for it (e.g. because it needs
+ * a smudge filter); the caller must then write it out itself.
+ */
+int enqueue_checkout(struct cache_entry *ce);
+
+/*
+ * Write out all the queued entries, using `num_workers` checkout--worker
+ * processes if there are at least `threshold` of them, and fill in their
+ * stat data in state->istate. Entries which could not be written by the
+ * workers because of a path collision are written sequentially at the
+ * end. Returns 0 on success and -1 if any entry failed.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers, int threshold);
+
+/****************************************************************
+ * Interface with checkout--worker
+ ****************************************************************/
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/*
+	 * The entry could not be written because there was another file
+	 * already present in its path or a leading directory of it was
+	 * replaced. It is retried sequentially after the workers are done.
+	 */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED
+};
+
+struct parallel_checkout_item {
+	/*
+	 * In the main process this points into istate->cache[]; the
+	 * workers allocate their own copy.
+	 */
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	size_t id; /* position in the main process' queue */
+
+	/* Output fields, sent back by the workers */
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * The fixed-size portion of an item as it is sent to a worker, in one
+ * packet together with the path of the entry which follows it.
+ */
+struct pc_item_fixed_portion {
+	size_t id;
+	struct object_id oid;
+	unsigned int ce_mode;
+	enum crlf_action crlf_action;
+	int ident;
+	size_t name_len;
+};
+
+/* The result of an item, as sent back by a worker */
+struct pc_item_result {
+	size_t id;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * Write the item's blob to its path in the working tree, which must not
+ * exist yet, and record the outcome and the stat data of the new file
+ * in the item.
+ */
+void write_pc_item(struct parallel_checkout_item *pc_item);
+
+#endif /* PARALLEL_CHECKOUT_H */
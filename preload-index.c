@@ -4,6 +4,9 @@
 #include "cache.h"
 #include "pathspec.h"
 #include "dir.h"
+#include "fsmonitor.h"
+#include "convert.h"
+#include "object.h"
 
 #ifdef NO_PTHREADS
 static void preload_index(struct index_state *index,
@@ -24,13 +27,52 @@ static void preload_index(struct index_state *index,
 #define MAX_PARALLEL (20)
 #define THREAD_COST (500)
 
+/*
+ * Likewise for comparing contents: reading and hashing a file costs
+ * much more than an lstat, but a thread still has to be given a few
+ * of them to be worth starting.
+ */
+#define CONTENT_THREAD_COST (16)
+
+static struct trace_key trace_preload_contents = TRACE_KEY_INIT(PRELOAD_CONTENTS);
+
+/*
+ * An entry whose stat data changed, or is racily clean, while its
+ * contents may still be the same, as found by preload_thread().
+ */
+struct content_check {
+	struct cache_entry *ce;
+	struct stat st;
+	int unchanged;
+};
+
 struct thread_data {
 	pthread_t pthread;
 	struct index_state *index;
 	struct pathspec pathspec;
 	int offset, nr;
+	int fsmonitor_changed;
+	struct content_check *checks;
+	int checks_nr, checks_alloc;
 };
 
+/*
+ * Whether refresh_cache_ent() would compare the contents of the file
+ * with the blob to tell if it changed (see ie_modified()): for a
+ * regular file, when only its size may tell, if it is racily clean,
+ * or if the index has no size for it.
+ */
+static int needs_content_check(const struct cache_entry *ce,
+			       const struct stat *st, int changed)
+{
+	if (!S_ISREG(ce->ce_mode) || !S_ISREG(st->st_mode))
+		return 0;
+	if (changed & (MODE_CHANGED | TYPE_CHANGED))
+		return 0;
+	return !ce->ce_stat_data.sd_size ||
+		ce->ce_stat_data.sd_size == (unsigned int)st->st_size;
+}
+
 static void *preload_thread(void *_data)
 {
 	int nr;
@@ -46,6 +88,7 @@ static void *preload_thread(void *_data)
 	do {
 		struct cache_entry *ce = *cep++;
 		struct stat st;
+		int changed;
 
 		if (ce_stage(ce))
 			continue;
@@ -55,20 +98,156 @@ static void *preload_thread(void *_data)
 			continue;
 		if (ce_skip_worktree(ce))
 			continue;
+		if (ce->ce_flags & CE_FSMONITOR_VALID) {
+			ce_mark_uptodate(ce);
+			continue;
+		}
 		if (!ce_path_match(ce, &p->pathspec, NULL))
 			continue;
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
 		if (lstat(ce->name, &st))
 			continue;
-		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
+		changed = ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY);
+		if (changed) {
+			if (needs_content_check(ce, &st, changed)) {
+				ALLOC_GROW(p->checks, p->checks_nr + 1,
+					   p->checks_alloc);
+				p->checks[p->checks_nr].ce = ce;
+				p->checks[p->checks_nr].st = st;
+				p->checks[p->checks_nr].unchanged = 0;
+				p->checks_nr++;
+			}
 			continue;
+		}
 		ce_mark_uptodate(ce);
+		/*
+		 * Other threads work on the same index_state, so leave
+		 * marking it as changed to the main thread.
+		 */
+		if (core_fsmonitor) {
+			ce->ce_flags |= CE_FSMONITOR_VALID;
+			p->fsmonitor_changed = 1;
+		}
 	} while (--nr > 0);
 	cache_def_clear(&cache);
 	return NULL;
 }
 
+/*
+ * Hash the file like index_fd() would without any conversion, reading
+ * it in chunks; the size is the one lstat() saw.
+ */
+static int content_unchanged(const struct cache_entry *ce, const struct stat *st)
+{
+	char hdr[32], buf[65536];
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+	size_t left = xsize_t(st->st_size);
+	int fd, hdrlen;
+
+	fd = git_open_cloexec(ce->name, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
+			   typename(OBJ_BLOB), (uintmax_t)left) + 1;
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, hdr, hdrlen);
+	while (left) {
+		ssize_t n = xread(fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+
+		if (n <= 0)
+			break;
+		git_SHA1_Update(&c, buf, n);
+		left -= n;
+	}
+	close(fd);
+	if (left)
+		return 0;
+	git_SHA1_Final(sha1, &c);
+	return !hashcmp(sha1, ce->oid.hash);
+}
+
+struct content_thread_data {
+	pthread_t pthread;
+	struct content_check *checks;
+	int nr;
+};
+
+static void *content_check_thread(void *_data)
+{
+	struct content_thread_data *p = _data;
+	int i;
+
+	for (i = 0; i < p->nr; i++)
+		p->checks[i].unchanged = content_unchanged(p->checks[i].ce,
+							   &p->checks[i].st);
+	return NULL;
+}
+
+/*
+ * Compare the contents of the files found by the threads with their
+ * blobs, in parallel again, so that refresh_index() does not have to
+ * hash them one after the other. Only files that are stored without
+ * any conversion are handled here; deciding that needs the attributes,
+ * which is done up front by the main thread.
+ */
+static void preload_contents(struct index_state *index,
+			     struct thread_data *data, int nr_data)
+{
+	struct content_thread_data threads[MAX_PARALLEL];
+	struct content_check *checks = NULL;
+	int i, j, nr = 0, alloc = 0, nr_threads, work, offset;
+
+	for (i = 0; i < nr_data; i++) {
+		struct thread_data *p = data + i;
+
+		for (j = 0; j < p->checks_nr; j++) {
+			if (would_convert_to_git(p->checks[j].ce->name))
+				continue;
+			ALLOC_GROW(checks, nr + 1, alloc);
+			checks[nr++] = p->checks[j];
+		}
+		free(p->checks);
+	}
+
+	/* A few files are left to refresh_index() */
+	nr_threads = nr / CONTENT_THREAD_COST;
+	if (nr_threads < 2) {
+		free(checks);
+		return;
+	}
+	if (nr_threads > MAX_PARALLEL)
+		nr_threads = MAX_PARALLEL;
+	work = DIV_ROUND_UP(nr, nr_threads);
+	for (i = offset = 0; i < nr_threads && offset < nr; i++, offset += work) {
+		struct content_thread_data *p = threads + i;
+
+		p->checks = checks + offset;
+		p->nr = offset + work > nr ? nr - offset : work;
+		if (pthread_create(&p->pthread, NULL, content_check_thread, p))
+			die("unable to create threaded content check");
+	}
+	nr_threads = i;
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die("unable to join threaded content check");
+	trace_printf_key(&trace_preload_contents,
+			 "compared %d files in %d threads\n", nr, nr_threads);
+
+	/* Record what refresh_cache_ent() would for a clean file */
+	for (i = 0; i < nr; i++) {
+		struct cache_entry *ce = checks[i].ce;
+
+		if (!checks[i].unchanged)
+			continue;
+		fill_stat_cache_info(ce, &checks[i].st);
+		ce->ce_flags |= CE_UPDATE_IN_BASE;
+		index->cache_changed |= CE_ENTRY_CHANGED;
+	}
+	free(checks);
+}
+
 static void preload_index(struct index_state *index,
 			  const struct pathspec *pathspec)
 {
@@ -101,7 +280,10 @@ static void preload_index(struct index_state *index,
 		struct thread_data *p = data+i;
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
+		if (p->fsmonitor_changed)
+			index->cache_changed |= FSMONITOR_CHANGED;
 	}
+	preload_contents(index, data, threads);
 }
 #endif
 
@@ -18,6 +18,10 @@
 #include "varint.h"
 #include "split-index.h"
 #include "utf8.h"
+#include "thread-utils.h"
+#include "fsmonitor.h"
+#include "sparse-index.h"
+#include "ewah/ewok.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -37,11 +41,15 @@
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
 #define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
 #define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
+#define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
 		 CE_ENTRY_ADDED | CE_ENTRY_REMOVED | CE_ENTRY_CHANGED | \
-		 SPLIT_INDEX_ORDERED | UNTRACKED_CHANGED)
+		 SPLIT_INDEX_ORDERED | UNTRACKED_CHANGED | FSMONITOR_CHANGED)
 
 struct index_state the_index;
 static const char *alternate_index_output;
@@ -149,8 +157,11 @@ void fill_stat_cache_info(struct cache_entry *ce, struct stat *st)
 	if (assume_unchanged)
 		ce->ce_flags |= CE_VALID;
 
-	if (S_ISREG(st->st_mode))
+	if (S_ISREG(st->st_mode)) {
 		ce_mark_uptodate(ce);
+		if (core_fsmonitor)
+			ce->ce_flags |= CE_FSMONITOR_VALID;
+	}
 }
 
 static int ce_compare_data(const struct cache_entry *ce, struct stat *st)
@@ -307,6 +318,7 @@ int ie_match_stat(const struct index_state *istate,
 	int ignore_valid = options & CE_MATCH_IGNORE_VALID;
 	int ignore_skip_worktree = options & CE_MATCH_IGNORE_SKIP_WORKTREE;
 	int assume_racy_is_modified = options & CE_MATCH_RACY_IS_DIRTY;
+	int ignore_fsmonitor = options & CE_MATCH_IGNORE_FSMONITOR;
 
 	/*
 	 * If it's marked as always valid in the index, it's
@@ -318,6 +330,8 @@ int ie_match_stat(const struct index_state *istate,
 		return 0;
 	if (!ignore_valid && (ce->ce_flags & CE_VALID))
 		return 0;
+	if (!ignore_fsmonitor && (ce->ce_flags & CE_FSMONITOR_VALID))
+		return 0;
 
 	/*
 	 * Intent-to-add entries have not been added, so the index entry
@@ -631,7 +645,7 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 	int size, namelen, was_same;
 	mode_t st_mode = st->st_mode;
 	struct cache_entry *ce, *alias;
-	unsigned ce_option = CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE|CE_MATCH_RACY_IS_DIRTY;
+	unsigned ce_option = CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE|CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR;
 	int verbose = flags & (ADD_CACHE_VERBOSE | ADD_CACHE_PRETEND);
 	int pretend = flags & ADD_CACHE_PRETEND;
 	int intent_only = flags & ADD_CACHE_INTENT;
@@ -1163,7 +1177,7 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 
 	if (!ok_to_add)
 		return -1;
-	if (!verify_path(ce->name))
+	if (!S_ISSPARSEDIR(ce->ce_mode) && !verify_path(ce->name))
 		return error("Invalid path '%s'", ce->name);
 
 	if (!skip_df_check &&
@@ -1228,10 +1242,20 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	int ignore_valid = options & CE_MATCH_IGNORE_VALID;
 	int ignore_skip_worktree = options & CE_MATCH_IGNORE_SKIP_WORKTREE;
 	int ignore_missing = options & CE_MATCH_IGNORE_MISSING;
+	int ignore_fsmonitor = options & CE_MATCH_IGNORE_FSMONITOR;
 
 	if (!refresh || ce_uptodate(ce))
 		return ce;
 
+	/*
+	 * The filesystem monitor has not reported any change to the
+	 * path since the entry was last found to be up to date.
+	 */
+	if (!ignore_fsmonitor && (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
+
 	/*
 	 * CE_VALID or CE_SKIP_WORKTREE means the user promised us
 	 * that the change to the work tree does not matter and told
@@ -1282,8 +1306,10 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 * because CE_UPTODATE flag is in-core only;
 			 * we are not going to write this change out.
 			 */
-			if (!S_ISGITLINK(ce->ce_mode))
+			if (!S_ISGITLINK(ce->ce_mode)) {
 				ce_mark_uptodate(ce);
+				mark_fsmonitor_valid(istate, ce);
+			}
 			return ce;
 		}
 	}
@@ -1337,6 +1363,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	int in_porcelain = (flags & REFRESH_IN_PORCELAIN);
 	unsigned int options = (CE_MATCH_REFRESH |
 				(really ? CE_MATCH_IGNORE_VALID : 0) |
+				(really ? CE_MATCH_IGNORE_FSMONITOR : 0) |
 				(not_new ? CE_MATCH_IGNORE_MISSING : 0));
 	const char *modified_fmt;
 	const char *deleted_fmt;
@@ -1349,6 +1376,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	typechange_fmt = (in_porcelain ? "T\t%s\n" : "%s needs update\n");
 	added_fmt = (in_porcelain ? "A\t%s\n" : "%s needs update\n");
 	unmerged_fmt = (in_porcelain ? "U\t%s\n" : "%s: needs merge\n");
+	refresh_fsmonitor(istate);
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce, *new;
 		int cache_errno = 0;
@@ -1513,6 +1541,7 @@ static int verify_hdr(struct cache_header *hdr, unsigned long size)
 {
 	git_SHA_CTX c;
 	unsigned char sha1[20];
+	const unsigned char *trailer = (unsigned char *)hdr + size - 20;
 	int hdr_version;
 
 	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
@@ -1521,13 +1550,14 @@ static int verify_hdr(struct cache_header *hdr, unsigned long size)
 	if (hdr_version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < hdr_version)
 		return error("bad index version %d", hdr_version);
 
-	if (!verify_index_checksum)
+	/* A null trailer was written with index.skipHash; nothing to verify. */
+	if (!verify_index_checksum || is_null_sha1(trailer))
 		return 0;
 
 	git_SHA1_Init(&c);
 	git_SHA1_Update(&c, hdr, size - 20);
 	git_SHA1_Final(sha1, &c);
-	if (hashcmp(sha1, (unsigned char *)hdr + size - 20))
+	if (hashcmp(sha1, trailer))
 		return error("bad index file sha1 signature");
 	return 0;
 }
@@ -1549,6 +1579,18 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_UNTRACKED:
 		istate->untracked = read_untracked_extension(data, sz);
 		break;
+	case CACHE_EXT_FSMONITOR:
+		if (read_fsmonitor_extension(istate, data, sz))
+			return -1;
+		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		/* no content, only an indication that the index is sparse */
+		istate->sparse_index = 1;
+		break;
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
+		/* already handled in do_read_index() */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1602,14 +1644,23 @@ static struct cache_entry *cache_entry_from_ondisk(struct ondisk_cache_entry *on
  * number of bytes to be stripped from the end of the previous name,
  * and the bytes to append to the result, to come up with its name.
  */
-static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
+static unsigned long expand_name_field(struct strbuf *name, const char *cp_,
+				       int block_start)
 {
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
-	if (name->len < len)
+	/*
+	 * The first entry of a block of the entry offset table strips
+	 * the whole name of its predecessor, which a reader starting
+	 * at that block has never seen.
+	 */
+	if (block_start)
+		strbuf_reset(name);
+	else if (name->len < len)
 		die("malformed name field in the index");
-	strbuf_remove(name, name->len - len, len);
+	else
+		strbuf_remove(name, name->len - len, len);
 	for (ep = cp; *ep; ep++)
 		; /* find the end */
 	strbuf_add(name, cp, ep - cp);
@@ -1618,7 +1669,8 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 
 static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 					    unsigned long *ent_size,
-					    struct strbuf *previous_name)
+					    struct strbuf *previous_name,
+					    int block_start)
 {
 	struct cache_entry *ce;
 	size_t len;
@@ -1652,7 +1704,7 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 		*ent_size = ondisk_ce_size(ce);
 	} else {
 		unsigned long consumed;
-		consumed = expand_name_field(previous_name, name);
+		consumed = expand_name_field(previous_name, name, block_start);
 		ce = cache_entry_from_ondisk(ondisk, flags,
 					     previous_name->buf,
 					     previous_name->len);
@@ -1721,24 +1773,386 @@ static void post_read_index_from(struct index_state *istate)
 	check_ce_order(istate);
 	tweak_untracked_cache(istate);
 	tweak_split_index(istate);
+	tweak_fsmonitor(istate);
+	istate->write_sparse = istate->sparse_index;
+	if (istate->sparse_index && command_requires_full_index)
+		ensure_full_index(istate);
+}
+
+/*
+ * The "end of index entries" extension (EOIE) records where the
+ * entries end and the extensions begin, so that the extensions can be
+ * parsed without parsing all of the entries first. It is always the
+ * last extension, which lets a reader find it right in front of the
+ * trailing checksum:
+ *
+ *   "EOIE"
+ *   <4-byte length of the extension data (24)>
+ *   <4-byte offset of the first extension>
+ *   <20-byte SHA-1 over the names and sizes of all other extensions>
+ */
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
+
+static size_t read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *eoie;
+	size_t eoie_offset, offset, src_offset;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+	eoie_offset = mmap_size - 20 - EOIE_SIZE_WITH_HEADER;
+	eoie = mmap + eoie_offset;
+	if (CACHE_EXT(eoie) != CACHE_EXT_ENDOFINDEXENTRIES ||
+	    get_be32(eoie + 4) != EOIE_SIZE)
+		return 0;
+
+	offset = get_be32(eoie + 8);
+	if (offset < sizeof(struct cache_header) || offset > eoie_offset)
+		return 0;
+
+	/*
+	 * Walk the extension headers from the recorded offset; they
+	 * have to lead back to the EOIE extension and hash to the
+	 * recorded value, or the offset is not to be trusted.
+	 */
+	git_SHA1_Init(&c);
+	src_offset = offset;
+	while (src_offset + 8 <= eoie_offset) {
+		uint32_t extsize = get_be32(mmap + src_offset + 4);
+
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		src_offset += 8;
+		if (eoie_offset - src_offset < extsize)
+			return 0;
+		src_offset += extsize;
+	}
+	git_SHA1_Final(sha1, &c);
+	if (src_offset != eoie_offset ||
+	    hashcmp(sha1, (const unsigned char *)eoie + 12))
+		return 0;
+
+	return offset;
+}
+
+static void write_eoie_extension(struct strbuf *sb, git_SHA_CTX *eoie_context,
+				 size_t offset)
+{
+	uint32_t buffer;
+	unsigned char sha1[20];
+
+	put_be32(&buffer, offset);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+	git_SHA1_Final(sha1, eoie_context);
+	strbuf_add(sb, sha1, 20);
+}
+
+/*
+ * The "index entry offset table" extension (IEOT) divides the entries
+ * into blocks that can be parsed independently of each other:
+ *
+ *   <4-byte version (1)>
+ *   for each block:
+ *     <4-byte offset of the first entry of the block in the file>
+ *     <4-byte number of entries in the block>
+ *
+ * In a version 4 index the first entry of each block strips the whole
+ * name of the entry preceding it, so that its name can be recovered
+ * without knowing the previous one.
+ */
+#define IEOT_VERSION (1)
+
+struct index_entry_offset {
+	unsigned int offset;
+	unsigned int nr;
+};
+
+struct index_entry_offset_table {
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+static void write_ieot_extension(struct strbuf *sb,
+				 struct index_entry_offset_table *ieot)
+{
+	uint32_t buffer;
+	int i;
+
+	put_be32(&buffer, IEOT_VERSION);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+	for (i = 0; i < ieot->nr; i++) {
+		put_be32(&buffer, ieot->entries[i].offset);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+		put_be32(&buffer, ieot->entries[i].nr);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+	}
+}
+
+/*
+ * Do not bother with threads unless each of them gets at least this
+ * many entries to parse.
+ */
+#define THREAD_COST (10000)
+
+static int record_eoie(void)
+{
+	int val;
+
+	if (!git_config_get_bool("index.recordendofindexentries", &val))
+		return val;
+
+	/*
+	 * Older versions of Git announce each optional extension they
+	 * skip, so only write it by default when threaded index loading
+	 * has been asked for explicitly.
+	 */
+	return !git_config_get_index_threads(&val) && val != 1;
+}
+
+static int record_ieot(void)
+{
+	int val;
+
+	if (!git_config_get_bool("index.recordoffsettable", &val))
+		return val;
+
+	/* Same as for the EOIE extension above. */
+	return !git_config_get_index_threads(&val) && val != 1;
+}
+
+/*
+ * Parse nr entries starting at src_offset into istate->cache[first]
+ * and following. Return the number of bytes consumed.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long src_offset,
+					    int first, int nr,
+					    int block_start)
+{
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	unsigned long start_offset = src_offset;
+	int i;
+
+	if (istate->version == 4)
+		previous_name = &previous_name_buf;
+	else
+		previous_name = NULL;
+
+	for (i = first; i < first + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + src_offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name,
+				      block_start && i == first);
+		set_index_entry(istate, i, ce);
+
+		src_offset += consumed;
+	}
+	strbuf_release(&previous_name_buf);
+	return src_offset - start_offset;
+}
+
+struct load_index_extensions {
+#ifndef NO_PTHREADS
+	pthread_t pthread;
+#endif
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long src_offset;
+	int ret;
+};
+
+static void *load_index_extensions(void *_data)
+{
+	struct load_index_extensions *p = _data;
+	unsigned long src_offset = p->src_offset;
+
+	while (src_offset <= p->mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize = get_be32(p->mmap + src_offset + 4);
+
+		if (read_index_extension(p->istate,
+					 p->mmap + src_offset,
+					 (char *)p->mmap + src_offset + 8,
+					 extsize) < 0) {
+			p->ret = -1;
+			break;
+		}
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return NULL;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Find the IEOT extension among the extensions starting at
+ * extension_offset. Return NULL if there is none or if it does not
+ * describe the entries of this index exactly.
+ */
+static struct index_entry_offset_table *read_ieot_extension(
+		struct index_state *istate, const char *mmap,
+		size_t mmap_size, size_t extension_offset)
+{
+	struct index_entry_offset_table *ieot;
+	const char *index = NULL;
+	uint32_t extsize = 0;
+	unsigned long total = 0, prev = 0;
+	int i, nr;
+
+	while (extension_offset <= mmap_size - 20 - 8) {
+		extsize = get_be32(mmap + extension_offset + 4);
+		if (CACHE_EXT((mmap + extension_offset)) ==
+		    CACHE_EXT_INDEXENTRYOFFSETTABLE) {
+			index = mmap + extension_offset + 8;
+			break;
+		}
+		extension_offset += 8;
+		extension_offset += extsize;
+	}
+	if (!index || extsize < 4 || (extsize - 4) % 8 ||
+	    get_be32(index) != IEOT_VERSION)
+		return NULL;
+	index += 4;
+
+	nr = (extsize - 4) / 8;
+	if (!nr)
+		return NULL;
+	ieot = xmalloc(st_add(sizeof(*ieot),
+			      st_mult(nr, sizeof(struct index_entry_offset))));
+	ieot->nr = nr;
+	for (i = 0; i < nr; i++) {
+		ieot->entries[i].offset = get_be32(index);
+		ieot->entries[i].nr = get_be32(index + 4);
+		index += 8;
+
+		if (ieot->entries[i].offset < sizeof(struct cache_header) ||
+		    ieot->entries[i].offset <= prev ||
+		    ieot->entries[i].offset >= mmap_size) {
+			free(ieot);
+			return NULL;
+		}
+		prev = ieot->entries[i].offset;
+		total += ieot->entries[i].nr;
+	}
+	if (total != istate->cache_nr) {
+		free(ieot);
+		return NULL;
+	}
+	return ieot;
+}
+
+struct load_cache_entries_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int ieot_start;		/* first block of the table to parse */
+	int ieot_blocks;	/* number of blocks to parse */
+	int first;		/* position of the first entry in istate->cache */
+};
+
+static void *load_cache_entries_thread(void *_data)
+{
+	struct load_cache_entries_thread_data *p = _data;
+	int i, first = p->first;
+
+	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
+		struct index_entry_offset *block = &p->ieot->entries[i];
+
+		load_cache_entry_block(p->istate, p->mmap, block->offset,
+				       first, block->nr, 1);
+		first += block->nr;
+	}
+	return NULL;
+}
+
+static void load_cache_entries_threaded(struct index_state *istate,
+					const char *mmap, int nr_threads,
+					struct index_entry_offset_table *ieot)
+{
+	struct load_cache_entries_thread_data *data;
+	int i, ieot_blocks, ieot_start = 0, first = 0;
+
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	ieot_blocks = DIV_ROUND_UP(ieot->nr, nr_threads);
+
+	data = xcalloc(nr_threads, sizeof(*data));
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_thread_data *p = &data[i];
+		int j;
+
+		if (ieot_start + ieot_blocks > ieot->nr)
+			ieot_blocks = ieot->nr - ieot_start;
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->ieot_start = ieot_start;
+		p->ieot_blocks = ieot_blocks;
+		p->first = first;
+
+		for (j = ieot_start; j < ieot_start + ieot_blocks; j++)
+			first += ieot->entries[j].nr;
+		ieot_start += ieot_blocks;
+
+		if (pthread_create(&p->pthread, NULL,
+				   load_cache_entries_thread, p))
+			die("unable to create threaded index load");
+	}
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join threaded index load");
+	}
+	free(data);
+}
+
+#endif
+
+/* Remember the stat data of the index file; NULL forgets it */
+static void record_index_file(struct index_state *istate, const struct stat *st)
+{
+	istate->timestamp.sec = st ? (unsigned int)st->st_mtime : 0;
+	istate->timestamp.nsec = st ? ST_MTIME_NSEC(*st) : 0;
+	istate->file_dev = st ? st->st_dev : 0;
+	istate->file_ino = st ? st->st_ino : 0;
+	istate->file_size = st ? st->st_size : 0;
 }
 
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
-	int fd, i;
+	int fd;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	struct load_index_extensions p;
+	size_t extension_offset = 0;
+#ifndef NO_PTHREADS
+	struct index_entry_offset_table *ieot = NULL;
+	int nr_threads;
+#endif
 
 	if (istate->initialized)
 		return istate->cache_nr;
 
-	istate->timestamp.sec = 0;
-	istate->timestamp.nsec = 0;
+	record_index_file(istate, NULL);
 	fd = open(path, O_RDONLY);
 	if (fd < 0) {
 		if (!must_exist && errno == ENOENT)
@@ -1769,45 +2183,64 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
 	istate->initialized = 1;
 
-	if (istate->version == 4)
-		previous_name = &previous_name_buf;
-	else
-		previous_name = NULL;
-
+	memset(&p, 0, sizeof(p));
+	p.istate = istate;
+	p.mmap = mmap;
+	p.mmap_size = mmap_size;
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
 
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
+#ifndef NO_PTHREADS
+	if (git_config_get_index_threads(&nr_threads))
+		nr_threads = 0;
+	if (!nr_threads) {
+		int cpus = online_cpus();
 
-		src_offset += consumed;
+		nr_threads = istate->cache_nr / THREAD_COST;
+		if (nr_threads > cpus)
+			nr_threads = cpus;
 	}
-	strbuf_release(&previous_name_buf);
-	istate->timestamp.sec = st.st_mtime;
-	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
-			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
+	/*
+	 * If we know where the extensions start, parse them in a
+	 * thread of their own while the entries are being loaded, and
+	 * split the loading of the entries itself among the remaining
+	 * threads if the offset table allows it.
+	 */
+	if (nr_threads > 1) {
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+		if (extension_offset) {
+			p.src_offset = extension_offset;
+			if (pthread_create(&p.pthread, NULL,
+					   load_index_extensions, &p))
+				die("unable to create threaded index extension load");
+			nr_threads--;
+		}
 	}
+	if (extension_offset && nr_threads > 1)
+		ieot = read_ieot_extension(istate, mmap, mmap_size,
+					   extension_offset);
+
+	if (ieot) {
+		load_cache_entries_threaded(istate, mmap, nr_threads, ieot);
+		free(ieot);
+	} else
+#endif
+		src_offset += load_cache_entry_block(istate, mmap, src_offset,
+						     0, istate->cache_nr, 0);
+	record_index_file(istate, &st);
+
+#ifndef NO_PTHREADS
+	if (extension_offset) {
+		if (pthread_join(p.pthread, NULL))
+			die("unable to join threaded index extension load");
+	}
+#endif
+	if (!extension_offset) {
+		p.src_offset = src_offset;
+		load_index_extensions(&p);
+	}
+	if (p.ret < 0)
+		goto unmap;
 	munmap(mmap, mmap_size);
 	return istate->cache_nr;
 
@@ -1883,8 +2316,7 @@ int discard_index(struct index_state *istate)
 	resolve_undo_clear_index(istate);
 	istate->cache_nr = 0;
 	istate->cache_changed = 0;
-	istate->timestamp.sec = 0;
-	istate->timestamp.nsec = 0;
+	record_index_file(istate, NULL);
 	free_name_hash(istate);
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
@@ -1894,6 +2326,15 @@ int discard_index(struct index_state *istate)
 	discard_split_index(istate);
 	free_untracked_cache(istate->untracked);
 	istate->untracked = NULL;
+	free(istate->fsmonitor_last_update);
+	istate->fsmonitor_last_update = NULL;
+	if (istate->fsmonitor_dirty) {
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+	}
+	istate->fsmonitor_has_run_once = 0;
+	istate->sparse_index = 0;
+	istate->write_sparse = 0;
 	return 0;
 }
 
@@ -1907,17 +2348,151 @@ int unmerged_index(const struct index_state *istate)
 	return 0;
 }
 
-#define WRITE_BUFFER_SIZE 8192
-static unsigned char write_buffer[WRITE_BUFFER_SIZE];
+#define WRITE_BUFFER_SIZE 65536
+static unsigned char write_buffers[2][WRITE_BUFFER_SIZE];
+static unsigned char *write_buffer = write_buffers[0];
 static unsigned long write_buffer_len;
+/* Position in the file of the first byte of write_buffer */
+static off_t write_buffer_offset;
+/* Write a null trailer instead of the checksum (index.skipHash) */
+static int write_skip_hash;
+
+#ifndef NO_PTHREADS
+/*
+ * For a large index, a thread feeds the filled buffers to the checksum
+ * and writes them out while the next buffer is being filled with the
+ * following entries.
+ */
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	git_SHA_CTX *context;
+	int fd;
+	unsigned char *pending; /* buffer handed to the thread, or NULL */
+	unsigned long pending_len;
+	int stop, error, running;
+} async_write;
+
+static void *async_write_thread(void *unused)
+{
+	pthread_mutex_lock(&async_write.mutex);
+	for (;;) {
+		unsigned char *buf;
+		unsigned long len;
+		int err = 0;
+
+		while (!async_write.pending && !async_write.stop)
+			pthread_cond_wait(&async_write.cond, &async_write.mutex);
+		if (!async_write.pending)
+			break;
+		buf = async_write.pending;
+		len = async_write.pending_len;
+		pthread_mutex_unlock(&async_write.mutex);
+
+		if (!write_skip_hash)
+			git_SHA1_Update(async_write.context, buf, len);
+		if (write_in_full(async_write.fd, buf, len) != len)
+			err = -1;
+
+		pthread_mutex_lock(&async_write.mutex);
+		if (err)
+			async_write.error = err;
+		async_write.pending = NULL;
+		pthread_cond_broadcast(&async_write.cond);
+	}
+	pthread_mutex_unlock(&async_write.mutex);
+	return NULL;
+}
+
+static void start_async_write(git_SHA_CTX *context, int fd)
+{
+	memset(&async_write, 0, sizeof(async_write));
+	async_write.context = context;
+	async_write.fd = fd;
+	pthread_mutex_init(&async_write.mutex, NULL);
+	pthread_cond_init(&async_write.cond, NULL);
+	if (pthread_create(&async_write.thread, NULL, async_write_thread, NULL)) {
+		/* Not fatal, the buffers are then written synchronously. */
+		pthread_cond_destroy(&async_write.cond);
+		pthread_mutex_destroy(&async_write.mutex);
+		return;
+	}
+	async_write.running = 1;
+}
+
+/*
+ * Wait until everything handed to the thread is written and stop it.
+ * Afterwards the checksum covers all the data before write_buffer.
+ */
+static int finish_async_write(void)
+{
+	if (!async_write.running)
+		return 0;
+	pthread_mutex_lock(&async_write.mutex);
+	async_write.stop = 1;
+	pthread_cond_broadcast(&async_write.cond);
+	pthread_mutex_unlock(&async_write.mutex);
+	if (pthread_join(async_write.thread, NULL))
+		die("unable to join index writing thread");
+	pthread_cond_destroy(&async_write.cond);
+	pthread_mutex_destroy(&async_write.mutex);
+	async_write.running = 0;
+	return async_write.error;
+}
+
+static int hand_off_write_buffer(void)
+{
+	int err;
+
+	pthread_mutex_lock(&async_write.mutex);
+	while (async_write.pending)
+		pthread_cond_wait(&async_write.cond, &async_write.mutex);
+	err = async_write.error;
+	if (!err) {
+		async_write.pending = write_buffer;
+		async_write.pending_len = write_buffer_len;
+		pthread_cond_broadcast(&async_write.cond);
+	}
+	pthread_mutex_unlock(&async_write.mutex);
+	if (err)
+		return -1;
+
+	/* Fill the other buffer in the meantime */
+	if (write_buffer == write_buffers[0])
+		write_buffer = write_buffers[1];
+	else
+		write_buffer = write_buffers[0];
+	return 0;
+}
+#else
+static void start_async_write(git_SHA_CTX *context, int fd)
+{
+}
+
+static int finish_async_write(void)
+{
+	return 0;
+}
+#endif
 
 static int ce_write_flush(git_SHA_CTX *context, int fd)
 {
 	unsigned int buffered = write_buffer_len;
 	if (buffered) {
-		git_SHA1_Update(context, write_buffer, buffered);
-		if (write_in_full(fd, write_buffer, buffered) != buffered)
-			return -1;
+#ifndef NO_PTHREADS
+		if (async_write.running) {
+			if (hand_off_write_buffer())
+				return -1;
+		} else
+#endif
+		{
+			if (!write_skip_hash)
+				git_SHA1_Update(context, write_buffer, buffered);
+			if (write_in_full(fd, write_buffer, buffered) != buffered)
+				return -1;
+		}
+		write_buffer_offset += buffered;
 		write_buffer_len = 0;
 	}
 	return 0;
@@ -1945,11 +2520,16 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
+static int write_index_ext_header(git_SHA_CTX *context,
+				  git_SHA_CTX *eoie_context, int fd,
 				  unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
@@ -1958,9 +2538,13 @@ static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 {
 	unsigned int left = write_buffer_len;
 
+	if (finish_async_write())
+		return -1;
+
 	if (left) {
 		write_buffer_len = 0;
-		git_SHA1_Update(context, write_buffer, left);
+		if (!write_skip_hash)
+			git_SHA1_Update(context, write_buffer, left);
 	}
 
 	/* Flush first if not enough space for SHA1 signature */
@@ -1971,7 +2555,10 @@ static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 	}
 
 	/* Append the SHA1 signature at the end */
-	git_SHA1_Final(write_buffer + left, context);
+	if (write_skip_hash)
+		hashclr(write_buffer + left);
+	else
+		git_SHA1_Final(write_buffer + left, context);
 	hashcpy(sha1, write_buffer + left);
 	left += 20;
 	return (write_in_full(fd, write_buffer, left) != left) ? -1 : 0;
@@ -2144,6 +2731,22 @@ static int verify_index_from(const struct index_state *istate, const char *path)
 	if (hashcmp(istate->sha1, sha1))
 		goto out;
 
+	/*
+	 * Without a checksum (index.skipHash), fall back to the stat
+	 * data to tell whether the file was rewritten. The mtime alone
+	 * may not change within the same second, but the index is only
+	 * ever replaced by renaming a lockfile over it, which gives it
+	 * a new inode; where there is no inode number, do not guess.
+	 */
+	if (is_null_sha1(sha1) &&
+	    (!st.st_ino || !istate->file_ino ||
+	     istate->file_ino != st.st_ino ||
+	     istate->file_dev != st.st_dev ||
+	     istate->file_size != st.st_size ||
+	     istate->timestamp.sec != (unsigned int)st.st_mtime ||
+	     istate->timestamp.nsec != ST_MTIME_NSEC(st)))
+		goto out;
+
 	close(fd);
 	return 1;
 
@@ -2181,8 +2784,16 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
-static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
-			  int strip_extensions)
+static int index_skip_hash(void)
+{
+	int val = 0;
+
+	git_config_get_bool("index.skiphash", &val);
+	return val;
+}
+
+static int do_write_index_1(struct index_state *istate, struct tempfile *tempfile,
+			    int strip_extensions)
 {
 	int newfd = tempfile->fd;
 	git_SHA_CTX c;
@@ -2193,6 +2804,10 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct stat st;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 	int drop_cache_tree = 0;
+	int nr_threads, ieot_entries = 0, block_nr = 0;
+	struct index_entry_offset_table *ieot = NULL;
+	git_SHA_CTX eoie_context, *eoie_c = NULL;
+	off_t offset;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -2222,12 +2837,64 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	hdr.hdr_version = htonl(hdr_version);
 	hdr.hdr_entries = htonl(entries - removed);
 
+	if (git_config_get_index_threads(&nr_threads))
+		nr_threads = 0;
+	if (!strip_extensions && nr_threads != 1 && record_ieot()) {
+		int ieot_blocks;
+
+		/*
+		 * By default, write as many blocks as the reader is going
+		 * to use threads for the entries, leaving one for the
+		 * extensions.
+		 */
+		if (!nr_threads) {
+			ieot_blocks = (entries - removed) / THREAD_COST;
+			if (ieot_blocks > online_cpus() - 1)
+				ieot_blocks = online_cpus() - 1;
+		} else {
+			ieot_blocks = nr_threads;
+		}
+		if (ieot_blocks > entries - removed)
+			ieot_blocks = entries - removed;
+
+		if (ieot_blocks > 1) {
+			ieot = xcalloc(1, st_add(sizeof(*ieot),
+				st_mult(ieot_blocks, sizeof(struct index_entry_offset))));
+			ieot_entries = DIV_ROUND_UP(entries - removed, ieot_blocks);
+		}
+	}
+	if (!strip_extensions && record_eoie()) {
+		git_SHA1_Init(&eoie_context);
+		eoie_c = &eoie_context;
+	}
+
+	/*
+	 * A shared index is named after its checksum, so that one is
+	 * always computed.
+	 */
+	write_skip_hash = !strip_extensions && index_skip_hash();
+	write_buffer_offset = lseek(newfd, 0, SEEK_CUR);
+	if (write_buffer_offset < 0) {
+		free(ieot);
+		return -1;
+	}
+
 	git_SHA1_Init(&c);
-	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
+	/*
+	 * Let a thread compute the checksum and write out the data while
+	 * the entries are being converted, unless that is not worth it.
+	 */
+	if (nr_threads > 1 || (!nr_threads && entries >= THREAD_COST))
+		start_async_write(&c, newfd);
+	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0) {
+		free(ieot);
 		return -1;
+	}
+
+	offset = write_buffer_offset + write_buffer_len;
 
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
-	for (i = 0; i < entries; i++) {
+	for (i = err = 0; i < entries && !err; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
@@ -2241,22 +2908,76 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
 			if (allow)
 				warning(msg, ce->name);
-			else
-				return error(msg, ce->name);
+			else {
+				err = error(msg, ce->name);
+				break;
+			}
 
 			drop_cache_tree = 1;
 		}
+		if (ieot && block_nr == ieot_entries) {
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->entries[ieot->nr].nr = block_nr;
+			ieot->nr++;
+
+			/*
+			 * Make the first name of the new block share
+			 * nothing with the previous one, so that it can be
+			 * decoded on its own.
+			 */
+			if (previous_name && previous_name->len)
+				previous_name->buf[0] = '\0';
+
+			offset = write_buffer_offset + write_buffer_len;
+			block_nr = 0;
+		}
 		if (ce_write_entry(&c, newfd, ce, previous_name) < 0)
-			return -1;
+			err = -1;
+		block_nr++;
 	}
 	strbuf_release(&previous_name_buf);
+	if (err) {
+		free(ieot);
+		return err;
+	}
+	if (ieot && block_nr) {
+		ieot->entries[ieot->nr].offset = offset;
+		ieot->entries[ieot->nr].nr = block_nr;
+		ieot->nr++;
+	}
+
+	offset = write_buffer_offset + write_buffer_len;
+
+	/* Both extensions record 32-bit offsets into the file. */
+	if (offset > 0xffffffff) {
+		free(ieot);
+		ieot = NULL;
+		eoie_c = NULL;
+	}
+
+	/*
+	 * Write extension data here. The offset table comes first to
+	 * be found quickly.
+	 */
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_ieot_extension(&sb, ieot);
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_INDEXENTRYOFFSETTABLE,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		free(ieot);
+		if (err)
+			return -1;
+	}
 
-	/* Write extension data here */
 	if (!strip_extensions && istate->split_index) {
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2267,7 +2988,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -2277,7 +2998,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2288,7 +3009,41 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_untracked_extension(&sb, istate->untracked);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_UNTRACKED,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_UNTRACKED,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->fsmonitor_last_update) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_FSMONITOR,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->sparse_index) {
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0;
+		if (err)
+			return -1;
+	}
+
+	/*
+	 * The EOIE extension has to be the last one, as readers look for
+	 * it right in front of the trailing checksum.
+	 */
+	if (eoie_c) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_eoie_extension(&sb, eoie_c, offset);
+		err = write_index_ext_header(&c, NULL, newfd,
+					     CACHE_EXT_ENDOFINDEXENTRIES,
 					     sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2302,11 +3057,26 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		return error(_("could not close '%s'"), tempfile->filename.buf);
 	if (stat(tempfile->filename.buf, &st))
 		return -1;
-	istate->timestamp.sec = (unsigned int)st.st_mtime;
-	istate->timestamp.nsec = ST_MTIME_NSEC(st);
+	record_index_file(istate, &st);
 	return 0;
 }
 
+static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
+			  int strip_extensions)
+{
+	int ret = do_write_index_1(istate, tempfile, strip_extensions);
+
+	/*
+	 * An error may have left the writing thread running, and data
+	 * in the buffer that must not end up in the next file.
+	 */
+	if (finish_async_write() && !ret)
+		ret = -1;
+	if (ret)
+		write_buffer_len = 0;
+	return ret;
+}
+
 void set_alternate_index_output(const char *name)
 {
 	alternate_index_output = name;
@@ -2437,15 +3207,42 @@ static int write_shared_index(struct index_state *istate,
 
 static const int default_max_percent_split_change = 20;
 
+/*
+ * Each write of the index writes all the entries of the split index,
+ * whose number grows by about the number of entries changed by each
+ * command, while writing a new shared index costs all the entries
+ * once and leaves an almost empty split index. Over n commands that
+ * change d entries each, this is N + d * n^2 / 2 entries written, the
+ * least per command for n = sqrt(2 * N / d), that is once the split
+ * index has grown to sqrt(2 * N * d) entries. This is a model in
+ * entry counts, not a measurement of time or bytes written; d is
+ * estimated from how much the split index grew since it was read.
+ */
+static int split_index_too_costly(struct index_state *istate,
+				  unsigned int nr_split)
+{
+	struct split_index *si = istate->split_index;
+	uint64_t changed = 1;
+
+	if (nr_split > si->nr_split_read)
+		changed = nr_split - si->nr_split_read;
+	return (uint64_t)nr_split * nr_split >=
+		2 * (uint64_t)istate->cache_nr * changed;
+}
+
 static int too_many_not_shared_entries(struct index_state *istate)
 {
-	int i, not_shared = 0;
+	int i, not_shared = 0, nr_split = 0, adaptive = 0;
 	int max_split = git_config_get_max_percent_split_change();
 
 	switch (max_split) {
 	case -1:
-		/* not or badly configured: use the default value */
+		/*
+		 * not or badly configured: use the default value, but
+		 * write a new shared index earlier when that is cheaper
+		 */
 		max_split = default_max_percent_split_change;
+		adaptive = 1;
 		break;
 	case 0:
 		return 1; /* 0% means always write a new shared index */
@@ -2455,22 +3252,30 @@ static int too_many_not_shared_entries(struct index_state *istate)
 		break; /* just use the configured value */
 	}
 
-	/* Count not shared entries */
+	/* Count not shared entries, and those the split index will have */
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce = istate->cache[i];
 		if (!ce->index)
 			not_shared++;
+		if (!ce->index || (ce->ce_flags & CE_UPDATE_IN_BASE))
+			nr_split++;
 	}
 
-	return (int64_t)istate->cache_nr * max_split < (int64_t)not_shared * 100;
+	if ((int64_t)istate->cache_nr * max_split < (int64_t)not_shared * 100)
+		return 1;
+	return adaptive && split_index_too_costly(istate, nr_split);
 }
 
-int write_locked_index(struct index_state *istate, struct lock_file *lock,
-		       unsigned flags)
+static int write_locked_index_1(struct index_state *istate,
+				struct lock_file *lock, unsigned flags)
 {
 	int new_shared_index, ret;
 	struct split_index *si = istate->split_index;
 
+	/* The bitmap covers the whole index, not just the split part. */
+	if (istate->fsmonitor_last_update)
+		fill_fsmonitor_bitmap(istate);
+
 	if (!si || alternate_index_output ||
 	    (istate->cache_changed & ~EXTMASK)) {
 		if (si)
@@ -2503,6 +3308,29 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 	return ret;
 }
 
+int write_locked_index(struct index_state *istate, struct lock_file *lock,
+		       unsigned flags)
+{
+	struct sparse_index_undo *undo = NULL;
+	int ret;
+
+	/*
+	 * The index is written sparse if it was read sparse, if the
+	 * sparse-checkout patterns were just applied to it, or if the
+	 * command can work with a sparse index; otherwise there is no
+	 * point in paying for the conversion. A caller that has a full
+	 * index gets its entries back as they were after the write. The
+	 * split index does not know about sparse directories.
+	 */
+	if (istate->split_index)
+		ensure_full_index(istate);
+	else if (istate->write_sparse || !command_requires_full_index)
+		convert_to_sparse_undoable(istate, &undo);
+	ret = write_locked_index_1(istate, lock, flags);
+	restore_full_index(istate, undo);
+	return ret;
+}
+
 /*
  * Read the index file that is potentially unmerged into given
  * index_state, dropping any unmerged entries.  Returns true if
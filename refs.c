@@ -16,7 +16,7 @@
 /*
  * List of all available backends
  */
-static struct ref_storage_be *refs_backends = &refs_be_files;
+static struct ref_storage_be *refs_backends = &refs_be_reftable;
 
 static struct ref_storage_be *find_ref_storage_backend(const char *name)
 {
@@ -1563,12 +1563,16 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
  * gitdir.
  */
 static struct ref_store *ref_store_init(const char *gitdir,
+					const char *be_name,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	if (!be_name)
+		be_name = "files";
+	be = find_ref_storage_backend(be_name);
+
 	if (!be)
 		die("BUG: reference backend %s is unknown", be_name);
 
@@ -1576,12 +1580,38 @@ static struct ref_store *ref_store_init(const char *gitdir,
 	return refs;
 }
 
+/*
+ * Create a read-only ref_store for the submodule repository in
+ * gitdir, which might use a different ref storage format than the
+ * superproject. Return NULL if we don't understand its format.
+ */
+static struct ref_store *submodule_ref_store_init(const char *gitdir)
+{
+	struct repository_format format;
+	struct strbuf sb = STRBUF_INIT;
+	struct ref_store *refs = NULL;
+
+	get_common_dir_noenv(&sb, gitdir);
+	strbuf_addstr(&sb, "/config");
+	read_repository_format(&format, sb.buf);
+	if (!verify_repository_format(&format, &sb))
+		refs = ref_store_init(gitdir,
+				      format.version >= 1 ? format.ref_storage : NULL,
+				      REF_STORE_READ | REF_STORE_ODB);
+	free(format.ref_storage);
+	string_list_clear(&format.unknown_extensions, 0);
+	strbuf_release(&sb);
+	return refs;
+}
+
 struct ref_store *get_main_ref_store(void)
 {
 	if (main_ref_store)
 		return main_ref_store;
 
-	main_ref_store = ref_store_init(get_git_dir(), REF_STORE_ALL_CAPS);
+	main_ref_store = ref_store_init(get_git_dir(),
+					repository_format_ref_storage,
+					REF_STORE_ALL_CAPS);
 	return main_ref_store;
 }
 
@@ -1632,8 +1662,11 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 	}
 
 	/* assume that add_submodule_odb() has been called */
-	refs = ref_store_init(submodule_sb.buf,
-			      REF_STORE_READ | REF_STORE_ODB);
+	refs = submodule_ref_store_init(submodule_sb.buf);
+	if (!refs) {
+		strbuf_release(&submodule_sb);
+		return NULL;
+	}
 	register_ref_store_map(&submodule_ref_stores, "submodule",
 			       refs, submodule);
 
@@ -1656,9 +1689,11 @@ struct ref_store *get_worktree_ref_store(const struct worktree *wt)
 
 	if (wt->id)
 		refs = ref_store_init(git_common_path("worktrees/%s", wt->id),
+				      repository_format_ref_storage,
 				      REF_STORE_ALL_CAPS);
 	else
 		refs = ref_store_init(get_git_common_dir(),
+				      repository_format_ref_storage,
 				      REF_STORE_ALL_CAPS);
 
 	if (refs)
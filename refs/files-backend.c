@@ -47,6 +47,42 @@ struct packed_ref_cache {
 	struct stat_validity validity;
 };
 
+/*
+ * A read-only view of the packed-refs file, which is mmapped as-is
+ * instead of being parsed into a ref_cache.  If the file is known to
+ * be sorted, single references can be found by binary search and the
+ * references under a prefix can be iterated over by seeking to the
+ * first of them.  See get_packed_refs_snapshot().
+ */
+struct packed_refs_snapshot {
+	/*
+	 * The mmapped contents of the file, or NULL if it does not
+	 * exist or is empty.
+	 */
+	char *buf;
+	size_t size;
+
+	/* The first reference record, and the end of the records */
+	const char *start, *eof;
+
+	/* The peeling traits from the header; see read_packed_refs() */
+	enum { SNAPSHOT_PEELED_NONE, SNAPSHOT_PEELED_TAGS,
+	       SNAPSHOT_PEELED_FULLY } peeled;
+
+	/*
+	 * Whether the header declares the records to be sorted; only a
+	 * sorted snapshot is used, other files are read into the
+	 * packed_ref_cache instead.
+	 */
+	unsigned sorted : 1;
+
+	/* Count of references to this snapshot, as for packed_ref_cache */
+	unsigned int referrers;
+
+	/* The metadata from when this snapshot was taken */
+	struct stat_validity validity;
+};
+
 /*
  * Future: need to be in "struct repository"
  * when doing a full libification.
@@ -61,6 +97,7 @@ struct files_ref_store {
 
 	struct ref_cache *loose;
 	struct packed_ref_cache *packed;
+	struct packed_refs_snapshot *snapshot;
 
 	/*
 	 * Lock used for the "packed-refs" file. Note that this (and
@@ -182,7 +219,7 @@ static struct files_ref_store *files_downcast(struct ref_store *ref_store,
  * traits will be added later.  The trailing space is required.
  */
 static const char PACKED_REFS_HEADER[] =
-	"# pack-refs with: peeled fully-peeled \n";
+	"# pack-refs with: peeled fully-peeled sorted \n";
 
 /*
  * Parse one line from a packed-refs file.  Write the SHA1 to sha1.
@@ -236,6 +273,11 @@ static const char *parse_ref_line(struct strbuf *line, struct object_id *oid)
  *      trait should typically be written alongside "peeled" for
  *      compatibility with older clients, but we do not require it
  *      (i.e., "peeled" is a no-op if "fully-peeled" is set).
+ *
+ *   sorted:
+ *
+ *      The references are sorted by refname, so that the file can be
+ *      searched without parsing it; see get_packed_refs_snapshot().
  */
 static struct packed_ref_cache *read_packed_refs(const char *packed_refs_file)
 {
@@ -402,6 +444,371 @@ static struct ref_dir *get_packed_refs(struct files_ref_store *refs)
 	return get_packed_ref_dir(get_packed_ref_cache(refs));
 }
 
+static void acquire_packed_refs_snapshot(struct packed_refs_snapshot *snapshot)
+{
+	snapshot->referrers++;
+}
+
+static void release_packed_refs_snapshot(struct packed_refs_snapshot *snapshot)
+{
+	if (!--snapshot->referrers) {
+		if (snapshot->buf)
+			munmap(snapshot->buf, snapshot->size);
+		stat_validity_clear(&snapshot->validity);
+		free(snapshot);
+	}
+}
+
+static void clear_packed_refs_snapshot(struct files_ref_store *refs)
+{
+	if (refs->snapshot) {
+		release_packed_refs_snapshot(refs->snapshot);
+		refs->snapshot = NULL;
+	}
+}
+
+/*
+ * mmap `packed_refs_file` into a newly-allocated snapshot and return
+ * it, with its reference count already incremented.  Only the header
+ * is looked at; a file that is missing or empty makes for a sorted
+ * snapshot without any records.
+ */
+static struct packed_refs_snapshot *read_packed_refs_snapshot(const char *packed_refs_file)
+{
+	struct packed_refs_snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
+	struct stat st;
+	int fd;
+
+	acquire_packed_refs_snapshot(snapshot);
+	snapshot->sorted = 1;
+
+	fd = open(packed_refs_file, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return snapshot;
+		die_errno("couldn't read %s", packed_refs_file);
+	}
+
+	stat_validity_update(&snapshot->validity, fd);
+	if (fstat(fd, &st) < 0)
+		die_errno("couldn't stat %s", packed_refs_file);
+
+	snapshot->size = xsize_t(st.st_size);
+	if (!snapshot->size) {
+		close(fd);
+		return snapshot;
+	}
+	snapshot->buf = xmmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	snapshot->start = snapshot->buf;
+	snapshot->eof = snapshot->buf + snapshot->size;
+	snapshot->sorted = 0;
+
+	if (*snapshot->buf == '#') {
+		struct strbuf header = STRBUF_INIT;
+		const char *eol, *traits;
+
+		eol = memchr(snapshot->buf, '\n', snapshot->size);
+		if (!eol)
+			return snapshot;
+		strbuf_add(&header, snapshot->buf, eol + 1 - snapshot->buf);
+
+		if (skip_prefix(header.buf, "# pack-refs with:", &traits)) {
+			if (strstr(traits, " fully-peeled "))
+				snapshot->peeled = SNAPSHOT_PEELED_FULLY;
+			else if (strstr(traits, " peeled "))
+				snapshot->peeled = SNAPSHOT_PEELED_TAGS;
+			snapshot->sorted = !!strstr(traits, " sorted ");
+		}
+		strbuf_release(&header);
+		snapshot->start = eol + 1;
+	}
+
+	/* searching relies on every record being terminated */
+	if (snapshot->eof[-1] != '\n')
+		snapshot->sorted = 0;
+
+	return snapshot;
+}
+
+/*
+ * Get the snapshot of the packed-refs file for the specified
+ * files_ref_store, mapping it anew if the file has changed since it
+ * was last mapped.  Return NULL if the snapshot cannot be used, in
+ * which case the caller has to use the packed_ref_cache: because the
+ * file is not sorted, or because we hold the lock on it and the cache
+ * may have been modified in memory.
+ */
+static struct packed_refs_snapshot *get_packed_refs_snapshot(struct files_ref_store *refs)
+{
+	const char *packed_refs_file = files_packed_refs_path(refs);
+
+	if (is_lock_file_locked(&refs->packed_refs_lock))
+		return NULL;
+
+	if (refs->snapshot &&
+	    !stat_validity_check(&refs->snapshot->validity, packed_refs_file))
+		clear_packed_refs_snapshot(refs);
+
+	if (!refs->snapshot)
+		refs->snapshot = read_packed_refs_snapshot(packed_refs_file);
+
+	return refs->snapshot->sorted ? refs->snapshot : NULL;
+}
+
+static NORETURN void die_invalid_snapshot_line(const char *p, const char *eof)
+{
+	const char *eol = memchr(p, '\n', eof - p);
+
+	die("unexpected line in packed-refs: %.*s",
+	    (int)((eol ? eol : eof) - p), p);
+}
+
+/*
+ * Return the start of the record containing position "p" of the
+ * snapshot; peeled lines belong to the record before them.
+ */
+static const char *find_start_of_record(const char *buf, const char *p)
+{
+	while (p > buf && (p[-1] != '\n' || p[0] == '^'))
+		p--;
+	return p;
+}
+
+/*
+ * Return the start of the record after the one containing position
+ * "p", or "eof".
+ */
+static const char *find_end_of_record(const char *p, const char *eof)
+{
+	while (++p < eof && (p[-1] != '\n' || p[0] == '^'))
+		;
+	return p;
+}
+
+/*
+ * Compare the refname of the record at "rec" with "refname", like
+ * strcmp() would.
+ */
+static int cmp_record_to_refname(struct packed_refs_snapshot *snapshot,
+				 const char *rec, const char *refname)
+{
+	const unsigned char *r1, *r2;
+
+	if (snapshot->eof - rec < GIT_SHA1_HEXSZ + 2 ||
+	    rec[GIT_SHA1_HEXSZ] != ' ')
+		die_invalid_snapshot_line(rec, snapshot->eof);
+
+	r1 = (const unsigned char *)rec + GIT_SHA1_HEXSZ + 1;
+	r2 = (const unsigned char *)refname;
+	while (1) {
+		if (*r1 == '\n')
+			return *r2 ? -1 : 0;
+		if (!*r2)
+			return 1;
+		if (*r1 != *r2)
+			return *r1 < *r2 ? -1 : 1;
+		r1++;
+		r2++;
+	}
+}
+
+/*
+ * Binary-search the snapshot for the record of "refname".  If there
+ * is none, return NULL if "mustexist" is set, or else the record that
+ * it would have to be inserted before (possibly "eof").
+ */
+static const char *find_snapshot_record(struct packed_refs_snapshot *snapshot,
+					const char *refname, int mustexist)
+{
+	const char *lo = snapshot->start, *hi = snapshot->eof;
+
+	while (lo < hi) {
+		const char *mid = lo + (hi - lo) / 2;
+		const char *rec = find_start_of_record(lo, mid);
+		int cmp = cmp_record_to_refname(snapshot, rec, refname);
+
+		if (cmp < 0)
+			lo = find_end_of_record(mid, hi);
+		else if (cmp > 0)
+			hi = rec;
+		else
+			return rec;
+	}
+
+	return mustexist ? NULL : lo;
+}
+
+/*
+ * Parse the record at "rec" into "refname", "oid" and "flags", and
+ * its peeled value (or the null oid) into "peeled".  Return the start
+ * of the next record.
+ */
+static const char *parse_snapshot_record(struct packed_refs_snapshot *snapshot,
+					 const char *rec, struct strbuf *refname,
+					 struct object_id *oid,
+					 struct object_id *peeled,
+					 unsigned int *flags)
+{
+	const char *p, *eol;
+
+	if (parse_oid_hex(rec, oid, &p) || *p++ != ' ')
+		die_invalid_snapshot_line(rec, snapshot->eof);
+
+	/* the snapshot is known to end with a newline */
+	eol = memchr(p, '\n', snapshot->eof - p);
+	strbuf_reset(refname);
+	strbuf_add(refname, p, eol - p);
+
+	*flags = REF_ISPACKED;
+	if (check_refname_format(refname->buf, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(refname->buf))
+			die("packed refname is dangerous: %s", refname->buf);
+		oidclr(oid);
+		*flags |= REF_BAD_NAME | REF_ISBROKEN;
+	}
+
+	oidclr(peeled);
+	if (snapshot->peeled == SNAPSHOT_PEELED_FULLY ||
+	    (snapshot->peeled == SNAPSHOT_PEELED_TAGS &&
+	     starts_with(refname->buf, "refs/tags/")))
+		*flags |= REF_KNOWS_PEELED;
+
+	p = eol + 1;
+	if (p < snapshot->eof && *p == '^') {
+		if (snapshot->eof - p < PEELED_LINE_LENGTH ||
+		    p[PEELED_LINE_LENGTH - 1] != '\n' ||
+		    get_oid_hex(p + 1, peeled))
+			die_invalid_snapshot_line(p, snapshot->eof);
+		/*
+		 * Regardless of what the file header said, we
+		 * definitely know the value of *this* reference:
+		 */
+		*flags |= REF_KNOWS_PEELED;
+		p += PEELED_LINE_LENGTH;
+	}
+
+	return p;
+}
+
+/*
+ * Look up "refname" in the snapshot.  Return 0 and fill "oid",
+ * "peeled" and "flags" as parse_snapshot_record() does if it is
+ * found, or -1 if not.
+ */
+static int snapshot_read_ref(struct packed_refs_snapshot *snapshot,
+			     const char *refname, struct object_id *oid,
+			     struct object_id *peeled, unsigned int *flags)
+{
+	struct strbuf sb = STRBUF_INIT;
+	const char *rec = find_snapshot_record(snapshot, refname, 1);
+
+	if (!rec)
+		return -1;
+
+	parse_snapshot_record(snapshot, rec, &sb, oid, peeled, flags);
+	strbuf_release(&sb);
+	return 0;
+}
+
+struct snapshot_ref_iterator {
+	struct ref_iterator base;
+
+	struct packed_refs_snapshot *snapshot;
+
+	/* The next record to parse */
+	const char *pos;
+
+	/* Stop at the first refname not starting with it, if set */
+	char *prefix;
+
+	struct strbuf refname;
+	struct object_id oid, peeled;
+};
+
+static int snapshot_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct snapshot_ref_iterator *iter =
+		(struct snapshot_ref_iterator *)ref_iterator;
+
+	if (iter->pos < iter->snapshot->eof) {
+		iter->pos = parse_snapshot_record(iter->snapshot, iter->pos,
+						  &iter->refname, &iter->oid,
+						  &iter->peeled,
+						  &iter->base.flags);
+
+		if (!iter->prefix || starts_with(iter->refname.buf, iter->prefix)) {
+			iter->base.refname = iter->refname.buf;
+			iter->base.oid = &iter->oid;
+			return ITER_OK;
+		}
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int snapshot_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct snapshot_ref_iterator *iter =
+		(struct snapshot_ref_iterator *)ref_iterator;
+
+	if (iter->base.flags & REF_KNOWS_PEELED) {
+		oidcpy(peeled, &iter->peeled);
+		return is_null_oid(&iter->peeled) ? -1 : 0;
+	}
+	if (iter->base.flags & REF_ISBROKEN)
+		return -1;
+	return !!peel_object(iter->oid.hash, peeled->hash);
+}
+
+static int snapshot_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct snapshot_ref_iterator *iter =
+		(struct snapshot_ref_iterator *)ref_iterator;
+
+	release_packed_refs_snapshot(iter->snapshot);
+	strbuf_release(&iter->refname);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable snapshot_ref_iterator_vtable = {
+	snapshot_ref_iterator_advance,
+	snapshot_ref_iterator_peel,
+	snapshot_ref_iterator_abort
+};
+
+/*
+ * Iterate over the references in the snapshot whose names start with
+ * "prefix", starting right at the first of them.
+ */
+static struct ref_iterator *snapshot_ref_iterator_begin(
+		struct packed_refs_snapshot *snapshot, const char *prefix)
+{
+	struct snapshot_ref_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+
+	base_ref_iterator_init(ref_iterator, &snapshot_ref_iterator_vtable);
+
+	iter->snapshot = snapshot;
+	acquire_packed_refs_snapshot(snapshot);
+	strbuf_init(&iter->refname, 0);
+
+	if (prefix && *prefix) {
+		iter->prefix = xstrdup(prefix);
+		iter->pos = find_snapshot_record(snapshot, prefix, 0);
+	} else {
+		iter->pos = snapshot->start;
+	}
+
+	return ref_iterator;
+}
+
 /*
  * Add a reference to the in-memory packed reference cache.  This may
  * only be called while the packed-refs file is locked (see
@@ -562,12 +969,26 @@ static int resolve_packed_ref(struct files_ref_store *refs,
 			      const char *refname,
 			      unsigned char *sha1, unsigned int *flags)
 {
+	struct packed_refs_snapshot *snapshot;
 	struct ref_entry *entry;
 
 	/*
 	 * The loose reference file does not exist; check for a packed
 	 * reference.
 	 */
+	snapshot = get_packed_refs_snapshot(refs);
+	if (snapshot) {
+		struct object_id oid, peeled;
+		unsigned int packed_flags;
+
+		if (snapshot_read_ref(snapshot, refname, &oid, &peeled,
+				      &packed_flags))
+			return -1;
+		hashcpy(sha1, oid.hash);
+		*flags |= REF_ISPACKED;
+		return 0;
+	}
+
 	entry = get_packed_ref(refs, refname);
 	if (entry) {
 		hashcpy(sha1, entry->u.value.oid.hash);
@@ -991,7 +1412,26 @@ static int files_peel_ref(struct ref_store *ref_store,
 	 * have REF_KNOWS_PEELED.
 	 */
 	if (flag & REF_ISPACKED) {
-		struct ref_entry *r = get_packed_ref(refs, refname);
+		struct packed_refs_snapshot *snapshot =
+			get_packed_refs_snapshot(refs);
+		struct ref_entry *r;
+
+		if (snapshot) {
+			struct object_id oid, peeled;
+			unsigned int packed_flags;
+
+			if (!snapshot_read_ref(snapshot, refname, &oid, &peeled,
+					       &packed_flags) &&
+			    (packed_flags & REF_KNOWS_PEELED)) {
+				if (is_null_oid(&peeled))
+					return -1;
+				hashcpy(sha1, peeled.hash);
+				return 0;
+			}
+			return peel_object(base, sha1);
+		}
+
+		r = get_packed_ref(refs, refname);
 		if (r) {
 			if (peel_entry(r, 0))
 				return -1;
@@ -1059,7 +1499,8 @@ static int files_ref_iterator_abort(struct ref_iterator *ref_iterator)
 	if (iter->iter0)
 		ok = ref_iterator_abort(iter->iter0);
 
-	release_packed_ref_cache(iter->packed_ref_cache);
+	if (iter->packed_ref_cache)
+		release_packed_ref_cache(iter->packed_ref_cache);
 	base_ref_iterator_free(ref_iterator);
 	return ok;
 }
@@ -1076,6 +1517,7 @@ static struct ref_iterator *files_ref_iterator_begin(
 {
 	struct files_ref_store *refs;
 	struct ref_iterator *loose_iter, *packed_iter;
+	struct packed_refs_snapshot *snapshot;
 	struct files_ref_iterator *iter;
 	struct ref_iterator *ref_iterator;
 	unsigned int required_flags = REF_STORE_READ;
@@ -1101,18 +1543,23 @@ static struct ref_iterator *files_ref_iterator_begin(
 	 * (If they've already been read, that's OK; we only need to
 	 * guarantee that they're read before the packed refs, not
 	 * *how much* before.) After that, we call
-	 * get_packed_ref_cache(), which internally checks whether the
-	 * packed-ref cache is up to date with what is on disk, and
-	 * re-reads it if not.
+	 * get_packed_refs_snapshot() or get_packed_ref_cache(), which
+	 * internally check whether the packed refs are up to date with
+	 * what is on disk, and re-read them if not.
 	 */
 
 	loose_iter = cache_ref_iterator_begin(get_loose_ref_cache(refs),
 					      prefix, 1);
 
-	iter->packed_ref_cache = get_packed_ref_cache(refs);
-	acquire_packed_ref_cache(iter->packed_ref_cache);
-	packed_iter = cache_ref_iterator_begin(iter->packed_ref_cache->cache,
-					       prefix, 0);
+	snapshot = get_packed_refs_snapshot(refs);
+	if (snapshot) {
+		packed_iter = snapshot_ref_iterator_begin(snapshot, prefix);
+	} else {
+		iter->packed_ref_cache = get_packed_ref_cache(refs);
+		acquire_packed_ref_cache(iter->packed_ref_cache);
+		packed_iter = cache_ref_iterator_begin(iter->packed_ref_cache->cache,
+						       prefix, 0);
+	}
 
 	iter->iter0 = overlay_ref_iterator_begin(loose_iter, packed_iter);
 	iter->flags = flags;
@@ -1311,6 +1758,10 @@ static int lock_packed_refs(struct files_ref_store *refs, int flags)
 			    &refs->packed_refs_lock, files_packed_refs_path(refs),
 			    flags, timeout_value) < 0)
 		return -1;
+
+	/* The snapshot is not used while we hold the lock; unmap it. */
+	clear_packed_refs_snapshot(refs);
+
 	/*
 	 * Get the current packed-refs while holding the lock. It is
 	 * important that we call `get_packed_ref_cache()` before
@@ -0,0 +1,1902 @@
+#include "../cache.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../lockfile.h"
+#include "../object.h"
+
+/*
+ * The reftable backend stores references and their reflogs in stacks
+ * of reftables (see reftable.h):
+ *
+ * - References below "refs/" and their reflogs live in the stack in
+ *   "$GIT_COMMON_DIR/reftable".
+ *
+ * - The per-worktree references below "refs/bisect/" and the reflog
+ *   of HEAD live in "$GIT_DIR/reftable", which for the main worktree
+ *   is the same stack.
+ *
+ * - HEAD itself remains a loose file, so that repository discovery
+ *   and the code that inspects the HEADs of other worktrees keep
+ *   working, and pseudorefs like ORIG_HEAD are left to a files
+ *   ref_store for the same $GIT_DIR.
+ */
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitdir;
+	char *gitcommondir;
+
+	struct reftable_stack *main_stack;
+
+	/* The stack for per-worktree refs, if it isn't main_stack: */
+	struct reftable_stack *worktree_stack;
+
+	/* Used for HEAD and the pseudorefs: */
+	struct ref_store *loose_refs;
+
+	int auto_compact;
+};
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	refs->gitdir = xstrdup(gitdir);
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	refs->main_stack = reftable_stack_new(sb.buf);
+	if (strcmp(refs->gitdir, refs->gitcommondir)) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable", refs->gitdir);
+		refs->worktree_stack = reftable_stack_new(sb.buf);
+	}
+	strbuf_release(&sb);
+
+	refs->loose_refs = refs_be_files.init(gitdir, flags);
+
+	refs->auto_compact = 1;
+	git_config_get_bool("reftable.autocompaction", &refs->auto_compact);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store or lacks any of the required_flags.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		die("BUG: ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		die("BUG: operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+/* Is refname (or its reflog) kept in a reftable? */
+static int is_table_ref(const char *refname)
+{
+	return starts_with(refname, "refs/");
+}
+
+static int is_table_reflog(const char *refname)
+{
+	return is_table_ref(refname) || !strcmp(refname, "HEAD");
+}
+
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname)
+{
+	if (refs->worktree_stack &&
+	    ref_type(refname) == REF_TYPE_PER_WORKTREE)
+		return refs->worktree_stack;
+	return refs->main_stack;
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+	int fd;
+
+	if (refs->loose_refs->be->init_db(refs->loose_refs, err))
+		return -1;
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	safe_create_dir(sb.buf, 1);
+	strbuf_addstr(&sb, "/tables.list");
+	fd = open(sb.buf, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0 && errno != EEXIST) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    sb.buf, strerror(errno));
+		strbuf_release(&sb);
+		return -1;
+	}
+	if (fd >= 0) {
+		close(fd);
+		adjust_shared_perm(sb.buf);
+	}
+	strbuf_release(&sb);
+	return 0;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, unsigned char *sha1,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	int ret;
+
+	if (!is_table_ref(refname))
+		return refs_read_raw_ref(refs->loose_refs, refname, sha1,
+					 referent, type);
+
+	*type = 0;
+	ret = reftable_stack_read_ref(stack_for(refs, refname), refname, &ref);
+	if (ret > 0) {
+		errno = ENOENT;
+		ret = -1;
+	} else if (!ret) {
+		if (ref.type == REFTABLE_REF_SYMREF) {
+			strbuf_reset(referent);
+			strbuf_addbuf(referent, &ref.target);
+			*type |= REF_ISSYMREF;
+		} else {
+			hashcpy(sha1, ref.oid.hash);
+		}
+	} else {
+		errno = EIO;
+	}
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+static int reftable_peel_ref(struct ref_store *ref_store,
+			     const char *refname, unsigned char *sha1)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ | REF_STORE_ODB,
+				  "peel_ref");
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	unsigned char base[20];
+	int flag;
+
+	if (current_ref_iter && current_ref_iter->refname == refname) {
+		struct object_id peeled;
+
+		if (ref_iterator_peel(current_ref_iter, &peeled))
+			return -1;
+		hashcpy(sha1, peeled.hash);
+		return 0;
+	}
+
+	if (refs_read_ref_full(ref_store, refname,
+			       RESOLVE_REF_READING, base, &flag))
+		return -1;
+
+	/*
+	 * Compacted tables record the peeled values of tags, so look
+	 * there before reading the object.
+	 */
+	if (is_table_ref(refname) && !(flag & REF_ISSYMREF) &&
+	    !reftable_stack_read_ref(stack_for(refs, refname), refname, &ref) &&
+	    ref.type == REFTABLE_REF_VAL2 && !hashcmp(ref.oid.hash, base)) {
+		hashcpy(sha1, ref.peeled.hash);
+		reftable_ref_record_release(&ref);
+		return 0;
+	}
+	reftable_ref_record_release(&ref);
+
+	return peel_object(base, sha1);
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_iterator *iter;
+	struct reftable_ref_record ref;
+	struct object_id oid;
+	unsigned int flags;
+
+	/* Skip per-worktree refs, or everything else: */
+	int skip_per_worktree, per_worktree_only;
+};
+
+static int ref_resolves_to_object(const char *refname,
+				  const struct object_id *oid,
+				  unsigned int flags)
+{
+	if (flags & REF_ISBROKEN)
+		return 0;
+	if (!has_sha1_file(oid->hash)) {
+		error("%s does not point to a valid object!", refname);
+		return 0;
+	}
+	return 1;
+}
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ok = ITER_DONE;
+	int ret;
+
+	while (!(ret = reftable_iterator_next_ref(iter->iter, &iter->ref))) {
+		const char *refname = iter->ref.refname.buf;
+		int per_worktree = ref_type(refname) == REF_TYPE_PER_WORKTREE;
+
+		if (per_worktree ? iter->skip_per_worktree : iter->per_worktree_only)
+			continue;
+
+		iter->base.flags = 0;
+		if (iter->ref.type == REFTABLE_REF_SYMREF) {
+			iter->base.flags |= REF_ISSYMREF;
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     iter->oid.hash, NULL)) {
+				oidclr(&iter->oid);
+				iter->base.flags |= REF_ISBROKEN;
+			}
+		} else {
+			oidcpy(&iter->oid, &iter->ref.oid);
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid,
+					    iter->base.flags))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		return ITER_OK;
+	}
+
+	if (ret < 0)
+		ok = ITER_ERROR;
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		ok = ITER_ERROR;
+	return ok;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->ref.type == REFTABLE_REF_VAL2) {
+		oidcpy(peeled, &iter->ref.peeled);
+		return 0;
+	}
+	if (iter->base.flags & (REF_ISSYMREF | REF_ISBROKEN))
+		return -1;
+	return peel_object(iter->oid.hash, peeled->hash) == PEEL_PEELED ? 0 : -1;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_iterator_free(iter->iter);
+	reftable_ref_record_release(&iter->ref);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *stack_ref_iterator_begin(
+		struct reftable_ref_store *refs, struct reftable_stack *st,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct reftable_ref_record blank = REFTABLE_REF_RECORD_INIT;
+	struct ref_iterator *ref_iterator = &iter->base;
+
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable);
+	iter->refs = refs;
+	iter->ref = blank;
+	iter->flags = flags;
+	iter->iter = reftable_stack_refs(st, prefix);
+	if (!iter->iter)
+		die_errno("unable to read reftables for '%s'", refs->gitdir);
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct reftable_ref_iterator *main_iter, *worktree_iter;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+
+	refs = reftable_downcast(ref_store, required_flags, "ref_iterator_begin");
+
+	if (flags & DO_FOR_EACH_PER_WORKTREE_ONLY) {
+		struct reftable_stack *st = refs->worktree_stack ?
+			refs->worktree_stack : refs->main_stack;
+
+		worktree_iter = (struct reftable_ref_iterator *)
+			stack_ref_iterator_begin(refs, st, prefix, flags);
+		worktree_iter->per_worktree_only = 1;
+		return &worktree_iter->base;
+	}
+
+	main_iter = (struct reftable_ref_iterator *)
+		stack_ref_iterator_begin(refs, refs->main_stack, prefix, flags);
+	if (!refs->worktree_stack)
+		return &main_iter->base;
+
+	/*
+	 * The per-worktree refs in the common stack belong to the main
+	 * worktree; ours are in the worktree stack.
+	 */
+	main_iter->skip_per_worktree = 1;
+	worktree_iter = (struct reftable_ref_iterator *)
+		stack_ref_iterator_begin(refs, refs->worktree_stack, prefix, flags);
+	worktree_iter->per_worktree_only = 1;
+	return overlay_ref_iterator_begin(&worktree_iter->base, &main_iter->base);
+}
+
+/* Building the records of a new table */
+
+struct table_update {
+	struct reftable_addition add;
+	int locked, written;
+
+	struct reftable_ref_record **refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_log_record **logs;
+	size_t logs_nr, logs_alloc;
+};
+
+static void table_update_init(struct table_update *u)
+{
+	struct reftable_addition blank = REFTABLE_ADDITION_INIT;
+
+	memset(u, 0, sizeof(*u));
+	u->add = blank;
+}
+
+static int table_update_lock(struct table_update *u, struct reftable_stack *st,
+			     struct strbuf *err)
+{
+	if (u->locked)
+		return 0;
+	if (reftable_stack_lock(st, &u->add, err))
+		return -1;
+	u->locked = 1;
+	return 0;
+}
+
+static void table_update_release(struct table_update *u)
+{
+	size_t i;
+
+	if (u->locked)
+		reftable_addition_rollback(&u->add);
+	u->locked = u->written = 0;
+	for (i = 0; i < u->refs_nr; i++) {
+		reftable_ref_record_release(u->refs[i]);
+		free(u->refs[i]);
+	}
+	free(u->refs);
+	u->refs = NULL;
+	u->refs_nr = u->refs_alloc = 0;
+	for (i = 0; i < u->logs_nr; i++) {
+		reftable_log_record_release(u->logs[i]);
+		free(u->logs[i]);
+	}
+	free(u->logs);
+	u->logs = NULL;
+	u->logs_nr = u->logs_alloc = 0;
+}
+
+static struct reftable_ref_record *add_ref_record(struct table_update *u,
+						  const char *refname,
+						  enum reftable_ref_type type)
+{
+	struct reftable_ref_record blank = REFTABLE_REF_RECORD_INIT;
+	struct reftable_ref_record *ref = xmalloc(sizeof(*ref));
+
+	*ref = blank;
+	strbuf_addstr(&ref->refname, refname);
+	ref->type = type;
+	ALLOC_GROW(u->refs, u->refs_nr + 1, u->refs_alloc);
+	u->refs[u->refs_nr++] = ref;
+	return ref;
+}
+
+static struct reftable_log_record *add_log_record(struct table_update *u,
+						  const char *refname,
+						  uint64_t update_index,
+						  enum reftable_log_type type)
+{
+	struct reftable_log_record blank = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_log_record *log = xmalloc(sizeof(*log));
+
+	*log = blank;
+	strbuf_addstr(&log->refname, refname);
+	log->update_index = update_index;
+	log->type = type;
+	ALLOC_GROW(u->logs, u->logs_nr + 1, u->logs_alloc);
+	u->logs[u->logs_nr++] = log;
+	return log;
+}
+
+/* Record a new reflog entry for refname, as files_log_ref_write() would. */
+static void add_reflog_entry(struct table_update *u, const char *refname,
+			     const struct object_id *old_oid,
+			     const struct object_id *new_oid,
+			     const char *msg)
+{
+	struct reftable_log_record *log =
+		add_log_record(u, refname, u->add.update_index,
+			       REFTABLE_LOG_UPDATE);
+	const char *committer = git_committer_info(0);
+	const char *email_end = strrchr(committer, '>');
+	char *end;
+
+	oidcpy(&log->old_oid, old_oid);
+	oidcpy(&log->new_oid, new_oid);
+	if (email_end) {
+		strbuf_add(&log->ident, committer, email_end + 1 - committer);
+		log->time = parse_timestamp(email_end + 1, &end, 10);
+		log->tz = strtol(end, NULL, 10);
+	} else {
+		strbuf_addstr(&log->ident, committer);
+	}
+
+	if (msg && *msg) {
+		int len;
+
+		strbuf_grow(&log->message, strlen(msg) + 2);
+		len = copy_reflog_msg(log->message.buf, msg);
+		/* Strip the leading tab and the trailing newline: */
+		if (len > 2) {
+			memmove(log->message.buf, log->message.buf + 1, len - 2);
+			strbuf_setlen(&log->message, len - 2);
+		}
+	}
+}
+
+/*
+ * Add deletion records for all reflog entries of refname to u. If
+ * keep is not NULL, spare the entries whose update index is listed
+ * in it (sorted in decreasing order).
+ */
+static int delete_reflog_entries(struct table_update *u,
+				 struct reftable_stack *st, const char *refname,
+				 const uint64_t *keep, size_t keep_nr)
+{
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it = reftable_stack_logs(st, refname);
+	int ret;
+
+	if (!it)
+		return -1;
+	while (!(ret = reftable_iterator_next_log(it, &log))) {
+		while (keep_nr && *keep > log.update_index) {
+			keep++;
+			keep_nr--;
+		}
+		if (keep_nr && *keep == log.update_index)
+			continue;
+		add_log_record(u, refname, log.update_index,
+			       REFTABLE_LOG_DELETION);
+	}
+	reftable_iterator_free(it);
+	reftable_log_record_release(&log);
+	return ret < 0 ? -1 : 0;
+}
+
+static int stack_reflog_exists(struct reftable_stack *st, const char *refname)
+{
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it = reftable_stack_logs(st, refname);
+	int ret = 0;
+
+	if (it)
+		ret = !reftable_iterator_next_log(it, &log);
+	reftable_iterator_free(it);
+	reftable_log_record_release(&log);
+	return ret;
+}
+
+static int should_write_reflog(struct reftable_stack *st, const char *refname,
+			       unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	return (flags & REF_FORCE_CREATE_REFLOG) ||
+		should_autocreate_reflog(refname) ||
+		stack_reflog_exists(st, refname);
+}
+
+/* Write the records collected in u to a new (temporary) table. */
+static int table_update_write(struct table_update *u, struct strbuf *err)
+{
+	if (u->written)
+		return 0;
+	if (reftable_addition_add(&u->add, u->refs, u->refs_nr,
+				  u->logs, u->logs_nr, err))
+		return -1;
+	u->written = 1;
+	return 0;
+}
+
+/*
+ * Put the records collected in u into a new table on top of st and
+ * compact the stack if that is called for.
+ */
+static int table_update_commit(struct reftable_ref_store *refs,
+			       struct table_update *u,
+			       struct reftable_stack *st, struct strbuf *err)
+{
+	int ret;
+
+	ret = table_update_write(u, err);
+	if (!ret)
+		ret = reftable_addition_commit(&u->add, err);
+	else
+		reftable_addition_rollback(&u->add);
+	u->locked = u->written = 0;
+
+	if (!ret && refs->auto_compact) {
+		struct strbuf compact_err = STRBUF_INIT;
+
+		/* This is just housekeeping; failing is OK. */
+		reftable_stack_compact(st, 0, &compact_err);
+		strbuf_release(&compact_err);
+	}
+	return ret;
+}
+
+/* Writing HEAD */
+
+/*
+ * Lock the loose ref refname (i.e., HEAD) and write content to the
+ * lockfile, leaving it to the caller to commit or roll back the lock.
+ */
+static struct lock_file *lock_loose_ref(struct reftable_ref_store *refs,
+					const char *refname,
+					const char *content,
+					struct strbuf *err)
+{
+	struct lock_file *lock = xcalloc(1, sizeof(*lock));
+	struct strbuf path = STRBUF_INIT;
+	int fd;
+
+	strbuf_addf(&path, "%s/%s", refs->gitdir, refname);
+	fd = hold_lock_file_for_update(lock, path.buf, LOCK_NO_DEREF);
+	if (fd < 0) {
+		unable_to_lock_message(path.buf, errno, err);
+		strbuf_release(&path);
+		return NULL;
+	}
+	if (content &&
+	    (write_in_full(fd, content, strlen(content)) < 0 ||
+	     close_lock_file(lock))) {
+		strbuf_addf(err, "couldn't write '%s'", get_lock_file_path(lock));
+		rollback_lock_file(lock);
+		strbuf_release(&path);
+		return NULL;
+	}
+	strbuf_release(&path);
+	return lock;
+}
+
+/* Transactions */
+
+struct reftable_transaction_data {
+	/* The updates of the main and worktree stacks: */
+	struct table_update tables[2];
+
+	/* The lock on HEAD, if HEAD itself is being written: */
+	struct lock_file *head_lock;
+	int head_deleted;
+
+	/* The updates of pseudorefs, handed to the files backend: */
+	struct ref_transaction *loose_transaction;
+};
+
+static struct table_update *table_update_for(struct reftable_ref_store *refs,
+					     struct reftable_transaction_data *data,
+					     const char *refname)
+{
+	return &data->tables[stack_for(refs, refname) != refs->main_stack];
+}
+
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	struct strbuf err = STRBUF_INIT;
+
+	if (data) {
+		table_update_release(&data->tables[0]);
+		table_update_release(&data->tables[1]);
+		if (data->head_lock)
+			rollback_lock_file(data->head_lock);
+		if (data->loose_transaction) {
+			if (data->loose_transaction->state == REF_TRANSACTION_PREPARED)
+				ref_transaction_abort(data->loose_transaction, &err);
+			else
+				ref_transaction_free(data->loose_transaction);
+		}
+		free(data);
+		transaction->backend_data = NULL;
+	}
+	strbuf_release(&err);
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   !oidcmp(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/*
+ * Record the value that update's reference had before the
+ * transaction in its old_oid (which is no longer needed for checking
+ * at this point), and in those of the symref updates it was split
+ * off from, for use in the reflog entries.
+ */
+static void record_old_oid(struct ref_update *update,
+			   const struct object_id *oid)
+{
+	for (; update; update = update->parent_update)
+		oidcpy(&update->old_oid, oid);
+}
+
+static int check_new_object(struct ref_update *update, struct strbuf *err)
+{
+	struct object *o = parse_object(&update->new_oid);
+
+	if (!o) {
+		strbuf_addf(err,
+			    "trying to write ref '%s' with nonexistent object %s",
+			    update->refname, oid_to_hex(&update->new_oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(update->refname)) {
+		strbuf_addf(err,
+			    "trying to write non-commit object %s to branch '%s'",
+			    oid_to_hex(&update->new_oid), update->refname);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NODEREF set. Split it into a REF_LOG_ONLY update of the symref
+ * and a new update of the referent, like files-backend does.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+	if (!is_table_ref(referent)) {
+		strbuf_addf(err, "cannot update '%s' via symref '%s'",
+			    referent, update->refname);
+		return TRANSACTION_GENERIC_ERROR;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			update->new_oid.hash, update->old_oid.hash,
+			update->msg);
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NODEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	string_list_insert(affected_refnames, new_update->refname)->util =
+		new_update;
+	return 0;
+}
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct ref_update *new_update;
+
+	if (!head_ref || strcmp(update->refname, head_ref) ||
+	    (update->flags & (REF_LOG_ONLY | REF_ISPRUNING |
+			      REF_UPDATE_VIA_HEAD)))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			(update->flags & ~REF_HAVE_OLD) | REF_LOG_ONLY | REF_NODEREF,
+			update->new_oid.hash, NULL, update->msg);
+	oidcpy(&new_update->old_oid, &update->old_oid);
+
+	string_list_insert(affected_refnames, "HEAD")->util = new_update;
+	return 0;
+}
+
+static int prepare_head_update(struct reftable_ref_store *refs,
+			       struct reftable_transaction_data *data,
+			       struct ref_update *update,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct strbuf referent = STRBUF_INIT;
+	struct object_id oid;
+	unsigned int type = 0;
+	int ret = 0;
+
+	/* A REF_LOG_ONLY update of HEAD only needs its reflog entry. */
+	if (update->flags & REF_LOG_ONLY)
+		return 0;
+
+	if (refs_read_raw_ref(refs->loose_refs, "HEAD", oid.hash,
+			      &referent, &type))
+		oidclr(&oid);
+	else if ((type & REF_ISSYMREF) && !(update->flags & REF_NODEREF)) {
+		ret = split_symref_update(update, referent.buf, transaction,
+					  affected_refnames, err);
+		goto out;
+	} else if ((type & REF_ISSYMREF) &&
+		   refs_read_ref_full(&refs->base, referent.buf, 0,
+				      oid.hash, NULL)) {
+		oidclr(&oid);
+	}
+
+	if (check_old_oid(update, &oid, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	record_old_oid(update, &oid);
+
+	if (!(update->flags & REF_HAVE_NEW))
+		goto out;
+	if (update->flags & REF_DELETING) {
+		data->head_lock = lock_loose_ref(refs, "HEAD", NULL, err);
+		data->head_deleted = 1;
+	} else if (!(type & REF_ISSYMREF) && !oidcmp(&oid, &update->new_oid)) {
+		goto out;
+	} else if (check_new_object(update, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	} else {
+		char content[GIT_SHA1_HEXSZ + 2];
+
+		xsnprintf(content, sizeof(content), "%s\n",
+			  oid_to_hex(&update->new_oid));
+		data->head_lock = lock_loose_ref(refs, "HEAD", content, err);
+	}
+	if (!data->head_lock) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	update->flags |= REF_NEEDS_COMMIT;
+
+out:
+	strbuf_release(&referent);
+	return ret;
+}
+
+static int prepare_table_update(struct reftable_ref_store *refs,
+				struct reftable_transaction_data *data,
+				struct ref_update *update,
+				struct ref_transaction *transaction,
+				const char *head_ref,
+				struct string_list *affected_refnames,
+				struct strbuf *err)
+{
+	struct reftable_stack *st = stack_for(refs, update->refname);
+	struct table_update *u = table_update_for(refs, data, update->refname);
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct object_id oid;
+	int exists, ret = 0;
+
+	if (table_update_lock(u, st, err))
+		return TRANSACTION_GENERIC_ERROR;
+
+	exists = reftable_stack_read_ref(st, update->refname, &ref);
+	if (exists < 0) {
+		strbuf_addf(err, "cannot lock ref '%s': unable to read reftables",
+			    original_update_refname(update));
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	exists = !exists;
+
+	if (exists && ref.type == REFTABLE_REF_SYMREF &&
+	    !(update->flags & REF_NODEREF)) {
+		ret = split_symref_update(update, ref.target.buf, transaction,
+					  affected_refnames, err);
+		goto out;
+	}
+
+	if (!exists && (update->flags & REF_HAVE_OLD) &&
+	    !is_null_oid(&update->old_oid)) {
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "unable to resolve reference '%s'",
+			    original_update_refname(update), update->refname);
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+
+	if (!exists)
+		oidclr(&oid);
+	else if (ref.type != REFTABLE_REF_SYMREF)
+		oidcpy(&oid, &ref.oid);
+	else if (refs_read_ref_full(&refs->base, ref.target.buf, 0,
+				    oid.hash, NULL))
+		oidclr(&oid);
+
+	if (check_old_oid(update, &oid, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	record_old_oid(update, &oid);
+
+	ret = split_head_update(update, transaction, head_ref,
+				affected_refnames, err);
+	if (ret || !(update->flags & REF_HAVE_NEW) ||
+	    (update->flags & REF_LOG_ONLY))
+		goto out;
+
+	if (update->flags & REF_DELETING) {
+		if (exists)
+			update->flags |= REF_NEEDS_COMMIT;
+		goto out;
+	}
+	if (exists && ref.type != REFTABLE_REF_SYMREF &&
+	    !oidcmp(&oid, &update->new_oid))
+		/* The reference already has the desired value. */
+		goto out;
+
+	if (check_new_object(update, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	if (!exists &&
+	    refs_verify_refname_available(&refs->base, update->refname,
+					  affected_refnames, NULL, err)) {
+		ret = TRANSACTION_NAME_CONFLICT;
+		goto out;
+	}
+	update->flags |= REF_NEEDS_COMMIT;
+
+out:
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+/*
+ * Pass an update of a pseudoref on to the files backend, unless it
+ * is a symref into refs/ that we have to update ourselves.
+ */
+static int prepare_loose_update(struct reftable_ref_store *refs,
+				struct reftable_transaction_data *data,
+				struct ref_update *update,
+				struct ref_transaction *transaction,
+				struct string_list *affected_refnames,
+				struct strbuf *err)
+{
+	struct strbuf referent = STRBUF_INIT;
+	unsigned char sha1[20];
+	unsigned int type = 0;
+	int ret = 0;
+
+	if (!(update->flags & REF_NODEREF) &&
+	    !refs_read_raw_ref(refs->loose_refs, update->refname, sha1,
+			       &referent, &type) &&
+	    (type & REF_ISSYMREF)) {
+		ret = split_symref_update(update, referent.buf, transaction,
+					  affected_refnames, err);
+		if (ret)
+			goto out;
+	}
+
+	/*
+	 * The files backend would resolve symrefs among its own
+	 * references only, so check the old value here.
+	 */
+	if (update->flags & REF_HAVE_OLD) {
+		struct object_id oid;
+
+		if (!refs_resolve_ref_unsafe(&refs->base, update->refname, 0,
+					     oid.hash, NULL))
+			oidclr(&oid);
+		if (check_old_oid(update, &oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+	}
+
+	if (!data->loose_transaction)
+		data->loose_transaction =
+			ref_store_transaction_begin(refs->loose_refs, err);
+	ref_transaction_add_update(data->loose_transaction, update->refname,
+				   update->flags & ~(REF_DELETING | REF_HAVE_OLD),
+				   update->new_oid.hash, update->old_oid.hash,
+				   update->msg);
+
+out:
+	strbuf_release(&referent);
+	return ret;
+}
+
+/*
+ * Turn the prepared updates into table records and write the new
+ * tables (but don't put them on the stacks yet).
+ */
+static int write_transaction_tables(struct reftable_ref_store *refs,
+				    struct reftable_transaction_data *data,
+				    struct ref_transaction *transaction,
+				    struct strbuf *err)
+{
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_stack *st = stack_for(refs, update->refname);
+		struct table_update *u =
+			table_update_for(refs, data, update->refname);
+
+		if (!is_table_reflog(update->refname) ||
+		    !(update->flags & (REF_NEEDS_COMMIT | REF_LOG_ONLY)))
+			continue;
+		if (table_update_lock(u, st, err))
+			return TRANSACTION_GENERIC_ERROR;
+
+		if (update->flags & REF_NEEDS_COMMIT) {
+			if (update->flags & REF_DELETING) {
+				if (is_table_ref(update->refname))
+					add_ref_record(u, update->refname,
+						       REFTABLE_REF_DELETION);
+				if (delete_reflog_entries(u, st, update->refname,
+							  NULL, 0)) {
+					strbuf_addf(err, "unable to read reflog of '%s'",
+						    update->refname);
+					return TRANSACTION_GENERIC_ERROR;
+				}
+				continue;
+			}
+			if (is_table_ref(update->refname))
+				oidcpy(&add_ref_record(u, update->refname,
+						       REFTABLE_REF_VAL1)->oid,
+				       &update->new_oid);
+		}
+		if (should_write_reflog(st, update->refname, update->flags))
+			add_reflog_entry(u, update->refname, &update->old_oid,
+					 &update->new_oid, update->msg);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(data->tables); i++) {
+		struct table_update *u = &data->tables[i];
+
+		if (u->locked && table_update_write(u, err))
+			return TRANSACTION_GENERIC_ERROR;
+	}
+	return 0;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct reftable_transaction_data *data;
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	char *head_ref = NULL;
+	int head_type;
+	struct object_id head_oid;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	data = xcalloc(1, sizeof(*data));
+	table_update_init(&data->tables[0]);
+	table_update_init(&data->tables[1]);
+	transaction->backend_data = data;
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+
+		string_list_append(&affected_refnames, update->refname)->util =
+			update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * If HEAD is a symbolic reference, then record the name of the
+	 * reference that it points to, so that a direct update of that
+	 * reference is logged in the reflog of HEAD, too (see the
+	 * comment in files_transaction_prepare()).
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       head_oid.hash, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF)) {
+		free(head_ref);
+		head_ref = NULL;
+	}
+
+	/*
+	 * Lock the stacks, check the old values and decide what needs
+	 * to be written. This might append more updates to the
+	 * transaction.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+
+		if ((update->flags & REF_HAVE_NEW) &&
+		    is_null_oid(&update->new_oid))
+			update->flags |= REF_DELETING;
+
+		if (!strcmp(update->refname, "HEAD")) {
+			ret = prepare_head_update(refs, data, update,
+						  transaction,
+						  &affected_refnames, err);
+		} else if (is_table_ref(update->refname)) {
+			ret = prepare_table_update(refs, data, update,
+						   transaction, head_ref,
+						   &affected_refnames, err);
+		} else {
+			ret = prepare_loose_update(refs, data, update,
+						   transaction,
+						   &affected_refnames, err);
+		}
+		if (ret)
+			goto cleanup;
+	}
+
+	ret = write_transaction_tables(refs, data, transaction, err);
+	if (!ret && data->loose_transaction)
+		ret = ref_transaction_prepare(data->loose_transaction, err);
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, 0, "ref_transaction_finish");
+	struct reftable_transaction_data *data = transaction->backend_data;
+	int ret = 0;
+
+	assert(err);
+
+	if (!data)
+		goto cleanup;
+
+	if (data->tables[0].locked &&
+	    table_update_commit(refs, &data->tables[0], refs->main_stack, err))
+		ret = TRANSACTION_GENERIC_ERROR;
+	else if (data->tables[1].locked &&
+		 table_update_commit(refs, &data->tables[1],
+				     refs->worktree_stack, err))
+		ret = TRANSACTION_GENERIC_ERROR;
+	if (ret)
+		goto cleanup;
+
+	if (data->head_lock) {
+		if (data->head_deleted) {
+			struct strbuf path = STRBUF_INIT;
+
+			strbuf_addf(&path, "%s/HEAD", refs->gitdir);
+			if (unlink_or_msg(path.buf, err))
+				ret = TRANSACTION_GENERIC_ERROR;
+			strbuf_release(&path);
+			rollback_lock_file(data->head_lock);
+		} else if (commit_lock_file(data->head_lock)) {
+			strbuf_addstr(err, "couldn't set 'HEAD'");
+			ret = TRANSACTION_GENERIC_ERROR;
+		}
+		data->head_lock = NULL;
+		if (ret)
+			goto cleanup;
+	}
+
+	if (data->loose_transaction) {
+		ret = ref_transaction_commit(data->loose_transaction, err);
+		ref_transaction_free(data->loose_transaction);
+		data->loose_transaction = NULL;
+	}
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	int ret = reftable_transaction_prepare(ref_store, transaction, err);
+
+	if (ret)
+		return ret;
+	return reftable_transaction_finish(ref_store, transaction, err);
+}
+
+/* Other updates */
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_compact(refs->main_stack,
+				   REFTABLE_COMPACT_ALL | REFTABLE_COMPACT_PEEL,
+				   &err) ||
+	    (refs->worktree_stack &&
+	     reftable_stack_compact(refs->worktree_stack,
+				    REFTABLE_COMPACT_ALL, &err)))
+		ret = error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct reftable_stack *st = stack_for(refs, refname);
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct table_update u;
+	struct strbuf err = STRBUF_INIT;
+	struct object_id old_oid, new_oid;
+	struct lock_file *head_lock = NULL;
+	int ret = 0;
+
+	if (!is_table_reflog(refname))
+		return refs_create_symref(refs->loose_refs, refname, target,
+					  logmsg);
+
+	table_update_init(&u);
+	if (table_update_lock(&u, st, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	if (refs_read_ref_full(ref_store, refname, 0, old_oid.hash, NULL))
+		oidclr(&old_oid);
+
+	if (is_table_ref(refname)) {
+		if (reftable_stack_read_ref(st, refname, &ref) > 0 &&
+		    refs_verify_refname_available(ref_store, refname,
+						  NULL, NULL, &err)) {
+			ret = error("%s", err.buf);
+			goto out;
+		}
+		strbuf_addstr(&add_ref_record(&u, refname,
+					      REFTABLE_REF_SYMREF)->target,
+			      target);
+	} else {
+		struct strbuf content = STRBUF_INIT;
+
+		strbuf_addf(&content, "ref: %s\n", target);
+		head_lock = lock_loose_ref(refs, refname, content.buf, &err);
+		strbuf_release(&content);
+		if (!head_lock) {
+			ret = error("%s", err.buf);
+			goto out;
+		}
+	}
+
+	if (logmsg &&
+	    !refs_read_ref_full(ref_store, target, RESOLVE_REF_READING,
+				new_oid.hash, NULL) &&
+	    should_write_reflog(st, refname, 0))
+		add_reflog_entry(&u, refname, &old_oid, &new_oid, logmsg);
+
+	if (head_lock && commit_lock_file(head_lock)) {
+		ret = error("unable to write symref for %s: %s", refname,
+			    strerror(errno));
+		goto out;
+	}
+	if (table_update_commit(refs, &u, st, &err))
+		ret = error("%s", err.buf);
+
+out:
+	table_update_release(&u);
+	reftable_ref_record_release(&ref);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	int i, ret = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	for (i = 0; transaction && i < refnames->nr; i++) {
+		const char *refname = refnames->items[i].string;
+
+		/* Pseudorefs are deleted directly, as in refs_delete_ref(). */
+		if (ref_type(refname) == REF_TYPE_PSEUDOREF) {
+			if (refs_delete_ref(ref_store, msg, refname, NULL, flags))
+				ret = error(_("could not remove reference %s"),
+					    refname);
+			continue;
+		}
+		if (ref_transaction_delete(transaction, refname,
+					   NULL, flags, msg, &err))
+			break;
+	}
+	if (!transaction || i < refnames->nr ||
+	    ref_transaction_commit(transaction, &err)) {
+		if (refnames->nr == 1)
+			ret = error(_("could not delete reference %s: %s"),
+				    refnames->items[0].string, err.buf);
+		else
+			ret = error(_("could not delete references: %s"),
+				    err.buf);
+	}
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int uint64_cmp_desc(const void *va, const void *vb)
+{
+	uint64_t a = *(const uint64_t *)va, b = *(const uint64_t *)vb;
+
+	return a < b ? 1 : a > b ? -1 : 0;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct reftable_stack *st = stack_for(refs, oldrefname);
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it = NULL;
+	struct table_update u;
+	struct strbuf err = STRBUF_INIT;
+	uint64_t *copied = NULL;
+	size_t copied_nr = 0, copied_alloc = 0;
+	int ret = 0;
+
+	table_update_init(&u);
+
+	if (!is_table_ref(oldrefname) || !is_table_ref(newrefname) ||
+	    st != stack_for(refs, newrefname))
+		return error("renaming '%s' to '%s' is not supported",
+			     oldrefname, newrefname);
+
+	if (!refs_rename_ref_available(ref_store, oldrefname, newrefname))
+		return 1;
+
+	if (table_update_lock(&u, st, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	if (reftable_stack_read_ref(st, oldrefname, &ref)) {
+		ret = error("refname %s not found", oldrefname);
+		goto out;
+	}
+	if (ref.type == REFTABLE_REF_SYMREF) {
+		ret = error("refname %s is a symbolic ref, renaming it is not supported",
+			    oldrefname);
+		goto out;
+	}
+
+	/*
+	 * Renaming a branch onto itself (as "git branch -M" does) only
+	 * adds the reflog entry.
+	 */
+	if (strcmp(oldrefname, newrefname)) {
+		add_ref_record(&u, oldrefname, REFTABLE_REF_DELETION);
+		oidcpy(&add_ref_record(&u, newrefname, REFTABLE_REF_VAL1)->oid,
+		       &ref.oid);
+
+		/* Move the reflog entries over to the new name... */
+		it = reftable_stack_logs(st, oldrefname);
+		while (it && !(ret = reftable_iterator_next_log(it, &log))) {
+			struct reftable_log_record *copy =
+				add_log_record(&u, newrefname, log.update_index,
+					       REFTABLE_LOG_UPDATE);
+
+			oidcpy(&copy->old_oid, &log.old_oid);
+			oidcpy(&copy->new_oid, &log.new_oid);
+			strbuf_addbuf(&copy->ident, &log.ident);
+			copy->time = log.time;
+			copy->tz = log.tz;
+			strbuf_addbuf(&copy->message, &log.message);
+			add_log_record(&u, oldrefname, log.update_index,
+				       REFTABLE_LOG_DELETION);
+			ALLOC_GROW(copied, copied_nr + 1, copied_alloc);
+			copied[copied_nr++] = log.update_index;
+		}
+		reftable_iterator_free(it);
+		if (!it || ret < 0) {
+			ret = error("unable to read reflog of '%s'", oldrefname);
+			goto out;
+		}
+
+		/* ...replacing those that the new name might have had. */
+		QSORT(copied, copied_nr, uint64_cmp_desc);
+		if (delete_reflog_entries(&u, st, newrefname, copied, copied_nr)) {
+			ret = error("unable to read reflog of '%s'", newrefname);
+			goto out;
+		}
+	}
+
+	if (should_write_reflog(st, newrefname,
+				copied_nr ? REF_FORCE_CREATE_REFLOG : 0))
+		add_reflog_entry(&u, newrefname, &ref.oid, &ref.oid, logmsg);
+
+	if (table_update_commit(refs, &u, st, &err))
+		ret = error("unable to rename '%s' to '%s': %s",
+			    oldrefname, newrefname, err.buf);
+	else
+		ret = 0;
+
+out:
+	table_update_release(&u);
+	reftable_ref_record_release(&ref);
+	reftable_log_record_release(&log);
+	free(copied);
+	strbuf_release(&err);
+	return ret;
+}
+
+/* Reflogs */
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct ref_store *ref_store;
+	struct string_list refnames;
+	size_t next;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	while (iter->next < iter->refnames.nr) {
+		const char *refname = iter->refnames.items[iter->next++].string;
+		int flags;
+
+		if (refs_read_ref_full(iter->ref_store, refname, 0,
+				       iter->oid.hash, &flags)) {
+			error("bad ref for %s", refname);
+			continue;
+		}
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	return ref_iterator_abort(ref_iterator);
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	die("BUG: ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	string_list_clear(&iter->refnames, 0);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+/* Add the names of the references that have reflogs in st to list. */
+static void collect_reflog_names(struct reftable_stack *st,
+				 struct string_list *list,
+				 int skip_per_worktree, int per_worktree_only)
+{
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it = reftable_stack_logs(st, NULL);
+	const char *last = NULL;
+
+	if (!it)
+		die_errno("unable to read reftables");
+	while (!reftable_iterator_next_log(it, &log)) {
+		int per_worktree =
+			ref_type(log.refname.buf) == REF_TYPE_PER_WORKTREE;
+
+		if (last && !strcmp(last, log.refname.buf))
+			continue;
+		if (per_worktree ? skip_per_worktree : per_worktree_only)
+			continue;
+		last = string_list_append(list, log.refname.buf)->string;
+	}
+	reftable_iterator_free(it);
+	reftable_log_record_release(&log);
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+	struct reftable_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+	struct ref_iterator *loose_iter;
+
+	base_ref_iterator_init(ref_iterator, &reftable_reflog_iterator_vtable);
+	iter->ref_store = ref_store;
+	string_list_init(&iter->refnames, 1);
+
+	collect_reflog_names(refs->main_stack, &iter->refnames,
+			     !!refs->worktree_stack, 0);
+	if (refs->worktree_stack)
+		collect_reflog_names(refs->worktree_stack, &iter->refnames,
+				     0, 1);
+
+	/* The pseudorefs might have reflogs in the files backend: */
+	loose_iter = refs->loose_refs->be->reflog_iterator_begin(refs->loose_refs);
+	while (ref_iterator_advance(loose_iter) == ITER_OK)
+		if (!is_table_reflog(loose_iter->refname))
+			string_list_append(&iter->refnames, loose_iter->refname);
+
+	string_list_sort(&iter->refnames);
+	string_list_remove_duplicates(&iter->refnames, 0);
+	return ref_iterator;
+}
+
+/*
+ * Collect the live reflog entries of refname, newest first, leaving
+ * out the entries that only mark the existence of the reflog.
+ */
+static int read_reflog(struct reftable_ref_store *refs, const char *refname,
+		       struct reftable_log_record **entries, size_t *nr)
+{
+	struct reftable_iterator *it =
+		reftable_stack_logs(stack_for(refs, refname), refname);
+	size_t alloc = 0;
+	int ret;
+
+	*entries = NULL;
+	*nr = 0;
+	if (!it)
+		return error("unable to read reflog of '%s'", refname);
+	for (;;) {
+		struct reftable_log_record blank = REFTABLE_LOG_RECORD_INIT;
+
+		ALLOC_GROW(*entries, *nr + 1, alloc);
+		(*entries)[*nr] = blank;
+		ret = reftable_iterator_next_log(it, &(*entries)[*nr]);
+		if (ret)
+			break;
+		if (is_null_oid(&(*entries)[*nr].old_oid) &&
+		    is_null_oid(&(*entries)[*nr].new_oid))
+			reftable_log_record_release(&(*entries)[*nr]);
+		else
+			(*nr)++;
+	}
+	reftable_log_record_release(&(*entries)[*nr]);
+	reftable_iterator_free(it);
+	return ret < 0 ? error("unable to read reflog of '%s'", refname) : 0;
+}
+
+static void free_reflog(struct reftable_log_record *entries, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		reftable_log_record_release(&entries[i]);
+	free(entries);
+}
+
+static int show_reflog_entry(struct reftable_log_record *log,
+			     struct strbuf *message,
+			     each_reflog_ent_fn fn, void *cb_data)
+{
+	strbuf_reset(message);
+	strbuf_addbuf(message, &log->message);
+	strbuf_addch(message, '\n');
+	return fn(&log->old_oid, &log->new_oid, log->ident.buf,
+		  log->time, log->tz, message->buf, cb_data);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse");
+	struct reftable_log_record *entries;
+	struct strbuf message = STRBUF_INIT;
+	size_t nr, i;
+	int ret = 0;
+
+	if (!is_table_reflog(refname))
+		return refs_for_each_reflog_ent_reverse(refs->loose_refs,
+							refname, fn, cb_data);
+
+	if (read_reflog(refs, refname, &entries, &nr))
+		return -1;
+	for (i = 0; !ret && i < nr; i++)
+		ret = show_reflog_entry(&entries[i], &message, fn, cb_data);
+	free_reflog(entries, nr);
+	strbuf_release(&message);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct reftable_log_record *entries;
+	struct strbuf message = STRBUF_INIT;
+	size_t nr, i;
+	int ret = 0;
+
+	if (!is_table_reflog(refname))
+		return refs_for_each_reflog_ent(refs->loose_refs, refname,
+						fn, cb_data);
+
+	if (read_reflog(refs, refname, &entries, &nr))
+		return -1;
+	for (i = nr; !ret && i--; )
+		ret = show_reflog_entry(&entries[i], &message, fn, cb_data);
+	free_reflog(entries, nr);
+	strbuf_release(&message);
+	return ret;
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+
+	if (!is_table_reflog(refname))
+		return refs_reflog_exists(refs->loose_refs, refname);
+	return stack_reflog_exists(stack_for(refs, refname), refname);
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct reftable_stack *st = stack_for(refs, refname);
+	struct table_update u;
+	int ret = 0;
+
+	if (!is_table_reflog(refname))
+		return refs_create_reflog(refs->loose_refs, refname,
+					  force_create, err);
+
+	if (!should_write_reflog(st, refname,
+				 force_create ? REF_FORCE_CREATE_REFLOG : 0) ||
+	    stack_reflog_exists(st, refname))
+		return 0;
+
+	/* An entry with null object names marks an empty reflog. */
+	table_update_init(&u);
+	if (table_update_lock(&u, st, err))
+		ret = -1;
+	else
+		add_reflog_entry(&u, refname, &null_oid, &null_oid, NULL);
+	if (!ret)
+		ret = table_update_commit(refs, &u, st, err);
+	table_update_release(&u);
+	return ret;
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct reftable_stack *st = stack_for(refs, refname);
+	struct strbuf err = STRBUF_INIT;
+	struct table_update u;
+	int ret = 0;
+
+	if (!is_table_reflog(refname))
+		return refs_delete_reflog(refs->loose_refs, refname);
+
+	table_update_init(&u);
+	if (table_update_lock(&u, st, &err) ||
+	    delete_reflog_entries(&u, st, refname, NULL, 0) ||
+	    table_update_commit(refs, &u, st, &err))
+		ret = error("unable to delete reflog of '%s': %s",
+			    refname, err.buf);
+	table_update_release(&u);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const unsigned char *sha1,
+				  unsigned int expire_flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct reftable_stack *st = stack_for(refs, refname);
+	struct reftable_log_record *entries = NULL;
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct strbuf err = STRBUF_INIT;
+	struct strbuf message = STRBUF_INIT;
+	struct object_id oid, last_kept_oid;
+	struct table_update u;
+	size_t nr = 0, i;
+	int ret = 0;
+
+	if (!is_table_reflog(refname))
+		return refs_reflog_expire(refs->loose_refs, refname, sha1,
+					  expire_flags, prepare_fn,
+					  should_prune_fn, cleanup_fn,
+					  policy_cb_data);
+
+	table_update_init(&u);
+	if (table_update_lock(&u, st, &err)) {
+		ret = error("cannot lock ref '%s': %s", refname, err.buf);
+		goto out;
+	}
+
+	if (refs_read_ref_full(ref_store, refname, 0, oid.hash, NULL))
+		oidclr(&oid);
+	if (sha1 && hashcmp(oid.hash, sha1)) {
+		ret = error("cannot lock ref '%s': is at %s but expected %s",
+			    refname, oid_to_hex(&oid), sha1_to_hex(sha1));
+		goto out;
+	}
+
+	if (read_reflog(refs, refname, &entries, &nr)) {
+		ret = -1;
+		goto out;
+	}
+
+	(*prepare_fn)(refname, &oid, policy_cb_data);
+
+	oidclr(&last_kept_oid);
+	for (i = nr; i--; ) {
+		struct reftable_log_record *log = &entries[i];
+		struct object_id old_oid;
+
+		oidcpy(&old_oid, (expire_flags & EXPIRE_REFLOGS_REWRITE) ?
+		       &last_kept_oid : &log->old_oid);
+		strbuf_reset(&message);
+		strbuf_addbuf(&message, &log->message);
+		strbuf_addch(&message, '\n');
+
+		if ((*should_prune_fn)(&old_oid, &log->new_oid, log->ident.buf,
+				       log->time, log->tz, message.buf,
+				       policy_cb_data)) {
+			add_log_record(&u, refname, log->update_index,
+				       REFTABLE_LOG_DELETION);
+			continue;
+		}
+		if (oidcmp(&old_oid, &log->old_oid)) {
+			struct reftable_log_record *rewritten =
+				add_log_record(&u, refname, log->update_index,
+					       REFTABLE_LOG_UPDATE);
+
+			oidcpy(&rewritten->old_oid, &old_oid);
+			oidcpy(&rewritten->new_oid, &log->new_oid);
+			strbuf_addbuf(&rewritten->ident, &log->ident);
+			rewritten->time = log->time;
+			rewritten->tz = log->tz;
+			strbuf_addbuf(&rewritten->message, &log->message);
+		}
+		oidcpy(&last_kept_oid, &log->new_oid);
+	}
+
+	(*cleanup_fn)(policy_cb_data);
+
+	if (expire_flags & EXPIRE_REFLOGS_DRY_RUN)
+		goto out;
+
+	if ((expire_flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+	    !is_null_oid(&last_kept_oid) && oidcmp(&last_kept_oid, &oid) &&
+	    is_table_ref(refname) &&
+	    !reftable_stack_read_ref(st, refname, &ref) &&
+	    ref.type != REFTABLE_REF_SYMREF)
+		oidcpy(&add_ref_record(&u, refname, REFTABLE_REF_VAL1)->oid,
+		       &last_kept_oid);
+
+	if (table_update_commit(refs, &u, st, &err))
+		ret = error("unable to write reflog of '%s': %s",
+			    refname, err.buf);
+
+out:
+	table_update_release(&u);
+	free_reflog(entries, nr);
+	reftable_ref_record_release(&ref);
+	strbuf_release(&message);
+	strbuf_release(&err);
+	return ret;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	&refs_be_files,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_peel_ref,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
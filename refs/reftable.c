@@ -0,0 +1,1524 @@
+#include "../cache.h"
+#include "../refs.h"
+#include "../lockfile.h"
+#include "../tempfile.h"
+#include "../varint.h"
+#include "refs-internal.h"
+#include "reftable.h"
+
+#define REFTABLE_VERSION 1
+#define REFTABLE_HEADER_SIZE 24
+#define REFTABLE_FOOTER_SIZE 52
+#define REFTABLE_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16
+#define REFTABLE_MAX_BLOCK_LEN ((1 << 24) - 1)
+#define REFTABLE_LOCK_TIMEOUT_MS 1000
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+static void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = (v >> 16) & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = v & 0xff;
+}
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+	put_be32(p, (uint32_t)(v >> 32));
+	put_be32(p + 4, (uint32_t)(v & 0xffffffff));
+}
+
+static void strbuf_add_varint(struct strbuf *sb, uintmax_t value)
+{
+	unsigned char buf[16];
+
+	strbuf_add(sb, buf, encode_varint(value, buf));
+}
+
+static int key_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+	if (cmp)
+		return cmp;
+	return a_len < b_len ? -1 : a_len != b_len;
+}
+
+/*
+ * The key of a reflog entry is the refname followed by a NUL and the
+ * bitwise complement of the update index, so that the entries of a
+ * reference sort newest first.
+ */
+static void log_record_key(struct strbuf *key, const char *refname,
+			   size_t refname_len, uint64_t update_index)
+{
+	unsigned char buf[8];
+
+	strbuf_reset(key);
+	strbuf_add(key, refname, refname_len);
+	strbuf_addch(key, '\0');
+	put_be64(buf, ~update_index);
+	strbuf_add(key, buf, sizeof(buf));
+}
+
+void reftable_ref_record_release(struct reftable_ref_record *ref)
+{
+	strbuf_release(&ref->refname);
+	strbuf_release(&ref->target);
+}
+
+void reftable_log_record_release(struct reftable_log_record *log)
+{
+	strbuf_release(&log->refname);
+	strbuf_release(&log->ident);
+	strbuf_release(&log->message);
+}
+
+static void ref_record_copy(struct reftable_ref_record *dst,
+			    const struct reftable_ref_record *src)
+{
+	strbuf_reset(&dst->refname);
+	strbuf_addbuf(&dst->refname, &src->refname);
+	dst->update_index = src->update_index;
+	dst->type = src->type;
+	oidcpy(&dst->oid, &src->oid);
+	oidcpy(&dst->peeled, &src->peeled);
+	strbuf_reset(&dst->target);
+	strbuf_addbuf(&dst->target, &src->target);
+}
+
+static void log_record_copy(struct reftable_log_record *dst,
+			    const struct reftable_log_record *src)
+{
+	strbuf_reset(&dst->refname);
+	strbuf_addbuf(&dst->refname, &src->refname);
+	dst->update_index = src->update_index;
+	dst->type = src->type;
+	oidcpy(&dst->old_oid, &src->old_oid);
+	oidcpy(&dst->new_oid, &src->new_oid);
+	strbuf_reset(&dst->ident);
+	strbuf_addbuf(&dst->ident, &src->ident);
+	dst->time = src->time;
+	dst->tz = src->tz;
+	strbuf_reset(&dst->message);
+	strbuf_addbuf(&dst->message, &src->message);
+}
+
+/* Writing tables */
+
+struct index_entry {
+	char *key;
+	size_t key_len;
+	uint64_t offset;
+};
+
+struct reftable_writer {
+	/* The table being written: */
+	struct strbuf out;
+	uint64_t min_update_index, max_update_index;
+
+	/* The block being filled and its state: */
+	uint8_t type;
+	struct strbuf block;
+	struct strbuf block_last_key;
+	uint32_t *restarts;
+	size_t restarts_nr, restarts_alloc;
+	size_t entries;
+
+	/* The last key of each block of the current section: */
+	struct index_entry *index;
+	size_t index_nr, index_alloc;
+	struct strbuf last_key;
+
+	uint64_t ref_index_offset, log_offset, log_index_offset;
+
+	struct strbuf key, value;
+};
+
+static void write_header(unsigned char *buf, uint64_t min_update_index,
+			 uint64_t max_update_index)
+{
+	memcpy(buf, "REFT", 4);
+	buf[4] = REFTABLE_VERSION;
+	put_be24(buf + 5, REFTABLE_BLOCK_SIZE);
+	put_be64(buf + 8, min_update_index);
+	put_be64(buf + 16, max_update_index);
+}
+
+static void writer_init(struct reftable_writer *w,
+			uint64_t min_update_index, uint64_t max_update_index)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE];
+
+	memset(w, 0, sizeof(*w));
+	strbuf_init(&w->out, 0);
+	strbuf_init(&w->block, REFTABLE_BLOCK_SIZE);
+	strbuf_init(&w->block_last_key, 0);
+	strbuf_init(&w->last_key, 0);
+	strbuf_init(&w->key, 0);
+	strbuf_init(&w->value, 0);
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+
+	write_header(header, min_update_index, max_update_index);
+	strbuf_add(&w->out, header, sizeof(header));
+}
+
+static void writer_release(struct reftable_writer *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	free(w->index);
+	free(w->restarts);
+	strbuf_release(&w->out);
+	strbuf_release(&w->block);
+	strbuf_release(&w->block_last_key);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->key);
+	strbuf_release(&w->value);
+}
+
+static void block_start(struct reftable_writer *w, uint8_t type)
+{
+	strbuf_reset(&w->block);
+	strbuf_addch(&w->block, type);
+	strbuf_add(&w->block, "\0\0\0", 3);
+	strbuf_reset(&w->block_last_key);
+	w->restarts_nr = 0;
+	w->entries = 0;
+}
+
+/*
+ * Append a record to the current block. Return -1 (leaving the block
+ * untouched) if the block already holds at least one record and the
+ * new one would make it exceed block_size; a block_size of zero means
+ * that there is no limit.
+ */
+static int block_add(struct reftable_writer *w, size_t block_size,
+		     const char *key, size_t key_len, unsigned int val_type,
+		     const struct strbuf *value)
+{
+	int restart = !(w->entries % REFTABLE_RESTART_INTERVAL);
+	size_t start = w->block.len;
+	size_t prefix = 0;
+
+	if (!restart)
+		while (prefix < key_len && prefix < w->block_last_key.len &&
+		       key[prefix] == w->block_last_key.buf[prefix])
+			prefix++;
+
+	strbuf_add_varint(&w->block, prefix);
+	strbuf_add_varint(&w->block, ((uintmax_t)(key_len - prefix) << 3) | val_type);
+	strbuf_add(&w->block, key + prefix, key_len - prefix);
+	strbuf_addbuf(&w->block, value);
+
+	if (block_size && w->entries &&
+	    w->block.len + 3 * (w->restarts_nr + restart) + 2 > block_size) {
+		strbuf_setlen(&w->block, start);
+		return -1;
+	}
+
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] = start;
+	}
+	w->entries++;
+	strbuf_reset(&w->block_last_key);
+	strbuf_add(&w->block_last_key, key, key_len);
+	return 0;
+}
+
+/* Terminate the current block and append it to the table. */
+static int block_finish(struct reftable_writer *w)
+{
+	unsigned char buf[3];
+	size_t i;
+
+	for (i = 0; i < w->restarts_nr; i++) {
+		put_be24(buf, w->restarts[i]);
+		strbuf_add(&w->block, buf, 3);
+	}
+	strbuf_addch(&w->block, (w->restarts_nr >> 8) & 0xff);
+	strbuf_addch(&w->block, w->restarts_nr & 0xff);
+
+	if (w->block.len > REFTABLE_MAX_BLOCK_LEN || w->restarts_nr > 0xffff)
+		return error("reftable block too large");
+	put_be24((unsigned char *)w->block.buf + 1, w->block.len);
+	strbuf_addbuf(&w->out, &w->block);
+	return 0;
+}
+
+static int writer_flush_block(struct reftable_writer *w)
+{
+	struct index_entry *entry;
+
+	if (!w->entries)
+		return 0;
+
+	ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+	entry = &w->index[w->index_nr++];
+	entry->key = xmemdupz(w->block_last_key.buf, w->block_last_key.len);
+	entry->key_len = w->block_last_key.len;
+	entry->offset = w->out.len;
+
+	if (block_finish(w))
+		return -1;
+	w->entries = 0;
+	return 0;
+}
+
+/*
+ * Flush the last block of the current section and, if the section
+ * consists of more than one block, write an index block for it.
+ */
+static int writer_finish_section(struct reftable_writer *w)
+{
+	struct strbuf offset = STRBUF_INIT;
+	uint64_t index_offset = 0;
+	size_t i;
+
+	if (writer_flush_block(w))
+		return -1;
+
+	if (w->index_nr > 1) {
+		index_offset = w->out.len;
+		block_start(w, BLOCK_TYPE_INDEX);
+		/*
+		 * Don't use w->value here; it may hold the first record
+		 * of the next section.
+		 */
+		for (i = 0; i < w->index_nr; i++) {
+			strbuf_reset(&offset);
+			strbuf_add_varint(&offset, w->index[i].offset);
+			block_add(w, 0, w->index[i].key, w->index[i].key_len,
+				  0, &offset);
+		}
+		strbuf_release(&offset);
+		if (block_finish(w))
+			return -1;
+	}
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	w->index_nr = 0;
+
+	if (w->type == BLOCK_TYPE_REF)
+		w->ref_index_offset = index_offset;
+	else if (w->type == BLOCK_TYPE_LOG)
+		w->log_index_offset = index_offset;
+	return 0;
+}
+
+static int writer_add(struct reftable_writer *w, uint8_t type,
+		      const char *key, size_t key_len, unsigned int val_type,
+		      const struct strbuf *value)
+{
+	if (w->type != type) {
+		if (type == BLOCK_TYPE_REF && w->type)
+			die("BUG: reftable refs must be written before logs");
+		if (writer_finish_section(w))
+			return -1;
+		w->type = type;
+		if (type == BLOCK_TYPE_LOG)
+			w->log_offset = w->out.len;
+		strbuf_reset(&w->last_key);
+		block_start(w, type);
+	} else if (key_cmp(key, key_len, w->last_key.buf, w->last_key.len) <= 0) {
+		die("BUG: reftable records must be added in strictly increasing order");
+	}
+	strbuf_reset(&w->last_key);
+	strbuf_add(&w->last_key, key, key_len);
+
+	if (!block_add(w, REFTABLE_BLOCK_SIZE, key, key_len, val_type, value))
+		return 0;
+
+	if (writer_flush_block(w))
+		return -1;
+	block_start(w, type);
+	return block_add(w, REFTABLE_BLOCK_SIZE, key, key_len, val_type, value);
+}
+
+static int writer_add_ref(struct reftable_writer *w,
+			  const struct reftable_ref_record *ref)
+{
+	if (ref->update_index < w->min_update_index ||
+	    ref->update_index > w->max_update_index)
+		die("BUG: update index of '%s' out of range for reftable",
+		    ref->refname.buf);
+
+	strbuf_reset(&w->value);
+	strbuf_add_varint(&w->value, ref->update_index - w->min_update_index);
+	switch (ref->type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL1:
+		strbuf_add(&w->value, ref->oid.hash, GIT_SHA1_RAWSZ);
+		break;
+	case REFTABLE_REF_VAL2:
+		strbuf_add(&w->value, ref->oid.hash, GIT_SHA1_RAWSZ);
+		strbuf_add(&w->value, ref->peeled.hash, GIT_SHA1_RAWSZ);
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_add_varint(&w->value, ref->target.len);
+		strbuf_addbuf(&w->value, &ref->target);
+		break;
+	}
+	return writer_add(w, BLOCK_TYPE_REF, ref->refname.buf,
+			  ref->refname.len, ref->type, &w->value);
+}
+
+static int writer_add_log(struct reftable_writer *w,
+			  const struct reftable_log_record *log)
+{
+	log_record_key(&w->key, log->refname.buf, log->refname.len,
+		       log->update_index);
+
+	strbuf_reset(&w->value);
+	if (log->type == REFTABLE_LOG_UPDATE) {
+		strbuf_add(&w->value, log->old_oid.hash, GIT_SHA1_RAWSZ);
+		strbuf_add(&w->value, log->new_oid.hash, GIT_SHA1_RAWSZ);
+		strbuf_add_varint(&w->value, log->ident.len);
+		strbuf_addbuf(&w->value, &log->ident);
+		strbuf_add_varint(&w->value, log->time);
+		strbuf_addch(&w->value, ((uint16_t)log->tz >> 8) & 0xff);
+		strbuf_addch(&w->value, (uint16_t)log->tz & 0xff);
+		strbuf_add_varint(&w->value, log->message.len);
+		strbuf_addbuf(&w->value, &log->message);
+	}
+	return writer_add(w, BLOCK_TYPE_LOG, w->key.buf, w->key.len,
+			  log->type, &w->value);
+}
+
+static int writer_finish(struct reftable_writer *w)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+
+	if (writer_finish_section(w))
+		return -1;
+
+	write_header(footer, w->min_update_index, w->max_update_index);
+	put_be64(footer + 24, w->ref_index_offset);
+	put_be64(footer + 32, w->log_offset);
+	put_be64(footer + 40, w->log_index_offset);
+	put_be32(footer + 48, crc32(0, footer, 48));
+	strbuf_add(&w->out, footer, sizeof(footer));
+	return 0;
+}
+
+/* Reading tables */
+
+struct reftable {
+	char *name;
+	const unsigned char *map;
+	size_t size;
+	uint64_t min_update_index, max_update_index;
+
+	/* The ref blocks occupy [REFTABLE_HEADER_SIZE, ref_end): */
+	size_t ref_end, ref_index_offset;
+
+	/* The log blocks occupy [log_offset, log_end): */
+	size_t log_offset, log_end, log_index_offset;
+
+	unsigned int refcount;
+};
+
+static void release_reftable(struct reftable *t)
+{
+	if (--t->refcount)
+		return;
+	munmap((void *)t->map, t->size);
+	free(t->name);
+	free(t);
+}
+
+static struct reftable *open_reftable(const char *dir, const char *name)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct reftable *t;
+	struct stat st;
+	const unsigned char *footer;
+	size_t footer_start;
+	int fd;
+
+	strbuf_addf(&path, "%s/%s", dir, name);
+	fd = open(path.buf, O_RDONLY);
+	if (fd < 0) {
+		strbuf_release(&path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		int save_errno = errno;
+		close(fd);
+		strbuf_release(&path);
+		errno = save_errno;
+		return NULL;
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->size = xsize_t(st.st_size);
+	if (t->size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE) {
+		close(fd);
+		error("reftable '%s' is too short", path.buf);
+		goto corrupt;
+	}
+	t->map = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	footer_start = t->size - REFTABLE_FOOTER_SIZE;
+	footer = t->map + footer_start;
+	if (memcmp(t->map, "REFT", 4) || t->map[4] != REFTABLE_VERSION ||
+	    memcmp(footer, t->map, REFTABLE_HEADER_SIZE) ||
+	    crc32(0, footer, 48) != get_be32(footer + 48)) {
+		error("reftable '%s' has a bad header or footer", path.buf);
+		goto corrupt;
+	}
+
+	t->min_update_index = get_be64(footer + 8);
+	t->max_update_index = get_be64(footer + 16);
+	t->ref_index_offset = get_be64(footer + 24);
+	t->log_offset = get_be64(footer + 32);
+	t->log_index_offset = get_be64(footer + 40);
+
+	if (t->ref_index_offset)
+		t->ref_end = t->ref_index_offset;
+	else if (t->log_offset)
+		t->ref_end = t->log_offset;
+	else
+		t->ref_end = footer_start;
+	t->log_end = t->log_index_offset ? t->log_index_offset : footer_start;
+
+	if (t->ref_end < REFTABLE_HEADER_SIZE || t->ref_end > footer_start ||
+	    t->log_offset > footer_start || t->log_end > footer_start ||
+	    (t->log_offset && t->log_offset < t->ref_end) ||
+	    (t->log_offset && t->log_end < t->log_offset)) {
+		error("reftable '%s' has invalid section offsets", path.buf);
+		goto corrupt;
+	}
+
+	t->name = xstrdup(name);
+	t->refcount = 1;
+	strbuf_release(&path);
+	return t;
+
+corrupt:
+	if (t->map)
+		munmap((void *)t->map, t->size);
+	free(t);
+	strbuf_release(&path);
+	errno = EINVAL;
+	return NULL;
+}
+
+struct block_reader {
+	const unsigned char *block;
+	uint32_t len;
+	uint32_t restarts_nr;
+
+	/* The offset of the restart table, which follows the records: */
+	uint32_t records_end;
+};
+
+static int block_reader_init(struct block_reader *br, struct reftable *t,
+			     size_t offset, size_t end, uint8_t type)
+{
+	const unsigned char *p = t->map + offset;
+
+	if (offset + 6 > end || p[0] != type)
+		goto corrupt;
+	br->len = get_be24(p + 1);
+	if (br->len < 6 || br->len > end - offset)
+		goto corrupt;
+	br->restarts_nr = get_be16(p + br->len - 2);
+	if (4 + 3 * br->restarts_nr + 2 > br->len)
+		goto corrupt;
+	br->records_end = br->len - 2 - 3 * br->restarts_nr;
+	br->block = p;
+	return 0;
+
+corrupt:
+	return error("reftable '%s' has a corrupt block at offset %"PRIuMAX,
+		     t->name, (uintmax_t)offset);
+}
+
+struct cursor {
+	const unsigned char *p, *end;
+};
+
+static int cursor_varint(struct cursor *c, uintmax_t *value)
+{
+	if (c->p >= c->end)
+		return -1;
+	*value = decode_varint(&c->p);
+	return c->p > c->end ? -1 : 0;
+}
+
+static int cursor_bytes(struct cursor *c, size_t len, const unsigned char **out)
+{
+	if (len > c->end - c->p)
+		return -1;
+	*out = c->p;
+	c->p += len;
+	return 0;
+}
+
+static int cursor_oid(struct cursor *c, struct object_id *oid)
+{
+	const unsigned char *p;
+
+	if (cursor_bytes(c, GIT_SHA1_RAWSZ, &p))
+		return -1;
+	hashcpy(oid->hash, p);
+	return 0;
+}
+
+static int cursor_strbuf(struct cursor *c, struct strbuf *sb)
+{
+	const unsigned char *p;
+	uintmax_t len;
+
+	if (cursor_varint(c, &len) || cursor_bytes(c, len, &p))
+		return -1;
+	strbuf_reset(sb);
+	strbuf_add(sb, p, len);
+	return 0;
+}
+
+/*
+ * Decode the key of the record at c->p, which is prefix-compressed
+ * against the previous key stored in `key`.
+ */
+static int decode_key(struct cursor *c, struct strbuf *key,
+		      unsigned int *val_type)
+{
+	const unsigned char *p;
+	uintmax_t prefix, suffix;
+
+	if (cursor_varint(c, &prefix) || cursor_varint(c, &suffix))
+		return -1;
+	*val_type = suffix & 7;
+	suffix >>= 3;
+	if (prefix > key->len || cursor_bytes(c, suffix, &p))
+		return -1;
+	strbuf_setlen(key, prefix);
+	strbuf_add(key, p, suffix);
+	return 0;
+}
+
+/*
+ * Return the offset within the block of the last restart point whose
+ * key is not greater than key, or of the first record if there is no
+ * such restart point.
+ */
+static uint32_t restart_seek(const struct block_reader *br,
+			     const char *key, size_t key_len)
+{
+	struct strbuf restart_key = STRBUF_INIT;
+	const unsigned char *table = br->block + br->records_end;
+	size_t lo = 0, hi = br->restarts_nr;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		struct cursor c;
+		unsigned int val_type;
+
+		c.p = br->block + get_be24(table + 3 * mid);
+		c.end = br->block + br->records_end;
+		strbuf_reset(&restart_key);
+		if (c.p < br->block + 4 || c.p > c.end ||
+		    decode_key(&c, &restart_key, &val_type) ||
+		    key_cmp(restart_key.buf, restart_key.len, key, key_len) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	strbuf_release(&restart_key);
+
+	if (!lo)
+		return 4;
+	return get_be24(table + 3 * (lo - 1));
+}
+
+struct table_iter {
+	struct reftable *t;
+	uint8_t type;
+	size_t block_offset, section_end;
+	struct block_reader br;
+	uint32_t pos;
+	int done;
+
+	/* The current record: */
+	struct strbuf key;
+	struct reftable_ref_record ref;
+	struct reftable_log_record log;
+};
+
+#define TABLE_ITER_INIT { NULL, 0, 0, 0, { NULL, 0, 0, 0 }, 0, 0, \
+			  STRBUF_INIT, REFTABLE_REF_RECORD_INIT, \
+			  REFTABLE_LOG_RECORD_INIT }
+
+static void table_iter_release(struct table_iter *ti)
+{
+	strbuf_release(&ti->key);
+	reftable_ref_record_release(&ti->ref);
+	reftable_log_record_release(&ti->log);
+}
+
+static int table_iter_decode(struct table_iter *ti)
+{
+	struct cursor c;
+	unsigned int val_type;
+	uintmax_t value;
+	const unsigned char *p;
+
+	c.p = ti->br.block + ti->pos;
+	c.end = ti->br.block + ti->br.records_end;
+	if (decode_key(&c, &ti->key, &val_type))
+		goto corrupt;
+
+	if (ti->type == BLOCK_TYPE_REF) {
+		struct reftable_ref_record *ref = &ti->ref;
+
+		strbuf_reset(&ref->refname);
+		strbuf_addbuf(&ref->refname, &ti->key);
+		if (cursor_varint(&c, &value))
+			goto corrupt;
+		ref->update_index = ti->t->min_update_index + value;
+		ref->type = val_type;
+		switch (val_type) {
+		case REFTABLE_REF_DELETION:
+			break;
+		case REFTABLE_REF_VAL2:
+			if (cursor_oid(&c, &ref->oid) ||
+			    cursor_oid(&c, &ref->peeled))
+				goto corrupt;
+			break;
+		case REFTABLE_REF_VAL1:
+			if (cursor_oid(&c, &ref->oid))
+				goto corrupt;
+			break;
+		case REFTABLE_REF_SYMREF:
+			if (cursor_strbuf(&c, &ref->target))
+				goto corrupt;
+			break;
+		default:
+			goto corrupt;
+		}
+	} else {
+		struct reftable_log_record *log = &ti->log;
+
+		if (ti->key.len < 9 || ti->key.buf[ti->key.len - 9])
+			goto corrupt;
+		strbuf_reset(&log->refname);
+		strbuf_add(&log->refname, ti->key.buf, ti->key.len - 9);
+		log->update_index =
+			~get_be64((unsigned char *)ti->key.buf + ti->key.len - 8);
+		log->type = val_type;
+		if (val_type == REFTABLE_LOG_UPDATE) {
+			if (cursor_oid(&c, &log->old_oid) ||
+			    cursor_oid(&c, &log->new_oid) ||
+			    cursor_strbuf(&c, &log->ident) ||
+			    cursor_varint(&c, &value) ||
+			    cursor_bytes(&c, 2, &p) ||
+			    cursor_strbuf(&c, &log->message))
+				goto corrupt;
+			log->time = value;
+			log->tz = (int16_t)((p[0] << 8) | p[1]);
+		} else if (val_type != REFTABLE_LOG_DELETION) {
+			goto corrupt;
+		}
+	}
+
+	ti->pos = c.p - ti->br.block;
+	return 0;
+
+corrupt:
+	return error("reftable '%s' has a corrupt record in block at offset %"PRIuMAX,
+		     ti->t->name, (uintmax_t)ti->block_offset);
+}
+
+/*
+ * Load the next record into ti. Return 0 on success, 1 at the end of
+ * the section, or -1 on error.
+ */
+static int table_iter_next(struct table_iter *ti)
+{
+	while (ti->pos >= ti->br.records_end) {
+		ti->block_offset += ti->br.len;
+		if (ti->block_offset >= ti->section_end) {
+			ti->done = 1;
+			return 1;
+		}
+		if (block_reader_init(&ti->br, ti->t, ti->block_offset,
+				      ti->section_end, ti->type))
+			return -1;
+		ti->pos = 4;
+		strbuf_reset(&ti->key);
+	}
+	return table_iter_decode(ti);
+}
+
+/*
+ * Find the offset of the block that could contain key by looking it
+ * up in the index block at index_offset. Return 1 if key is greater
+ * than every key in the section.
+ */
+static int index_seek(struct reftable *t, size_t index_offset,
+		      const char *key, size_t key_len, size_t *block_offset)
+{
+	struct block_reader br;
+	struct strbuf index_key = STRBUF_INIT;
+	struct cursor c;
+	int ret = 1;
+
+	if (block_reader_init(&br, t, index_offset,
+			      t->size - REFTABLE_FOOTER_SIZE, BLOCK_TYPE_INDEX))
+		return -1;
+
+	c.p = br.block + restart_seek(&br, key, key_len);
+	c.end = br.block + br.records_end;
+	while (c.p < c.end) {
+		unsigned int val_type;
+		uintmax_t offset;
+
+		if (decode_key(&c, &index_key, &val_type) ||
+		    cursor_varint(&c, &offset)) {
+			ret = error("reftable '%s' has a corrupt index block",
+				    t->name);
+			break;
+		}
+		if (key_cmp(index_key.buf, index_key.len, key, key_len) >= 0) {
+			*block_offset = offset;
+			ret = 0;
+			break;
+		}
+	}
+	strbuf_release(&index_key);
+	return ret;
+}
+
+/*
+ * Position ti at the first record of the given type in t whose key is
+ * not less than key. Return 0 on success (ti->done is set if there is
+ * no such record) or -1 on error.
+ */
+static int table_iter_seek(struct table_iter *ti, struct reftable *t,
+			   uint8_t type, const char *key, size_t key_len)
+{
+	size_t section_start, index_offset;
+	int ret;
+
+	ti->t = t;
+	ti->type = type;
+	ti->done = 0;
+	if (type == BLOCK_TYPE_REF) {
+		section_start = REFTABLE_HEADER_SIZE;
+		ti->section_end = t->ref_end;
+		index_offset = t->ref_index_offset;
+	} else {
+		section_start = t->log_offset;
+		ti->section_end = t->log_offset ? t->log_end : 0;
+		index_offset = t->log_index_offset;
+	}
+	if (section_start >= ti->section_end) {
+		ti->done = 1;
+		return 0;
+	}
+
+	ti->block_offset = section_start;
+	if (index_offset) {
+		ret = index_seek(t, index_offset, key, key_len,
+				 &ti->block_offset);
+		if (ret) {
+			ti->done = 1;
+			return ret < 0 ? -1 : 0;
+		}
+		if (ti->block_offset < section_start ||
+		    ti->block_offset >= ti->section_end)
+			return error("reftable '%s' has a corrupt index block",
+				     t->name);
+	}
+
+	if (block_reader_init(&ti->br, t, ti->block_offset, ti->section_end,
+			      type))
+		return -1;
+	ti->pos = restart_seek(&ti->br, key, key_len);
+	strbuf_reset(&ti->key);
+
+	while (!(ret = table_iter_next(ti)))
+		if (key_cmp(ti->key.buf, ti->key.len, key, key_len) >= 0)
+			return 0;
+	return ret < 0 ? -1 : 0;
+}
+
+/* Merging tables */
+
+struct reftable_iterator {
+	struct reftable **tables;
+	size_t nr;
+	struct table_iter *subs;
+	uint8_t type;
+
+	/* The iteration stops at the first key not starting with this: */
+	struct strbuf prefix;
+
+	int include_deletions;
+};
+
+static struct reftable_iterator *merged_iter_new(struct reftable **tables,
+						 size_t nr, uint8_t type,
+						 const char *key, size_t key_len,
+						 int include_deletions)
+{
+	struct reftable_iterator *it = xcalloc(1, sizeof(*it));
+	size_t i;
+
+	it->type = type;
+	it->include_deletions = include_deletions;
+	strbuf_init(&it->prefix, 0);
+	strbuf_add(&it->prefix, key, key_len);
+	ALLOC_ARRAY(it->tables, nr);
+	ALLOC_ARRAY(it->subs, nr);
+	for (i = 0; i < nr; i++) {
+		struct table_iter blank = TABLE_ITER_INIT;
+
+		it->tables[i] = tables[i];
+		tables[i]->refcount++;
+		it->subs[i] = blank;
+		it->nr++;
+		if (table_iter_seek(&it->subs[i], tables[i], type,
+				    key, key_len)) {
+			reftable_iterator_free(it);
+			return NULL;
+		}
+	}
+	return it;
+}
+
+void reftable_iterator_free(struct reftable_iterator *it)
+{
+	size_t i;
+
+	if (!it)
+		return;
+	for (i = 0; i < it->nr; i++) {
+		table_iter_release(&it->subs[i]);
+		release_reftable(it->tables[i]);
+	}
+	free(it->subs);
+	free(it->tables);
+	strbuf_release(&it->prefix);
+	free(it);
+}
+
+/*
+ * Find the sub-iterator holding the smallest key. When several tables
+ * contain the same key, the newest one wins and the others are
+ * advanced past it. Return NULL at the end of the iteration, or set
+ * *err on error.
+ */
+static struct table_iter *merged_iter_peek(struct reftable_iterator *it,
+					   int *err)
+{
+	struct table_iter *best = NULL;
+	size_t i;
+
+	for (i = 0; i < it->nr; i++) {
+		struct table_iter *ti = &it->subs[i];
+
+		if (ti->done)
+			continue;
+		if (best &&
+		    key_cmp(ti->key.buf, ti->key.len,
+			    best->key.buf, best->key.len) > 0)
+			continue;
+		if (best &&
+		    !key_cmp(ti->key.buf, ti->key.len,
+			     best->key.buf, best->key.len) &&
+		    table_iter_next(best) < 0) {
+			*err = -1;
+			return NULL;
+		}
+		best = ti;
+	}
+
+	if (!best || best->key.len < it->prefix.len ||
+	    memcmp(best->key.buf, it->prefix.buf, it->prefix.len))
+		return NULL;
+	return best;
+}
+
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *ref)
+{
+	struct table_iter *ti;
+	int err = 0;
+
+	if (it->type != BLOCK_TYPE_REF)
+		die("BUG: reading refs from a reflog iterator");
+
+	while ((ti = merged_iter_peek(it, &err))) {
+		int deleted = ti->ref.type == REFTABLE_REF_DELETION;
+
+		if (!deleted || it->include_deletions)
+			ref_record_copy(ref, &ti->ref);
+		if (table_iter_next(ti) < 0)
+			return -1;
+		if (!deleted || it->include_deletions)
+			return 0;
+	}
+	return err ? -1 : 1;
+}
+
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *log)
+{
+	struct table_iter *ti;
+	int err = 0;
+
+	if (it->type != BLOCK_TYPE_LOG)
+		die("BUG: reading reflogs from a ref iterator");
+
+	while ((ti = merged_iter_peek(it, &err))) {
+		int deleted = ti->log.type == REFTABLE_LOG_DELETION;
+
+		if (!deleted || it->include_deletions)
+			log_record_copy(log, &ti->log);
+		if (table_iter_next(ti) < 0)
+			return -1;
+		if (!deleted || it->include_deletions)
+			return 0;
+	}
+	return err ? -1 : 1;
+}
+
+/* Stacks */
+
+struct reftable_stack {
+	char *dir;
+	char *list_path;
+	struct reftable **tables;
+	size_t nr, alloc;
+	int loaded;
+
+	/* The contents of tables.list when the stack was last loaded: */
+	struct strbuf list;
+
+	/* Used by additions; at most one can be active at a time: */
+	struct lock_file lock;
+	struct tempfile tempfile;
+};
+
+struct reftable_stack *reftable_stack_new(const char *dir)
+{
+	struct reftable_stack *st = xcalloc(1, sizeof(*st));
+
+	st->dir = xstrdup(dir);
+	strbuf_init(&st->list, 0);
+	st->list_path = xstrfmt("%s/tables.list", dir);
+	return st;
+}
+
+static void stack_set_tables(struct reftable_stack *st,
+			     struct reftable **tables, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < st->nr; i++)
+		release_reftable(st->tables[i]);
+	free(st->tables);
+	st->tables = tables;
+	st->nr = st->alloc = nr;
+}
+
+/*
+ * Read tables.list and open the tables that it names, reusing the
+ * tables that are already open. Return -1 with errno set on error.
+ *
+ * The list is small, so it is simply read again each time rather
+ * than trusting its stat data: tables.list is replaced by renaming,
+ * and a rewrite within the same second that reuses the inode of the
+ * old file and happens to have the same size (which is the norm, as
+ * the table names have a fixed length) would go unnoticed.
+ */
+static int stack_load(struct reftable_stack *st)
+{
+	struct strbuf list = STRBUF_INIT;
+	struct reftable **tables = NULL;
+	size_t nr = 0, alloc = 0, i;
+	char *line, *eol;
+	int fd, save_errno;
+
+	fd = open(st->list_path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			return -1;
+		stack_set_tables(st, NULL, 0);
+		strbuf_reset(&st->list);
+		st->loaded = 1;
+		return 0;
+	}
+	if (strbuf_read(&list, fd, 0) < 0)
+		goto error;
+	close(fd);
+	fd = -1;
+	if (st->loaded && !strbuf_cmp(&list, &st->list)) {
+		strbuf_release(&list);
+		return 0;
+	}
+	strbuf_reset(&st->list);
+	strbuf_addbuf(&st->list, &list);
+
+	for (line = list.buf; *line; line = eol + 1) {
+		struct reftable *t = NULL;
+
+		eol = strchrnul(line, '\n');
+		if (!*eol)
+			break;
+		*eol = '\0';
+		if (!*line)
+			continue;
+
+		for (i = 0; i < st->nr; i++)
+			if (!strcmp(st->tables[i]->name, line)) {
+				t = st->tables[i];
+				t->refcount++;
+				break;
+			}
+		if (!t && !(t = open_reftable(st->dir, line)))
+			goto error;
+		ALLOC_GROW(tables, nr + 1, alloc);
+		tables[nr++] = t;
+	}
+
+	stack_set_tables(st, tables, nr);
+	st->loaded = 1;
+	strbuf_release(&list);
+	return 0;
+
+error:
+	save_errno = errno;
+	for (i = 0; i < nr; i++)
+		release_reftable(tables[i]);
+	free(tables);
+	if (fd >= 0)
+		close(fd);
+	strbuf_reset(&st->list);
+	st->loaded = 0;
+	strbuf_release(&list);
+	errno = save_errno;
+	return -1;
+}
+
+int reftable_stack_reload(struct reftable_stack *st)
+{
+	int tries;
+
+	/*
+	 * A table named in tables.list can vanish if another process
+	 * compacts the stack between our reading the list and opening
+	 * the table. The list has been replaced in that case, so just
+	 * try again.
+	 */
+	for (tries = 0; tries < 5; tries++) {
+		if (!stack_load(st))
+			return 0;
+		if (errno != ENOENT)
+			return -1;
+	}
+	return -1;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *ref)
+{
+	size_t len = strlen(refname), i;
+	int ret = 1;
+
+	if (reftable_stack_reload(st))
+		return -1;
+
+	for (i = st->nr; i--; ) {
+		struct table_iter ti = TABLE_ITER_INIT;
+		int found = 0;
+
+		if (table_iter_seek(&ti, st->tables[i], BLOCK_TYPE_REF,
+				    refname, len)) {
+			ret = -1;
+			found = 1;
+		} else if (!ti.done &&
+			   !key_cmp(ti.key.buf, ti.key.len, refname, len)) {
+			found = 1;
+			if (ti.ref.type != REFTABLE_REF_DELETION) {
+				ref_record_copy(ref, &ti.ref);
+				ret = 0;
+			}
+		}
+		table_iter_release(&ti);
+		if (found)
+			break;
+	}
+	return ret;
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st)
+{
+	if (!st->nr)
+		return 1;
+	return st->tables[st->nr - 1]->max_update_index + 1;
+}
+
+size_t reftable_stack_nr_tables(struct reftable_stack *st)
+{
+	return st->nr;
+}
+
+struct reftable_iterator *reftable_stack_refs(struct reftable_stack *st,
+					      const char *prefix)
+{
+	if (!prefix)
+		prefix = "";
+	if (reftable_stack_reload(st))
+		return NULL;
+	return merged_iter_new(st->tables, st->nr, BLOCK_TYPE_REF,
+			       prefix, strlen(prefix), 0);
+}
+
+struct reftable_iterator *reftable_stack_logs(struct reftable_stack *st,
+					      const char *refname)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct reftable_iterator *it = NULL;
+
+	if (refname) {
+		strbuf_addstr(&key, refname);
+		strbuf_addch(&key, '\0');
+	}
+	if (!reftable_stack_reload(st))
+		it = merged_iter_new(st->tables, st->nr, BLOCK_TYPE_LOG,
+				     key.buf, key.len, 0);
+	strbuf_release(&key);
+	return it;
+}
+
+/* Modifying stacks */
+
+int reftable_stack_lock(struct reftable_stack *st,
+			struct reftable_addition *add, struct strbuf *err)
+{
+	add->st = st;
+	add->lock = &st->lock;
+	add->tempfile = NULL;
+
+	if (safe_create_leading_directories_const(st->list_path)) {
+		strbuf_addf(err, "unable to create directory for '%s'",
+			    st->list_path);
+		return -1;
+	}
+	if (hold_lock_file_for_update_timeout(add->lock, st->list_path, 0,
+					      REFTABLE_LOCK_TIMEOUT_MS) < 0) {
+		unable_to_lock_message(st->list_path, errno, err);
+		return -1;
+	}
+	if (reftable_stack_reload(st)) {
+		strbuf_addf(err, "unable to read '%s': %s",
+			    st->list_path, strerror(errno));
+		rollback_lock_file(add->lock);
+		return -1;
+	}
+	add->update_index = reftable_stack_next_update_index(st);
+	return 0;
+}
+
+/*
+ * Write the finished table in w to a temporary file in the stack's
+ * directory and record the name it should be given in add->name.
+ */
+static int addition_write_table(struct reftable_addition *add,
+				struct reftable_writer *w, struct strbuf *err)
+{
+	struct reftable_stack *st = add->st;
+	struct strbuf path = STRBUF_INIT;
+	const char *tmp;
+	int fd;
+
+	if (writer_finish(w)) {
+		strbuf_addstr(err, "unable to encode reftable");
+		return -1;
+	}
+
+	strbuf_addf(&path, "%s/tmp_table_XXXXXX", st->dir);
+	fd = mks_tempfile_m(&st->tempfile, path.buf, 0444);
+	if (fd < 0) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    path.buf, strerror(errno));
+		strbuf_release(&path);
+		return -1;
+	}
+	add->tempfile = &st->tempfile;
+	tmp = get_tempfile_path(add->tempfile);
+	if (write_in_full(fd, w->out.buf, w->out.len) < 0 ||
+	    close_tempfile(add->tempfile)) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    tmp, strerror(errno));
+		delete_tempfile(add->tempfile);
+		add->tempfile = NULL;
+		strbuf_release(&path);
+		return -1;
+	}
+	adjust_shared_perm(tmp);
+
+	strbuf_reset(&add->name);
+	strbuf_addf(&add->name, "0x%012"PRIx64"-0x%012"PRIx64"-%s.ref",
+		    w->min_update_index, w->max_update_index,
+		    tmp + strlen(tmp) - 6);
+	strbuf_release(&path);
+	return 0;
+}
+
+static int ref_record_ptr_cmp(const void *va, const void *vb)
+{
+	const struct reftable_ref_record *a =
+		*(const struct reftable_ref_record **)va;
+	const struct reftable_ref_record *b =
+		*(const struct reftable_ref_record **)vb;
+
+	return strcmp(a->refname.buf, b->refname.buf);
+}
+
+static int log_record_ptr_cmp(const void *va, const void *vb)
+{
+	const struct reftable_log_record *a =
+		*(const struct reftable_log_record **)va;
+	const struct reftable_log_record *b =
+		*(const struct reftable_log_record **)vb;
+	int cmp = strcmp(a->refname.buf, b->refname.buf);
+
+	if (cmp)
+		return cmp;
+	if (a->update_index != b->update_index)
+		return a->update_index > b->update_index ? -1 : 1;
+	return 0;
+}
+
+int reftable_addition_add(struct reftable_addition *add,
+			  struct reftable_ref_record **refs, size_t refs_nr,
+			  struct reftable_log_record **logs, size_t logs_nr,
+			  struct strbuf *err)
+{
+	struct reftable_writer w;
+	size_t i;
+	int ret = 0;
+
+	if (add->tempfile)
+		die("BUG: only one table can be added at a time");
+	if (!refs_nr && !logs_nr)
+		return 0;
+
+	QSORT(refs, refs_nr, ref_record_ptr_cmp);
+	QSORT(logs, logs_nr, log_record_ptr_cmp);
+
+	writer_init(&w, add->update_index, add->update_index);
+	for (i = 0; !ret && i < refs_nr; i++) {
+		refs[i]->update_index = add->update_index;
+		ret = writer_add_ref(&w, refs[i]);
+	}
+	for (i = 0; !ret && i < logs_nr; i++)
+		ret = writer_add_log(&w, logs[i]);
+	if (ret)
+		strbuf_addstr(err, "unable to encode reftable");
+	else
+		ret = addition_write_table(add, &w, err);
+	writer_release(&w);
+	return ret;
+}
+
+/*
+ * Replace the tables [lo, hi) of the stack with the newly written
+ * table (if any) and commit tables.list.
+ */
+static int addition_replace(struct reftable_addition *add,
+			    size_t lo, size_t hi, struct strbuf *err)
+{
+	struct reftable_stack *st = add->st;
+	struct strbuf list = STRBUF_INIT;
+	struct strbuf path = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	if (add->tempfile) {
+		strbuf_addf(&path, "%s/%s", st->dir, add->name.buf);
+		if (rename_tempfile(add->tempfile, path.buf)) {
+			strbuf_addf(err, "unable to rename reftable into '%s': %s",
+				    path.buf, strerror(errno));
+			add->tempfile = NULL;
+			ret = -1;
+			goto out;
+		}
+		add->tempfile = NULL;
+	}
+
+	for (i = 0; i < lo; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+	if (path.len)
+		strbuf_addf(&list, "%s\n", add->name.buf);
+	for (i = hi; i < st->nr; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+
+	adjust_shared_perm(get_lock_file_path(add->lock));
+	if (write_in_full(get_lock_file_fd(add->lock), list.buf, list.len) < 0 ||
+	    commit_lock_file(add->lock)) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    st->list_path, strerror(errno));
+		if (path.len)
+			unlink_or_warn(path.buf);
+		ret = -1;
+	}
+
+out:
+	if (ret)
+		reftable_addition_rollback(add);
+	strbuf_release(&list);
+	strbuf_release(&path);
+	strbuf_release(&add->name);
+	return ret;
+}
+
+int reftable_addition_commit(struct reftable_addition *add,
+			     struct strbuf *err)
+{
+	if (!add->tempfile) {
+		reftable_addition_rollback(add);
+		return 0;
+	}
+	return addition_replace(add, add->st->nr, add->st->nr, err);
+}
+
+void reftable_addition_rollback(struct reftable_addition *add)
+{
+	if (add->tempfile) {
+		delete_tempfile(add->tempfile);
+		add->tempfile = NULL;
+	}
+	if (add->lock)
+		rollback_lock_file(add->lock);
+	strbuf_release(&add->name);
+}
+
+/*
+ * Return the index of the oldest table that should be merged with
+ * the ones above it to restore the invariant that each table is more
+ * than twice as large as all newer tables combined.
+ */
+static size_t compaction_start(struct reftable_stack *st)
+{
+	size_t lo = st->nr - 1, i;
+	uint64_t newer = st->tables[lo]->size;
+
+	for (i = lo; i--; ) {
+		if (st->tables[i]->size > 2 * newer)
+			break;
+		newer += st->tables[i]->size;
+		lo = i;
+	}
+	return lo;
+}
+
+int reftable_stack_compact(struct reftable_stack *st, unsigned int flags,
+			   struct strbuf *err)
+{
+	struct reftable_addition add = REFTABLE_ADDITION_INIT;
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it;
+	struct reftable_writer w;
+	char **names;
+	size_t lo, hi, i;
+	int ret;
+
+	if (reftable_stack_lock(st, &add, err))
+		return -1;
+
+	hi = st->nr;
+	lo = (flags & REFTABLE_COMPACT_ALL) || !hi ? 0 : compaction_start(st);
+	if (!hi || (hi - lo < 2 && !(flags & REFTABLE_COMPACT_ALL))) {
+		reftable_addition_rollback(&add);
+		return 0;
+	}
+
+	/*
+	 * Deletion records have to be kept unless the oldest table
+	 * takes part, as they might be shadowing older records.
+	 */
+	writer_init(&w, st->tables[lo]->min_update_index,
+		    st->tables[hi - 1]->max_update_index);
+	it = merged_iter_new(st->tables + lo, hi - lo, BLOCK_TYPE_REF,
+			     "", 0, lo > 0);
+	if (!it)
+		goto error;
+	while (!(ret = reftable_iterator_next_ref(it, &ref))) {
+		if ((flags & REFTABLE_COMPACT_PEEL) &&
+		    ref.type == REFTABLE_REF_VAL1 &&
+		    starts_with(ref.refname.buf, "refs/tags/") &&
+		    peel_object(ref.oid.hash, ref.peeled.hash) == PEEL_PEELED)
+			ref.type = REFTABLE_REF_VAL2;
+		if (writer_add_ref(&w, &ref)) {
+			ret = -1;
+			break;
+		}
+	}
+	reftable_iterator_free(it);
+	if (ret < 0)
+		goto error;
+
+	it = merged_iter_new(st->tables + lo, hi - lo, BLOCK_TYPE_LOG,
+			     "", 0, lo > 0);
+	if (!it)
+		goto error;
+	while (!(ret = reftable_iterator_next_log(it, &log)))
+		if (writer_add_log(&w, &log)) {
+			ret = -1;
+			break;
+		}
+	reftable_iterator_free(it);
+	if (ret < 0)
+		goto error;
+
+	if (addition_write_table(&add, &w, err))
+		goto out;
+
+	ALLOC_ARRAY(names, hi - lo);
+	for (i = lo; i < hi; i++)
+		names[i - lo] = xstrfmt("%s/%s", st->dir, st->tables[i]->name);
+	ret = addition_replace(&add, lo, hi, err);
+	for (i = 0; i < hi - lo; i++) {
+		if (!ret)
+			unlink_or_warn(names[i]);
+		free(names[i]);
+	}
+	free(names);
+	if (!ret)
+		ret = reftable_stack_reload(st);
+	writer_release(&w);
+	reftable_ref_record_release(&ref);
+	reftable_log_record_release(&log);
+	return ret;
+
+error:
+	strbuf_addf(err, "unable to compact reftables in '%s'", st->dir);
+out:
+	reftable_addition_rollback(&add);
+	writer_release(&w);
+	reftable_ref_record_release(&ref);
+	reftable_log_record_release(&log);
+	return -1;
+}
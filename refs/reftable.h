@@ -0,0 +1,192 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+/*
+ * Reftables: block-based, prefix-compressed reference storage.
+ *
+ * A reftable is an immutable file holding a sorted set of reference
+ * records and reflog records. Records are grouped into blocks of
+ * roughly `block_size` bytes; within a block each key is stored as
+ * the length of the prefix it shares with the preceding key plus the
+ * remaining suffix. Every 16th record is a "restart point" that
+ * stores its full key, and the offsets of the restart points are
+ * recorded at the end of the block, so that a block can be searched
+ * by bisecting the restart points and then scanning at most 16
+ * records. If a table has more than one block of a kind, an index
+ * block mapping the last key of each block to its offset allows the
+ * right block to be found with one more binary search.
+ *
+ * The tables of a repository are stacked: `tables.list` names the
+ * live tables, oldest first, and a record in a newer table shadows
+ * a record with the same key in an older one (including "deletion"
+ * records, which hide the key altogether). A transaction therefore
+ * writes one small new table and atomically rewrites `tables.list`
+ * under `tables.list.lock`; the stack is kept short by merging the
+ * newest tables whenever they are no longer geometrically decreasing
+ * in size. See Documentation/technical/reftable.txt for the details
+ * of the on-disk format.
+ */
+
+struct lock_file;
+struct tempfile;
+
+enum reftable_ref_type {
+	/* The reference has been deleted: */
+	REFTABLE_REF_DELETION = 0,
+	/* The reference points at `oid`: */
+	REFTABLE_REF_VAL1 = 1,
+	/* The reference points at `oid`, which peels to `peeled`: */
+	REFTABLE_REF_VAL2 = 2,
+	/* The reference is a symbolic ref pointing at `target`: */
+	REFTABLE_REF_SYMREF = 3
+};
+
+struct reftable_ref_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_ref_type type;
+	struct object_id oid;
+	struct object_id peeled;
+	struct strbuf target;
+};
+
+#define REFTABLE_REF_RECORD_INIT { STRBUF_INIT, 0, REFTABLE_REF_DELETION, \
+				   { { 0 } }, { { 0 } }, STRBUF_INIT }
+
+enum reftable_log_type {
+	/* The reflog entry has been deleted: */
+	REFTABLE_LOG_DELETION = 0,
+	REFTABLE_LOG_UPDATE = 1
+};
+
+/*
+ * A reflog entry. Entries are keyed by (refname, update_index) and
+ * sorted newest first within a reference. `ident` is the "Name
+ * <email>" part of the committer line, and `message` is stored
+ * without the trailing newline that the reflog API passes to its
+ * callbacks. An entry whose old and new object names are both null
+ * merely records that the reflog exists.
+ */
+struct reftable_log_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_log_type type;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	struct strbuf ident;
+	timestamp_t time;
+	int tz;
+	struct strbuf message;
+};
+
+#define REFTABLE_LOG_RECORD_INIT { STRBUF_INIT, 0, REFTABLE_LOG_DELETION, \
+				   { { 0 } }, { { 0 } }, STRBUF_INIT, 0, 0, \
+				   STRBUF_INIT }
+
+void reftable_ref_record_release(struct reftable_ref_record *ref);
+void reftable_log_record_release(struct reftable_log_record *log);
+
+/* A stack of reftables living in a single directory. */
+struct reftable_stack;
+
+/*
+ * Create a stack for the tables in `dir`. Nothing is read until the
+ * stack is first used; a missing directory is an empty stack.
+ */
+struct reftable_stack *reftable_stack_new(const char *dir);
+
+/*
+ * Re-read `tables.list` if it has changed since the stack was last
+ * loaded. Return 0 on success or -1 (with errno set) on error.
+ */
+int reftable_stack_reload(struct reftable_stack *st);
+
+/*
+ * Look up `refname`. Return 0 and fill in `ref` if it exists, 1 if it
+ * doesn't, or -1 if the tables could not be read.
+ */
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *ref);
+
+/* Return the update index that the next table added to st will use. */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st);
+
+/* The number of tables currently on the stack. */
+size_t reftable_stack_nr_tables(struct reftable_stack *st);
+
+/*
+ * An iterator over the merged contents of a stack. It holds a
+ * reference to the tables it was created from, so it stays valid
+ * even if the stack is reloaded or compacted in the meantime.
+ */
+struct reftable_iterator;
+
+/* Iterate over the live references whose names start with prefix. */
+struct reftable_iterator *reftable_stack_refs(struct reftable_stack *st,
+					      const char *prefix);
+
+/*
+ * Iterate over the live reflog entries of refname (or of all
+ * references if refname is NULL), newest first for each reference.
+ */
+struct reftable_iterator *reftable_stack_logs(struct reftable_stack *st,
+					      const char *refname);
+
+/*
+ * Advance the iterator. Return 0 if a record was stored into ref
+ * (resp. log), 1 if the iteration is over, or -1 on error.
+ */
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *ref);
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *log);
+
+void reftable_iterator_free(struct reftable_iterator *it);
+
+/*
+ * A pending modification of a stack. reftable_stack_lock() takes
+ * `tables.list.lock` and reloads the stack; the records passed to
+ * reftable_addition_add() (in any order, but with unique keys) are
+ * written to a new temporary table, which reftable_addition_commit()
+ * then puts on top of the stack. reftable_addition_rollback() drops
+ * the lock and the temporary table.
+ */
+struct reftable_addition {
+	struct reftable_stack *st;
+	struct lock_file *lock;
+	struct tempfile *tempfile;
+	struct strbuf name;
+	uint64_t update_index;
+};
+
+#define REFTABLE_ADDITION_INIT { NULL, NULL, NULL, STRBUF_INIT, 0 }
+
+int reftable_stack_lock(struct reftable_stack *st,
+			struct reftable_addition *add, struct strbuf *err);
+int reftable_addition_add(struct reftable_addition *add,
+			  struct reftable_ref_record **refs, size_t refs_nr,
+			  struct reftable_log_record **logs, size_t logs_nr,
+			  struct strbuf *err);
+int reftable_addition_commit(struct reftable_addition *add,
+			     struct strbuf *err);
+void reftable_addition_rollback(struct reftable_addition *add);
+
+/* Flags for reftable_stack_compact(): */
+
+/* Merge all tables, dropping deletion records: */
+#define REFTABLE_COMPACT_ALL	(1 << 0)
+
+/* Record the peeled value of references under refs/tags/: */
+#define REFTABLE_COMPACT_PEEL	(1 << 1)
+
+/*
+ * Merge tables to keep the stack short. Without REFTABLE_COMPACT_ALL
+ * only the newest tables are merged, and only as far as needed to
+ * make each table more than twice as large as all of the tables
+ * above it combined. Return 0 on success (including when there was
+ * nothing to do) or -1 on error.
+ */
+int reftable_stack_compact(struct reftable_stack *st, unsigned int flags,
+			   struct strbuf *err);
+
+#endif /* REFS_REFTABLE_H */
@@ -19,8 +19,11 @@
 #define SYMMETRIC_LEFT	(1u<<8)
 #define PATCHSAME	(1u<<9)
 #define BOTTOM		(1u<<10)
+#define TOPO_WALK_EXPLORED	(1u<<24)
+#define TOPO_WALK_INDEGREE	(1u<<25)
 #define TRACK_LINEAR	(1u<<26)
-#define ALL_REV_FLAGS	(((1u<<11)-1) | TRACK_LINEAR)
+#define ALL_REV_FLAGS	(((1u<<11)-1) | TOPO_WALK_EXPLORED | TOPO_WALK_INDEGREE | \
+			 TRACK_LINEAR)
 
 #define DECORATE_SHORT_REFS	1
 #define DECORATE_FULL_REFS	2
@@ -29,6 +32,7 @@ struct rev_info;
 struct log_info;
 struct string_list;
 struct saved_parents;
+struct topo_walk_info;
 
 struct rev_cmdline_info {
 	unsigned int nr;
@@ -73,6 +77,7 @@ struct rev_info {
 
 	/* topo-sort */
 	enum rev_sort_order sort_order;
+	struct topo_walk_info *topo_walk_info;
 
 	unsigned int	early_output:1,
 			ignore_missing:1,
@@ -24,6 +24,7 @@
 #include "streaming.h"
 #include "dir.h"
 #include "mru.h"
+#include "midx.h"
 #include "list.h"
 #include "mergesort.h"
 #include "quote.h"
@@ -485,6 +486,23 @@ struct alternate_object_database *alloc_alt_odb(const char *dir)
 	return ent;
 }
 
+static struct alternate_object_database *local_odb;
+
+struct alternate_object_database *local_object_database(void)
+{
+	const char *objdir = get_object_directory();
+
+	if (local_odb && strcmp(local_odb->path, objdir)) {
+		odb_clear_loose_cache(local_odb);
+		strbuf_release(&local_odb->scratch);
+		free(local_odb);
+		local_odb = NULL;
+	}
+	if (!local_odb)
+		local_odb = alloc_alt_odb(objdir);
+	return local_odb;
+}
+
 void add_to_alternates_file(const char *reference)
 {
 	struct lock_file *lock = xcalloc(1, sizeof(struct lock_file));
@@ -977,7 +995,7 @@ static int close_pack_fd(struct packed_git *p)
 	return 1;
 }
 
-static void close_pack(struct packed_git *p)
+void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
 	close_pack_fd(p);
@@ -1482,6 +1500,10 @@ static void prepare_packed_git_one(char *objdir, int local)
 		if (!report_garbage)
 			continue;
 
+		if (!strcmp(de->d_name, "multi-pack-index") ||
+		    !strcmp(de->d_name, "multi-pack-index.bitmap"))
+			continue;
+
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
@@ -1583,9 +1605,12 @@ void prepare_packed_git(void)
 	if (prepare_packed_git_run_once)
 		return;
 	prepare_packed_git_one(get_object_directory(), 1);
+	prepare_multi_pack_index_one(get_object_directory(), 1);
 	prepare_alt_odb();
-	for (alt = alt_odb_list; alt; alt = alt->next)
+	for (alt = alt_odb_list; alt; alt = alt->next) {
 		prepare_packed_git_one(alt->path, 0);
+		prepare_multi_pack_index_one(alt->path, 0);
+	}
 	rearrange_packed_git();
 	prepare_packed_git_mru();
 	prepare_packed_git_run_once = 1;
@@ -1593,8 +1618,15 @@ void prepare_packed_git(void)
 
 void reprepare_packed_git(void)
 {
+	struct alternate_object_database *alt;
+
+	if (local_odb)
+		odb_clear_loose_cache(local_odb);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		odb_clear_loose_cache(alt);
 	approximate_object_count_valid = 0;
 	prepare_packed_git_run_once = 0;
+	close_multi_pack_indexes();
 	prepare_packed_git();
 }
 
@@ -2057,11 +2089,11 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	return get_delta_hdr_size(&data, delta_head+sizeof(delta_head));
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+			     struct pack_window **w_curs,
+			     off_t *curpos,
+			     enum object_type type,
+			     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -2345,6 +2377,29 @@ static size_t delta_base_cached;
 
 static LIST_HEAD(delta_base_cache_lru);
 
+/*
+ * Each entry earns some credit from the number of deltas we saw stacked
+ * on top of it and from being found in the cache again.  An entry at
+ * the cold end of the LRU that still has credit and is not big spends
+ * one unit of it to go back to the hot end instead of being evicted,
+ * so that small bases many objects depend on survive a stream of big
+ * ones that are used only once.
+ */
+#define DELTA_BASE_CREDIT_MAX 8
+#define DELTA_BASE_BIG_SHIFT 4
+
+static const char *delta_base_cache_cmd;
+static int delta_base_cache_initialized;
+static size_t delta_base_cache_max;
+
+static struct {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	unsigned long spared;
+	uint64_t nanos;
+} delta_base_cache_stats;
+
 struct delta_base_cache_key {
 	struct packed_git *p;
 	off_t base_offset;
@@ -2357,8 +2412,44 @@ struct delta_base_cache_entry {
 	void *data;
 	unsigned long size;
 	enum object_type type;
+	unsigned int credit;
 };
 
+void set_delta_base_cache_command(const char *cmd)
+{
+	delta_base_cache_cmd = cmd;
+}
+
+static void report_delta_base_cache_stats(void)
+{
+	trace_performance(delta_base_cache_stats.nanos,
+			  "delta base cache: %lu hits, %lu misses, "
+			  "%lu evictions, %lu spared",
+			  delta_base_cache_stats.hits,
+			  delta_base_cache_stats.misses,
+			  delta_base_cache_stats.evictions,
+			  delta_base_cache_stats.spared);
+}
+
+static void init_delta_base_cache(void)
+{
+	if (delta_base_cache_initialized)
+		return;
+	delta_base_cache_initialized = 1;
+
+	delta_base_cache_max = delta_base_cache_limit;
+	if (delta_base_cache_cmd) {
+		struct strbuf key = STRBUF_INIT;
+		unsigned long limit;
+
+		strbuf_addf(&key, "deltabasecachelimit.%s", delta_base_cache_cmd);
+		if (!git_config_get_ulong(key.buf, &limit))
+			delta_base_cache_max = limit;
+		strbuf_release(&key);
+	}
+	atexit(report_delta_base_cache_stats);
+}
+
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
 	unsigned int hash;
@@ -2427,6 +2518,9 @@ static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	if (!ent)
 		return unpack_entry(p, base_offset, type, base_size);
 
+	delta_base_cache_stats.hits++;
+	if (ent->credit < DELTA_BASE_CREDIT_MAX)
+		ent->credit++;
 	*type = ent->type;
 	*base_size = ent->size;
 	return xmemdupz(ent->data, ent->size);
@@ -2449,19 +2543,28 @@ void clear_delta_base_cache(void)
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
-	void *base, unsigned long base_size, enum object_type type)
+	void *base, unsigned long base_size, enum object_type type,
+	unsigned int credit)
 {
 	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
-	struct list_head *lru, *tmp;
+	size_t big = delta_base_cache_max >> DELTA_BASE_BIG_SHIFT;
 
 	delta_base_cached += base_size;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
+	while (delta_base_cached > delta_base_cache_max &&
+	       !list_empty(&delta_base_cache_lru)) {
 		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
+			list_entry(delta_base_cache_lru.next,
+				   struct delta_base_cache_entry, lru);
+		if (f->credit && f->size <= big) {
+			f->credit--;
+			list_del(&f->lru);
+			list_add_tail(&f->lru, &delta_base_cache_lru);
+			delta_base_cache_stats.spared++;
+			continue;
+		}
 		release_delta_base_cache(f);
+		delta_base_cache_stats.evictions++;
 	}
 
 	ent->key.p = p;
@@ -2469,6 +2572,7 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
+	ent->credit = credit < DELTA_BASE_CREDIT_MAX ? credit : DELTA_BASE_CREDIT_MAX;
 	list_add_tail(&ent->lru, &delta_base_cache_lru);
 
 	if (!delta_base_cache.cmpfn)
@@ -2508,7 +2612,10 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	struct unpack_entry_stack_ent *delta_stack = small_delta_stack;
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
+	unsigned int base_credit = 0;
+	uint64_t start = getnanotime();
 
+	init_delta_base_cache();
 	write_pack_access_log(p, obj_offset);
 
 	/* PHASE 1: drill down to the innermost base object */
@@ -2522,10 +2629,14 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
+			base_credit = ent->credit + 1;
 			detach_delta_base_cache_entry(ent);
 			base_from_cache = 1;
+			delta_base_cache_stats.hits++;
 			break;
 		}
+		if (delta_stack_nr)
+			delta_base_cache_stats.misses++;
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
 			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
@@ -2607,8 +2718,14 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 
 		data = NULL;
 
+		/*
+		 * The deltas still on the stack beyond the one we are
+		 * about to apply all need this base, too.
+		 */
 		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
+			add_delta_base_cache(p, obj_offset, base, base_size, type,
+					     base_credit + delta_stack_nr - 1);
+		base_credit = 0;
 
 		if (!base) {
 			/*
@@ -2678,6 +2795,7 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	if (delta_stack != small_delta_stack)
 		free(delta_stack);
 
+	delta_base_cache_stats.nanos += getnanotime() - start;
 	return data;
 }
 
@@ -2868,13 +2986,31 @@ static int fill_pack_entry(const unsigned char *sha1,
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct mru_entry *p;
+	int skip_midx_packs = 1;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
 
+	/*
+	 * A multi-pack-index answers for all the packs it covers with
+	 * a single lookup.  Only if it points at a copy we cannot use
+	 * do we need to look into those packs one by one.
+	 */
+	switch (fill_midx_entry(sha1, e)) {
+	case 1:
+		return 1;
+	case -1:
+		skip_midx_packs = 0;
+		break;
+	}
+
 	for (p = packed_git_mru->head; p; p = p->next) {
-		if (fill_pack_entry(sha1, e, p->item)) {
+		struct packed_git *pack = p->item;
+
+		if (skip_midx_packs && pack->multi_pack_index)
+			continue;
+		if (fill_pack_entry(sha1, e, pack)) {
 			mru_mark(packed_git_mru, p);
 			return 1;
 		}
@@ -3022,6 +3158,110 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 	return 0;
 }
 
+/*
+ * How much to read ahead for each object (enough for its header and
+ * usually its data), and how far apart two objects may be for a
+ * single readahead to cover both.
+ */
+#define BATCH_READAHEAD_SIZE 4096
+#define BATCH_READAHEAD_GAP (64 * 1024)
+
+static int object_info_batch_cmp(const void *va, const void *vb)
+{
+	const struct object_info_batch *a = *(const struct object_info_batch **)va;
+	const struct object_info_batch *b = *(const struct object_info_batch **)vb;
+
+	if (a->pack != b->pack)
+		return (uintptr_t)a->pack < (uintptr_t)b->pack ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+static void readahead_packed_objects(struct object_info_batch **sorted, int nr)
+{
+#ifdef POSIX_FADV_WILLNEED
+	int i = 0;
+
+	while (i < nr) {
+		struct packed_git *p = sorted[i]->pack;
+		off_t start, end;
+
+		if (!p) {
+			i++;
+			continue;
+		}
+		start = sorted[i]->offset;
+		end = start + BATCH_READAHEAD_SIZE;
+		for (i++; i < nr && sorted[i]->pack == p; i++) {
+			if (sorted[i]->offset > end + BATCH_READAHEAD_GAP)
+				break;
+			end = sorted[i]->offset + BATCH_READAHEAD_SIZE;
+		}
+		if (p->pack_fd < 0 && open_packed_git(p))
+			continue;
+		posix_fadvise(p->pack_fd, start, end - start,
+			      POSIX_FADV_WILLNEED);
+	}
+#endif
+}
+
+void sha1_object_info_batch(const struct oid_array *oids,
+			    struct object_info_batch *out,
+			    const struct object_info *want,
+			    unsigned flags)
+{
+	struct object_info_batch **sorted;
+	int i;
+
+	if (want->typename)
+		die("BUG: sha1_object_info_batch() cannot return type names");
+
+	ALLOC_ARRAY(sorted, oids->nr);
+	for (i = 0; i < oids->nr; i++) {
+		struct object_info_batch *o = &out[i];
+		const unsigned char *real;
+		struct pack_entry e;
+
+		memset(o, 0, sizeof(*o));
+		oidcpy(&o->oid, &oids->oid[i]);
+		real = lookup_replace_object_extended(o->oid.hash, flags);
+		if (find_pack_entry(real, &e)) {
+			o->pack = e.p;
+			o->offset = e.offset;
+		}
+		sorted[i] = o;
+	}
+	QSORT(sorted, oids->nr, object_info_batch_cmp);
+
+	/* A single object would be read right away anyway */
+	if (oids->nr > 1)
+		readahead_packed_objects(sorted, oids->nr);
+
+	for (i = 0; i < oids->nr; i++) {
+		struct object_info_batch *o = sorted[i];
+		struct object_info oi = OBJECT_INFO_INIT;
+
+		if (want->typep)
+			oi.typep = &o->type;
+		if (want->sizep)
+			oi.sizep = &o->size;
+		if (want->disk_sizep)
+			oi.disk_sizep = &o->disk_size;
+		if (want->delta_base_sha1)
+			oi.delta_base_sha1 = o->delta_base.hash;
+		o->status = sha1_object_info_extended(o->oid.hash, &oi, flags);
+		if (o->status < 0 || oi.whence == OI_LOOSE ||
+		    oi.whence == OI_CACHED)
+			o->pack = NULL;
+		else if (oi.whence == OI_PACKED) {
+			o->pack = oi.u.packed.pack;
+			o->offset = oi.u.packed.offset;
+		}
+	}
+	free(sorted);
+}
+
 /* returns enum object_type or negative */
 int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 {
@@ -3321,6 +3561,9 @@ static int create_tmpfile(struct strbuf *tmp, const char *filename)
 	return fd;
 }
 
+static void odb_loose_cache_add(struct alternate_object_database *alt,
+				const unsigned char *sha1);
+
 static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 			      const void *buf, unsigned long len, time_t mtime)
 {
@@ -3385,7 +3628,10 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 			warning_errno("failed utime() on %s", tmp_file.buf);
 	}
 
-	return finalize_object_file(tmp_file.buf, filename);
+	if (finalize_object_file(tmp_file.buf, filename))
+		return -1;
+	odb_loose_cache_add(local_object_database(), sha1);
+	return 0;
 }
 
 static int freshen_loose_object(const unsigned char *sha1)
@@ -3406,6 +3652,11 @@ static int freshen_packed_object(const unsigned char *sha1)
 	return 1;
 }
 
+int freshen_object(const unsigned char *sha1)
+{
+	return freshen_packed_object(sha1) || freshen_loose_object(sha1);
+}
+
 int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1)
 {
 	char hdr[32];
@@ -3415,7 +3666,7 @@ int write_sha1_file(const void *buf, unsigned long len, const char *type, unsign
 	 * it out into .git/objects/??/?{38} file.
 	 */
 	write_sha1_file_prepare(buf, len, type, sha1, hdr, &hdrlen);
-	if (freshen_packed_object(sha1) || freshen_loose_object(sha1))
+	if (freshen_object(sha1))
 		return 0;
 	return write_loose_object(sha1, hdr, hdrlen, buf, len, 0);
 }
@@ -3485,10 +3736,19 @@ int has_sha1_file_with_flags(const unsigned char *sha1, int flags)
 		return 0;
 	if (find_pack_entry(sha1, &e))
 		return 1;
+	if (flags & HAS_SHA1_QUICK) {
+		struct alternate_object_database *alt;
+
+		if (odb_loose_cache_has(local_object_database(), sha1))
+			return 1;
+		prepare_alt_odb();
+		for (alt = alt_odb_list; alt; alt = alt->next)
+			if (odb_loose_cache_has(alt, sha1))
+				return 1;
+		return 0;
+	}
 	if (has_loose_object(sha1))
 		return 1;
-	if (flags & HAS_SHA1_QUICK)
-		return 0;
 	reprepare_packed_git();
 	return find_pack_entry(sha1, &e);
 }
@@ -3791,6 +4051,76 @@ static int for_each_file_in_obj_subdir(int subdir_nr,
 	return r;
 }
 
+static int append_loose_object(const struct object_id *oid, const char *path,
+			       void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+struct oid_array *odb_loose_cache(struct alternate_object_database *alt,
+				  const unsigned char *sha1)
+{
+	int subdir_nr = sha1[0];
+	struct oid_array *cache = &alt->loose_objects_cache[subdir_nr];
+
+	if (!alt->loose_objects_subdir_seen[subdir_nr]) {
+		struct strbuf *buf = alt_scratch_buf(alt);
+
+		strbuf_addf(buf, "%02x", subdir_nr);
+		for_each_file_in_obj_subdir(subdir_nr, buf,
+					    append_loose_object,
+					    NULL, NULL, cache);
+		alt->loose_objects_subdir_seen[subdir_nr] = 1;
+	}
+	return cache;
+}
+
+int odb_loose_cache_has(struct alternate_object_database *alt,
+			const unsigned char *sha1)
+{
+	struct object_id oid;
+
+	hashcpy(oid.hash, sha1);
+	return oid_array_lookup(odb_loose_cache(alt, sha1), &oid) >= 0;
+}
+
+/*
+ * Keep a listing we already read in sync with our own writes. The
+ * object goes where it sorts, as appending would make the next lookup
+ * sort the whole listing again.
+ */
+static void odb_loose_cache_add(struct alternate_object_database *alt,
+				const unsigned char *sha1)
+{
+	struct oid_array *cache = &alt->loose_objects_cache[sha1[0]];
+	struct object_id oid;
+	int pos;
+
+	if (!alt->loose_objects_subdir_seen[sha1[0]])
+		return;
+	hashcpy(oid.hash, sha1);
+	pos = oid_array_lookup(cache, &oid);
+	if (pos >= 0)
+		return;
+	pos = -pos - 1;
+	ALLOC_GROW(cache->oid, cache->nr + 1, cache->alloc);
+	memmove(cache->oid + pos + 1, cache->oid + pos,
+		(cache->nr - pos) * sizeof(*cache->oid));
+	oidcpy(&cache->oid[pos], &oid);
+	cache->nr++;
+}
+
+void odb_clear_loose_cache(struct alternate_object_database *alt)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(alt->loose_objects_cache); i++)
+		oid_array_clear(&alt->loose_objects_cache[i]);
+	memset(alt->loose_objects_subdir_seen, 0,
+	       sizeof(alt->loose_objects_subdir_seen));
+}
+
 int for_each_loose_file_in_objdir_buf(struct strbuf *path,
 			    each_loose_object_fn obj_cb,
 			    each_loose_cruft_fn cruft_cb,
@@ -3868,7 +4198,7 @@ int for_each_loose_object(each_loose_object_fn cb, void *data, unsigned flags)
 	return foreach_alt_odb(loose_from_alt_odb, &alt);
 }
 
-static int for_each_object_in_pack(struct packed_git *p, each_packed_object_fn cb, void *data)
+int for_each_object_in_pack(struct packed_git *p, each_packed_object_fn cb, void *data)
 {
 	uint32_t i;
 	int r = 0;
@@ -77,50 +77,6 @@ static void update_candidates(struct disambiguate_state *ds, const struct object
 	/* otherwise, current can be discarded and candidate is still good */
 }
 
-static void find_short_object_filename(struct disambiguate_state *ds)
-{
-	struct alternate_object_database *alt;
-	char hex[GIT_MAX_HEXSZ];
-	static struct alternate_object_database *fakeent;
-
-	if (!fakeent) {
-		/*
-		 * Create a "fake" alternate object database that
-		 * points to our own object database, to make it
-		 * easier to get a temporary working space in
-		 * alt->name/alt->base while iterating over the
-		 * object databases including our own.
-		 */
-		fakeent = alloc_alt_odb(get_object_directory());
-	}
-	fakeent->next = alt_odb_list;
-
-	xsnprintf(hex, sizeof(hex), "%.2s", ds->hex_pfx);
-	for (alt = fakeent; alt && !ds->ambiguous; alt = alt->next) {
-		struct strbuf *buf = alt_scratch_buf(alt);
-		struct dirent *de;
-		DIR *dir;
-
-		strbuf_addf(buf, "%.2s/", ds->hex_pfx);
-		dir = opendir(buf->buf);
-		if (!dir)
-			continue;
-
-		while (!ds->ambiguous && (de = readdir(dir)) != NULL) {
-			struct object_id oid;
-
-			if (strlen(de->d_name) != GIT_SHA1_HEXSZ - 2)
-				continue;
-			if (memcmp(de->d_name, ds->hex_pfx + 2, ds->len - 2))
-				continue;
-			memcpy(hex + 2, de->d_name, GIT_SHA1_HEXSZ - 2);
-			if (!get_oid_hex(hex, &oid))
-				update_candidates(ds, &oid);
-		}
-		closedir(dir);
-	}
-}
-
 static int match_sha(unsigned len, const unsigned char *a, const unsigned char *b)
 {
 	do {
@@ -136,6 +92,23 @@ static int match_sha(unsigned len, const unsigned char *a, const unsigned char *
 	return 1;
 }
 
+static void find_short_object_filename(struct disambiguate_state *ds)
+{
+	struct alternate_object_database *alt;
+	struct alternate_object_database *local = local_object_database();
+
+	local->next = alt_odb_list;
+	for (alt = local; alt && !ds->ambiguous; alt = alt->next) {
+		struct oid_array *loose = odb_loose_cache(alt, ds->bin_pfx.hash);
+		int i;
+
+		for (i = 0; i < loose->nr && !ds->ambiguous; i++)
+			if (match_sha(ds->len, ds->bin_pfx.hash,
+				      loose->oid[i].hash))
+				update_candidates(ds, &loose->oid[i]);
+	}
+}
+
 static void unique_in_pack(struct packed_git *p,
 			   struct disambiguate_state *ds)
 {
@@ -405,6 +378,17 @@ static int get_short_sha1(const char *name, int len, unsigned char *sha1,
 	find_short_packed_object(&ds);
 	status = finish_object_disambiguation(&ds, sha1);
 
+	/*
+	 * The object may have been written, or packed, by someone else
+	 * since we read the loose object directories and the packs.
+	 */
+	if (status == MISSING_OBJECT) {
+		reprepare_packed_git();
+		find_short_object_filename(&ds);
+		find_short_packed_object(&ds);
+		status = finish_object_disambiguation(&ds, sha1);
+	}
+
 	if (!quietly && (status == SHORT_NAME_AMBIGUOUS)) {
 		error(_("short SHA1 %s is ambiguous"), ds.hex_pfx);
 
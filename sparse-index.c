@@ -0,0 +1,440 @@
+#include "cache.h"
+#include "dir.h"
+#include "tree.h"
+#include "cache-tree.h"
+#include "pathspec.h"
+#include "sparse-index.h"
+
+static int index_sparse_config(void)
+{
+	int sparse = 0;
+
+	git_config_get_bool("index.sparse", &sparse);
+	return sparse;
+}
+
+int sparse_patterns_are_cone(const struct exclude_list *el)
+{
+	int i;
+
+	if (el->use_cone_patterns)
+		return 1;
+	if (!el->nr)
+		return 0;
+	for (i = 0; i < el->nr; i++) {
+		const struct exclude *x = el->excludes[i];
+		int len = x->patternlen;
+
+		if (x->baselen || len < 2 || x->pattern[0] != '/')
+			return 0;
+		if (x->flags & EXC_FLAG_NEGATIVE) {
+			/* all the subdirectories of a directory */
+			if (!(x->flags & EXC_FLAG_MUSTBEDIR) ||
+			    x->nowildcardlen != len - 1 ||
+			    x->pattern[len - 2] != '/' || x->pattern[len - 1] != '*')
+				return 0;
+		} else if (x->flags & EXC_FLAG_MUSTBEDIR) {
+			/* a directory and everything in it */
+			if (x->nowildcardlen != len)
+				return 0;
+		} else {
+			/* the files at the top level */
+			if (len != 2 || x->pattern[1] != '*')
+				return 0;
+		}
+	}
+	return 1;
+}
+
+int sparse_dir_in_cone(struct index_state *istate, struct exclude_list *el,
+		       const char *dir, int len)
+{
+	struct strbuf path = STRBUF_INIT;
+	int i, in_cone = 0;
+
+	/*
+	 * Decide each leading directory in turn; an undecided one
+	 * inherits the decision made for its parent.
+	 */
+	for (i = 0; i <= len; i++) {
+		int dtype = DT_DIR;
+		const char *basename;
+		int ret;
+
+		if (i < len && dir[i] != '/')
+			continue;
+		strbuf_reset(&path);
+		strbuf_add(&path, dir, i);
+		basename = strrchr(path.buf, '/');
+		basename = basename ? basename + 1 : path.buf;
+		ret = is_excluded_from_list(path.buf, path.len, basename,
+					    &dtype, el, istate);
+		if (ret >= 0)
+			in_cone = ret;
+	}
+	strbuf_release(&path);
+	if (in_cone)
+		return 1;
+
+	/* Is a directory further down included? */
+	for (i = 0; i < el->nr; i++) {
+		const struct exclude *x = el->excludes[i];
+
+		if (!(x->flags & EXC_FLAG_NEGATIVE) &&
+		    x->patternlen > len + 1 &&
+		    x->pattern[len + 1] == '/' &&
+		    !memcmp(x->pattern + 1, dir, len))
+			return 1;
+	}
+	return 0;
+}
+
+static struct cache_entry *construct_sparse_dir_entry(const char *path, int len,
+						      const struct object_id *oid)
+{
+	struct cache_entry *ce = xcalloc(1, cache_entry_size(len));
+
+	memcpy(ce->name, path, len);
+	ce->ce_namelen = len;
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	oidcpy(&ce->oid, oid);
+	return ce;
+}
+
+static int can_collapse(struct index_state *istate, struct exclude_list *el,
+			int start, int end, const char *path, int pathlen,
+			struct cache_tree *ct)
+{
+	int i;
+
+	if (sparse_dir_in_cone(istate, el, path, pathlen - 1))
+		return 0;
+	for (i = start; i < end; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) || S_ISGITLINK(ce->ce_mode) ||
+		    !ce_skip_worktree(ce) ||
+		    (ce->ce_flags & (CE_INTENT_TO_ADD | CE_REMOVE)))
+			return 0;
+	}
+	/* The tree has to be there to expand the entry again. */
+	return has_sha1_file(ct->oid.hash);
+}
+
+/*
+ * What convert_to_sparse() changed in an index that was full, so that
+ * restore_full_index() can undo it without reading any tree.
+ */
+struct sparse_index_undo {
+	/* the entries of the full index, in order */
+	struct cache_entry **cache;
+	unsigned int cache_nr, cache_alloc;
+
+	/* the sparse directory entries made in their stead */
+	struct cache_entry **sparse_dirs;
+	int sparse_dirs_nr, sparse_dirs_alloc;
+
+	/* the cache tree nodes that were changed, as they were */
+	struct undo_cache_tree {
+		struct cache_tree *ct;
+		struct cache_tree_sub **down;
+		int subtree_nr, subtree_alloc;
+		int entry_count;
+	} *trees;
+	int trees_nr, trees_alloc;
+};
+
+static void save_cache_tree(struct sparse_index_undo *undo,
+			    struct cache_tree *ct)
+{
+	struct undo_cache_tree *t;
+
+	ALLOC_GROW(undo->trees, undo->trees_nr + 1, undo->trees_alloc);
+	t = undo->trees + undo->trees_nr++;
+	t->ct = ct;
+	t->down = ct->down;
+	t->subtree_nr = ct->subtree_nr;
+	t->subtree_alloc = ct->subtree_alloc;
+	t->entry_count = ct->entry_count;
+}
+
+static void drop_subtrees(struct cache_tree *ct)
+{
+	int i;
+
+	for (i = 0; i < ct->subtree_nr; i++) {
+		cache_tree_free(&ct->down[i]->cache_tree);
+		free(ct->down[i]);
+	}
+	ct->subtree_nr = 0;
+}
+
+/*
+ * istate->cache[start..end) are the entries of the tree "ct" at "path"
+ * (which has a trailing slash, unless it is the top level). Collapse
+ * what can be collapsed and move the resulting entries down to
+ * istate->cache[dst..], keeping "ct" in sync. Returns the number of
+ * entries left. With "undo", nothing is freed and everything changed is
+ * recorded there instead.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 struct exclude_list *el,
+				 int dst, int start, int end,
+				 const char *path, int pathlen,
+				 struct cache_tree *ct, int *nr_collapsed,
+				 struct sparse_index_undo *undo)
+{
+	int i, nr = 0;
+
+	if (end - start == 1 && S_ISSPARSEDIR(istate->cache[start]->ce_mode)) {
+		istate->cache[start]->ce_flags &= ~CE_HASHED;
+		istate->cache[dst] = istate->cache[start];
+		return 1;
+	}
+
+	if (pathlen && can_collapse(istate, el, start, end, path, pathlen, ct)) {
+		struct cache_entry *ce;
+
+		ce = construct_sparse_dir_entry(path, pathlen, &ct->oid);
+		if (undo) {
+			ALLOC_GROW(undo->sparse_dirs, undo->sparse_dirs_nr + 1,
+				   undo->sparse_dirs_alloc);
+			undo->sparse_dirs[undo->sparse_dirs_nr++] = ce;
+			save_cache_tree(undo, ct);
+			ct->down = NULL;
+			ct->subtree_nr = ct->subtree_alloc = 0;
+		} else {
+			for (i = start; i < end; i++)
+				free(istate->cache[i]);
+			drop_subtrees(ct);
+		}
+		istate->cache[dst] = ce;
+		ct->entry_count = 1;
+		(*nr_collapsed)++;
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		struct cache_entry *ce = istate->cache[i];
+		const char *name = ce->name + pathlen;
+		const char *slash = strchr(name, '/');
+		struct cache_tree *sub = NULL;
+		int span;
+
+		if (slash) {
+			int pos = cache_tree_subtree_pos(ct, name, slash - name);
+			if (pos >= 0)
+				sub = ct->down[pos]->cache_tree;
+		}
+		if (!sub || sub->entry_count <= 0 ||
+		    i + sub->entry_count > end) {
+			if (!undo)
+				ce->ce_flags &= ~CE_HASHED;
+			istate->cache[dst + nr++] = ce;
+			i++;
+			continue;
+		}
+
+		span = sub->entry_count;
+		nr += convert_to_sparse_rec(istate, el, dst + nr, i, i + span,
+					    ce->name, slash - ce->name + 1,
+					    sub, nr_collapsed, undo);
+		i += span;
+	}
+	if (undo && ct->entry_count != nr)
+		save_cache_tree(undo, ct);
+	ct->entry_count = nr;
+	return nr;
+}
+
+static int convert_to_sparse_1(struct index_state *istate,
+			       struct sparse_index_undo **undop)
+{
+	struct sparse_index_undo *undo = NULL;
+	struct exclude_list el;
+	char *sparse;
+	int nr_collapsed = 0;
+
+	if (istate->split_index || !istate->cache_nr ||
+	    !core_apply_sparse_checkout || !index_sparse_config() ||
+	    unmerged_index(istate))
+		return 0;
+
+	memset(&el, 0, sizeof(el));
+	el.use_cone_patterns = core_sparse_checkout_cone;
+	sparse = git_pathdup("info/sparse-checkout");
+	if (add_excludes_from_file_to_list(sparse, "", 0, &el, NULL) < 0 ||
+	    !sparse_patterns_are_cone(&el))
+		goto done;
+
+	/*
+	 * The cache tree tells where each directory starts and ends in
+	 * the index, and gives the object names of the trees.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_DRY_RUN |
+				      WRITE_TREE_MISSING_OK))
+		goto done;
+
+	if (undop) {
+		/*
+		 * The name hash only refers to entries that are kept
+		 * around, and is good again once they are put back.
+		 */
+		undo = xcalloc(1, sizeof(*undo));
+		undo->cache_nr = istate->cache_nr;
+		undo->cache_alloc = istate->cache_nr;
+		ALLOC_ARRAY(undo->cache, undo->cache_alloc);
+		COPY_ARRAY(undo->cache, istate->cache, istate->cache_nr);
+	} else {
+		free_name_hash(istate);
+	}
+	istate->cache_nr = convert_to_sparse_rec(istate, &el, 0, 0,
+						 istate->cache_nr, "", 0,
+						 istate->cache_tree,
+						 &nr_collapsed, undo);
+	if (nr_collapsed)
+		istate->sparse_index = 1;
+	if (undo) {
+		if (nr_collapsed)
+			*undop = undo;
+		else
+			restore_full_index(istate, undo);
+	}
+
+done:
+	clear_exclude_list(&el);
+	free(sparse);
+	return nr_collapsed;
+}
+
+int convert_to_sparse(struct index_state *istate)
+{
+	return convert_to_sparse_1(istate, NULL);
+}
+
+int convert_to_sparse_undoable(struct index_state *istate,
+			       struct sparse_index_undo **undo)
+{
+	*undo = NULL;
+	if (istate->sparse_index)
+		return convert_to_sparse_1(istate, NULL);
+	return convert_to_sparse_1(istate, undo);
+}
+
+void restore_full_index(struct index_state *istate,
+			struct sparse_index_undo *undo)
+{
+	int i;
+
+	if (!undo)
+		return;
+
+	for (i = 0; i < undo->trees_nr; i++) {
+		struct undo_cache_tree *t = undo->trees + i;
+
+		t->ct->down = t->down;
+		t->ct->subtree_nr = t->subtree_nr;
+		t->ct->subtree_alloc = t->subtree_alloc;
+		t->ct->entry_count = t->entry_count;
+	}
+	for (i = 0; i < undo->sparse_dirs_nr; i++)
+		free(undo->sparse_dirs[i]);
+	free(istate->cache);
+	istate->cache = undo->cache;
+	istate->cache_nr = undo->cache_nr;
+	istate->cache_alloc = undo->cache_alloc;
+	istate->sparse_index = 0;
+
+	free(undo->sparse_dirs);
+	free(undo->trees);
+	free(undo);
+}
+
+static int add_path_to_index(const unsigned char *sha1, struct strbuf *base,
+			     const char *path, unsigned int mode, int stage,
+			     void *context)
+{
+	struct index_state *full = context;
+	struct cache_entry *ce;
+	int len;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	len = base->len + strlen(path);
+	ce = xcalloc(1, cache_entry_size(len));
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, len - base->len);
+	ce->ce_namelen = len;
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	hashcpy(ce->oid.hash, sha1);
+
+	ALLOC_GROW(full->cache, full->cache_nr + 1, full->cache_alloc);
+	full->cache[full->cache_nr++] = ce;
+	return 0;
+}
+
+void expand_index(struct index_state *istate,
+		  int (*need_expand)(const struct cache_entry *ce, void *data),
+		  void *data)
+{
+	struct index_state full;
+	struct pathspec ps;
+	unsigned int cache_changed = istate->cache_changed;
+	int i, nr_sparse = 0;
+
+	if (!istate->sparse_index)
+		return;
+
+	memset(&full, 0, sizeof(full));
+	memset(&ps, 0, sizeof(ps));
+	ALLOC_GROW(full.cache, istate->cache_nr, full.cache_alloc);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode) ||
+		    (need_expand && !need_expand(ce, data))) {
+			if (S_ISSPARSEDIR(ce->ce_mode))
+				nr_sparse++;
+			ce->ce_flags &= ~CE_HASHED;
+			ALLOC_GROW(full.cache, full.cache_nr + 1, full.cache_alloc);
+			full.cache[full.cache_nr++] = ce;
+			continue;
+		}
+
+		tree = lookup_tree(&ce->oid);
+		if (!tree ||
+		    read_tree_recursive(tree, ce->name, ce_namelen(ce), 0, &ps,
+					add_path_to_index, &full))
+			die(_("unable to expand sparse directory '%s'"), ce->name);
+		cache_tree_invalidate_path(istate, ce->name);
+		free(ce);
+	}
+
+	free_name_hash(istate);
+	free(istate->cache);
+	istate->cache = full.cache;
+	istate->cache_nr = full.cache_nr;
+	istate->cache_alloc = full.cache_alloc;
+	istate->sparse_index = !!nr_sparse;
+
+	/*
+	 * Recompute the parts of the cache tree that were invalidated
+	 * above, without writing any object. The index itself has the
+	 * same contents as before, only spelled out differently.
+	 */
+	if (istate->cache_tree)
+		cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_REPAIR);
+	istate->cache_changed = cache_changed;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	expand_index(istate, NULL, NULL);
+}
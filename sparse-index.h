@@ -0,0 +1,71 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+struct cache_entry;
+struct exclude_list;
+struct sparse_index_undo;
+
+/*
+ * A sparse index stores each directory that is entirely outside of
+ * the sparse-checkout cone as a single "sparse directory" entry: its
+ * name is the path of the directory with a trailing slash, its mode
+ * is S_IFDIR, its object name is that of the tree, and it always has
+ * the skip-worktree bit set.
+ *
+ * Only commands that know how to deal with such entries set
+ * command_requires_full_index to zero; for all others the sparse
+ * directories are expanded as soon as the index is read.
+ */
+
+/*
+ * Replace the directories of the index that are outside of the
+ * sparse-checkout cone (and whose entries are all merged and
+ * skip-worktree) by sparse directory entries, if index.sparse is
+ * enabled and the sparse-checkout patterns allow it. Returns the
+ * number of directories collapsed.
+ */
+int convert_to_sparse(struct index_state *istate);
+
+/*
+ * Like convert_to_sparse(), but if the index was full, keep what was
+ * collapsed in "*undo" (NULL when nothing was), for
+ * restore_full_index() to put back without reading any tree. This is
+ * for writing a full index out in its sparse form.
+ */
+int convert_to_sparse_undoable(struct index_state *istate,
+			       struct sparse_index_undo **undo);
+void restore_full_index(struct index_state *istate,
+			struct sparse_index_undo *undo);
+
+/*
+ * Expand the sparse directory entries for which "need_expand" returns
+ * non-zero (all of them, if it is NULL) into the entries of their
+ * trees.
+ */
+void expand_index(struct index_state *istate,
+		  int (*need_expand)(const struct cache_entry *ce, void *data),
+		  void *data);
+
+/* Expand all sparse directories, giving a full index. */
+void ensure_full_index(struct index_state *istate);
+
+/*
+ * Return 1 if the sparse-checkout patterns only include or exclude
+ * whole directories ("cone" patterns): a single star for the files at
+ * the top level, "/<dir>/" for a directory and its files, and negative
+ * patterns that end with a star and a slash for the subdirectories of
+ * the top level or of an included directory. Only then can a directory
+ * be known to be outside of the sparse checkout without looking at the
+ * paths inside of it.
+ */
+int sparse_patterns_are_cone(const struct exclude_list *el);
+
+/*
+ * Return 1 if the cone patterns in "el" may include paths at or
+ * below the directory "dir" (given without the trailing slash).
+ */
+int sparse_dir_in_cone(struct index_state *istate, struct exclude_list *el,
+		       const char *dir, int len);
+
+#endif /* SPARSE_INDEX_H */
@@ -141,6 +141,7 @@ void merge_base_index(struct index_state *istate)
 
 	mark_base_index_entries(si->base);
 
+	si->nr_split_read   = istate->cache_nr;
 	si->saved_cache	    = istate->cache;
 	si->saved_cache_nr  = istate->cache_nr;
 	istate->cache_nr    = si->base->cache_nr;
@@ -14,6 +14,8 @@ struct split_index {
 	unsigned int saved_cache_nr;
 	unsigned int nr_deletions;
 	unsigned int nr_replacements;
+	/* number of entries in the split index file that was read */
+	unsigned int nr_split_read;
 	int refcount;
 };
 
@@ -8,7 +8,8 @@ enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -41,6 +42,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -49,6 +51,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -63,6 +66,34 @@ struct filtered_istream {
 	int input_finished;
 };
 
+#define DELTA_BUFFER (1024*16)
+#define DELTA_BASE_WINDOW (1024*1024)
+
+struct delta_istream {
+	struct packed_git *pack;
+	off_t pos; /* of the deflated delta data not yet inflated */
+	off_t base_offset;
+	unsigned long base_size;
+	unsigned long result_left;
+
+	/* inflated delta data not yet consumed */
+	unsigned char dbuf[DELTA_BUFFER];
+	int d_end, d_ptr;
+
+	/* the instruction being applied */
+	int inserting;
+	unsigned long copy_off;
+	unsigned long op_left;
+
+	/* the whole base, when it is small enough to hold in core... */
+	char *base_buf;
+
+	/* ...otherwise a stream of it, with a window of what we read last */
+	struct git_istream *base;
+	char *window;
+	unsigned long win_start, win_len;
+};
+
 struct git_istream {
 	const struct stream_vtbl *vtbl;
 	unsigned long size; /* inflated size of full object */
@@ -89,6 +120,7 @@ struct git_istream {
 		} in_pack;
 
 		struct filtered_istream filtered;
+		struct delta_istream delta;
 	} u;
 };
 
@@ -121,8 +153,8 @@ static enum input_source istream_source(const unsigned char *sha1,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold < size)
-			return pack_non_delta;
+		if (big_file_threshold < size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
@@ -452,6 +484,305 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Deltified packed object stream
+ *
+ * The delta is inflated and applied a buffer at a time.  A base that
+ * is no larger than core.bigFileThreshold is read in core; a bigger
+ * one is itself streamed, and copies are served from a window over
+ * the part of it that was read last.  Copying from before the window
+ * restarts the base stream from the beginning.
+ *
+ *****************************************************************/
+
+static struct git_istream *open_istream_pack_entry(struct packed_git *p,
+						   off_t offset)
+{
+	struct git_istream *st = xmalloc(sizeof(*st));
+	struct object_info oi = OBJECT_INFO_INIT;
+	struct pack_window *window = NULL;
+	enum object_type type;
+	off_t pos = offset;
+	unsigned long size;
+	int status;
+
+	type = unpack_object_header(p, &window, &pos, &size);
+	unuse_pack(&window);
+
+	oi.whence = OI_PACKED;
+	oi.u.packed.pack = p;
+	oi.u.packed.offset = offset;
+	if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA)
+		status = open_istream_pack_delta(st, &oi, NULL, &type);
+	else
+		status = open_istream_pack_non_delta(st, &oi, NULL, &type);
+	if (status) {
+		free(st);
+		return NULL;
+	}
+	return st;
+}
+
+static int fill_delta_buffer(struct git_istream *st)
+{
+	struct delta_istream *ds = &st->u.delta;
+
+	if (st->z_state != z_used)
+		return -1;
+
+	ds->d_ptr = ds->d_end = 0;
+	while (!ds->d_end) {
+		int status;
+		struct pack_window *window = NULL;
+		unsigned char *mapped;
+
+		mapped = use_pack(ds->pack, &window, ds->pos, &st->z.avail_in);
+
+		st->z.next_out = ds->dbuf;
+		st->z.avail_out = sizeof(ds->dbuf);
+		st->z.next_in = mapped;
+		status = git_inflate(&st->z, Z_FINISH);
+
+		ds->pos += st->z.next_in - mapped;
+		ds->d_end = st->z.next_out - ds->dbuf;
+		unuse_pack(&window);
+
+		if (status == Z_STREAM_END) {
+			git_inflate_end(&st->z);
+			st->z_state = z_done;
+			break;
+		}
+		if (status != Z_OK && status != Z_BUF_ERROR) {
+			git_inflate_end(&st->z);
+			st->z_state = z_error;
+			return -1;
+		}
+	}
+	return ds->d_end ? 0 : -1;
+}
+
+static int delta_getc(struct git_istream *st)
+{
+	struct delta_istream *ds = &st->u.delta;
+
+	if (ds->d_ptr == ds->d_end && fill_delta_buffer(st))
+		return -1;
+	return ds->dbuf[ds->d_ptr++];
+}
+
+static int read_delta_hdr_size(struct git_istream *st, unsigned long *sizep)
+{
+	unsigned long size = 0;
+	int shift = 0, c;
+
+	do {
+		c = delta_getc(st);
+		if (c < 0)
+			return -1;
+		size |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	*sizep = size;
+	return 0;
+}
+
+/* Give at most "sz" bytes of the base starting at "off" */
+static ssize_t read_delta_base(struct delta_istream *ds, char *buf,
+			       unsigned long off, size_t sz)
+{
+	size_t avail;
+
+	if (ds->base_buf) {
+		memcpy(buf, ds->base_buf + off, sz);
+		return sz;
+	}
+
+	if (off < ds->win_start) {
+		close_istream(ds->base);
+		ds->base = open_istream_pack_entry(ds->pack, ds->base_offset);
+		if (!ds->base)
+			return -1;
+		ds->win_start = ds->win_len = 0;
+	}
+
+	while (ds->win_start + ds->win_len <= off) {
+		ds->win_start += ds->win_len;
+		ds->win_len = 0;
+		while (ds->win_len < DELTA_BASE_WINDOW) {
+			ssize_t readlen = read_istream(ds->base,
+						       ds->window + ds->win_len,
+						       DELTA_BASE_WINDOW - ds->win_len);
+			if (readlen < 0)
+				return -1;
+			if (!readlen)
+				break;
+			ds->win_len += readlen;
+		}
+		if (!ds->win_len)
+			return -1; /* base is shorter than it claimed */
+	}
+
+	avail = ds->win_start + ds->win_len - off;
+	if (sz > avail)
+		sz = avail;
+	memcpy(buf, ds->window + (off - ds->win_start), sz);
+	return sz;
+}
+
+static read_method_decl(pack_delta)
+{
+	struct delta_istream *ds = &st->u.delta;
+	size_t total_read = 0;
+
+	while (total_read < sz && ds->result_left) {
+		size_t to_copy;
+		ssize_t copied;
+
+		if (!ds->op_left) {
+			int cmd = delta_getc(st);
+
+			if (cmd < 0)
+				return -1;
+			if (cmd & 0x80) {
+				unsigned long off = 0, size = 0;
+				int i, c;
+
+				for (i = 0; i < 4; i++) {
+					if (!(cmd & (0x01 << i)))
+						continue;
+					if ((c = delta_getc(st)) < 0)
+						return -1;
+					off |= (unsigned long)c << (8 * i);
+				}
+				for (i = 0; i < 3; i++) {
+					if (!(cmd & (0x10 << i)))
+						continue;
+					if ((c = delta_getc(st)) < 0)
+						return -1;
+					size |= (unsigned long)c << (8 * i);
+				}
+				if (!size)
+					size = 0x10000;
+				if (unsigned_add_overflows(off, size) ||
+				    off + size > ds->base_size)
+					return error("delta copies past the end of its base");
+				ds->inserting = 0;
+				ds->copy_off = off;
+				ds->op_left = size;
+			} else if (cmd) {
+				ds->inserting = 1;
+				ds->op_left = cmd;
+			} else {
+				return error("unexpected delta opcode 0");
+			}
+			if (ds->result_left < ds->op_left)
+				return error("delta produces more than its result size");
+		}
+
+		to_copy = sz - total_read;
+		if (ds->op_left < to_copy)
+			to_copy = ds->op_left;
+		if (ds->inserting) {
+			if (ds->d_ptr == ds->d_end && fill_delta_buffer(st))
+				return -1;
+			if (ds->d_end - ds->d_ptr < to_copy)
+				to_copy = ds->d_end - ds->d_ptr;
+			memcpy(buf + total_read, ds->dbuf + ds->d_ptr, to_copy);
+			ds->d_ptr += to_copy;
+			copied = to_copy;
+		} else {
+			copied = read_delta_base(ds, buf + total_read,
+						 ds->copy_off, to_copy);
+			if (copied < 0)
+				return -1;
+			ds->copy_off += copied;
+		}
+		ds->op_left -= copied;
+		ds->result_left -= copied;
+		total_read += copied;
+	}
+	return total_read;
+}
+
+static close_method_decl(pack_delta)
+{
+	struct delta_istream *ds = &st->u.delta;
+
+	close_deflated_stream(st);
+	free(ds->base_buf);
+	free(ds->window);
+	if (ds->base)
+		return close_istream(ds->base);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+static open_method_decl(pack_delta)
+{
+	struct delta_istream *ds = &st->u.delta;
+	struct pack_window *window = NULL;
+	off_t obj_offset = oi->u.packed.offset;
+	enum object_type in_pack_type;
+	unsigned long size;
+
+	ds->pack = oi->u.packed.pack;
+	ds->pos = obj_offset;
+	in_pack_type = unpack_object_header(ds->pack, &window, &ds->pos, &size);
+	if (in_pack_type != OBJ_OFS_DELTA && in_pack_type != OBJ_REF_DELTA) {
+		unuse_pack(&window);
+		return -1;
+	}
+	ds->base_offset = get_delta_base(ds->pack, &window, &ds->pos,
+					 in_pack_type, obj_offset);
+	unuse_pack(&window);
+	if (!ds->base_offset)
+		return -1;
+
+	memset(&st->z, 0, sizeof(st->z));
+	git_inflate_init(&st->z);
+	st->z_state = z_used;
+	ds->d_end = ds->d_ptr = 0;
+	ds->inserting = 0;
+	ds->copy_off = ds->op_left = 0;
+	ds->base_buf = NULL;
+	ds->base = NULL;
+	ds->window = NULL;
+	ds->win_start = ds->win_len = 0;
+
+	if (read_delta_hdr_size(st, &ds->base_size) ||
+	    read_delta_hdr_size(st, &st->size))
+		goto fail;
+	ds->result_left = st->size;
+
+	if (ds->base_size <= big_file_threshold) {
+		enum object_type base_type;
+		unsigned long base_size;
+
+		ds->base_buf = unpack_entry(ds->pack, ds->base_offset,
+					    &base_type, &base_size);
+		if (!ds->base_buf || base_size != ds->base_size)
+			goto fail;
+	} else {
+		ds->base = open_istream_pack_entry(ds->pack, ds->base_offset);
+		if (!ds->base || ds->base->size != ds->base_size)
+			goto fail;
+		ds->window = xmalloc(DELTA_BASE_WINDOW);
+	}
+
+	st->vtbl = &pack_delta_vtbl;
+	return 0;
+
+fail:
+	close_istream_pack_delta(st);
+	return -1;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
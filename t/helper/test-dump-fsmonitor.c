@@ -0,0 +1,40 @@
+#include "cache.h"
+#include "ewah/ewok.h"
+
+static void mark_dirty(size_t pos, void *data)
+{
+	struct index_state *istate = data;
+
+	if (pos < istate->cache_nr)
+		istate->cache[pos]->ce_flags &= ~CE_FSMONITOR_VALID;
+}
+
+int cmd_main(int ac, const char **av)
+{
+	struct index_state *istate = &the_index;
+	int i;
+
+	setup_git_directory();
+	/* Read without running the hook to see what has been recorded. */
+	if (do_read_index(istate, get_index_file(), 0) < 0)
+		die("unable to read index file");
+	if (!istate->fsmonitor_last_update) {
+		printf("no fsmonitor\n");
+		return 0;
+	}
+	printf("fsmonitor last update %s\n", istate->fsmonitor_last_update);
+
+	for (i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+	if (istate->fsmonitor_dirty)
+		ewah_each_bit(istate->fsmonitor_dirty, mark_dirty, istate);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		printf("%c %s\n",
+		       (ce->ce_flags & CE_FSMONITOR_VALID) ? '+' : '-',
+		       ce->name);
+	}
+
+	return 0;
+}
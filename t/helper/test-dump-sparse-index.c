@@ -0,0 +1,21 @@
+#include "cache.h"
+
+int cmd_main(int ac, const char **av)
+{
+	int i;
+
+	setup_git_directory();
+	/* Show the index as it is stored, without expanding it. */
+	command_requires_full_index = 0;
+	if (read_cache() < 0)
+		die("unable to read index file");
+	printf("%s\n", the_index.sparse_index ? "sparse" : "full");
+	for (i = 0; i < active_nr; i++) {
+		const struct cache_entry *ce = active_cache[i];
+
+		printf("%06o %s %d%s\t%s\n", ce->ce_mode,
+		       oid_to_hex(&ce->oid), ce_stage(ce),
+		       ce_skip_worktree(ce) ? " S" : "", ce->name);
+	}
+	return 0;
+}
@@ -0,0 +1,41 @@
+#include "cache.h"
+
+/*
+ * Drive the loose object caches from a single process: each command
+ * read from stdin prints its answer, and stdout is flushed after it so
+ * that a test can interleave other processes.
+ */
+int cmd_main(int argc, const char **argv)
+{
+	struct strbuf line = STRBUF_INIT;
+
+	setup_git_directory();
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		const char *arg;
+		unsigned char sha1[20];
+
+		if (skip_prefix(line.buf, "write ", &arg)) {
+			if (write_sha1_file(arg, strlen(arg), "blob", sha1))
+				die("unable to write %s", arg);
+			puts(sha1_to_hex(sha1));
+		} else if (skip_prefix(line.buf, "has ", &arg)) {
+			if (get_sha1_hex(arg, sha1))
+				die("not a hexadecimal SHA1: %s", arg);
+			printf("%d\n", has_sha1_file_with_flags(sha1, HAS_SHA1_QUICK));
+		} else if (skip_prefix(line.buf, "abbrev ", &arg)) {
+			if (get_sha1_hex(arg, sha1))
+				die("not a hexadecimal SHA1: %s", arg);
+			puts(find_unique_abbrev(sha1, 4));
+		} else if (skip_prefix(line.buf, "resolve ", &arg)) {
+			if (get_sha1(arg, sha1))
+				puts("missing");
+			else
+				puts(sha1_to_hex(sha1));
+		} else
+			die("unknown command: %s", line.buf);
+		fflush(stdout);
+	}
+	strbuf_release(&line);
+	return 0;
+}
@@ -23,6 +23,13 @@ int cmd_main(int argc, const char **argv)
 	while (*++argv) {
 		if (!strcmp(*argv, "get"))
 			show(prio_queue_get(&pq));
+		else if (!strcmp(*argv, "peek")) {
+			int *v = prio_queue_peek(&pq);
+			if (!v)
+				printf("NULL\n");
+			else
+				printf("%d\n", *v);
+		}
 		else if (!strcmp(*argv, "dump")) {
 			int *v;
 			while ((v = prio_queue_get(&pq)))
@@ -3,6 +3,12 @@
 int cmd_main(int argc, const char **argv)
 {
 	int i, cnt = 1;
+	if (argc > 1 && !strcmp(argv[1], "--verify-checksum")) {
+		/* What git fsck does; the default is not to verify. */
+		verify_index_checksum = 1;
+		argc--;
+		argv++;
+	}
 	if (argc == 2)
 		cnt = strtol(argv[1], NULL, 0);
 	setup_git_directory();
@@ -27,4 +27,21 @@ test_perf 'rev-list --objects $commit --not --all' '
 	git rev-list --objects $commit --not --all >/dev/null
 '
 
+test_perf 'log --topo-order -10' '
+	git log --topo-order -10 >/dev/null
+'
+
+test_expect_success 'write commit-graph' '
+	git commit-graph write --reachable &&
+	git config core.commitGraph true
+'
+
+test_perf 'log --topo-order -10 (commit-graph)' '
+	git log --topo-order -10 >/dev/null
+'
+
+test_perf 'log --graph -10 (commit-graph)' '
+	git log --graph --oneline -10 >/dev/null
+'
+
 test_done
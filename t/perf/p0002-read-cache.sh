@@ -11,4 +11,19 @@ test_perf "read_cache/discard_cache $count times" "
 	test-read-cache $count
 "
 
+test_perf "read_cache/discard_cache $count times, verifying the checksum" "
+	test-read-cache --verify-checksum $count
+"
+
+for skip in false true
+do
+	test_perf "write the index (index.skipHash=$skip)" "
+		git -c index.skipHash=$skip read-tree HEAD
+	"
+
+	test_perf "read_cache/discard_cache $count times (index.skipHash=$skip)" "
+		test-read-cache --verify-checksum $count
+	"
+done
+
 test_done
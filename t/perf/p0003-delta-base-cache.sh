@@ -3,7 +3,10 @@
 test_description='Test operations that emphasize the delta base cache.
 
 We look at both "log --raw", which should put only trees into the delta cache,
-and "log -Sfoo --raw", which should look at both trees and blobs.
+and "log -Sfoo --raw", which should look at both trees and blobs.  "log -p"
+and "blame" of the file touched by the most recent commits walk the long delta
+chains of its blobs over and over, also with a cache too small to hold them
+all, while "archive" of the whole tree reads each blob of HEAD once.
 
 Any effects will be emphasized if the test repository is fully packed (loose
 objects obviously do not use the delta base cache at all). It is also
@@ -28,4 +31,27 @@ test_perf 'log -S' '
 	git log --raw -Sfoo >/dev/null
 '
 
+test_expect_success 'find the file with the most changes' '
+	git log -1000 --format= --name-only HEAD |
+	sort | uniq -c | sort -nr |
+	sed -n -e "1s/^ *[0-9]* //p" >busy-file &&
+	test -s busy-file
+'
+
+test_perf 'log -p on the busiest file' '
+	git log -p -- "$(cat busy-file)" >/dev/null
+'
+
+test_perf 'log -p on the busiest file, small cache' '
+	git -c core.deltaBaseCacheLimit=8m log -p -- "$(cat busy-file)" >/dev/null
+'
+
+test_perf 'blame on the busiest file' '
+	git blame -- "$(cat busy-file)" >/dev/null
+'
+
+test_perf 'archive' '
+	git archive HEAD >/dev/null
+'
+
 test_done
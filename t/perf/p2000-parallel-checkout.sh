@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# This test measures the performance of writing the working tree on
+# clone and branch switches, sequentially and with parallel checkout.
+# Unlike p0006-read-tree-checkout.sh, it is primarily interested in the
+# cost of inflating and writing the files.
+
+test_description="Tests performance of parallel checkout"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# The same branches as in p0006-read-tree-checkout.sh; the ballast is
+# what gets written out when switching between them.
+test_expect_success "setup repo" '
+	if git rev-parse --verify refs/heads/p0006-ballast^{commit}
+	then
+		echo Assuming synthetic repo from many-files.sh
+		git branch br_base            master
+		git branch br_ballast         p0006-ballast
+	else
+		echo Assuming non-synthetic repo...
+		git branch br_base            $(git rev-list HEAD | tail -n 1)
+		git branch br_ballast         HEAD
+	fi &&
+	git checkout -q br_ballast &&
+	nr_files=$(git ls-files | wc -l)
+'
+
+for workers in 1 2 8
+do
+	test_perf "clone ($nr_files files, $workers workers)" "
+		rm -rf clone &&
+		git -c checkout.workers=$workers clone -q --no-checkout . clone &&
+		git -C clone -c checkout.workers=$workers reset -q --hard
+	"
+
+	test_perf "switch between br_base br_ballast ($nr_files files, $workers workers)" "
+		git -c checkout.workers=$workers checkout -q br_base &&
+		git -c checkout.workers=$workers checkout -q br_ballast
+	"
+done
+
+test_done
@@ -82,6 +82,18 @@ do
 		  --reflog --indexed-objects --delta-base-offset \
 		  --stdout </dev/null >/dev/null
 	'
+
+	test_expect_success "write multi-pack-index ($nr_packs)" '
+		git multi-pack-index write
+	'
+
+	test_perf "rev-list with midx ($nr_packs)" '
+		git -c core.multiPackIndex=true rev-list --objects --all >/dev/null
+	'
+
+	test_expect_success "remove multi-pack-index ($nr_packs)" '
+		rm -f .git/objects/pack/multi-pack-index
+	'
 done
 
 test_done
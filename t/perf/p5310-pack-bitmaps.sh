@@ -32,6 +32,16 @@ test_perf 'simulated fetch' '
 	} | git pack-objects --revs --stdout >/dev/null
 '
 
+# A small fetch needs only a couple of the commit bitmaps, so what
+# dominates is the time until pack-objects can start sending data.
+test_perf 'simulated fetch, time to first byte' '
+	have=$(git rev-list HEAD~10 -1) &&
+	{
+		echo HEAD &&
+		echo ^$have
+	} | git pack-objects --revs --stdout | head -c 1 >/dev/null
+'
+
 test_perf 'pack to file' '
 	git pack-objects --all pack1 </dev/null >/dev/null
 '
@@ -40,6 +50,22 @@ test_perf 'pack to file (bitmap)' '
 	git pack-objects --use-bitmap-index --all pack1b </dev/null >/dev/null
 '
 
+test_expect_success 'repack with a bitmap lookup table' '
+	git -c pack.writeBitmapLookupTable=true repack -ad
+'
+
+test_perf 'simulated fetch, time to first byte (lookup table)' '
+	have=$(git rev-list HEAD~10 -1) &&
+	{
+		echo HEAD &&
+		echo ^$have
+	} | git pack-objects --revs --stdout | head -c 1 >/dev/null
+'
+
+test_perf 'rev-list count (lookup table)' '
+	git rev-list --use-bitmap-index --count HEAD >/dev/null
+'
+
 test_expect_success 'create partial bitmap state' '
 	# pick a commit to represent the repo tip in the past
 	cutoff=$(git rev-list HEAD~100 -1) &&
@@ -79,7 +79,7 @@ test_expect_success 'git-add in subdir invalidates cache-tree' '
 	mkdir dirx &&
 	echo "I changed this file" >dirx/foo &&
 	git add dirx/foo &&
-	test_invalid_cache_tree
+	test_invalid_cache_tree dirx/
 '
 
 cat >before <<\EOF
@@ -107,6 +107,53 @@ test_expect_success 'git-add in subdir does not invalidate sibling cache-tree' '
 	cmp_cache_tree expect
 '
 
+test_expect_success 'git-add of reverted change revalidates cache-tree' '
+	test_when_finished "git reset --hard no-children; git read-tree HEAD" &&
+	mkdir dir3 dir4 &&
+	test_commit dir3/c &&
+	test_commit dir4/d &&
+	echo "I changed this file" >dir3/c.t &&
+	git add dir3/c.t &&
+	test_invalid_cache_tree dir3/ &&
+	git checkout HEAD -- dir3/c.t &&
+	git add dir3/c.t &&
+	test_cache_tree
+'
+
+test_expect_success 'git-add with a valid cache-tree shows no staged changes' '
+	test_when_finished "git reset --hard; git read-tree HEAD" &&
+	echo "I changed this file" >foo.t &&
+	git add foo.t &&
+	git diff-index --cached --name-only HEAD >actual &&
+	echo foo.t >expect &&
+	test_cmp expect actual &&
+	git checkout HEAD foo.t &&
+	git add foo.t &&
+	test_cache_tree &&
+	git diff-index --cached --exit-code HEAD &&
+	git diff-index --cached --exit-code HEAD^{tree} &&
+	test_must_fail git diff-index --cached --exit-code $EMPTY_TREE
+'
+
+test_expect_success 'git-add leaves directories it did not touch invalid' '
+	test_when_finished "git reset --hard no-children; git read-tree HEAD" &&
+	mkdir dir5 dir6 &&
+	test_commit dir5/e &&
+	test_commit dir6/f &&
+	echo "I changed this file" >dir6/f.t &&
+	git update-index dir6/f.t &&
+	git checkout HEAD -- dir6/f.t &&
+	git update-index dir6/f.t &&
+	test_invalid_cache_tree dir6/ &&
+	echo "I changed this file" >dir5/e.t &&
+	git add dir5/e.t &&
+	git checkout HEAD -- dir5/e.t &&
+	git add dir5/e.t &&
+	test_invalid_cache_tree dir6/ &&
+	test-dump-cache-tree >actual &&
+	grep "^$_x40 dir5/" actual
+'
+
 test_expect_success 'update-index invalidates cache-tree' '
 	test_when_finished "git reset --hard; git read-tree HEAD" &&
 	echo "I changed this file" >foo &&
@@ -573,4 +573,43 @@ test_expect_success 'cat-file --batch-all-objects shows all objects' '
 	test_cmp expect actual
 '
 
+test_expect_success 'cat-file --batch-all-objects with object info' '
+	git -C all-two cat-file --batch-all-objects --batch-check="%(objectname)" |
+	git -C all-two cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" >expect &&
+	git -C all-two cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file --batch-check --buffer keeps answers in order' '
+	(
+		cd all-two &&
+		git rev-parse HEAD:file HEAD HEAD^{tree} &&
+		echo $_z40 &&
+		echo HEAD &&
+		echo does-not-exist &&
+		echo HEAD:file
+	) >input &&
+	(
+		cd all-two &&
+		git cat-file --batch-check="%(objectname) %(objecttype) %(rest)" <../input
+	) >expect &&
+	grep " missing$" expect &&
+	(
+		cd all-two &&
+		git cat-file --batch-check="%(objectname) %(objecttype) %(rest)" \
+			--buffer <../input
+	) >actual &&
+	test_cmp expect actual &&
+	(
+		cd all-two &&
+		git cat-file --batch --buffer <../input
+	) >actual &&
+	(
+		cd all-two &&
+		git cat-file --batch <../input
+	) >expect &&
+	test_cmp expect actual
+'
+
 test_done
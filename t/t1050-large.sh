@@ -11,6 +11,11 @@ file_size () {
 	perl -e 'print -s $ARGV[0]' "$1"
 }
 
+# numbered lines of noise, so that edited copies deltify well
+large_lines () {
+	perl -e 'srand($ARGV[0]); printf "%d %d\n", $_, rand(1e12) for 1..$ARGV[1]' "$@"
+}
+
 test_expect_success setup '
 	# clone does not allow us to pass core.bigfilethreshold to
 	# new repos, so set core.bigfilethreshold globally
@@ -211,4 +216,59 @@ test_expect_success 'fsck large blobs' '
 	test_must_be_empty err
 '
 
+test_expect_success 'setup deltified large blobs' '
+	# each version shares most with its neighbours only, so that
+	# the pack has chains of deltas against large deltified bases;
+	# the rotation in delta3 makes a delta copy backwards
+	large_lines 1 100000 >delta1 &&
+	{ head -n 20000 delta1 &&
+	  large_lines 2 20000 &&
+	  tail -n +40001 delta1; } >delta2 &&
+	{ tail -n +80001 delta2 && head -n 80000 delta2; } >delta3 &&
+	{ head -n 50000 delta3 &&
+	  large_lines 3 20000 &&
+	  tail -n +70001 delta3; } >delta4 &&
+	test_create_repo deltas &&
+	(
+		cd deltas &&
+		for i in 1 2 3 4
+		do
+			cp ../delta$i file &&
+			GIT_ALLOC_LIMIT=0 git add file &&
+			git commit -q -m "v$i" &&
+			git tag v$i || return 1
+		done
+	)
+'
+
+for ofs in true false
+do
+	test_expect_success "stream deltified large blobs (useDeltaBaseOffset=$ofs)" '
+		(
+			cd deltas &&
+			git config repack.useDeltaBaseOffset $ofs &&
+			GIT_ALLOC_LIMIT=0 git -c core.bigfilethreshold=512m \
+				repack -adf --depth=3 &&
+			GIT_ALLOC_LIMIT=0 git verify-pack -v \
+				.git/objects/pack/pack-*.idx >verify &&
+			test $(grep -c "blob .* $_x40" verify) = 3 &&
+			# the blobs are about 1.8MB; reading one in core
+			# instead of streaming it would hit the limit
+			for i in 1 2 3 4
+			do
+				GIT_ALLOC_LIMIT=1500k git -c core.bigfilethreshold=200k \
+					checkout -q -f v$i &&
+				test_cmp ../delta$i file &&
+				GIT_ALLOC_LIMIT=1500k git -c core.bigfilethreshold=200k \
+					cat-file blob v$i:file >actual &&
+				test_cmp ../delta$i actual &&
+				GIT_ALLOC_LIMIT=1500k git -c core.bigfilethreshold=200k \
+					archive v$i file >archive.tar &&
+				tar xOf archive.tar file >actual &&
+				test_cmp ../delta$i actual || return 1
+			done
+		)
+	'
+done
+
 test_done
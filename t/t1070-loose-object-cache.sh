@@ -0,0 +1,98 @@
+#!/bin/sh
+
+test_description='per-process cache of loose object directories'
+. ./test-lib.sh
+
+# Both blobs have ids starting with a8a2d, so that an abbreviation of
+# one is unique only once it is 6 characters long.
+A='loose 1213'
+B='loose 1315'
+
+test_expect_success 'setup' '
+	A_ID=$(printf "%s" "$A" | git hash-object --stdin) &&
+	B_ID=$(printf "%s" "$B" | git hash-object --stdin) &&
+	test $(echo $A_ID | cut -c1-5) = a8a2d &&
+	test $(echo $B_ID | cut -c1-5) = a8a2d
+'
+
+test_expect_success 'objects written by the process itself are cached' '
+	test-loose-cache >actual <<-EOF &&
+	has $A_ID
+	abbrev $B_ID
+	write $B
+	write $A
+	has $A_ID
+	has $B_ID
+	abbrev $A_ID
+	abbrev $B_ID
+	EOF
+	cat >expect <<-EOF &&
+	0
+	$(echo $B_ID | cut -c1-4)
+	$B_ID
+	$A_ID
+	1
+	1
+	$(echo $A_ID | cut -c1-6)
+	$(echo $B_ID | cut -c1-6)
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success PIPE 'objects written by others are found after a reprepare' '
+	git init others &&
+	(
+		cd others &&
+		mkfifo in out &&
+		(test-loose-cache <in >out &) &&
+		exec 9>in &&
+		exec 8<out &&
+		test_when_finished "exec 9>&-" &&
+		test_when_finished "exec 8<&-" &&
+
+		# fill the cache of the a8 directory
+		echo >&9 "has $A_ID" &&
+		read response <&8 &&
+		test "$response" = 0 &&
+
+		printf "%s" "$A" | git hash-object -w --stdin &&
+
+		# not found in the stale cache, which makes us look again
+		echo >&9 "resolve a8a2d" &&
+		read response <&8 &&
+		test "$response" = $A_ID &&
+		echo >&9 "has $A_ID" &&
+		read response <&8 &&
+		test "$response" = 1
+	)
+'
+
+test_expect_success 'loose objects of alternates are cached' '
+	git init alternate &&
+	printf "%s" "$A" | git -C alternate hash-object -w --stdin &&
+	git init borrower &&
+	echo "$(pwd)/alternate/.git/objects" \
+		>borrower/.git/objects/info/alternates &&
+	(
+		cd borrower &&
+		test-loose-cache >actual <<-EOF &&
+		has $A_ID
+		abbrev $A_ID
+		write $B
+		abbrev $A_ID
+		abbrev $B_ID
+		EOF
+		cat >expect <<-EOF &&
+		1
+		$(echo $A_ID | cut -c1-4)
+		$B_ID
+		$(echo $A_ID | cut -c1-6)
+		$(echo $B_ID | cut -c1-6)
+		EOF
+		test_cmp expect actual &&
+		git rev-parse --verify a8a2da &&
+		test_must_fail git rev-parse --verify a8a2d
+	)
+'
+
+test_done
@@ -0,0 +1,184 @@
+#!/bin/sh
+
+test_description='sparse-checkout builtin and cone patterns'
+
+. ./test-lib.sh
+
+list_files () {
+	(cd "$1" && find . -type f ! -path "./.git/*" | sed "s|^\./||" | sort)
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		mkdir -p folder1/sub folder2 deep/deeper1/deepest deep/deeper2 &&
+		for f in a folder1/a folder1/sub/a folder2/a deep/a \
+			 deep/deeper1/a deep/deeper1/deepest/a deep/deeper2/a
+		do
+			echo $f >$f || return 1
+		done &&
+		git add . &&
+		git commit -m initial
+	)
+'
+
+test_expect_success 'list fails without a sparse-checkout file' '
+	test_must_fail git -C repo sparse-checkout list
+'
+
+test_expect_success 'init writes the patterns for the top level' '
+	git -C repo sparse-checkout init &&
+	echo true >expect &&
+	git -C repo config core.sparseCheckout >actual &&
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	/*
+	!/*/
+	EOF
+	test_cmp expect repo/.git/info/sparse-checkout &&
+	echo a >expect &&
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'set replaces the patterns' '
+	git -C repo sparse-checkout set "/*" "!/*/" "/folder1/" &&
+	git -C repo sparse-checkout list >actual &&
+	cat >expect <<-\EOF &&
+	/*
+	!/*/
+	/folder1/
+	EOF
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	a
+	folder1/a
+	folder1/sub/a
+	EOF
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'set --stdin' '
+	printf "/*\n!/*/\n/folder2/\n" | git -C repo sparse-checkout set --stdin &&
+	cat >expect <<-\EOF &&
+	a
+	folder2/a
+	EOF
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init --cone keeps the existing patterns' '
+	git -C repo sparse-checkout init --cone &&
+	echo true >expect &&
+	git -C repo config core.sparseCheckoutCone >actual &&
+	test_cmp expect actual &&
+	echo folder2 >expect &&
+	git -C repo sparse-checkout list >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'set in cone mode writes cone patterns' '
+	git -C repo sparse-checkout set deep/deeper1/deepest/ folder1 &&
+	cat >expect <<-\EOF &&
+	/*
+	!/*/
+	/deep/
+	!/deep/*/
+	/deep/deeper1/
+	!/deep/deeper1/*/
+	/deep/deeper1/deepest/
+	/folder1/
+	EOF
+	test_cmp expect repo/.git/info/sparse-checkout &&
+	cat >expect <<-\EOF &&
+	deep/deeper1/deepest
+	folder1
+	EOF
+	git -C repo sparse-checkout list >actual &&
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	a
+	deep/a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	folder1/a
+	folder1/sub/a
+	EOF
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cone mode drops directories inside of others' '
+	git -C repo sparse-checkout set deep deep/deeper1 &&
+	echo deep >expect &&
+	git -C repo sparse-checkout list >actual &&
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	a
+	deep/a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	deep/deeper2/a
+	EOF
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cone mode rejects patterns' '
+	test_must_fail git -C repo sparse-checkout set "deep/*" &&
+	echo deep >expect &&
+	git -C repo sparse-checkout list >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'other patterns disable cone matching with a warning' '
+	cat >repo/.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	/folder1/a
+	EOF
+	git -C repo read-tree -m -u HEAD 2>err &&
+	test_i18ngrep "unrecognized pattern: ./folder1/a." err &&
+	test_i18ngrep "disabling cone pattern matching" err &&
+	cat >expect <<-\EOF &&
+	a
+	folder1/a
+	EOF
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cone and non-cone matching agree' '
+	git -C repo sparse-checkout set folder1 deep/deeper1 &&
+	list_files repo >expect &&
+	git -C repo config core.sparseCheckoutCone false &&
+	git -C repo read-tree -m -u HEAD &&
+	list_files repo >actual &&
+	test_cmp expect actual &&
+	git -C repo config core.sparseCheckoutCone true
+'
+
+test_expect_success 'a failed update keeps the old patterns' '
+	cp repo/.git/info/sparse-checkout expect &&
+	echo dirty >repo/folder1/a &&
+	test_must_fail git -C repo sparse-checkout set deep &&
+	test_cmp expect repo/.git/info/sparse-checkout &&
+	git -C repo checkout folder1/a
+'
+
+test_expect_success 'disable checks out everything' '
+	git -C repo sparse-checkout disable &&
+	test_path_is_missing repo/.git/info/sparse-checkout &&
+	echo false >expect &&
+	git -C repo config core.sparseCheckout >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C repo config core.sparseCheckoutCone &&
+	git -C repo ls-files >expect &&
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_done
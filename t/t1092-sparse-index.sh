@@ -0,0 +1,201 @@
+#!/bin/sh
+
+test_description='sparse index: directories outside the cone as tree entries'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p in/deep out/a out/b &&
+	for f in top in/x in/deep/y out/a/1 out/a/2 out/b/3 out/c
+	do
+		echo $f >$f || return 1
+	done &&
+	git add top in out &&
+	git commit -m initial &&
+	git tag initial &&
+
+	git checkout -b inside &&
+	echo changed >in/x &&
+	git commit -a -m "change inside the cone" &&
+
+	git checkout -b outside initial &&
+	echo changed >out/a/1 &&
+	echo new >out/b/4 &&
+	git add out &&
+	git commit -m "change outside the cone" &&
+	git checkout master &&
+
+	git clone . full &&
+	git config core.sparseCheckout true &&
+	git config index.sparse true &&
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	/in/
+	EOF
+	cat >.gitignore <<-\EOF &&
+	.gitignore
+	actual*
+	expect
+	full
+	EOF
+	git read-tree -m -u HEAD
+'
+
+test_expect_success 'the directories outside of the cone are collapsed' '
+	test_path_is_file in/deep/y &&
+	test_path_is_missing out &&
+	cat >expect <<-EOF &&
+	sparse
+	100644 $(git rev-parse HEAD:in/deep/y) 0	in/deep/y
+	100644 $(git rev-parse HEAD:in/x) 0	in/x
+	040000 $(git rev-parse HEAD:out) 0 S	out/
+	100644 $(git rev-parse HEAD:top) 0	top
+	EOF
+	test-dump-sparse-index >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'other commands see a full index' '
+	git -C full ls-files >expect &&
+	git ls-files >actual &&
+	test_cmp expect actual &&
+	git ls-files -t >actual &&
+	grep "^S out/a/1" actual &&
+	git diff --cached --exit-code HEAD &&
+	test-dump-sparse-index >actual &&
+	head -n 1 actual >actual.head &&
+	echo sparse >expect &&
+	test_cmp expect actual.head
+'
+
+test_expect_success 'status on a sparse index' '
+	echo modified >in/x &&
+	echo new >in/new &&
+	git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M in/x
+	?? in/new
+	EOF
+	test_cmp expect actual &&
+	git checkout in/x &&
+	rm in/new &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'switch to a branch changing the cone' '
+	git checkout inside &&
+	echo changed >expect &&
+	test_cmp expect in/x &&
+	test-dump-sparse-index >actual &&
+	grep "^040000 $(git rev-parse HEAD:out) 0 S	out/\$" actual
+'
+
+test_expect_success 'switch to a branch changing outside of the cone' '
+	git checkout outside &&
+	test_path_is_missing out &&
+	echo in/x >expect &&
+	test_cmp expect in/x &&
+	test-dump-sparse-index >actual &&
+	grep "^040000 $(git rev-parse outside:out) 0 S	out/\$" actual &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'merge and commit on a sparse index' '
+	git checkout -b merged inside &&
+	git merge -m merged outside &&
+	test_path_is_missing out &&
+	git diff --exit-code HEAD outside -- out &&
+	git diff --exit-code HEAD inside -- in &&
+	test-dump-sparse-index >actual &&
+	grep "^040000 $(git rev-parse HEAD:out) 0 S	out/\$" actual &&
+	echo more >>top &&
+	git commit -a -m "commit on a sparse index" &&
+	git diff --exit-code HEAD^ outside -- out &&
+	test-dump-sparse-index >actual &&
+	grep "^040000 $(git rev-parse HEAD:out) 0 S	out/\$" actual
+'
+
+test_expect_success 'widening the cone checks out the files' '
+	cat >>.git/info/sparse-checkout <<-\EOF &&
+	/out/
+	!/out/*/
+	/out/a/
+	EOF
+	git read-tree -m -u HEAD &&
+	echo changed >expect &&
+	test_cmp expect out/a/1 &&
+	test_path_is_file out/c &&
+	test_path_is_missing out/b &&
+	test-dump-sparse-index >actual &&
+	grep "^040000 $(git rev-parse HEAD:out/b) 0 S	out/b/\$" actual &&
+	! grep "	out/\$" actual &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'narrowing the cone collapses the directories again' '
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	/in/
+	EOF
+	git read-tree -m -u HEAD &&
+	test_path_is_missing out &&
+	test-dump-sparse-index >actual &&
+	grep "^040000 $(git rev-parse HEAD:out) 0 S	out/\$" actual
+'
+
+test_expect_success 'patterns which are not cone-shaped keep the index full' '
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/out/*
+	EOF
+	git read-tree -m -u HEAD &&
+	test-dump-sparse-index >actual &&
+	head -n 1 actual >actual.head &&
+	echo full >expect &&
+	test_cmp expect actual.head
+'
+
+test_expect_success 'index.sparse=false writes a full index' '
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	/in/
+	EOF
+	git read-tree -m -u HEAD &&
+	test-dump-sparse-index >actual &&
+	grep "	out/\$" actual &&
+	git -c index.sparse=false read-tree -m -u HEAD &&
+	test-dump-sparse-index >actual &&
+	! grep "	out/\$" actual &&
+	grep "^100644 .* 0 S	out/b/3\$" actual
+'
+
+test_expect_success 'commands needing a full index leave a full index full' '
+	echo more >>top &&
+	git add top &&
+	test-dump-sparse-index >actual &&
+	head -n 1 actual >actual.head &&
+	echo full >expect &&
+	test_cmp expect actual.head
+'
+
+test_expect_success 'but keep a sparse index sparse' '
+	git read-tree -m -u HEAD &&
+	echo even more >>top &&
+	git add top &&
+	test-dump-sparse-index >actual &&
+	grep "^040000 $(git rev-parse HEAD:out) 0 S	out/\$" actual &&
+	git diff --cached --name-only HEAD >actual &&
+	echo top >expect &&
+	test_cmp expect actual &&
+	git ls-tree -r --name-only HEAD >expect &&
+	git ls-files >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,313 @@
+#!/bin/sh
+
+test_description='reftable ref storage backend'
+
+. ./test-lib.sh
+
+test_expect_success 'init --ref-storage=reftable' '
+	git init --ref-storage=reftable repo &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryformatversion >actual &&
+	test_cmp expect actual &&
+	echo reftable >expect &&
+	git -C repo config extensions.refStorage >actual &&
+	test_cmp expect actual &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init rejects unknown and changed formats' '
+	test_must_fail git init --ref-storage=bogus bogus &&
+	test_must_fail git init --ref-storage=files repo &&
+	git init --ref-storage=reftable repo &&
+	test_must_fail git init --ref-storage=reftable .
+'
+
+test_expect_success 'unknown ref storage extension is rejected' '
+	git init unknown &&
+	git -C unknown config core.repositoryformatversion 1 &&
+	git -C unknown config extensions.refStorage bogus &&
+	test_must_fail git -C unknown rev-parse HEAD 2>err &&
+	test_i18ngrep "unknown ref storage format" err
+'
+
+test_expect_success 'commits update refs in tables, not loose files' '
+	(
+		cd repo &&
+		test_commit one &&
+		test_commit two &&
+		test_path_is_missing .git/refs/heads/master &&
+		test_path_is_missing .git/refs/tags/one &&
+		test_path_is_missing .git/logs &&
+		git rev-parse two >expect &&
+		git rev-parse master >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'update-ref with old value' '
+	(
+		cd repo &&
+		A=$(git rev-parse one) &&
+		B=$(git rev-parse two) &&
+		git update-ref refs/heads/topic $A &&
+		test_must_fail git update-ref refs/heads/topic $B $B &&
+		git update-ref refs/heads/topic $B $A &&
+		echo $B >expect &&
+		git rev-parse topic >actual &&
+		test_cmp expect actual &&
+		test_must_fail git update-ref -d refs/heads/topic $A &&
+		git update-ref -d refs/heads/topic $B &&
+		test_must_fail git rev-parse --verify -q topic
+	)
+'
+
+test_expect_success 'transactions are atomic' '
+	(
+		cd repo &&
+		A=$(git rev-parse one) &&
+		B=$(git rev-parse two) &&
+		git update-ref refs/heads/x $A &&
+		cat >stdin <<-EOF &&
+		create refs/heads/y $A
+		update refs/heads/x $B $B
+		EOF
+		test_must_fail git update-ref --stdin <stdin &&
+		test_must_fail git rev-parse --verify -q y &&
+		cat >stdin <<-EOF &&
+		create refs/heads/y $A
+		update refs/heads/x $B $A
+		EOF
+		git update-ref --stdin <stdin &&
+		git rev-parse one two >expect &&
+		git rev-parse y x >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'D/F conflicts are detected' '
+	(
+		cd repo &&
+		test_must_fail git update-ref refs/heads/x/sub HEAD &&
+		test_must_fail git update-ref refs/heads/master/sub HEAD &&
+		test_must_fail git symbolic-ref refs/heads/y/sub refs/heads/x &&
+		git update-ref -d refs/heads/x &&
+		git update-ref refs/heads/x/sub HEAD
+	)
+'
+
+test_expect_success 'for-each-ref lists refs in order and peels tags' '
+	(
+		cd repo &&
+		git tag -a -m annotated annotated one &&
+		git for-each-ref --format="%(refname) %(*objectname)" >output &&
+		sed "s/ *\$//" output >actual &&
+		cat >expect <<-EOF &&
+		refs/heads/master
+		refs/heads/x/sub
+		refs/heads/y
+		refs/tags/annotated $(git rev-parse one)
+		refs/tags/one
+		refs/tags/two
+		EOF
+		test_cmp expect actual &&
+		git show-ref -d annotated >actual &&
+		test_line_count = 2 actual
+	)
+'
+
+test_expect_success 'symbolic refs' '
+	(
+		cd repo &&
+		git symbolic-ref refs/heads/sym refs/heads/master &&
+		echo refs/heads/master >expect &&
+		git symbolic-ref refs/heads/sym >actual &&
+		test_cmp expect actual &&
+		git update-ref refs/heads/sym one &&
+		git rev-parse one >expect &&
+		git rev-parse master >actual &&
+		test_cmp expect actual &&
+		git update-ref refs/heads/master two &&
+		git symbolic-ref -d refs/heads/sym &&
+		test_must_fail git symbolic-ref refs/heads/sym
+	)
+'
+
+test_expect_success 'reflogs of branches and HEAD' '
+	(
+		cd repo &&
+		cat >expect <<-EOF &&
+		commit: two
+		commit (initial): one
+		EOF
+		git reflog show --format=%gs master >actual &&
+		tail -n 2 actual >actual.tail &&
+		test_cmp expect actual.tail &&
+		git reflog show --format=%gs HEAD >actual &&
+		tail -n 2 actual >actual.tail &&
+		test_cmp expect actual.tail &&
+		git reflog exists refs/heads/master &&
+		test_must_fail git reflog exists refs/heads/nonexistent
+	)
+'
+
+test_expect_success 'reflog of detached HEAD' '
+	(
+		cd repo &&
+		git checkout --detach one &&
+		git checkout master &&
+		git reflog show --format=%gs -2 HEAD >actual &&
+		cat >expect <<-EOF &&
+		checkout: moving from $(git rev-parse one) to master
+		checkout: moving from master to one
+		EOF
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'create reflog explicitly' '
+	(
+		cd repo &&
+		git update-ref --create-reflog refs/misc/logged HEAD &&
+		git reflog exists refs/misc/logged &&
+		git update-ref refs/misc/unlogged HEAD &&
+		test_must_fail git reflog exists refs/misc/unlogged
+	)
+'
+
+test_expect_success 'reflog expire and delete' '
+	(
+		cd repo &&
+		git branch expiring one &&
+		git branch -f expiring two &&
+		git reflog show expiring >actual &&
+		test_line_count = 2 actual &&
+		git reflog delete expiring@{1} &&
+		git reflog show expiring >actual &&
+		test_line_count = 1 actual &&
+		git reflog expire --expire=all expiring &&
+		git reflog show expiring >actual &&
+		test_line_count = 0 actual
+	)
+'
+
+test_expect_success 'branch rename moves the reflog' '
+	(
+		cd repo &&
+		git branch old one &&
+		git branch -f old two &&
+		git reflog show --format=%gs old >expect &&
+		git branch -m old new &&
+		test_must_fail git rev-parse --verify -q old &&
+		test_must_fail git reflog exists refs/heads/old &&
+		git reflog show --format=%gs -2 new >actual &&
+		echo "Branch: renamed refs/heads/old to refs/heads/new" >expect.new &&
+		head -n 1 expect >>expect.new &&
+		test_cmp expect.new actual &&
+		git branch -M new new &&
+		git branch -d new &&
+		test_must_fail git reflog exists refs/heads/new
+	)
+'
+
+test_expect_success 'deleting a branch removes its reflog' '
+	(
+		cd repo &&
+		git branch doomed &&
+		git reflog exists refs/heads/doomed &&
+		git branch -D doomed &&
+		test_must_fail git reflog exists refs/heads/doomed &&
+		git branch doomed &&
+		git reflog show doomed >actual &&
+		test_line_count = 1 actual
+	)
+'
+
+test_expect_success 'pseudorefs stay loose files' '
+	(
+		cd repo &&
+		git update-ref ORIG_HEAD HEAD &&
+		test_path_is_file .git/ORIG_HEAD &&
+		git rev-parse HEAD >expect &&
+		git rev-parse ORIG_HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'the stack is compacted automatically' '
+	(
+		cd repo &&
+		for i in $(test_seq 20)
+		do
+			git update-ref refs/heads/many-$i HEAD || return 1
+		done &&
+		test_line_count -le 6 .git/reftable/tables.list
+	)
+'
+
+test_expect_success 'autoCompaction can be disabled' '
+	(
+		cd repo &&
+		git pack-refs &&
+		test_line_count = 1 .git/reftable/tables.list &&
+		git -c reftable.autoCompaction=false update-ref refs/heads/a HEAD &&
+		git -c reftable.autoCompaction=false update-ref refs/heads/b HEAD &&
+		git -c reftable.autoCompaction=false update-ref refs/heads/c HEAD &&
+		test_line_count = 4 .git/reftable/tables.list
+	)
+'
+
+test_expect_success 'pack-refs merges all tables' '
+	(
+		cd repo &&
+		git for-each-ref >expect &&
+		git pack-refs --all &&
+		test_line_count = 1 .git/reftable/tables.list &&
+		git for-each-ref >actual &&
+		test_cmp expect actual &&
+		ls .git/reftable >tables &&
+		test_line_count = 2 tables
+	)
+'
+
+test_expect_success 'many refs spread over several blocks' '
+	(
+		cd repo &&
+		for i in $(test_seq 1000)
+		do
+			echo "create refs/heads/block/branch-$i HEAD" || return 1
+		done >stdin &&
+		git update-ref --stdin <stdin &&
+		git for-each-ref refs/heads/block/ >actual &&
+		test_line_count = 1000 actual &&
+		git rev-parse --verify block/branch-500 &&
+		git rev-parse --verify block/branch-1000 &&
+		git pack-refs --all &&
+		git for-each-ref refs/heads/block/ >actual &&
+		test_line_count = 1000 actual &&
+		git rev-parse --verify block/branch-1
+	)
+'
+
+test_expect_success 'worktrees have their own HEAD and reflog' '
+	(
+		cd repo &&
+		git worktree add ../wt one &&
+		git -C ../wt rev-parse HEAD >actual &&
+		git rev-parse one >expect &&
+		test_cmp expect actual &&
+		git -C ../wt commit --allow-empty -m in-worktree &&
+		git -C ../wt reflog show --format=%gs -1 HEAD >actual &&
+		echo "commit: in-worktree" >expect &&
+		test_cmp expect actual &&
+		git reflog show --format=%gs -1 HEAD >actual &&
+		! test_cmp expect actual &&
+		git -C ../wt update-ref refs/bisect/wt HEAD &&
+		test_must_fail git rev-parse --verify -q refs/bisect/wt &&
+		git -C ../wt rev-parse --verify refs/bisect/wt
+	)
+'
+
+test_done
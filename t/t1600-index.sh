@@ -73,4 +73,63 @@ test_expect_success 'GIT_INDEX_VERSION takes precedence over config' '
 	)
 '
 
+index_trailer () {
+	tail -c 20 "${1:-.git/index}" | od -An -tx1 | tr -d " \n" &&
+	echo
+}
+
+test_expect_success 'index.skipHash writes a null trailer' '
+	rm -f .git/index &&
+	git -c index.skipHash=true add a &&
+	echo $_z40 >expect &&
+	index_trailer >actual &&
+	test_cmp expect actual &&
+	echo a >expect &&
+	git ls-files >actual &&
+	test_cmp expect actual &&
+	git fsck --cache &&
+	echo 2 >a &&
+	git add a &&
+	index_trailer >actual &&
+	! test_cmp expect actual
+'
+
+test_expect_success 'index.skipHash keeps the checksum of a shared index' '
+	test_when_finished "git update-index --no-split-index" &&
+	git -c index.skipHash=true update-index --split-index &&
+	echo $_z40 >expect &&
+	index_trailer >actual &&
+	test_cmp expect actual &&
+	shared=$(git rev-parse --shared-index-path) &&
+	echo "${shared##*sharedindex.}" >expect &&
+	index_trailer "$shared" >actual &&
+	test_cmp expect actual &&
+	echo b >b &&
+	git -c index.skipHash=true update-index --add b &&
+	git ls-files >actual &&
+	test_write_lines a b >expect &&
+	test_cmp expect actual &&
+	git fsck --cache
+'
+
+test_expect_success 'index.skipHash does not overwrite an index replaced meanwhile' '
+	test_config index.skipHash true &&
+	echo 3 >a &&
+	git add a &&
+	cp .git/index other-index &&
+	echo 4 >a &&
+	git add a &&
+	test $(wc -c <other-index) = $(wc -c <.git/index) &&
+	# replace the index after status read it, with a file of the
+	# same size and timestamp, as a concurrent update could
+	write_script .git/fsmonitor-test <<-\EOF &&
+	cp other-index .git/index.new &&
+	touch -r .git/index .git/index.new &&
+	mv .git/index.new .git/index
+	EOF
+	test-chmtime =-60 a &&
+	git -c core.fsmonitor=.git/fsmonitor-test status &&
+	test_cmp_bin other-index .git/index
+'
+
 test_done
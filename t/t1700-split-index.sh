@@ -7,6 +7,9 @@ test_description='split index mode tests'
 # We need total control of index splitting here
 sane_unset GIT_TEST_SPLIT_INDEX
 
+# ... and of the optional extensions, which change the checksums below
+sane_unset GIT_TEST_INDEX_THREADS GIT_FSMONITOR_TEST
+
 test_expect_success 'enable split index' '
 	git config splitIndex.maxPercentChange 100 &&
 	git update-index --split-index &&
@@ -370,4 +373,38 @@ test_expect_success 'check splitIndex.sharedIndexExpire set to "never" and "now"
 	test $(ls .git/sharedindex.* | wc -l) -le 2
 '
 
+add_one_by_one () {
+	for i in $(test_seq $2)
+	do
+		: >$1$i &&
+		git update-index --add $1$i || return 1
+	done
+}
+
+test_expect_success 'small changes write a new shared index early by default' '
+	git config --unset splitIndex.maxPercentChange &&
+	for i in $(test_seq 200)
+	do
+		printf "100644 %s\tbig/file%03d\n" $EMPTY_BLOB $i
+	done | git update-index --index-info &&
+	BASE=$(test-dump-split-index .git/index | grep "^base") &&
+	add_one_by_one small 10 &&
+	test-dump-split-index .git/index | grep "^base" >actual &&
+	echo "$BASE" >expect &&
+	test_cmp expect actual &&
+	add_one_by_one more 20 &&
+	test-dump-split-index .git/index | grep "^base" >actual &&
+	! test_cmp expect actual
+'
+
+test_expect_success 'but not with splitIndex.maxPercentChange set' '
+	git config splitIndex.maxPercentChange 20 &&
+	git update-index --add more1 &&
+	BASE=$(test-dump-split-index .git/index | grep "^base") &&
+	add_one_by_one other 30 &&
+	test-dump-split-index .git/index | grep "^base" >actual &&
+	echo "$BASE" >expect &&
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,136 @@
+#!/bin/sh
+
+test_description='threaded index loading with the EOIE and IEOT extensions'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_INDEX_THREADS
+
+# Write the index from scratch, passing the arguments on to git.
+rewrite_index () {
+	rm -f .git/index &&
+	git "$@" read-tree HEAD &&
+	test-read-cache --verify-checksum
+}
+
+# Print the signature of the last extension of the index.
+last_extension () {
+	tail -c 52 .git/index | head -c 4
+}
+
+test_expect_success 'setup' '
+	for d in a b c d
+	do
+		mkdir -p $d/sub &&
+		for i in $(test_seq 50)
+		do
+			echo $d$i >$d/sub/file$i || return 1
+		done
+	done &&
+	git add . &&
+	git commit -m initial &&
+	git ls-files --stage >expect.stage &&
+	test-dump-cache-tree >expect.tree
+'
+
+test_expect_success 'no extensions are written by default' '
+	rewrite_index &&
+	test "$(last_extension)" != EOIE &&
+	! grep -a -q IEOT .git/index
+'
+
+for version in 2 4
+do
+	test_expect_success "index.threads writes the extensions (v$version)" '
+		rewrite_index -c index.threads=4 -c index.version=$version &&
+		test "$(test-index-version <.git/index)" = $version &&
+		test "$(last_extension)" = EOIE &&
+		grep -a -q IEOT .git/index
+	'
+
+	test_expect_success "threaded read matches the serial read (v$version)" '
+		git -c index.threads=4 ls-files --stage >actual &&
+		test_cmp expect.stage actual &&
+		git -c index.threads=4 diff-index --cached --exit-code HEAD &&
+		git -c index.threads=1 ls-files --stage >actual &&
+		test_cmp expect.stage actual &&
+		git -c index.threads=1 diff-index --cached --exit-code HEAD
+	'
+done
+
+test_expect_success 'extensions are loaded alongside the entries' '
+	rewrite_index -c index.threads=4 &&
+	git -c index.threads=4 update-index --untracked-cache &&
+	test-read-cache --verify-checksum &&
+	test "$(last_extension)" = EOIE &&
+	test-dump-cache-tree >actual &&
+	test_cmp expect.tree actual &&
+	git -c index.threads=1 status 2>err &&
+	test_must_be_empty err
+'
+
+test_expect_success 'modified index is written with fresh offsets' '
+	echo changed >b/sub/file7 &&
+	rm c/sub/file3 &&
+	git -c index.threads=4 update-index --remove b/sub/file7 c/sub/file3 &&
+	test-read-cache --verify-checksum &&
+	git ls-files --stage >expect &&
+	git -c index.threads=3 ls-files --stage >actual &&
+	test_cmp expect actual &&
+	git reset --hard &&
+	git -c index.threads=3 ls-files --stage >actual &&
+	test_cmp expect.stage actual
+'
+
+test_expect_success 'extensions can be disabled' '
+	rewrite_index -c index.threads=4 -c index.recordEndOfIndexEntries=false \
+		-c index.recordOffsetTable=false &&
+	test "$(last_extension)" != EOIE &&
+	! grep -a -q IEOT .git/index &&
+	git -c index.threads=4 ls-files --stage >actual &&
+	test_cmp expect.stage actual
+'
+
+test_expect_success 'offset table without EOIE is ignored' '
+	rewrite_index -c index.threads=4 -c index.recordEndOfIndexEntries=false &&
+	test "$(last_extension)" != EOIE &&
+	grep -a -q IEOT .git/index &&
+	git -c index.threads=4 ls-files --stage >actual &&
+	test_cmp expect.stage actual
+'
+
+test_expect_success 'index written in the background is consistent' '
+	blob=$(git rev-parse HEAD:a/sub/file1) &&
+	for i in $(test_seq 3000)
+	do
+		printf "100644 %s\tmany/path-with-a-longer-name-%04d\n" $blob $i
+	done >many.info &&
+	git -c index.threads=2 update-index --index-info <many.info &&
+	test $(wc -c <.git/index) -gt 131072 &&
+	test-read-cache --verify-checksum &&
+	git ls-files --stage >expect &&
+	git -c index.threads=1 read-tree HEAD &&
+	git -c index.threads=1 update-index --index-info <many.info &&
+	test-read-cache --verify-checksum &&
+	git -c index.threads=1 ls-files --stage >actual &&
+	test_cmp expect actual &&
+	for version in 2 4
+	do
+		git -c index.threads=2 -c index.version=$version \
+			update-index --index-version $version &&
+		test-read-cache --verify-checksum &&
+		git fsck --cache --no-dangling &&
+		git -c index.threads=3 ls-files --stage >actual &&
+		test_cmp expect actual &&
+		git -c index.threads=1 ls-files --stage >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	git reset --hard
+'
+
+test_expect_success 'negative index.threads is rejected' '
+	test_must_fail git -c index.threads=-1 ls-files 2>err &&
+	test_i18ngrep "index.threads" err
+'
+
+test_done
@@ -0,0 +1,169 @@
+#!/bin/sh
+
+test_description='parallel checkout basics
+
+Write the same trees with and without parallel checkout and check that
+the working trees and the index stat data come out the same.'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_CHECKOUT_WORKERS
+
+# Run "git <args>" with the given number of workers and no threshold,
+# and check that the expected number of checkout--worker processes was
+# started.
+test_checkout_workers () {
+	expected_workers=$1 &&
+	shift &&
+	rm -f "$TRASH_DIRECTORY/trace" &&
+	GIT_TRACE="$TRASH_DIRECTORY/trace" git -c checkout.workers=$expected_workers \
+		-c checkout.thresholdForParallelism=0 "$@" &&
+	grep "run_command: .checkout--worker" "$TRASH_DIRECTORY/trace" >"$TRASH_DIRECTORY/workers" &&
+	test_line_count = $expected_workers "$TRASH_DIRECTORY/workers"
+}
+
+# Compare the working trees (and index stat data) of two clones.
+test_cmp_worktrees () {
+	for wt in "$1" "$2"
+	do
+		(
+			cd "$wt" &&
+			git diff-files --exit-code &&
+			git ls-files -s &&
+			git ls-files -z | xargs -0 ls -ld | cut -c1-10 &&
+			git ls-files -z | xargs -0 cat
+		) >"$wt.out" || return 1
+	done &&
+	test_cmp "$1.out" "$2.out"
+}
+
+test_expect_success 'setup' '
+	git config --global filter.rot13.smudge "tr a-zA-Z n-za-mA-Z" &&
+	git config --global filter.rot13.clean "tr a-zA-Z n-za-mA-Z" &&
+	git init src &&
+	(
+		cd src &&
+		for d in a b c/sub d
+		do
+			mkdir -p $d &&
+			for i in $(test_seq 25)
+			do
+				echo "$d file $i" >$d/file$i || return 1
+			done
+		done &&
+		echo "#!$SHELL_PATH" >a/exec &&
+		chmod +x a/exec &&
+		printf "one\ntwo\n" >crlf.txt &&
+		printf "\$Id\$\n" >ident.txt &&
+		echo "filtered" >filtered.txt &&
+		cat >.gitattributes <<-\EOF &&
+		crlf.txt text eol=crlf
+		ident.txt ident
+		filtered.txt filter=rot13
+		EOF
+		git add . &&
+		git commit -m base &&
+		git branch base &&
+		rm -r b d/file3 &&
+		for i in $(test_seq 10)
+		do
+			echo "changed $i" >c/sub/file$i || return 1
+		done &&
+		mkdir b &&
+		echo "b is a file now" >b/new &&
+		echo "refiltered" >filtered.txt &&
+		git add -A &&
+		git commit -m changed
+	)
+'
+
+test_expect_success SYMLINKS 'setup symlinks' '
+	(
+		cd src &&
+		git checkout -q base &&
+		ln -s a/file1 link &&
+		git add link &&
+		git commit -m link &&
+		git checkout -q master &&
+		git merge -q --no-edit base
+	)
+'
+
+test_expect_success 'sequential clone' '
+	git -c checkout.workers=1 clone src sequential
+'
+
+test_expect_success 'parallel clone' '
+	test_checkout_workers 2 clone src parallel &&
+	test_cmp_worktrees sequential parallel
+'
+
+test_expect_success 'parallel checkout of another branch' '
+	git -C sequential -c checkout.workers=1 checkout -q base &&
+	(
+		cd parallel &&
+		test_checkout_workers 2 checkout -q base
+	) &&
+	test_cmp_worktrees sequential parallel
+'
+
+test_expect_success 'parallel checkout back to master' '
+	git -C sequential -c checkout.workers=1 checkout -q master &&
+	(
+		cd parallel &&
+		test_checkout_workers 3 checkout -q master
+	) &&
+	test_cmp_worktrees sequential parallel &&
+	git -C parallel status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'parallel reset --hard and read-tree -u' '
+	(
+		cd parallel &&
+		rm -r a c &&
+		echo dirty >d/file1 &&
+		test_checkout_workers 2 reset --hard &&
+		git ls-files -z | xargs -0 rm -f &&
+		test_checkout_workers 2 read-tree -u --reset HEAD
+	) &&
+	test_cmp_worktrees sequential parallel
+'
+
+test_expect_success 'no workers below the threshold' '
+	(
+		cd parallel &&
+		rm -f "$TRASH_DIRECTORY/trace" &&
+		GIT_TRACE="$TRASH_DIRECTORY/trace" git -c checkout.workers=2 \
+			-c checkout.thresholdForParallelism=1000 \
+			checkout -q base &&
+		! grep checkout--worker "$TRASH_DIRECTORY/trace" &&
+		git diff-files --exit-code &&
+		git checkout -q master
+	) &&
+	test_cmp_worktrees sequential parallel
+'
+
+test_expect_success 'GIT_TEST_CHECKOUT_WORKERS enables parallel checkout' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" GIT_TEST_CHECKOUT_WORKERS=2 \
+		git clone src env &&
+	grep "run_command: .checkout--worker" trace >workers &&
+	test_line_count = 2 workers &&
+	test_cmp_worktrees sequential env
+'
+
+test_expect_success 'untracked files in the way are replaced' '
+	(
+		cd parallel &&
+		git rm -q --cached d/file1 &&
+		echo untracked >d/file1 &&
+		test_checkout_workers 2 checkout -f -q base &&
+		git diff-files --exit-code &&
+		echo "d file 1" >expect &&
+		test_cmp expect d/file1 &&
+		git checkout -q master
+	)
+'
+
+test_done
@@ -211,4 +211,75 @@ test_expect_success 'retry acquiring packed-refs.lock' '
 	git -c core.packedrefstimeout=3000 pack-refs --all --prune
 '
 
+test_expect_success 'pack-refs declares the file sorted' '
+	git pack-refs --all --prune &&
+	head -n 1 .git/packed-refs >header &&
+	grep " sorted " header
+'
+
+test_expect_success 'setup many packed refs' '
+	git init many &&
+	(
+		cd many &&
+		test_commit base &&
+		git tag -a -m annotated annotated &&
+		git pack-refs --all --prune &&
+		commit=$(git rev-parse base) &&
+		for i in $(test_seq 100 999)
+		do
+			echo "$commit refs/pull/$i/head" || return 1
+		done >pulls &&
+		head -n 1 .git/packed-refs >header &&
+		grep " refs/heads/" .git/packed-refs >heads &&
+		sed -n "/ refs\/tags\//,\$p" .git/packed-refs >tags &&
+		sed -e "s/ sorted / /" header >unsorted &&
+		cat tags heads >>unsorted &&
+		sort -r pulls >>unsorted &&
+		cat header heads pulls tags >.git/packed-refs
+	)
+'
+
+test_expect_success 'look up single refs in a sorted packed-refs file' '
+	(
+		cd many &&
+		git rev-parse base >expect &&
+		git rev-parse refs/pull/100/head refs/pull/555/head \
+			refs/pull/999/head >actual &&
+		test_line_count = 3 actual &&
+		sort -u actual >actual.sorted &&
+		test_cmp expect actual.sorted &&
+		test_must_fail git rev-parse --verify refs/pull/1000/head &&
+		test_must_fail git rev-parse --verify refs/pull/55/head &&
+		git rev-parse annotated^{commit} >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'iterate over a prefix of a sorted packed-refs file' '
+	(
+		cd many &&
+		git for-each-ref --format="%(refname)" refs/pull/555 >actual &&
+		echo refs/pull/555/head >expect &&
+		test_cmp expect actual &&
+		git for-each-ref --format="%(refname)" refs/pull/ >actual &&
+		test_line_count = 900 actual &&
+		head -n 1 actual >first &&
+		echo refs/pull/100/head >expect &&
+		test_cmp expect first &&
+		git show-ref -d annotated >actual &&
+		test_line_count = 2 actual
+	)
+'
+
+test_expect_success 'packed-refs without the sorted trait is still read' '
+	(
+		cd many &&
+		git for-each-ref >expect &&
+		sed -e "1s/ sorted / /" unsorted >.git/packed-refs &&
+		git for-each-ref >actual &&
+		test_cmp expect actual &&
+		git rev-parse --verify refs/pull/555/head
+	)
+'
+
 test_done
@@ -406,6 +406,25 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success PTHREADS 'parallel deflate writes the same pack' '
+	git -c pack.packSizeLimit=0 pack-objects --window=0 --threads=1 \
+		--no-reuse-object --stdout <obj-list >serial.pack &&
+	git -c pack.packSizeLimit=0 pack-objects --window=0 --threads=4 \
+		--no-reuse-object --stdout <obj-list >parallel.pack &&
+	test_cmp serial.pack parallel.pack
+'
+
+test_expect_success PTHREADS 'parallel deflate of computed deltas' '
+	git -c pack.packSizeLimit=0 -c pack.deltaCacheSize=1 \
+		pack-objects --threads=4 --no-reuse-delta \
+		test-12 <obj-list >packname &&
+	git verify-pack -v test-12-$(cat packname).pack >verify &&
+	grep "^chain length = 1: 1 object" verify &&
+	git -c pack.packSizeLimit=0 pack-objects --threads=4 --no-reuse-delta \
+		--stdout <obj-list >delta.pack &&
+	git index-pack --strict -o delta.idx delta.pack
+'
+
 test_expect_success 'set up pack for non-repo tests' '
 	# make sure we have a pack with no matching index file
 	cp test-1-*.pack foo.pack
@@ -222,6 +222,24 @@ test_expect_success 'fetch (full bitmap)' '
 	test_cmp expect actual
 '
 
+test_expect_success 'full repack writes a lookup table' '
+	git config pack.writeBitmapLookupTable true &&
+	git repack -adf &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap other
+'
+
+rev_list_tests 'lookup table'
+
+test_expect_success 'full repack with lookup table reuses bitmaps' '
+	test_commit lookup-1 &&
+	git repack -ad &&
+	git rev-list --test-bitmap HEAD &&
+	git config --unset pack.writeBitmapLookupTable &&
+	git repack -ad &&
+	git rev-list --test-bitmap HEAD
+'
+
 test_expect_success 'create objects for missing-HAVE tests' '
 	blob=$(echo "missing have" | git hash-object -w --stdin) &&
 	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
@@ -331,4 +349,65 @@ test_expect_success 'pack reuse respects --incremental' '
 	git show-index <empty.idx >actual &&
 	test_cmp expect actual
 '
+
+# Each path gets two unrelated-looking versions of different sizes, so
+# that sorting by size alone keeps them apart, while sorting by the
+# name hash puts each version next to the other one.
+test_expect_success 'setup repo for name-hash cache tests' '
+	git init hash-cache &&
+	(
+		cd hash-cache &&
+		for i in $(test_seq 1 10)
+		do
+			mkdir dir-$i &&
+			test-genrandom v1-$i 2000 >dir-$i/file || return 1
+		done &&
+		git add . &&
+		git commit -m one &&
+		for i in $(test_seq 1 10)
+		do
+			test-genrandom v2-$i $((100 * $i)) >>dir-$i/file || return 1
+		done &&
+		git commit -a -m two
+	)
+'
+
+# count the deltas in a pack served from the bitmap, with a delta window
+# of one, so that only the neighbour in the sorted order is tried
+bitmap_pack_deltas () {
+	git rev-parse HEAD |
+	git pack-objects --revs --stdout --use-bitmap-index --window=1 \
+		--no-reuse-delta >tmp.pack &&
+	git index-pack -o tmp.idx tmp.pack >/dev/null &&
+	git verify-pack -v tmp.idx >verify &&
+	grep -c " 1 [0-9a-f]*$" verify
+}
+
+test_expect_success 'bitmaps carry a name-hash cache by default' '
+	(
+		cd hash-cache &&
+		git repack -adb --window=0 &&
+		printf "\000\005" >expect &&
+		dd if=$(ls .git/objects/pack/*.bitmap) bs=1 skip=6 count=2 \
+			>actual 2>/dev/null &&
+		test_cmp expect actual &&
+		bitmap_pack_deltas >deltas &&
+		echo 10 >expect &&
+		test_cmp expect deltas
+	)
+'
+
+test_expect_success 'pack.writeBitmapHashCache=false drops the cache' '
+	(
+		cd hash-cache &&
+		git -c pack.writeBitmapHashCache=false repack -adb --window=0 &&
+		printf "\000\001" >expect &&
+		dd if=$(ls .git/objects/pack/*.bitmap) bs=1 skip=6 count=2 \
+			>actual 2>/dev/null &&
+		test_cmp expect actual &&
+		bitmap_pack_deltas >deltas &&
+		test $(cat deltas) -lt 10
+	)
+'
+
 test_done
@@ -0,0 +1,84 @@
+#!/bin/sh
+
+test_description='delta base cache limits and statistics'
+. ./test-lib.sh
+
+test_expect_success 'setup repository with long delta chains' '
+	test_seq 1000 >one &&
+	test_seq 2000 >two &&
+	git add one two &&
+	git commit -m initial &&
+	for i in $(test_seq 2 40)
+	do
+		echo "change $i" >>one &&
+		echo "change $i" >>two &&
+		git commit -q -a -m "change $i" || return 1
+	done &&
+	git repack -a -d -f --depth=50 --window=50 &&
+	git log -p >expect
+'
+
+test_expect_success 'tiny cache gives the same output' '
+	git -c core.deltaBaseCacheLimit=1 log -p >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'performance trace reports cache statistics' '
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git log -p >actual &&
+	test_cmp expect actual &&
+	grep "delta base cache: [1-9][0-9]* hits, [0-9]* misses, 0 evictions" trace
+'
+
+test_expect_success 'per-command limit overrides core.deltaBaseCacheLimit' '
+	rm -f trace &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+		git -c deltaBaseCacheLimit.log=1 log -p >actual &&
+	test_cmp expect actual &&
+	grep "delta base cache: .* [1-9][0-9]* evictions" trace &&
+	rm -f trace &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+		git -c deltaBaseCacheLimit.blame=1 log -p >actual &&
+	test_cmp expect actual &&
+	grep "delta base cache: .* 0 evictions" trace
+'
+
+test_expect_success 'a small shared base survives a stream of big ones' '
+	git init spare &&
+	(
+		cd spare &&
+		test_seq 500 >small &&
+		for i in 1 2 3
+		do
+			test-genrandom big$i 40000 >big$i || return 1
+		done &&
+		git add . &&
+		git commit -q -m initial &&
+		for i in 2 3 4 5
+		do
+			echo "change $i" >>small &&
+			git commit -q -a -m "small $i" || return 1
+		done &&
+		for i in 1 2 3
+		do
+			echo change >>big$i || return 1
+		done &&
+		git commit -q -a -m big &&
+		git repack -a -d -f -q &&
+		# the older versions are all deltas against the latest one
+		for n in 5 4 3 2
+		do
+			git rev-parse HEAD~$n:small || return 1
+		done >list &&
+		# each big base is used once, and is too big to be spared
+		for i in 1 2 3
+		do
+			git rev-parse HEAD^:big$i || return 1
+		done >>list &&
+		git rev-parse HEAD~5:small >>list &&
+		GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+			git -c core.deltaBaseCacheLimit=64k cat-file --batch <list >/dev/null &&
+		grep "delta base cache: 4 hits, 4 misses, 2 evictions, 2 spared" trace
+	)
+'
+
+test_done
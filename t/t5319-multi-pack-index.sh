@@ -0,0 +1,294 @@
+#!/bin/sh
+
+test_description='multi-pack-index'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+midx_read_expect () {
+	NUM_PACKS=$1
+	NUM_OBJECTS=$2
+	NUM_CHUNKS=$3
+	OBJECT_DIR=$4
+	EXTRA_CHUNKS="$5"
+	{
+		cat <<-EOF &&
+		header: 4d494458 1 $NUM_CHUNKS $NUM_PACKS
+		chunks: pack-names oid-fanout oid-lookup object-offsets$EXTRA_CHUNKS
+		num_objects: $NUM_OBJECTS
+		packs:
+		EOF
+		if test $NUM_PACKS -ge 1
+		then
+			ls $OBJECT_DIR/pack | grep idx | sort
+		fi
+	} >expect &&
+	git multi-pack-index --object-dir=$OBJECT_DIR read >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'write midx with no packs' '
+	test_when_finished "rm -f $objdir/pack/multi-pack-index" &&
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 0 0 4 $objdir
+'
+
+generate_objects () {
+	i=$1
+	iii=$(printf '%03i' $i)
+	{
+		test-genrandom "bar" 200 &&
+		test-genrandom "baz $iii" 50
+	} >wide_delta_$iii &&
+	{
+		test-genrandom "foo"$i 100 &&
+		test-genrandom "foo"$(( $i + 1 )) 100 &&
+		test-genrandom "foo"$(( $i + 2 )) 100
+	} >deep_delta_$iii &&
+	{
+		echo $iii &&
+		test-genrandom "$iii" 8192
+	} >file_$iii &&
+	git update-index --add file_$iii deep_delta_$iii wide_delta_$iii
+}
+
+commit_and_list_objects () {
+	{
+		echo 101 &&
+		test-genrandom 100 8192;
+	} >file_101 &&
+	git update-index --add file_101 &&
+	tree=$(git write-tree) &&
+	commit=$(git commit-tree $tree -p HEAD</dev/null) &&
+	{
+		echo $tree &&
+		git ls-tree $tree | sed -e "s/.* \\([0-9a-f]*\\)	.*/\\1/"
+	} >obj-list &&
+	git reset --hard $commit
+}
+
+test_expect_success 'create objects' '
+	test_commit initial &&
+	for i in $(test_seq 1 5)
+	do
+		generate_objects $i
+	done &&
+	commit_and_list_objects
+'
+
+test_expect_success 'write midx with one v1 pack' '
+	pack=$(git pack-objects --index-version=1 $objdir/pack/test <obj-list) &&
+	test_when_finished rm $objdir/pack/test-$pack.pack \
+		$objdir/pack/test-$pack.idx $objdir/pack/multi-pack-index &&
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 1 18 4 $objdir
+'
+
+midx_git_two_modes () {
+	git -c core.multiPackIndex=false $1 >expect &&
+	git -c core.multiPackIndex=true $1 >actual &&
+	test_cmp expect actual
+}
+
+compare_results_with_midx () {
+	MSG=$1
+	test_expect_success "check normal git operations: $MSG" '
+		midx_git_two_modes "rev-list --objects --all" &&
+		midx_git_two_modes "log --raw" &&
+		midx_git_two_modes "count-objects --verbose" &&
+		midx_git_two_modes "cat-file --batch-all-objects --batch-check"
+	'
+}
+
+test_expect_success 'write midx with one v2 pack' '
+	git pack-objects --index-version=2,0x40 $objdir/pack/test <obj-list &&
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 1 18 4 $objdir
+'
+
+compare_results_with_midx "one v2 pack"
+
+test_expect_success 'add more objects' '
+	for i in $(test_seq 6 10)
+	do
+		generate_objects $i
+	done &&
+	commit_and_list_objects
+'
+
+test_expect_success 'write midx with two packs' '
+	git pack-objects --index-version=1 $objdir/pack/test-2 <obj-list &&
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 2 34 4 $objdir
+'
+
+compare_results_with_midx "two packs"
+
+test_expect_success 'add more packs' '
+	for j in $(test_seq 11 20)
+	do
+		generate_objects $j &&
+		commit_and_list_objects &&
+		git pack-objects --index-version=2 $objdir/pack/test-pack <obj-list
+	done
+'
+
+compare_results_with_midx "mixed mode (two packs + extra)"
+
+test_expect_success 'write midx with twelve packs' '
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 12 74 4 $objdir
+'
+
+compare_results_with_midx "twelve packs"
+
+test_expect_success 'objects are found through the midx' '
+	git -c core.multiPackIndex=true cat-file --batch-check <obj-list >actual &&
+	git -c core.multiPackIndex=false cat-file --batch-check <obj-list >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'deleted pack falls back to the remaining packs' '
+	test_when_finished "rm -rf dup" &&
+	mkdir dup &&
+	idx=$(ls $objdir/pack/test-pack-*.idx | head -n 1) &&
+	cp ${idx%.idx}.pack ${idx%.idx}.idx dup/ &&
+	git -c core.multiPackIndex=true rev-list --objects --all >expect &&
+	git pack-objects --revs --all $objdir/pack/test-all </dev/null &&
+	rm ${idx%.idx}.pack ${idx%.idx}.idx &&
+	git -c core.multiPackIndex=true rev-list --objects --all >actual &&
+	test_cmp expect actual &&
+	git -c core.multiPackIndex=true cat-file --batch-check <obj-list >actual &&
+	git -c core.multiPackIndex=false cat-file --batch-check <obj-list >expect &&
+	test_cmp expect actual &&
+	mv dup/* $objdir/pack/
+'
+
+test_expect_success 'repack writes the midx when enabled' '
+	git -c core.multiPackIndex=true repack -d &&
+	test_path_is_file $objdir/pack/multi-pack-index &&
+	for idx in $objdir/pack/*.idx
+	do
+		git show-index <$idx || return 1
+	done >packed &&
+	midx_read_expect $(ls $objdir/pack/*.idx | wc -l) \
+		$(cut -d" " -f2 packed | sort -u | wc -l) 4 $objdir
+'
+
+compare_results_with_midx "after repack"
+
+test_expect_success 'repack -d removes a stale midx' '
+	git -c core.multiPackIndex=false repack -ad &&
+	test_path_is_missing $objdir/pack/multi-pack-index
+'
+
+test_expect_success 'midx in an alternate' '
+	git clone --shared . alt-user &&
+	(
+		cd alt-user &&
+		git -c core.multiPackIndex=true multi-pack-index \
+			--object-dir=../$objdir write &&
+		midx_git_two_modes "rev-list --objects --all"
+	)
+'
+
+
+test_expect_success 'setup incremental packs for bitmaps' '
+	git init bitmaps &&
+	(
+		cd bitmaps &&
+		git config core.multiPackIndex true &&
+		for i in $(test_seq 1 3)
+		do
+			for j in $(test_seq 1 5)
+			do
+				test_commit "$i-$j" || return 1
+			done &&
+			git repack -d || return 1
+		done &&
+		git branch side HEAD~7 &&
+		git tag -a -m annotated annotated HEAD~3
+	)
+'
+
+midx_bitmap_git_two_modes () {
+	git rev-list --objects $1 | cut -d" " -f1 | sort >expect &&
+	git rev-list --use-bitmap-index --objects $1 |
+		cut -d" " -f1 | sort >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'write a midx bitmap' '
+	(
+		cd bitmaps &&
+		git multi-pack-index write --bitmap &&
+		test_path_is_file .git/objects/pack/multi-pack-index.bitmap &&
+		git rev-list --test-bitmap HEAD 2>err &&
+		grep OK! err &&
+		git count-objects -v >count &&
+		grep "^garbage: 0" count
+	)
+'
+
+test_expect_success 'rev-list uses the midx bitmap' '
+	(
+		cd bitmaps &&
+		midx_bitmap_git_two_modes --all &&
+		midx_bitmap_git_two_modes "HEAD ^side" &&
+		midx_bitmap_git_two_modes "annotated ^HEAD~10" &&
+		git rev-list --count HEAD ^side >expect &&
+		git rev-list --use-bitmap-index --count HEAD ^side >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'clone and fetch from a midx bitmap' '
+	git clone --no-local --bare bitmaps bitmaps-clone.git &&
+	git -C bitmaps rev-list --objects --all >expect &&
+	git -C bitmaps-clone.git rev-list --objects --all >actual &&
+	test_cmp expect actual &&
+	(
+		cd bitmaps &&
+		test_commit fetch-me
+	) &&
+	git -C bitmaps-clone.git fetch origin "+refs/heads/*:refs/heads/*" &&
+	git -C bitmaps-clone.git fsck
+'
+
+test_expect_success 'incremental repack keeps packs and updates the bitmap' '
+	(
+		cd bitmaps &&
+		ls .git/objects/pack/*.pack >before &&
+		test_commit incremental &&
+		git repack -d -b &&
+		ls .git/objects/pack/*.pack >after &&
+		test $(wc -l <after) -gt $(wc -l <before) &&
+		git rev-list --test-bitmap HEAD 2>err &&
+		grep OK! err &&
+		midx_bitmap_git_two_modes --all
+	)
+'
+
+test_expect_success 'stale midx bitmap is ignored' '
+	(
+		cd bitmaps &&
+		cp .git/objects/pack/multi-pack-index.bitmap stale.bitmap &&
+		test_commit stale &&
+		git repack -d &&
+		test_path_is_missing .git/objects/pack/multi-pack-index.bitmap &&
+		mv stale.bitmap .git/objects/pack/multi-pack-index.bitmap &&
+		test_must_fail git rev-list --test-bitmap HEAD &&
+		midx_bitmap_git_two_modes --all
+	)
+'
+
+test_expect_success 'midx bitmap is not used when disabled' '
+	(
+		cd bitmaps &&
+		git repack -d -b &&
+		test_must_fail git -c core.multiPackIndex=false \
+			rev-list --test-bitmap HEAD
+	)
+'
+
+test_done
@@ -683,4 +683,66 @@ test_expect_success 'untracked cache survives a commit' '
 	test_cmp ../before ../after
 '
 
+test_expect_success 'setup many directories' '
+	git init ../many &&
+	(
+		cd ../many &&
+		for i in $(test_seq 1200)
+		do
+			mkdir d$i &&
+			echo $i >d$i/tracked || return 1
+		done &&
+		git add . &&
+		git commit -q -m many &&
+		git update-index --untracked-cache &&
+		avoid_racy &&
+		git status --porcelain >../actual &&
+		test_must_be_empty ../actual &&
+		sync_mtime
+	)
+'
+
+test_expect_success 'directories are checked in parallel' '
+	(
+		cd ../many &&
+		: >d777/new &&
+		sync_mtime &&
+		GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+			git status --porcelain >../actual &&
+		echo "?? d777/new" >../expect &&
+		test_cmp ../expect ../actual &&
+		grep "^opendir: 1\$" "$TRASH_DIRECTORY/trace"
+	)
+'
+
+test_expect_success 'a single changed directory does not rewrite the index' '
+	(
+		cd ../many &&
+		test-dump-untracked-cache >../before &&
+		git status --porcelain >../actual &&
+		test-dump-untracked-cache >../after &&
+		test_cmp ../before ../after &&
+		! grep "^new" ../after
+	)
+'
+
+test_expect_success 'but a handful of changed directories do' '
+	(
+		cd ../many &&
+		for i in $(test_seq 5)
+		do
+			: >d$i/new || return 1
+		done &&
+		sync_mtime &&
+		git status --porcelain >../actual &&
+		test_line_count = 6 ../actual &&
+		test-dump-untracked-cache >../after &&
+		grep "^new" ../after &&
+		GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+			git status --porcelain >../actual &&
+		test_line_count = 6 ../actual &&
+		grep "^opendir: 0\$" "$TRASH_DIRECTORY/trace"
+	)
+'
+
 test_done
@@ -0,0 +1,77 @@
+#!/bin/sh
+
+test_description='preloading the index compares contents in parallel'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1200)
+	do
+		echo $i >file$i || return 1
+	done &&
+	echo "*.crlf text eol=crlf" >.gitattributes &&
+	printf "expect\nactual\n" >.gitignore &&
+	printf "a\\nb\\n" >x.crlf &&
+	git add . &&
+	git commit -q -m initial
+'
+
+test_expect_success 'files with new timestamps are found unchanged' '
+	test-chmtime =+10 file* x.crlf &&
+	echo changed >file7 &&
+	echo 78 >file77 &&
+	test-chmtime =+10 file7 file77 &&
+	git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M file7
+	 M file77
+	EOF
+	test_cmp expect actual &&
+	git diff-files --name-only >actual &&
+	cat >expect <<-\EOF &&
+	file7
+	file77
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'the refreshed stat data is written to the index' '
+	git checkout file7 file77 &&
+	test-chmtime =+20 file* &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual &&
+	git -c core.preloadIndex=false diff-files --exit-code
+'
+
+test_expect_success 'same results without preloading' '
+	test-chmtime =+30 file* &&
+	echo changed >file700 &&
+	git -c core.preloadIndex=false status --porcelain >actual &&
+	echo " M file700" >expect &&
+	test_cmp expect actual &&
+	git status --porcelain >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'files that do not split evenly among the threads' '
+	# refresh with timestamps in the past, so that only the files
+	# touched below are compared: file700 differs in size and is
+	# not, while the change to file321 keeps its size; 321 files
+	# make 20 slices of 17, the last of which would start past
+	# the end
+	test-chmtime =-100 file* &&
+	git status --porcelain >/dev/null &&
+	test-chmtime =-50 $(for i in $(test_seq 321); do echo file$i; done) &&
+	echo 32X >file321 &&
+	test-chmtime =-50 file321 &&
+	GIT_TRACE_PRELOAD_CONTENTS="$(pwd)/.git/trace" \
+		git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M file321
+	 M file700
+	EOF
+	test_cmp expect actual &&
+	grep "compared 321 files in 19 threads" .git/trace
+'
+
+test_done
@@ -0,0 +1,157 @@
+#!/bin/sh
+
+test_description='git status with file system watcher'
+
+. ./test-lib.sh
+
+# The hook answers with a new token and the paths listed (one per
+# line) in .git/fsmonitor-paths, and records the tokens it is asked
+# about in .git/fsmonitor-tokens.
+write_integration_script () {
+	write_script .git/fsmonitor-test <<-\EOF
+	if test "$#" -ne 2
+	then
+		echo "$0: exactly 2 arguments expected" >&2
+		exit 2
+	fi
+	if test "$1" != 2
+	then
+		echo "Unsupported core.fsmonitor hook version." >&2
+		exit 1
+	fi
+	echo "$2" >>.git/fsmonitor-tokens
+	printf "token-%d\0" $(wc -l <.git/fsmonitor-tokens)
+	if test -f .git/fsmonitor-paths
+	then
+		tr "\n" "\0" <.git/fsmonitor-paths
+	fi
+	EOF
+}
+
+report_changed () {
+	printf "%s\n" "$@" >.git/fsmonitor-paths
+}
+
+test_expect_success 'setup' '
+	mkdir dir1 dir2 &&
+	for f in file dir1/modified dir1/tracked dir2/modified dir2/tracked
+	do
+		echo 1 >$f || return 1
+	done &&
+	cat >.gitignore <<-\EOF &&
+	.gitignore
+	actual
+	expect
+	EOF
+	git add file dir1 dir2 &&
+	git commit -m initial &&
+	write_integration_script &&
+	git config core.fsmonitor .git/fsmonitor-test
+'
+
+test_expect_success 'the extension is added and all entries validated' '
+	git status &&
+	cat >expect <<-\EOF &&
+	fsmonitor last update token-1
+	+ dir1/modified
+	+ dir1/tracked
+	+ dir2/modified
+	+ dir2/tracked
+	+ file
+	EOF
+	test-dump-fsmonitor >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the hook is called with the last token' '
+	git status &&
+	echo token-1 >expect &&
+	tail -n 1 .git/fsmonitor-tokens >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unreported changes are not noticed' '
+	echo not-reported >dir1/modified &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual &&
+	git diff --name-only >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'update-index --really-refresh ignores fsmonitor' '
+	test_must_fail git update-index --really-refresh >actual &&
+	grep dir1/modified actual
+'
+
+test_expect_success 'reported changes are noticed' '
+	echo reported >dir2/modified &&
+	report_changed dir1/modified dir2/modified &&
+	cat >expect <<-\EOF &&
+	 M dir1/modified
+	 M dir2/modified
+	EOF
+	git status --porcelain >actual &&
+	test_cmp expect actual &&
+	rm .git/fsmonitor-paths &&
+	git status --porcelain >actual &&
+	test_cmp expect actual &&
+	git add dir1/modified dir2/modified &&
+	git commit -m modified &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual &&
+	test-dump-fsmonitor >actual &&
+	! grep "^-" actual
+'
+
+test_expect_success 'a "/" reports everything as changed' '
+	echo again >file &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual &&
+	report_changed / &&
+	echo " M file" >expect &&
+	git status --porcelain >actual &&
+	test_cmp expect actual &&
+	rm .git/fsmonitor-paths &&
+	git checkout file
+'
+
+test_expect_success 'a failing hook reports everything as changed' '
+	echo failing >dir1/tracked &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual &&
+	echo " M dir1/tracked" >expect &&
+	git -c core.fsmonitor=false status --porcelain >actual &&
+	test_cmp expect actual &&
+	echo "no fsmonitor" >expect &&
+	test-dump-fsmonitor >actual &&
+	test_cmp expect actual &&
+	git checkout dir1/tracked
+'
+
+test_expect_success 'untracked cache directories are invalidated' '
+	test_config core.untrackedCache true &&
+	git status --porcelain &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual &&
+	echo new >dir1/new &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual &&
+	report_changed dir1/new &&
+	echo "?? dir1/new" >expect &&
+	git status --porcelain >actual &&
+	test_cmp expect actual &&
+	rm dir1/new .git/fsmonitor-paths
+'
+
+test_expect_success 'unsetting core.fsmonitor removes the extension' '
+	git config --unset core.fsmonitor &&
+	echo unset >dir2/tracked &&
+	echo " M dir2/tracked" >expect &&
+	git status --porcelain >actual &&
+	test_cmp expect actual &&
+	echo "no fsmonitor" >expect &&
+	test-dump-fsmonitor >actual &&
+	test_cmp expect actual
+'
+
+test_done
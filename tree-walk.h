@@ -80,6 +80,8 @@ struct traverse_info {
 };
 
 int get_tree_entry(const unsigned char *, const char *, unsigned char *, unsigned *);
+/* Like get_tree_entry(), but starting from "t", which it consumes. */
+int find_tree_entry(struct tree_desc *t, const char *name, unsigned char *result, unsigned *mode);
 extern char *make_traverse_path(char *path, const struct traverse_info *info, const struct name_entry *n);
 extern void setup_traverse_info(struct traverse_info *info, const char *base);
 
@@ -12,6 +12,9 @@
 #include "dir.h"
 #include "submodule.h"
 #include "submodule-config.h"
+#include "parallel-checkout.h"
+#include "sparse-index.h"
+#include "pathspec.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -353,7 +356,7 @@ static int check_updates(struct unpack_trees_options *o)
 	struct progress *progress = NULL;
 	struct index_state *index = &o->result;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	state.force = 1;
 	state.quiet = 1;
@@ -379,6 +382,9 @@ static int check_updates(struct unpack_trees_options *o)
 	if (should_update_submodules() && o->update && !o->dry_run)
 		reload_gitmodules_file(index, &state);
 
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -393,6 +399,8 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold);
 	stop_progress(&progress);
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKIN, NULL);
@@ -968,6 +976,31 @@ static void debug_unpack_callback(int n,
 		debug_name_entry(i, names + i);
 }
 
+/*
+ * The traversal is looking at the directory p; return the sparse
+ * directory entry for it in the index, if there is one.
+ */
+static struct cache_entry *find_sparse_dir_entry(struct traverse_info *info,
+						 const struct name_entry *p)
+{
+	struct unpack_trees_options *o = info->data;
+	int len = traverse_path_len(info, p);
+	char *path = xmalloc(len + 2);
+	struct cache_entry *ce;
+	int pos;
+
+	make_traverse_path(path, info, p);
+	path[len++] = '/';
+	pos = index_name_pos(o->src_index, path, len);
+	free(path);
+	if (pos < 0)
+		return NULL;
+	ce = o->src_index->cache[pos];
+	if (!S_ISSPARSEDIR(ce->ce_mode) || (ce->ce_flags & CE_UNPACKED))
+		return NULL;
+	return ce;
+}
+
 static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, struct name_entry *names, struct traverse_info *info)
 {
 	struct cache_entry *src[MAX_UNPACK_TREES + 1] = { NULL, };
@@ -1031,6 +1064,27 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 
 	/* Now handle any directories.. */
 	if (dirmask) {
+		/*
+		 * A sparse directory is the same in all the trees (see
+		 * prepare_sparse_src_index()); carry it over as it is.
+		 */
+		if (o->merge && o->src_index->sparse_index) {
+			struct cache_entry *ce = find_sparse_dir_entry(info, p);
+
+			if (ce) {
+				int i;
+
+				for (i = 0; i < n; i++)
+					if (!(dirmask & (1ul << i)) ||
+					    oidcmp(names[i].oid, &ce->oid))
+						die("BUG: sparse directory '%s' differs from the trees",
+						    ce->name);
+				add_entry(o, ce, 0, 0);
+				mark_ce_used(ce, o);
+				return mask;
+			}
+		}
+
 		/* special case: "diff-index --cached" looking at a tree */
 		if (o->diff_index_cached &&
 		    n == 1 && dirmask == 1 && S_ISDIR(names->mode)) {
@@ -1072,9 +1126,16 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 {
 	struct cache_entry **cache_end;
 	int dtype = DT_DIR;
-	int ret = is_excluded_from_list(prefix->buf, prefix->len,
-					basename, &dtype, el, &the_index);
-	int rc;
+	enum cone_match_result match = CONE_MATCHED;
+	int ret, rc;
+
+	if (el->use_cone_patterns) {
+		match = cone_pattern_match(el, prefix->buf, prefix->len, DT_DIR);
+		ret = match != CONE_NOT_MATCHED;
+	} else {
+		ret = is_excluded_from_list(prefix->buf, prefix->len,
+					    basename, &dtype, el, &the_index);
+	}
 
 	strbuf_addch(prefix, '/');
 
@@ -1089,11 +1150,27 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 	}
 
 	/*
-	 * TODO: check el, if there are no patterns that may conflict
-	 * with ret (iow, we know in advance the incl/excl
-	 * decision for the entire directory), clear flag here without
-	 * calling clear_ce_flags_1(). That function will call
-	 * the expensive is_excluded_from_list() on every entry.
+	 * Cone patterns decide for everything below a directory at once
+	 * when it is not matched at all or matched recursively.
+	 */
+	if (match != CONE_MATCHED) {
+		struct cache_entry **cp;
+
+		if (match == CONE_MATCHED_RECURSIVE) {
+			for (cp = cache; cp != cache_end; cp++) {
+				struct cache_entry *ce = *cp;
+				if (!select_mask || (ce->ce_flags & select_mask))
+					ce->ce_flags &= ~clear_mask;
+			}
+		}
+		strbuf_setlen(prefix, prefix->len - 1);
+		return cache_end - cache;
+	}
+
+	/*
+	 * Otherwise there is no telling in advance whether the patterns
+	 * decide the same for the entire directory; clear_ce_flags_1()
+	 * calls the expensive is_excluded_from_list() on every entry.
 	 */
 	rc = clear_ce_flags_1(cache, cache_end - cache,
 			      prefix,
@@ -1173,6 +1250,14 @@ static int clear_ce_flags_1(struct cache_entry **cache, int nr,
 			continue;
 		}
 
+		/* A sparse directory goes with its directory */
+		if (S_ISSPARSEDIR(ce->ce_mode)) {
+			if (defval > 0)
+				ce->ce_flags &= ~clear_mask;
+			cache++;
+			continue;
+		}
+
 		/* Non-directory */
 		dtype = ce_to_dtype(ce);
 		ret = is_excluded_from_list(ce->name, ce_namelen(ce),
@@ -1233,6 +1318,57 @@ static void mark_new_skip_worktree(struct exclude_list *el,
 		       select_flag, skip_wt_flag, el);
 }
 
+struct sparse_expand_data {
+	unsigned len;
+	struct tree_desc *t;
+	struct unpack_trees_options *o;
+};
+
+static int sparse_dir_needs_expansion(const struct cache_entry *ce, void *data)
+{
+	struct sparse_expand_data *d = data;
+	unsigned i;
+
+	if (!d->o->skip_sparse_checkout &&
+	    sparse_dir_in_cone(d->o->src_index, d->o->el,
+			       ce->name, ce_namelen(ce) - 1))
+		return 1;
+
+	for (i = 0; i < d->len; i++) {
+		struct tree_desc t = d->t[i];
+		unsigned char sha1[20];
+		unsigned mode;
+
+		if (find_tree_entry(&t, ce->name, sha1, &mode) ||
+		    !S_ISDIR(mode) || hashcmp(sha1, ce->oid.hash))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Expand the sparse directories of the index that the merge has to
+ * look into: those which are not the same in all the trees, and those
+ * which come into the sparse checkout. All the others are carried over
+ * to the result without looking at their contents.
+ */
+static void prepare_sparse_src_index(unsigned len, struct tree_desc *t,
+				     struct unpack_trees_options *o)
+{
+	struct sparse_expand_data d;
+
+	if (o->prefix || (o->pathspec && o->pathspec->nr) ||
+	    (!o->skip_sparse_checkout && !sparse_patterns_are_cone(o->el))) {
+		ensure_full_index(o->src_index);
+		return;
+	}
+
+	d.len = len;
+	d.t = t;
+	d.o = o;
+	expand_index(o->src_index, sparse_dir_needs_expansion, &d);
+}
+
 static int verify_absent(const struct cache_entry *,
 			 enum unpack_trees_error_types,
 			 struct unpack_trees_options *);
@@ -1256,6 +1392,8 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		o->skip_sparse_checkout = 1;
 	if (!o->skip_sparse_checkout) {
 		char *sparse = git_pathdup("info/sparse-checkout");
+
+		el.use_cone_patterns = core_sparse_checkout_cone;
 		if (add_excludes_from_file_to_list(sparse, "", 0, &el, NULL) < 0)
 			o->skip_sparse_checkout = 1;
 		else
@@ -1267,12 +1405,25 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	o->result.initialized = 1;
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
+	o->result.file_dev = o->src_index->file_dev;
+	o->result.file_ino = o->src_index->file_ino;
+	o->result.file_size = o->src_index->file_size;
 	o->result.version = o->src_index->version;
+	if (o->src_index->fsmonitor_last_update)
+		o->result.fsmonitor_last_update =
+			xstrdup(o->src_index->fsmonitor_last_update);
+	o->result.fsmonitor_has_run_once = o->src_index->fsmonitor_has_run_once;
 	o->result.split_index = o->src_index->split_index;
 	if (o->result.split_index)
 		o->result.split_index->refcount++;
 	hashcpy(o->result.sha1, o->src_index->sha1);
 	o->merge_size = len;
+
+	if (o->merge && o->src_index->sparse_index)
+		prepare_sparse_src_index(len, t, o);
+	o->result.sparse_index = o->merge && o->src_index->sparse_index;
+	o->result.write_sparse = o->src_index->write_sparse ||
+				 !o->skip_sparse_checkout;
 	mark_all_ce_unused(o->src_index);
 
 	/*
@@ -36,6 +36,7 @@ static const char * const upload_pack_usage[] = {
 #define HIDDEN_REF	(1u << 19)
 
 static timestamp_t oldest_have;
+static uint32_t min_have_generation = GENERATION_NUMBER_INFINITY;
 
 static int deepen_relative;
 static int multi_ack;
@@ -308,6 +309,8 @@ static int got_oid(const char *hex, struct object_id *oid)
 			o->flags |= THEY_HAVE;
 		if (!oldest_have || (commit->date < oldest_have))
 			oldest_have = commit->date;
+		if (commit->generation < min_have_generation)
+			min_have_generation = commit->generation;
 		for (parents = commit->parents;
 		     parents;
 		     parents = parents->next)
@@ -334,12 +337,15 @@ static int reachable(struct commit *want)
 			break;
 		}
 		if (!commit->object.parsed)
-			parse_object(&commit->object.oid);
+			parse_commit(commit);
 		if (commit->object.flags & REACHABLE)
 			continue;
 		commit->object.flags |= REACHABLE;
 		if (commit->date < oldest_have)
 			continue;
+		/* nothing below every "have" can reach one of them */
+		if (commit->generation < min_have_generation)
+			continue;
 		for (list = commit->parents; list; list = list->next) {
 			struct commit *parent = list->item;
 			if (!(parent->object.flags & REACHABLE))